@@ -0,0 +1,104 @@
+/** \file code-comparison/bench-avr.c
+ * \brief Benchmark the histogram counter representations in simavr
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Counts the CPU cycles of each run with timer 1 running at the CPU
+ * clock, and prints the same "@" records as bench-host.c through the
+ * simavr console register. simavr takes the MCU type and clock from
+ * the ELF file, and stops when the CPU sleeps with interrupts
+ * disabled at the end.
+ *
+ * The cycle counts are the same on a real ATmega644, but there is
+ * no console to print them on.
+ */
+
+#include <stdint.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+#include "avr_mcu_section.h"
+
+#include "counters.h"
+
+AVR_MCU(F_CPU, "atmega644p");
+AVR_MCU_SIMAVR_CONSOLE(&GPIOR0);
+
+#define RUNS 4
+
+static void put_char(const char c)
+{
+	GPIOR0 = c;
+}
+
+static void put_str(const char *str)
+{
+	while (*str) {
+		put_char(*str++);
+	}
+}
+
+static void put_uint(uint16_t value)
+{
+	char buf[6];
+	uint8_t i = sizeof(buf);
+	buf[--i] = '\0';
+	do {
+		buf[--i] = '0' + (value % 10);
+		value /= 10;
+	} while (value);
+	put_str(&buf[i]);
+}
+
+int main(void)
+{
+	/* timer 1 counts CPU cycles */
+	TCCR1A = 0;
+	TCCR1B = _BV(CS10);
+
+	put_str("@arch avr cycles\n");
+	for (const counter_variant_t *variant = counter_variants;
+	     variant->name; variant++) {
+		counters_init();
+		uint16_t best = UINT16_MAX;
+		for (uint8_t run=0; run<RUNS; run++) {
+			const uint16_t t0 = TCNT1;
+			variant->run();
+			const uint16_t t1 = TCNT1;
+			if ((uint16_t)(t1 - t0) < best) {
+				best = t1 - t0;
+			}
+		}
+		put_char('@');
+		put_str(variant->name);
+		put_char(' ');
+		put_uint(variant->bytes_per_bin);
+		put_char(' ');
+		put_uint(best);
+		put_char(' ');
+		put_uint(COUNTER_VALUES);
+		put_char('\n');
+	}
+
+	cli();
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	sleep_mode();
+	return 0;
+}
@@ -0,0 +1,107 @@
+/** \file code-comparison/bench-host.c
+ * \brief Benchmark the histogram counter representations on the host
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Prints one "@" record per counter representation with the fastest
+ * of a number of runs, for bench-table.awk to put into the result
+ * table. Counts time stamp counter cycles on x86, and nanoseconds
+ * everywhere else.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+# include <x86intrin.h>
+#endif
+
+#include "counters.h"
+
+#define RUNS 20
+
+#if defined(__i386__) || defined(__x86_64__)
+
+# define UNIT "cycles"
+
+static uint64_t ticks(void)
+{
+	return __rdtsc();
+}
+
+#else
+
+# define UNIT "ns"
+
+static uint64_t ticks(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+#endif
+
+/** How often each bin appears in counter_values */
+static uint64_t occurrences[COUNTER_BINS];
+
+/** Check the counters after RUNS runs, modulo their width */
+static void check(const counter_variant_t *variant)
+{
+	if (variant->bytes_per_bin == 0) {
+		return;
+	}
+	const uint64_t mask = (variant->bytes_per_bin >= 8) ? UINT64_MAX :
+		((UINT64_C(1) << (8*variant->bytes_per_bin)) - 1);
+	for (uint16_t bin=0; bin<COUNTER_BINS; bin++) {
+		assert(counters_get(variant, bin) ==
+		       ((RUNS * occurrences[bin]) & mask));
+	}
+}
+
+int main(void)
+{
+	counters_init();
+	memset(occurrences, 0, sizeof(occurrences));
+	for (unsigned int i=0; i<COUNTER_VALUES; i++) {
+		occurrences[counter_values[i]]++;
+	}
+
+	printf("@arch host %s\n", UNIT);
+	for (const counter_variant_t *variant = counter_variants;
+	     variant->name; variant++) {
+		counters_init();
+		uint64_t best = UINT64_MAX;
+		for (unsigned int run=0; run<RUNS; run++) {
+			const uint64_t t0 = ticks();
+			variant->run();
+			const uint64_t t1 = ticks();
+			if (t1 - t0 < best) {
+				best = t1 - t0;
+			}
+		}
+		check(variant);
+		printf("@%s %u %llu %u\n", variant->name,
+		       variant->bytes_per_bin, (unsigned long long)best,
+		       COUNTER_VALUES);
+	}
+	return 0;
+}
@@ -0,0 +1,52 @@
+# bench-table.awk - Put the counter benchmark records into one table
+#
+# Reads the "@" records printed by bench-host and bench-avr (any other
+# output, like simavr's own messages or line prefixes, is skipped) and
+# prints one row per counter representation, with the cost of one
+# increment on every architecture after subtracting the loop overhead.
+# The "loop" row is that overhead itself.
+
+{
+	rec = index($0, "@")
+	if (rec == 0)
+		next
+	n = split(substr($0, rec + 1), f, " ")
+}
+
+n == 3 && f[1] == "arch" {
+	arch = f[2]
+	archs[++narchs] = arch
+	units[arch] = f[3]
+	next
+}
+
+n == 4 {
+	name = f[1]
+	if (!(name in bytes)) {
+		names[++nnames] = name
+		bytes[name] = f[2]
+	}
+	cost[arch, name] = f[3] / f[4]
+}
+
+END {
+	printf "Cost of one histogram increment, without the loop overhead\n\n"
+	printf "%-14s %9s %10s", "counter", "bytes/bin", "1024 bins"
+	for (a = 1; a <= narchs; a++)
+		printf " %14s", archs[a] " " units[archs[a]]
+	printf "\n"
+	for (i = 1; i <= nnames; i++) {
+		name = names[i]
+		printf "%-14s %9d %10d", name, bytes[name], 1024 * bytes[name]
+		for (a = 1; a <= narchs; a++) {
+			arch = archs[a]
+			if (!((arch, name) in cost))
+				printf " %14s", "-"
+			else if (name == "loop")
+				printf " %14.2f", cost[arch, name]
+			else
+				printf " %14.2f", cost[arch, name] - cost[arch, "loop"]
+		}
+		printf "\n"
+	}
+}
@@ -0,0 +1,191 @@
+/** \file code-comparison/counters.c
+ * \brief Histogram counter representations to benchmark
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * The histogram is volatile like the firmware's, so every increment
+ * loads and stores its counter like the ADC ISR has to.
+ *
+ * Besides plain integers of every width, this has the 24bit counter
+ * from firmware/table-element.h (assembly language on the AVR, the
+ * same byte by byte C as "u24-c" elsewhere), and counters split
+ * into separate arrays of low and high parts, where the high part
+ * only needs touching when the low part wraps around.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BITS_PER_VALUE 24
+#include "table-element.h"
+
+#include "counters.h"
+
+/** The values to count, like ADC results */
+uint16_t counter_values[COUNTER_VALUES];
+
+/** The histogram, in one of the representations at a time */
+static volatile union {
+	uint8_t  u8[COUNTER_BINS];
+	uint16_t u16[COUNTER_BINS];
+	freemcan_uint24_t u24[COUNTER_BINS];
+	uint32_t u32[COUNTER_BINS];
+	uint64_t u64[COUNTER_BINS];
+	struct {
+		uint8_t  lo[COUNTER_BINS];
+		uint8_t  hi[COUNTER_BINS];
+	} s8_8;
+	struct {
+		uint8_t  lo[COUNTER_BINS];
+		uint16_t hi[COUNTER_BINS];
+	} s8_16;
+	struct {
+		uint16_t lo[COUNTER_BINS];
+		uint8_t  hi[COUNTER_BINS];
+	} s16_8;
+	struct {
+		uint16_t lo[COUNTER_BINS];
+		uint16_t hi[COUNTER_BINS];
+	} s16_16;
+} table;
+
+/** Loop over all values, with the increment statement for value v */
+#define FOR_ALL_VALUES(STATEMENT)					\
+	for (unsigned int i=0; i<COUNTER_VALUES; i++) {			\
+		const uint16_t v = counter_values[i];			\
+		STATEMENT;						\
+	}
+
+static void run_loop(void)
+{
+	/* only make sure the value is loaded */
+	FOR_ALL_VALUES(__asm__ __volatile__("" : : "r" (v)));
+}
+
+static void run_u8(void)
+{
+	FOR_ALL_VALUES(table.u8[v]++);
+}
+
+static void run_u16(void)
+{
+	FOR_ALL_VALUES(table.u16[v]++);
+}
+
+static void run_u24(void)
+{
+	FOR_ALL_VALUES(table_element_inc(&table.u24[v]));
+}
+
+static void run_u24_c(void)
+{
+	FOR_ALL_VALUES(
+		volatile freemcan_uint24_t *element = &table.u24[v];
+		const uint32_t value = ((uint32_t)(*element)[0] |
+					((uint32_t)(*element)[1] << 8) |
+					((uint32_t)(*element)[2] << 16)) + 1;
+		(*element)[0] = value & 0xff;
+		(*element)[1] = (value >> 8) & 0xff;
+		(*element)[2] = (value >> 16) & 0xff);
+}
+
+static void run_u32(void)
+{
+	FOR_ALL_VALUES(table.u32[v]++);
+}
+
+static void run_u64(void)
+{
+	FOR_ALL_VALUES(table.u64[v]++);
+}
+
+static void run_s8_8(void)
+{
+	FOR_ALL_VALUES(if (++table.s8_8.lo[v] == 0) table.s8_8.hi[v]++);
+}
+
+static void run_s8_16(void)
+{
+	FOR_ALL_VALUES(if (++table.s8_16.lo[v] == 0) table.s8_16.hi[v]++);
+}
+
+static void run_s16_8(void)
+{
+	FOR_ALL_VALUES(if (++table.s16_8.lo[v] == 0) table.s16_8.hi[v]++);
+}
+
+static void run_s16_16(void)
+{
+	FOR_ALL_VALUES(if (++table.s16_16.lo[v] == 0) table.s16_16.hi[v]++);
+}
+
+const counter_variant_t counter_variants[] = {
+	{ "loop",        0, run_loop },
+	{ "u8",          1, run_u8 },
+	{ "u16",         2, run_u16 },
+	{ "u24",         3, run_u24 },
+	{ "u24-c",       3, run_u24_c },
+	{ "u32",         4, run_u32 },
+	{ "u64",         8, run_u64 },
+	{ "split-8+8",   2, run_s8_8 },
+	{ "split-8+16",  3, run_s8_16 },
+	{ "split-16+8",  3, run_s16_8 },
+	{ "split-16+16", 4, run_s16_16 },
+	{ NULL,          0, NULL }
+};
+
+void counters_init(void)
+{
+	/* xorshift32, the same values on every architecture */
+	uint32_t x = 2463534242UL;
+	for (unsigned int i=0; i<COUNTER_VALUES; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		counter_values[i] = x % COUNTER_BINS;
+	}
+	for (unsigned int i=0; i<COUNTER_BINS; i++) {
+		table.u64[i] = 0;
+	}
+}
+
+uint64_t counters_get(const counter_variant_t *variant, const uint16_t bin)
+{
+	if (variant->run == run_u8) {
+		return table.u8[bin];
+	} else if (variant->run == run_u16) {
+		return table.u16[bin];
+	} else if ((variant->run == run_u24) || (variant->run == run_u24_c)) {
+		return ((uint32_t)table.u24[bin][0] |
+			((uint32_t)table.u24[bin][1] << 8) |
+			((uint32_t)table.u24[bin][2] << 16));
+	} else if (variant->run == run_u32) {
+		return table.u32[bin];
+	} else if (variant->run == run_u64) {
+		return table.u64[bin];
+	} else if (variant->run == run_s8_8) {
+		return ((uint32_t)table.s8_8.hi[bin] << 8) | table.s8_8.lo[bin];
+	} else if (variant->run == run_s8_16) {
+		return ((uint32_t)table.s8_16.hi[bin] << 8) | table.s8_16.lo[bin];
+	} else if (variant->run == run_s16_8) {
+		return ((uint32_t)table.s16_8.hi[bin] << 16) | table.s16_8.lo[bin];
+	} else if (variant->run == run_s16_16) {
+		return ((uint32_t)table.s16_16.hi[bin] << 16) | table.s16_16.lo[bin];
+	}
+	return 0;
+}
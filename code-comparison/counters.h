@@ -0,0 +1,72 @@
+/** \file code-comparison/counters.h
+ * \brief Histogram counter representations to benchmark
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+
+/** Number of histogram bins
+ *
+ * The ATmega644 cannot hold 1024 64bit counters in its 4K of SRAM,
+ * and without a cache the number of bins does not change the cost
+ * of an increment there, so the AVR build uses fewer.
+ */
+#ifdef __AVR__
+# define COUNTER_BINS 256
+#else
+# define COUNTER_BINS 1024
+#endif
+
+/** Number of increments per run: the ADC values the run counts */
+#ifdef __AVR__
+# define COUNTER_VALUES 256
+#else
+# define COUNTER_VALUES 65536
+#endif
+
+/** The values to count, like ADC results, set up by counters_init() */
+extern uint16_t counter_values[COUNTER_VALUES];
+
+/** One way of representing the histogram counters */
+typedef struct {
+	/** Short name for the result table */
+	const char *name;
+	/** Bytes of memory per histogram bin */
+	uint8_t bytes_per_bin;
+	/** Increment the bins for all COUNTER_VALUES values once */
+	void (*run)(void);
+} counter_variant_t;
+
+/** All counter representations, ending with a NULL name
+ *
+ * The first one, "loop", does not increment anything. Its cost is
+ * the overhead of the run loop to subtract from the others.
+ */
+extern const counter_variant_t counter_variants[];
+
+/** Set up the values to count, and zero the histogram */
+void counters_init(void);
+
+/** Counter in the given bin, however it is represented */
+uint64_t counters_get(const counter_variant_t *variant, const uint16_t bin);
+
+#endif /* !COUNTERS_H */
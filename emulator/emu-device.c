@@ -0,0 +1,1219 @@
+/** \file emulator/emu-device.c
+ * \brief Emulated FreeMCAn device
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup emulator_device Emulated Device
+ * \ingroup emulator
+ *
+ * A device which behaves like the firmware towards the host: The
+ * command frame parser, the command queue and the firmware FSM follow
+ * firmware/main.c, and the measurement follows the perso-*.c file of
+ * the firmware personality, but in simulated time instead of cycle by
+ * cycle. That keeps a device cheap enough to run hundreds of them in
+ * one process.
+ *
+ * The event generator (see \ref evgen) provides the external
+ * triggers, with ADC values from a Cs-137 spectrum. Triggers within
+ * the dead time of the last recorded one are lost, as on the real
+ * device (see \ref packet_value_table_extended).
+ *
+ * The UART sends at most baudrate/10 bytes per second. Like the
+ * firmware main loop, which blocks in send_table() once the UART
+ * transmit queue is full, the device only handles the next command
+ * when the output of the previous command has gone out.
+ *
+ * Intermediate value tables are sent as they are when the command is
+ * handled. The firmware sends the elements as they are when the UART
+ * gets to them, which makes no difference to the host.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "frame-defs.h"
+#include "packet-defs.h"
+#include "checksum.h"
+#include "evgen.h"
+#include "value-table-compress.h"
+#include "emu-device.h"
+
+#include "git-version.h"
+
+
+/** CPU clock frequency of the emulated device (for the dead time) */
+#define F_CPU 16000000UL
+
+
+/** Number of entries in the command queue (as in main.c) */
+#define CMD_QUEUE_SIZE 4
+
+
+/** Number of ADC values (10 bit ADC) */
+#define ADC_VALUES 1024
+
+
+/** Number of external triggers to get from the event generator at once */
+#define TRIGGER_BATCH 256
+
+
+/** Maximum number of blocks in delta value tables (as in data-table.h) */
+#define DIRTY_BLOCKS 64
+
+
+/** Seconds of link time the UART may save up while idle
+ *
+ * A real UART cannot save up any, but the daemon only gets to run
+ * the device every few milliseconds.
+ */
+#define TX_BURST_SECONDS 0.02
+
+
+/** The firmware personalities (see firmware/perso-*.c)
+ *
+ * The linker determines the table size of the personalities using
+ * data-table-all-other-memory.x. We use what a typical build leaves.
+ * adc-int-mca is built with BUILD_FREEMCAN_ASM_ADC_ISR=yes, the only
+ * build which reports its dead time.
+ */
+static const emu_personality_t personalities[] = {
+  { "adc-int-mca", EMU_TRIGGERED_HISTOGRAM,
+    VALUE_TABLE_TYPE_HISTOGRAM, 24, 1024*3, 1, 2, 0,
+    true, (29 << 6) / 2 + 66 },
+  { "adc-int-mca-timed", EMU_TIMED_HISTOGRAM,
+    VALUE_TABLE_TYPE_HISTOGRAM, 24, 1024*3, 10, 2, 2,
+    true, 0 },
+  { "adc-int-timed-sampling", EMU_TIMED_SAMPLES,
+    VALUE_TABLE_TYPE_SAMPLES, 16, 3584, 10, 0, 2,
+    false, 0 },
+  { "geiger-time-series", EMU_TIME_SERIES,
+    VALUE_TABLE_TYPE_TIME_SERIES, 16, 3584, 1, 2, 0,
+    false, 0 }
+};
+
+
+/* documented in emu-device.h */
+const emu_personality_t *emu_personality_find(const char *name)
+{
+  for (size_t i=0; i<sizeof(personalities)/sizeof(personalities[0]); i++) {
+    if (strcmp(personalities[i].name, name) == 0) {
+      return &personalities[i];
+    }
+  }
+  return NULL;
+}
+
+
+/* documented in emu-device.h */
+const emu_personality_t *emu_personality_get(const unsigned int index)
+{
+  if (index < sizeof(personalities)/sizeof(personalities[0])) {
+    return &personalities[index];
+  }
+  return NULL;
+}
+
+
+/** Firmware FSM states (as in main.c) */
+typedef enum {
+  STP_READY,
+  STP_MEASURING,
+  STP_DONE
+} firmware_state_t;
+
+
+/** Command frame parser FSM states (as in main.c) */
+typedef enum {
+  STF_MAGIC,
+  STF_COMMAND,
+  STF_LENGTH,
+  STF_PARAM,
+  STF_CHECKSUM
+} frame_state_t;
+
+
+/** Frame parser error: frame with bad parameter length dropped */
+#define RX_ERROR_PARAM_LENGTH 0x01
+
+/** Frame parser error: frame with checksum mismatch dropped */
+#define RX_ERROR_CHECKSUM     0x02
+
+/** Frame parser error: frame dropped because command queue was full */
+#define RX_ERROR_OVERFLOW     0x04
+
+
+/** Command frame as received from the host */
+typedef struct {
+  uint8_t cmd;
+  uint8_t length;
+  uint8_t params[MAX_PARAM_LENGTH];
+} command_t;
+
+
+/** Measurement parameters (personality_param_t in the firmware) */
+typedef struct {
+  uint8_t length;
+  uint8_t params[MAX_PARAM_LENGTH];
+} params_t;
+
+
+/** Internals of opaque #emu_device_t */
+struct _emu_device_t {
+  /** Reference counter */
+  unsigned int refs;
+  /** Firmware personality */
+  const emu_personality_t *personality;
+  /** Device behaviour */
+  emu_config_t config;
+  /** Random number generator */
+  evgen_rng_t rng;
+  /** Spectrum of the ADC values */
+  evgen_spectrum_t *spectrum;
+  /** Device statistics */
+  emu_stats_t stats;
+
+  /** Current time in seconds since boot */
+  double now;
+  /** Time of the next timer unit */
+  double next_unit;
+  /** External triggers of the running measurement, or NULL */
+  evgen_t *triggers;
+  /** Start time of the running measurement */
+  double measurement_start;
+  /** #emu_stats_t.triggers before the running measurement */
+  uint64_t triggers_before;
+  /** #emu_stats_t.lost before the running measurement */
+  uint64_t lost_before;
+
+  /** Firmware FSM state */
+  firmware_state_t state;
+  /** GF_MEASUREMENT_FINISHED */
+  bool measurement_finished;
+  /** Parameters of the last command received in #STP_READY */
+  params_t pparam_sram;
+  /** Parameters stored in EEPROM, survive resets */
+  params_t pparam_eeprom;
+  /** Timer units left in the measurement (period) */
+  uint16_t timer1_count;
+  /** Timer units per measurement (period) */
+  uint16_t orig_timer1_count;
+  /** Samples left to skip */
+  uint16_t skip_samples;
+  /** Samples to skip between recorded ones */
+  uint16_t orig_skip_samples;
+
+  /** The data table */
+  uint32_t *table;
+  /** Maximum number of elements in #table */
+  size_t max_elements;
+  /** Current number of elements in #table */
+  size_t elements;
+  /** Dirty flags of the table blocks */
+  uint8_t dirty[DIRTY_BLOCKS];
+  /** Blocks changed since the value table the host has acknowledged */
+  uint8_t delta_unacked[DIRTY_BLOCKS/8];
+  /** Sequence number of the last delta value table sent, 0 if none */
+  uint8_t delta_seq;
+  /** Sequence number of the last delta value table the host has
+   *  acknowledged, 0 if none */
+  uint8_t delta_acked_seq;
+
+  /** Command frame parser state */
+  frame_state_t fstate;
+  /** Command frame parser offset/index into magic/params */
+  uint8_t fidx;
+  /** Command frame being received */
+  command_t rx_cmd;
+  /** Checksum over the command frame being received */
+  checksum_accu_t rx_checksum;
+  /** Command queue */
+  command_t cmd_queue[CMD_QUEUE_SIZE];
+  /** Index of next command for the main loop */
+  unsigned int cmd_head;
+  /** Index of next command for the frame parser */
+  unsigned int cmd_tail;
+  /** RX_ERROR_* for the main loop to report */
+  uint8_t rx_errors;
+
+  /** Bytes queued for the UART */
+  uint8_t *tx_buf;
+  /** Offset of the first byte in #tx_buf not sent yet */
+  size_t tx_start;
+  /** Offset of the end of the data in #tx_buf */
+  size_t tx_end;
+  /** Allocated size of #tx_buf */
+  size_t tx_alloc;
+  /** Offset of the frame being queued in #tx_buf */
+  size_t tx_frame;
+  /** Checksum over the frame being queued */
+  checksum_accu_t tx_checksum;
+  /** Number of bytes the UART may send by now */
+  double tx_credit;
+};
+
+
+/************************************************************************
+ * Random numbers
+ ************************************************************************/
+
+
+/** ADC value of a slowly changing signal with some noise */
+static
+uint16_t sampled_adc_value(emu_device_t *self, const double t)
+{
+  const double signal = 512 + 384 * sin(2 * M_PI * t / 60.0);
+  const double noise = 16 * (evgen_rng_uniform(&self->rng) - 0.5);
+  return (uint16_t)(signal + noise);
+}
+
+
+/************************************************************************
+ * UART (uart-comm.c, frame-comm.c)
+ ************************************************************************/
+
+
+/** Number of bytes queued for the UART */
+static
+size_t tx_pending(const emu_device_t *self)
+{
+  return self->tx_end - self->tx_start;
+}
+
+
+/** Queue bytes for the UART, and add them to the frame checksum */
+static
+void uart_putb(emu_device_t *self, const void *buf, const size_t size)
+{
+  if (self->tx_end + size > self->tx_alloc) {
+    memmove(self->tx_buf, &self->tx_buf[self->tx_start],
+            self->tx_end - self->tx_start);
+    self->tx_frame -= self->tx_start;
+    self->tx_end -= self->tx_start;
+    self->tx_start = 0;
+    while (self->tx_end + size > self->tx_alloc) {
+      self->tx_alloc *= 2;
+    }
+    self->tx_buf = realloc(self->tx_buf, self->tx_alloc);
+    assert(self->tx_buf);
+  }
+  const uint8_t *bytes = buf;
+  for (size_t i=0; i<size; i++) {
+    self->tx_checksum = checksum_update(self->tx_checksum, bytes[i]);
+  }
+  memcpy(&self->tx_buf[self->tx_end], buf, size);
+  self->tx_end += size;
+}
+
+
+/** Queue a single byte for the UART */
+static
+void uart_putc(emu_device_t *self, const uint8_t byte)
+{
+  uart_putb(self, &byte, 1);
+}
+
+
+/** Queue table elements, little endian, bytes_per_value bytes each */
+static
+void uart_putb_elements(emu_device_t *self, const uint32_t *elements,
+                        const size_t count, const uint8_t bytes_per_value)
+{
+  for (size_t i=0; i<count; i++) {
+    uint8_t buf[4];
+    for (uint8_t b=0; b<bytes_per_value; b++) {
+      buf[b] = (uint8_t)(elements[i] >> (8*b));
+    }
+    uart_putb(self, buf, bytes_per_value);
+  }
+}
+
+
+/** Start frame of given type and payload size */
+static
+void frame_start(emu_device_t *self, const frame_type_t type,
+                 const uint16_t payload_size)
+{
+  self->tx_frame = self->tx_end;
+  self->tx_checksum = checksum_reset();
+  uart_putb(self, FRAME_MAGIC_STR, 4);
+  uart_putb(self, &payload_size, sizeof(payload_size));
+  uart_putc(self, (uint8_t)type);
+}
+
+
+/** Corrupt the frame just queued: flip a bit, drop or repeat a byte */
+static
+void frame_inject_fault(emu_device_t *self)
+{
+  const uint64_t r = evgen_rng_next(&self->rng);
+  const size_t pos = (r >> 8) % (self->tx_end - self->tx_frame);
+  switch (r % 3) {
+  case 0:
+    self->tx_buf[self->tx_frame + pos] ^= (uint8_t)(1 << ((r >> 2) & 7));
+    break;
+  case 1: {
+    const size_t ofs = self->tx_frame + pos;
+    memmove(&self->tx_buf[ofs], &self->tx_buf[ofs+1],
+            self->tx_end - ofs - 1);
+    self->tx_end--;
+    break;
+  }
+  default: {
+    /* make room first, that may move the frame */
+    uart_putc(self, 0);
+    const size_t ofs = self->tx_frame + pos;
+    memmove(&self->tx_buf[ofs+1], &self->tx_buf[ofs],
+            self->tx_end - ofs - 1);
+    break;
+  }
+  }
+  self->stats.faults++;
+}
+
+
+/** Finish frame by queueing its checksum */
+static
+void frame_end(emu_device_t *self)
+{
+  const uint8_t checksum = (uint8_t)self->tx_checksum;
+  uart_putc(self, checksum);
+  self->stats.frames++;
+  if (self->config.faults_per_mille &&
+      (evgen_rng_next(&self->rng) % 1000 < self->config.faults_per_mille)) {
+    frame_inject_fault(self);
+  }
+}
+
+
+/** Send complete frame */
+static
+void frame_send(emu_device_t *self, const frame_type_t type,
+                const void *payload, const size_t size)
+{
+  frame_start(self, type, (uint16_t)size);
+  uart_putb(self, payload, size);
+  frame_end(self);
+}
+
+
+/** Send state message packet */
+static
+void send_state(emu_device_t *self, const char *state)
+{
+  frame_send(self, FRAME_TYPE_STATE, state, strlen(state));
+}
+
+
+/** Send text message packet */
+static
+void send_text(emu_device_t *self, const char *msg)
+{
+  frame_send(self, FRAME_TYPE_TEXT, msg, strlen(msg));
+}
+
+
+/************************************************************************
+ * Value tables (main.c)
+ ************************************************************************/
+
+
+/** Bytes per table element */
+static
+uint8_t bytes_per_value(const emu_device_t *self)
+{
+  return self->personality->bits_per_value / 8;
+}
+
+
+/** Size of what put_table_header() sends */
+static
+uint16_t table_header_size(const emu_device_t *self)
+{
+  return sizeof(packet_value_table_header_t) + self->pparam_sram.length +
+    (self->personality->dead_cycles ?
+     sizeof(packet_value_table_ext_header_t) : 0);
+}
+
+
+/** Elapsed timer units, as get_duration() */
+static
+uint16_t get_duration(const emu_device_t *self)
+{
+  return self->orig_timer1_count - self->timer1_count;
+}
+
+
+/** Send value table header, parameter buffer, and extended header */
+static
+void put_table_header(emu_device_t *self,
+                      const packet_value_table_reason_t reason,
+                      const uint8_t flags)
+{
+  const emu_personality_t *perso = self->personality;
+  const uint8_t extended = perso->dead_cycles ? PACKET_VALUE_TABLE_EXTENDED : 0;
+  const packet_value_table_header_t header = {
+    perso->bits_per_value | flags | extended,
+    reason,
+    perso->type,
+    get_duration(self),
+    self->pparam_sram.length
+  };
+  uart_putb(self, &header, sizeof(header));
+  uart_putb(self, self->pparam_sram.params, self->pparam_sram.length);
+  if (extended) {
+    const packet_value_table_ext_header_t ext_header = {
+      perso->dead_cycles,
+      F_CPU / 1000
+    };
+    uart_putb(self, &ext_header, sizeof(ext_header));
+  }
+}
+
+
+/** Send value table packet */
+static
+void send_table(emu_device_t *self, const packet_value_table_reason_t reason)
+{
+  const size_t table_size = self->elements * bytes_per_value(self);
+  if (self->config.compress && (reason != PACKET_VALUE_TABLE_INTERMEDIATE)) {
+    const size_t size =
+      value_table_compress(NULL, self->table, self->elements);
+    if (size < table_size) {
+      uint8_t buf[value_table_compress_max_size(self->elements)];
+      value_table_compress(buf, self->table, self->elements);
+      frame_start(self, FRAME_TYPE_VALUE_TABLE,
+                  table_header_size(self) + size);
+      put_table_header(self, reason, PACKET_VALUE_TABLE_COMPRESSED);
+      uart_putb(self, buf, size);
+      frame_end(self);
+      return;
+    }
+  }
+
+  frame_start(self, FRAME_TYPE_VALUE_TABLE,
+              table_header_size(self) + table_size);
+  put_table_header(self, reason, 0);
+  uart_putb_elements(self, self->table, self->elements,
+                     bytes_per_value(self));
+  frame_end(self);
+}
+
+
+/** Whether block has changed since the acknowledged value table */
+static
+bool delta_block_unacked(const emu_device_t *self, const unsigned int block)
+{
+  return self->delta_unacked[block >> 3] & (1 << (block & 7));
+}
+
+
+/** Send the changed blocks of the value table, as send_table_delta() */
+static
+void send_table_delta(emu_device_t *self, const uint8_t ack)
+{
+  if (!self->personality->marks_dirty) {
+    send_table(self, PACKET_VALUE_TABLE_INTERMEDIATE);
+    return;
+  }
+
+  const uint8_t bpv = bytes_per_value(self);
+  const size_t element_count = self->elements;
+  const unsigned int block_count =
+    (element_count + PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE - 1) /
+    PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE;
+
+  if (self->delta_seq && (ack == self->delta_seq)) {
+    /* host has the last delta value table we sent */
+    memset(self->delta_unacked, 0, sizeof(self->delta_unacked));
+    self->delta_acked_seq = ack;
+  } else if (!self->delta_acked_seq || (ack != self->delta_acked_seq)) {
+    /* host has no value table we know of: send everything */
+    memset(self->delta_unacked, 0xff, sizeof(self->delta_unacked));
+    self->delta_acked_seq = 0;
+  }
+
+  size_t runs_size = 0;
+  bool prev_unacked = false;
+  for (unsigned int b=0; b<block_count; b++) {
+    if (self->dirty[b]) {
+      self->dirty[b] = 0;
+      self->delta_unacked[b >> 3] |= (1 << (b & 7));
+    }
+    const bool unacked = delta_block_unacked(self, b);
+    if (unacked) {
+      const size_t start = b * PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE;
+      const size_t end = (b == block_count - 1) ?
+        element_count : (start + PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE);
+      runs_size += (prev_unacked ? 0 : 2) + (end - start) * bpv;
+    }
+    prev_unacked = unacked;
+  }
+
+  self->delta_seq = (self->delta_seq == UINT8_MAX) ? 1 : (self->delta_seq + 1);
+
+  const packet_value_table_delta_header_t delta_header = {
+    self->delta_acked_seq,
+    self->delta_seq,
+    (uint16_t)element_count
+  };
+  frame_start(self, FRAME_TYPE_VALUE_TABLE_DELTA,
+              table_header_size(self) + sizeof(delta_header) + runs_size);
+  put_table_header(self, PACKET_VALUE_TABLE_INTERMEDIATE, 0);
+  uart_putb(self, &delta_header, sizeof(delta_header));
+  for (unsigned int b=0; b<block_count; ) {
+    if (!delta_block_unacked(self, b)) {
+      b++;
+      continue;
+    }
+    const unsigned int first = b;
+    while ((b < block_count) && delta_block_unacked(self, b)) {
+      b++;
+    }
+    uart_putc(self, (uint8_t)first);
+    uart_putc(self, (uint8_t)(b - first));
+    const size_t start = first * PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE;
+    const size_t end = (b == block_count) ?
+      element_count : (b * PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE);
+    uart_putb_elements(self, &self->table[start], end - start, bpv);
+  }
+  frame_end(self);
+}
+
+
+/** Send personality info packet */
+static
+void send_personality_info(emu_device_t *self)
+{
+  const emu_personality_t *perso = self->personality;
+  const packet_personality_info_t info = {
+    perso->sizeof_table,
+    perso->bits_per_value,
+    perso->units_per_second,
+    perso->param_size_timer_count,
+    perso->param_size_skip_samples
+  };
+  const size_t name_length = strlen(perso->name);
+  frame_start(self, FRAME_TYPE_PERSONALITY_INFO, sizeof(info) + name_length);
+  uart_putb(self, &info, sizeof(info));
+  uart_putb(self, perso->name, name_length);
+  frame_end(self);
+}
+
+
+/** Send parameters read from EEPROM */
+static
+void send_eeprom_params_in_sram(emu_device_t *self)
+{
+  const uint8_t length = self->pparam_sram.length;
+  if (length == 0xff || length > sizeof(self->pparam_sram.params)) {
+    send_text(self, "Invalid EEPROM data");
+  } else {
+    frame_send(self, FRAME_TYPE_PARAMS_FROM_EEPROM,
+               self->pparam_sram.params, length);
+  }
+}
+
+
+/************************************************************************
+ * Measurement (perso-*.c)
+ ************************************************************************/
+
+
+/** Reset everything but the EEPROM, and send what the firmware sends
+ *  when it boots */
+static
+void boot(emu_device_t *self)
+{
+  self->state = STP_READY;
+  self->measurement_finished = false;
+  memset(&self->pparam_sram, 0, sizeof(self->pparam_sram));
+  self->timer1_count = self->orig_timer1_count = 0;
+  self->skip_samples = self->orig_skip_samples = 0;
+  memset(self->table, 0, self->max_elements * sizeof(self->table[0]));
+  memset(self->dirty, 0, sizeof(self->dirty));
+  self->delta_seq = self->delta_acked_seq = 0;
+  self->fstate = STF_MAGIC;
+  self->fidx = 0;
+  self->rx_checksum = checksum_reset();
+  self->cmd_head = self->cmd_tail = 0;
+  self->rx_errors = 0;
+
+  switch (self->personality->kind) {
+  case EMU_TRIGGERED_HISTOGRAM:
+  case EMU_TIMED_HISTOGRAM:
+    self->elements = self->max_elements;
+    break;
+  case EMU_TIMED_SAMPLES:
+    self->elements = 0;
+    break;
+  case EMU_TIME_SERIES:
+    self->elements = 1;
+    break;
+  }
+
+  send_text(self, "freemcan " GIT_VERSION " (emulator)");
+  send_personality_info(self);
+  send_state(self, "READY");
+}
+
+
+/** Read little endian uint16_t measurement parameter */
+static
+uint16_t param_u16(const emu_device_t *self, const size_t ofs)
+{
+  return self->pparam_sram.params[ofs] |
+    (self->pparam_sram.params[ofs+1] << 8);
+}
+
+
+/** Start measurement with the parameters in pparam_sram */
+static
+void start_measurement(emu_device_t *self)
+{
+  const emu_personality_t *perso = self->personality;
+  size_t ofs = 0;
+  if (perso->param_size_timer_count == 2) {
+    self->orig_timer1_count = self->timer1_count = param_u16(self, ofs);
+    ofs += 2;
+  }
+  if (perso->param_size_skip_samples == 2) {
+    self->orig_skip_samples = self->skip_samples = param_u16(self, ofs);
+  }
+  self->next_unit = self->now + 1.0 / perso->units_per_second;
+  self->measurement_start = self->now;
+  self->triggers_before = self->stats.triggers;
+  self->lost_before = self->stats.lost;
+  if (self->triggers) {
+    evgen_unref(self->triggers);
+    self->triggers = NULL;
+  }
+  const evgen_config_t config = {
+    self->config.event_rate,
+    (double)perso->dead_cycles / F_CPU,
+    false,
+    0
+  };
+  switch (perso->kind) {
+  case EMU_TRIGGERED_HISTOGRAM:
+    self->triggers = evgen_new(&config, self->spectrum,
+                               evgen_rng_next(&self->rng));
+    break;
+  case EMU_TIME_SERIES:
+    self->triggers = evgen_new(&config, NULL, evgen_rng_next(&self->rng));
+    break;
+  case EMU_TIMED_HISTOGRAM:
+  case EMU_TIMED_SAMPLES:
+    /* no external trigger */
+    break;
+  }
+}
+
+
+/** Increment table element, wrapping around like the firmware does */
+static
+void table_inc(emu_device_t *self, const size_t index)
+{
+  const uint32_t mask =
+    0xffffffffUL >> (32 - self->personality->bits_per_value);
+  self->table[index] = (self->table[index] + 1) & mask;
+  if (self->personality->marks_dirty) {
+    self->dirty[index / PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE] = 1;
+  }
+}
+
+
+/** Recorded external trigger (ISR(INT0_vect) or ISR(ADC_vect)) */
+static
+void handle_trigger(emu_device_t *self, const evgen_event_t *event)
+{
+  switch (self->personality->kind) {
+  case EMU_TRIGGERED_HISTOGRAM:
+    table_inc(self, event->value);
+    break;
+  case EMU_TIME_SERIES:
+    table_inc(self, self->elements - 1);
+    break;
+  case EMU_TIMED_HISTOGRAM:
+  case EMU_TIMED_SAMPLES:
+    /* no external trigger */
+    break;
+  }
+}
+
+
+/** Whether to record the current timer sample (skip_samples logic) */
+static
+bool take_sample(emu_device_t *self)
+{
+  if (self->skip_samples == 0) {
+    self->skip_samples = self->orig_skip_samples;
+    return true;
+  }
+  self->skip_samples--;
+  return false;
+}
+
+
+/** Timer unit has passed at time t (ISR(TIMER1_COMPA_vect) etc.) */
+static
+void handle_timer_unit(emu_device_t *self, const double t)
+{
+  switch (self->personality->kind) {
+  case EMU_TRIGGERED_HISTOGRAM:
+    self->timer1_count--;
+    if (self->timer1_count == 0) {
+      self->measurement_finished = true;
+    }
+    break;
+  case EMU_TIMED_HISTOGRAM:
+    if (take_sample(self)) {
+      table_inc(self, evgen_spectrum_sample(self->spectrum, &self->rng));
+    }
+    self->timer1_count--;
+    if (self->timer1_count == 0) {
+      self->measurement_finished = true;
+    }
+    break;
+  case EMU_TIMED_SAMPLES:
+    if (take_sample(self)) {
+      self->table[self->elements++] = sampled_adc_value(self, t);
+      if (self->elements >= self->max_elements) {
+        self->measurement_finished = true;
+      }
+    }
+    break;
+  case EMU_TIME_SERIES:
+    self->timer1_count--;
+    if (self->timer1_count == 0) {
+      if (self->elements < self->max_elements) {
+        self->elements++;
+        self->timer1_count = self->orig_timer1_count;
+      } else {
+        self->measurement_finished = true;
+      }
+    }
+    break;
+  }
+}
+
+
+/** Run the measurement up to time now */
+static
+void run_measurement(emu_device_t *self, const double now)
+{
+  const double unit = 1.0 / self->personality->units_per_second;
+  while (!self->measurement_finished) {
+    if (self->triggers) {
+      /* the triggers before the next timer unit */
+      const double until = ((self->next_unit < now) ? self->next_unit : now) -
+        self->measurement_start;
+      evgen_event_t events[TRIGGER_BATCH];
+      size_t n;
+      while ((n = evgen_events(self->triggers, events, TRIGGER_BATCH,
+                               until)) > 0) {
+        for (size_t i=0; i<n; i++) {
+          handle_trigger(self, &events[i]);
+        }
+      }
+      const evgen_stats_t *stats = evgen_stats(self->triggers);
+      self->stats.triggers = self->triggers_before + stats->events;
+      self->stats.lost = self->lost_before + stats->dead + stats->piled_up;
+    }
+    if (self->next_unit <= now) {
+      handle_timer_unit(self, self->next_unit);
+      self->next_unit += unit;
+    } else {
+      break;
+    }
+  }
+}
+
+
+/************************************************************************
+ * Command frame parser and firmware FSM (main.c)
+ ************************************************************************/
+
+
+/** Parse received byte into command frames, as uart_recv_byte() */
+static
+void recv_byte(emu_device_t *self, const uint8_t byte)
+{
+  switch (self->fstate) {
+  case STF_MAGIC:
+    if (byte == (uint8_t)FRAME_MAGIC_STR[self->fidx++]) {
+      self->rx_checksum = checksum_update(self->rx_checksum, byte);
+      if (self->fidx >= 4) {
+        self->fstate = STF_COMMAND;
+      }
+      return;
+    }
+    /* syncing, not an error */
+    break;
+  case STF_COMMAND:
+    self->rx_checksum = checksum_update(self->rx_checksum, byte);
+    self->rx_cmd.cmd = byte;
+    self->fstate = STF_LENGTH;
+    return;
+  case STF_LENGTH: {
+    self->rx_checksum = checksum_update(self->rx_checksum, byte);
+    self->rx_cmd.length = byte;
+    self->fidx = 0;
+    const uint8_t param_size = self->personality->param_size_timer_count +
+      self->personality->param_size_skip_samples;
+    if (byte == 0) {
+      self->fstate = STF_CHECKSUM;
+      return;
+    } else if (((byte >= param_size) && (byte < MAX_PARAM_LENGTH)) ||
+               ((self->rx_cmd.cmd == FRAME_CMD_INTERMEDIATE_DELTA) &&
+                (byte == 1))) {
+      self->fstate = STF_PARAM;
+      return;
+    }
+    self->rx_errors |= RX_ERROR_PARAM_LENGTH;
+    self->stats.rx_errors++;
+    break;
+  }
+  case STF_PARAM:
+    self->rx_checksum = checksum_update(self->rx_checksum, byte);
+    self->rx_cmd.params[self->fidx++] = byte;
+    if (self->fidx >= self->rx_cmd.length) {
+      self->fstate = STF_CHECKSUM;
+    }
+    return;
+  case STF_CHECKSUM:
+    if (!checksum_matches(self->rx_checksum, byte)) {
+      self->rx_errors |= RX_ERROR_CHECKSUM;
+      self->stats.rx_errors++;
+    } else if (self->cmd_tail - self->cmd_head == CMD_QUEUE_SIZE) {
+      self->rx_errors |= RX_ERROR_OVERFLOW;
+      self->stats.rx_errors++;
+    } else {
+      self->cmd_queue[self->cmd_tail % CMD_QUEUE_SIZE] = self->rx_cmd;
+      self->cmd_tail++;
+    }
+    break;
+  }
+
+  /* restart */
+  self->fstate = STF_MAGIC;
+  self->fidx = 0;
+  self->rx_checksum = checksum_reset();
+}
+
+
+/** Reset the device via the watchdog */
+static
+void soft_reset(emu_device_t *self)
+{
+  boot(self);
+}
+
+
+/** Firmware FSM event handler for finished measurement */
+static
+void handle_measurement_finished(emu_device_t *self)
+{
+  send_table(self, PACKET_VALUE_TABLE_DONE);
+  self->state = STP_DONE;
+}
+
+
+/** Firmware FSM event handler for a command from the host */
+static
+void handle_command(emu_device_t *self, const uint8_t cmd,
+                    const uint8_t param)
+{
+  switch (self->state) {
+  case STP_READY:
+    switch (cmd) {
+    case FRAME_CMD_PERSONALITY_INFO:
+      send_personality_info(self);
+      /* fall through */
+    case FRAME_CMD_ABORT:
+    case FRAME_CMD_INTERMEDIATE:
+    case FRAME_CMD_INTERMEDIATE_DELTA:
+    case FRAME_CMD_STATE:
+      send_state(self, "READY");
+      return;
+    case FRAME_CMD_PARAMS_TO_EEPROM:
+      send_state(self, "PARAMS_TO_EEPROM");
+      self->pparam_eeprom = self->pparam_sram;
+      send_state(self, "READY");
+      return;
+    case FRAME_CMD_PARAMS_FROM_EEPROM:
+      self->pparam_sram = self->pparam_eeprom;
+      send_eeprom_params_in_sram(self);
+      send_state(self, "READY");
+      return;
+    case FRAME_CMD_MEASURE:
+      start_measurement(self);
+      send_state(self, "MEASURING");
+      self->state = STP_MEASURING;
+      return;
+    case FRAME_CMD_RESET:
+      send_state(self, "RESET");
+      soft_reset(self);
+      return;
+    }
+    break;
+  case STP_MEASURING:
+    switch (cmd) {
+    case FRAME_CMD_INTERMEDIATE:
+      send_table(self, PACKET_VALUE_TABLE_INTERMEDIATE);
+      send_state(self, "MEASURING");
+      return;
+    case FRAME_CMD_INTERMEDIATE_DELTA:
+      send_table_delta(self, param);
+      send_state(self, "MEASURING");
+      return;
+    case FRAME_CMD_PERSONALITY_INFO:
+      send_personality_info(self);
+      /* fall through */
+    case FRAME_CMD_PARAMS_TO_EEPROM:
+    case FRAME_CMD_PARAMS_FROM_EEPROM:
+    case FRAME_CMD_MEASURE:
+    case FRAME_CMD_RESET:
+    case FRAME_CMD_STATE:
+      send_state(self, "MEASURING");
+      return;
+    case FRAME_CMD_ABORT:
+      send_state(self, "DONE");
+      send_table(self, PACKET_VALUE_TABLE_ABORTED);
+      send_state(self, "DONE");
+      self->state = STP_DONE;
+      return;
+    }
+    break;
+  case STP_DONE:
+    switch (cmd) {
+    case FRAME_CMD_PERSONALITY_INFO:
+      send_personality_info(self);
+      /* fall through */
+    case FRAME_CMD_STATE:
+      send_state(self, "DONE");
+      return;
+    case FRAME_CMD_RESET:
+      send_state(self, "RESET");
+      soft_reset(self);
+      return;
+    default:
+      send_table(self, PACKET_VALUE_TABLE_RESEND);
+      send_state(self, "DONE");
+      return;
+    }
+    break;
+  }
+  send_text(self, "STP_ERROR");
+  soft_reset(self);
+}
+
+
+/** Report dropped frames, and handle the next command from the queue */
+static
+void handle_received(emu_device_t *self)
+{
+  const uint8_t errors = self->rx_errors;
+  self->rx_errors = 0;
+  if (errors & RX_ERROR_PARAM_LENGTH) {
+    send_text(self, "param length mismatch");
+  }
+  if (errors & RX_ERROR_CHECKSUM) {
+    send_text(self, "checksum fail");
+  }
+  if (errors & RX_ERROR_OVERFLOW) {
+    send_text(self, "command queue overflow");
+  }
+
+  if (self->cmd_head != self->cmd_tail) {
+    const command_t *c = &self->cmd_queue[self->cmd_head % CMD_QUEUE_SIZE];
+    const uint8_t cmd = c->cmd;
+    const uint8_t param = (c->length > 0) ? c->params[0] : 0;
+    if (self->state == STP_READY) {
+      self->pparam_sram.length = c->length;
+      memcpy(self->pparam_sram.params, c->params, c->length);
+    }
+    self->cmd_head++;
+    self->stats.commands++;
+    handle_command(self, cmd, param);
+  }
+}
+
+
+/** Do what the firmware main loop does until it would have to wait */
+static
+void run_main_loop(emu_device_t *self)
+{
+  while (true) {
+    if (self->measurement_finished) {
+      self->measurement_finished = false;
+      handle_measurement_finished(self);
+      continue;
+    }
+    if (!self->rx_errors && (self->cmd_head == self->cmd_tail)) {
+      return;
+    }
+    if (self->config.baudrate && tx_pending(self)) {
+      /* the firmware's uart_putc() is still busy sending */
+      return;
+    }
+    handle_received(self);
+  }
+}
+
+
+/************************************************************************
+ * Public interface
+ ************************************************************************/
+
+
+/* documented in emu-device.h */
+emu_device_t *emu_device_new(const emu_personality_t *personality,
+                             const emu_config_t *config,
+                             const uint64_t seed)
+{
+  emu_device_t *self = calloc(1, sizeof(*self));
+  assert(self);
+  self->refs = 1;
+  self->personality = personality;
+  self->config = *config;
+  evgen_rng_seed(&self->rng, seed);
+  self->spectrum = evgen_spectrum_new_cs137(ADC_VALUES);
+
+  self->max_elements = personality->sizeof_table / bytes_per_value(self);
+  assert(!personality->marks_dirty ||
+         (self->max_elements <=
+          DIRTY_BLOCKS * PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE));
+  self->table = calloc(self->max_elements, sizeof(self->table[0]));
+  assert(self->table);
+
+  self->tx_alloc = 4096;
+  self->tx_buf = malloc(self->tx_alloc);
+  assert(self->tx_buf);
+
+  self->pparam_eeprom.length = 0xff;
+  boot(self);
+  return self;
+}
+
+
+/* documented in emu-device.h */
+void emu_device_ref(emu_device_t *self)
+{
+  assert(self->refs > 0);
+  self->refs++;
+}
+
+
+/* documented in emu-device.h */
+void emu_device_unref(emu_device_t *self)
+{
+  assert(self->refs > 0);
+  self->refs--;
+  if (self->refs == 0) {
+    if (self->triggers) {
+      evgen_unref(self->triggers);
+    }
+    evgen_spectrum_unref(self->spectrum);
+    free(self->table);
+    free(self->tx_buf);
+    free(self);
+  }
+}
+
+
+/* documented in emu-device.h */
+void emu_device_recv(emu_device_t *self, const void *buf, const size_t size)
+{
+  const uint8_t *bytes = buf;
+  for (size_t i=0; i<size; i++) {
+    recv_byte(self, bytes[i]);
+  }
+  run_main_loop(self);
+}
+
+
+/* documented in emu-device.h */
+void emu_device_advance(emu_device_t *self, const double now)
+{
+  if (now <= self->now) {
+    return;
+  }
+  if (self->config.baudrate) {
+    const double bytes_per_second = self->config.baudrate / 10.0;
+    self->tx_credit += (now - self->now) * bytes_per_second;
+    const double burst = TX_BURST_SECONDS * bytes_per_second + 1;
+    if (self->tx_credit > burst) {
+      self->tx_credit = burst;
+    }
+  }
+  if (self->state == STP_MEASURING) {
+    run_measurement(self, now);
+  }
+  self->now = now;
+  run_main_loop(self);
+}
+
+
+/* documented in emu-device.h */
+size_t emu_device_tx_peek(emu_device_t *self, const uint8_t **buf)
+{
+  size_t size = tx_pending(self);
+  if (self->config.baudrate && (size > self->tx_credit)) {
+    size = (size_t)self->tx_credit;
+  }
+  *buf = &self->tx_buf[self->tx_start];
+  return size;
+}
+
+
+/* documented in emu-device.h */
+void emu_device_tx_consume(emu_device_t *self, const size_t size)
+{
+  assert(size <= tx_pending(self));
+  self->tx_start += size;
+  if (self->tx_start == self->tx_end) {
+    self->tx_start = self->tx_end = 0;
+  }
+  if (self->config.baudrate) {
+    self->tx_credit -= size;
+  }
+  self->stats.tx_bytes += size;
+  run_main_loop(self);
+}
+
+
+/* documented in emu-device.h */
+const emu_stats_t *emu_device_stats(const emu_device_t *self)
+{
+  return &self->stats;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
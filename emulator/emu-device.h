@@ -0,0 +1,195 @@
+/** \file emulator/emu-device.h
+ * \brief Emulated FreeMCAn device (interface)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup emulator_device
+ * @{
+ */
+
+#ifndef EMU_DEVICE_H
+#define EMU_DEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/** How a firmware personality fills its data table */
+typedef enum {
+  /** Histogram of the ADC values at external triggers */
+  EMU_TRIGGERED_HISTOGRAM,
+  /** Histogram of ADC values sampled by the timer */
+  EMU_TIMED_HISTOGRAM,
+  /** ADC values sampled by the timer, one element each */
+  EMU_TIMED_SAMPLES,
+  /** Number of external triggers per measurement period */
+  EMU_TIME_SERIES
+} emu_personality_kind_t;
+
+
+/** What the emulator needs to know about a firmware personality
+ *
+ * Mirrors the PERSONALITY() and data_table_info definitions in the
+ * firmware's perso-*.c files.
+ */
+typedef struct {
+  /** Personality name as sent in the personality info packet */
+  const char *name;
+  /** How the data table is filled */
+  emu_personality_kind_t kind;
+  /** Value table type (#packet_value_table_type_t) */
+  uint8_t type;
+  /** Table element size in bits */
+  uint8_t bits_per_value;
+  /** Maximum size of the data table in bytes */
+  uint16_t sizeof_table;
+  /** Timer units per second */
+  uint8_t units_per_second;
+  /** Size of the timer count measurement parameter (0 or 2) */
+  uint8_t param_size_timer_count;
+  /** Size of the skip samples measurement parameter (0 or 2) */
+  uint8_t param_size_skip_samples;
+  /** Whether delta value tables are supported */
+  bool marks_dirty;
+  /** Dead time per recorded trigger in CPU cycles, 0 if unknown */
+  uint16_t dead_cycles;
+} emu_personality_t;
+
+
+/** Look up firmware personality by name
+ *
+ * \return The personality, or NULL if there is none of that name.
+ */
+const emu_personality_t *emu_personality_find(const char *name)
+  __attribute__(( nonnull(1) ));
+
+
+/** Get the firmware personality with the given index
+ *
+ * \return The personality, or NULL if index is past the last one.
+ */
+const emu_personality_t *emu_personality_get(const unsigned int index);
+
+
+/** Device behaviour which is not given by the personality */
+typedef struct {
+  /** External trigger rate in events per second */
+  double event_rate;
+  /** UART speed in bits per second (10 bits per byte), 0 for no limit */
+  unsigned long baudrate;
+  /** Frames to corrupt on purpose, per 1000 frames sent */
+  unsigned int faults_per_mille;
+  /** Send final value tables compressed if that is shorter */
+  bool compress;
+} emu_config_t;
+
+
+/** Device statistics */
+typedef struct {
+  /** External triggers arriving at the device */
+  uint64_t triggers;
+  /** External triggers lost in the dead time of previous ones */
+  uint64_t lost;
+  /** Command frames handled */
+  uint64_t commands;
+  /** Command frames dropped (bad length, checksum, queue overflow) */
+  uint64_t rx_errors;
+  /** Frames sent */
+  uint64_t frames;
+  /** Frames corrupted on purpose */
+  uint64_t faults;
+  /** Bytes sent over the link */
+  uint64_t tx_bytes;
+} emu_stats_t;
+
+
+/** Emulated device (opaque data type) */
+struct _emu_device_t;
+
+/** Emulated device (opaque data type) */
+typedef struct _emu_device_t emu_device_t;
+
+
+/** Create emulated device, booted at time 0 (in seconds)
+ *
+ * \param seed Seed for the device's random numbers
+ */
+emu_device_t *emu_device_new(const emu_personality_t *personality,
+                             const emu_config_t *config,
+                             const uint64_t seed)
+  __attribute__(( nonnull(1,2) ))
+  __attribute__(( malloc ))
+  __attribute__(( warn_unused_result ));
+
+
+void emu_device_ref(emu_device_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+void emu_device_unref(emu_device_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Feed bytes the host has sent to the device */
+void emu_device_recv(emu_device_t *self, const void *buf, const size_t size)
+  __attribute__(( nonnull(1,2) ));
+
+
+/** Let the device run until time now (in seconds since boot)
+ *
+ * Runs the measurement, handles received commands, and lets the UART
+ * send bytes at link speed. Time never goes backwards.
+ */
+void emu_device_advance(emu_device_t *self, const double now)
+  __attribute__(( nonnull(1) ));
+
+
+/** Get the bytes the UART can send by now
+ *
+ * \return Number of bytes at *buf.
+ */
+size_t emu_device_tx_peek(emu_device_t *self, const uint8_t **buf)
+  __attribute__(( nonnull(1,2) ));
+
+
+/** Remove size bytes from what #emu_device_tx_peek returned
+ *
+ * If nobody is connected, consume the bytes anyway, like a serial
+ * port does without anybody listening.
+ */
+void emu_device_tx_consume(emu_device_t *self, const size_t size)
+  __attribute__(( nonnull(1) ));
+
+
+/** Get device statistics */
+const emu_stats_t *emu_device_stats(const emu_device_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** @} */
+
+#endif /* !EMU_DEVICE_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,526 @@
+/** \file emulator/freemcan-emulator.c
+ * \brief Device emulator daemon
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup emulator Device Emulator
+ *
+ * Emulated FreeMCAn devices for testing the hostware without
+ * hardware.
+ *
+ * \defgroup emulator_daemon Emulator Daemon
+ * \ingroup emulator
+ *
+ * Runs any number of \ref emulator_device "emulated devices" in a
+ * single process, each behind its own UNIX domain socket. The
+ * hostware opens such a socket just like a serial port, so
+ * freemcan-tui or freemcan-daemon can be pointed at hundreds of
+ * devices at once.
+ *
+ * Like on a serial port, only one host can talk to a device at a
+ * time, and the device keeps running while nobody is connected. Its
+ * output goes nowhere then.
+ *
+ * The devices run in real time, in steps of #TICK_MS milliseconds,
+ * and whenever a command arrives. On SIGUSR1, the statistics of all
+ * devices are logged.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "emu-device.h"
+#include "freemcan-evloop.h"
+#include "freemcan-log.h"
+#include "uart-defs.h"
+
+#include "git-version.h"
+
+
+/** Milliseconds between running all devices */
+#define TICK_MS 10
+
+
+/** One emulated device and the socket leading to it */
+typedef struct {
+  /** The device */
+  emu_device_t *device;
+  /** Socket file name */
+  char *socket_name;
+  /** Listening socket */
+  int listen_fd;
+  /** Connection to the host, or -1 if nobody is connected */
+  int conn_fd;
+  /** Event loop watch for #conn_fd */
+  evloop_watch_t *conn_watch;
+  /** The host has hung up, close #conn_fd after this loop iteration */
+  bool hangup;
+} port_t;
+
+
+/** Number of devices to emulate */
+static unsigned long device_count = 1;
+
+/** Personality name, or "all" for all personalities in turn */
+static const char *personality_name = "adc-int-mca";
+
+/** Seed for the random numbers of the first device */
+static unsigned long seed = 1;
+
+/** Device behaviour */
+static emu_config_t config = { 1000, UART_BAUDRATE, 0, false };
+
+
+/** Start of emulated time */
+static struct timespec start_time;
+
+
+/** The event loop */
+static evloop_t *loop;
+
+
+/** All emulated devices */
+static port_t *ports;
+
+
+/** Set by the SIGINT and SIGTERM handler */
+static bool quit = false;
+
+
+/** Seconds since #start_time */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec - start_time.tv_sec) +
+    1e-9 * (ts.tv_nsec - start_time.tv_nsec);
+}
+
+
+/** Pass on what the device has sent by now */
+static void port_flush(port_t *port)
+{
+  const uint8_t *buf;
+  size_t size;
+  while ((size = emu_device_tx_peek(port->device, &buf)) > 0) {
+    if ((port->conn_fd < 0) || port->hangup) {
+      /* nobody is listening */
+      emu_device_tx_consume(port->device, size);
+      continue;
+    }
+    const ssize_t n = send(port->conn_fd, buf, size, MSG_NOSIGNAL);
+    if (n < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        /* the host is behind with reading, try again next tick */
+        return;
+      } else if (errno == EINTR) {
+        continue;
+      }
+      port->hangup = true;
+      continue;
+    }
+    emu_device_tx_consume(port->device, n);
+  }
+}
+
+
+/** Handle command bytes from the host */
+static void port_do_read(void *data, const uint64_t events)
+{
+  port_t *port = data;
+  if (port->hangup) {
+    return;
+  }
+  if (events & EPOLLIN) {
+    uint8_t buf[256];
+    const ssize_t n = read(port->conn_fd, buf, sizeof(buf));
+    if (n > 0) {
+      emu_device_advance(port->device, now());
+      emu_device_recv(port->device, buf, n);
+      port_flush(port);
+      return;
+    } else if ((n < 0) &&
+               ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+                (errno == EINTR))) {
+      return;
+    }
+  }
+  /* EOF, error, or hangup */
+  port->hangup = true;
+}
+
+
+/** Accept host connection, unless there already is one */
+static void port_do_accept(void *data, const uint64_t events
+                           __attribute__((unused)))
+{
+  port_t *port = data;
+  const int fd = accept4(port->listen_fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  if (port->conn_fd >= 0) {
+    fmlog("%s: device busy, refusing second connection", port->socket_name);
+    close(fd);
+    return;
+  }
+  port->conn_fd = fd;
+  port->hangup = false;
+  port->conn_watch =
+    evloop_add_fd(loop, fd, EPOLLIN, port_do_read, port);
+}
+
+
+/** Close connections the hosts have hung up
+ *
+ * Not done in the event handler, as further events for the
+ * connection may be pending in the same event loop iteration.
+ */
+static void reap_hangups(void)
+{
+  for (size_t i=0; i<device_count; i++) {
+    port_t *port = &ports[i];
+    if (port->hangup && (port->conn_fd >= 0)) {
+      evloop_remove(loop, port->conn_watch);
+      close(port->conn_fd);
+      port->conn_fd = -1;
+      port->conn_watch = NULL;
+      port->hangup = false;
+    }
+  }
+}
+
+
+/** Let all devices run until now */
+static void emulator_do_tick(void *data __attribute__((unused)),
+                             const uint64_t expirations
+                             __attribute__((unused)))
+{
+  const double t = now();
+  for (size_t i=0; i<device_count; i++) {
+    emu_device_advance(ports[i].device, t);
+    port_flush(&ports[i]);
+  }
+}
+
+
+/** Log the statistics summed up over all devices */
+static void log_stats(void)
+{
+  emu_stats_t total;
+  memset(&total, 0, sizeof(total));
+  size_t connected = 0;
+  for (size_t i=0; i<device_count; i++) {
+    const emu_stats_t *stats = emu_device_stats(ports[i].device);
+    total.triggers  += stats->triggers;
+    total.lost      += stats->lost;
+    total.commands  += stats->commands;
+    total.rx_errors += stats->rx_errors;
+    total.frames    += stats->frames;
+    total.faults    += stats->faults;
+    total.tx_bytes  += stats->tx_bytes;
+    connected += (ports[i].conn_fd >= 0);
+  }
+  fmlog("%lu devices, %zu connected, after %.1f seconds:",
+        device_count, connected, now());
+  fmlog("  %llu triggers, %llu lost in dead time",
+        (unsigned long long)total.triggers, (unsigned long long)total.lost);
+  fmlog("  %llu commands handled, %llu command frames dropped",
+        (unsigned long long)total.commands,
+        (unsigned long long)total.rx_errors);
+  fmlog("  %llu frames sent, %llu corrupted on purpose, %llu bytes",
+        (unsigned long long)total.frames, (unsigned long long)total.faults,
+        (unsigned long long)total.tx_bytes);
+}
+
+
+/** Handle signals */
+static void emulator_do_signal(void *data __attribute__((unused)),
+                               const uint64_t signo)
+{
+  switch (signo) {
+  case SIGUSR1:
+    log_stats();
+    break;
+  default:
+    quit = true;
+    break;
+  }
+}
+
+
+/** Create listening socket for a device */
+static int open_listen_socket(const char *socket_name)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_name) >= sizeof(addr.sun_path)) {
+    fmlog_error("Fatal: Socket name too long: %s", socket_name);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, socket_name);
+
+  /* remove the socket a previous run has left behind, but nothing else */
+  struct stat sb;
+  if ((stat(socket_name, &sb) == 0) && S_ISSOCK(sb.st_mode)) {
+    unlink(socket_name);
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fmlog_error("Fatal: socket(2)");
+    exit(EXIT_FAILURE);
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fmlog_error("Fatal: Cannot bind socket %s", socket_name);
+    exit(EXIT_FAILURE);
+  }
+  if (listen(fd, 4) < 0) {
+    fmlog_error("Fatal: Cannot listen on socket %s", socket_name);
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+
+/** Make sure we may open enough file descriptors for all devices */
+static void raise_fd_limit(void)
+{
+  /* listening socket and connection per device, plus a few */
+  const rlim_t needed = 2*device_count + 16;
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+    fmlog_error("getrlimit(2)");
+    return;
+  }
+  if (rl.rlim_cur >= needed) {
+    return;
+  }
+  rl.rlim_cur = (rl.rlim_max < needed) ? rl.rlim_max : needed;
+  if ((setrlimit(RLIMIT_NOFILE, &rl) < 0) || (rl.rlim_cur < needed)) {
+    fmlog("Warning: Cannot raise the open file limit to %lu, "
+          "some hosts will not be able to connect.",
+          (unsigned long)needed);
+  }
+}
+
+
+static void emulator_fmlog_command_line_help(const char *const argv0)
+{
+  const char *last_slash = strrchr(argv0, '/');
+  const char *prog = last_slash?(last_slash+1):(argv0);
+  fmlog("Usage: %s [<option>...] <SOCKET>", prog);
+  fmlog("Emulate FreeMCAn devices behind UNIX domain sockets. With more than");
+  fmlog("one device, the sockets are called <SOCKET>-000, <SOCKET>-001, etc.\n");
+  fmlog("Options:");
+  fmlog("   -n --devices=N         number of devices (%lu)", device_count);
+  fmlog("   -p --personality=NAME  firmware personality, or \"all\" for all in");
+  fmlog("                          turn (%s)", personality_name);
+  fmlog("   -r --rate=N            external triggers per second (%.0f)",
+        config.event_rate);
+  fmlog("   -b --baud=N            link speed in bits per second, 0 for no");
+  fmlog("                          limit (%lu)", config.baudrate);
+  fmlog("   -f --faults=N          corrupt N of 1000 frames sent (%u)",
+        config.faults_per_mille);
+  fmlog("   -z --compress          send final value tables compressed");
+  fmlog("   -S --seed=N            seed for the random numbers (%lu)", seed);
+  fmlog("   -h --help              print help message and exit");
+  fmlog("   -V --version           print version message and exit\n");
+  fmlog("Personalities:");
+  const emu_personality_t *perso;
+  for (unsigned int i=0; (perso = emu_personality_get(i)); i++) {
+    fmlog("   %s", perso->name);
+  }
+}
+
+
+/** Parse unsigned number option argument, abort if invalid */
+static unsigned long parse_number(const char *arg, const char *name,
+                                  const unsigned long max)
+{
+  char *end;
+  const unsigned long value = strtoul(arg, &end, 0);
+  if ((*arg == '\0') || (*end != '\0') || (value > max)) {
+    fmlog_error("Fatal: Invalid %s: %s", name, arg);
+    exit(EXIT_FAILURE);
+  }
+  return value;
+}
+
+
+/** Parse command line options, return index of the socket argument */
+static int parse_options(int argc, char *argv[])
+{
+  static const struct option long_options[] = {
+    { "devices",     required_argument, NULL, 'n' },
+    { "personality", required_argument, NULL, 'p' },
+    { "rate",        required_argument, NULL, 'r' },
+    { "baud",        required_argument, NULL, 'b' },
+    { "faults",      required_argument, NULL, 'f' },
+    { "compress",    no_argument,       NULL, 'z' },
+    { "seed",        required_argument, NULL, 'S' },
+    { "help",        no_argument,       NULL, 'h' },
+    { "version",     no_argument,       NULL, 'V' },
+    { NULL, 0, NULL, 0 }
+  };
+  while (1) {
+    const int c = getopt_long(argc, argv, "n:p:r:b:f:zS:hV", long_options, NULL);
+    if (c == -1) {
+      break;
+    }
+    switch (c) {
+    case 'n':
+      device_count = parse_number(optarg, "number of devices", 10000);
+      break;
+    case 'p':
+      if (strcmp(optarg, "all") && !emu_personality_find(optarg)) {
+        fmlog_error("Fatal: Unknown personality: %s", optarg);
+        exit(EXIT_FAILURE);
+      }
+      personality_name = optarg;
+      break;
+    case 'r':
+      config.event_rate = parse_number(optarg, "rate", 100000000);
+      break;
+    case 'b':
+      config.baudrate = parse_number(optarg, "baud rate", 100000000);
+      break;
+    case 'f':
+      config.faults_per_mille = parse_number(optarg, "fault rate", 1000);
+      break;
+    case 'z':
+      config.compress = true;
+      break;
+    case 'S':
+      seed = parse_number(optarg, "seed", ULONG_MAX);
+      break;
+    case 'h':
+      emulator_fmlog_command_line_help(argv[0]);
+      exit(EXIT_SUCCESS);
+    case 'V':
+      fmlog("freemcan-emulator " GIT_VERSION);
+      exit(EXIT_SUCCESS);
+    default:
+      emulator_fmlog_command_line_help(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if ((optind + 1 != argc) || (device_count == 0)) {
+    emulator_fmlog_command_line_help(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  return optind;
+}
+
+
+/** Emulator main program */
+int main(int argc, char *argv[])
+{
+  const char *socket_base = argv[parse_options(argc, argv)];
+
+  fmlog("freemcan emulator " GIT_VERSION);
+  raise_fd_limit();
+
+  loop = evloop_new();
+  evloop_add_signal(loop, SIGINT,  emulator_do_signal, NULL);
+  evloop_add_signal(loop, SIGTERM, emulator_do_signal, NULL);
+  evloop_add_signal(loop, SIGUSR1, emulator_do_signal, NULL);
+
+  unsigned int personality_count = 0;
+  while (emu_personality_get(personality_count)) {
+    personality_count++;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  ports = calloc(device_count, sizeof(ports[0]));
+  assert(ports);
+  for (size_t i=0; i<device_count; i++) {
+    port_t *port = &ports[i];
+    const emu_personality_t *perso = (strcmp(personality_name, "all") == 0) ?
+      emu_personality_get(i % personality_count) :
+      emu_personality_find(personality_name);
+    port->device = emu_device_new(perso, &config, seed + i);
+    if (device_count == 1) {
+      port->socket_name = strdup(socket_base);
+    } else {
+      const int width = snprintf(NULL, 0, "%lu", device_count - 1);
+      const int ret = asprintf(&port->socket_name, "%s-%0*zu",
+                               socket_base, (width < 3) ? 3 : width, i);
+      assert(ret > 0);
+    }
+    assert(port->socket_name);
+    port->listen_fd = open_listen_socket(port->socket_name);
+    port->conn_fd = -1;
+    evloop_add_fd(loop, port->listen_fd, EPOLLIN, port_do_accept, port);
+  }
+  fmlog("Emulating %lu %s device(s) at %s%s",
+        device_count, personality_name, socket_base,
+        (device_count == 1) ? "" : "-*");
+
+  evloop_watch_t *tick = evloop_add_timer(loop, emulator_do_tick, NULL);
+  evloop_timer_set(tick, TICK_MS);
+
+  while (!quit) {
+    evloop_run_once(loop, -1);
+    reap_hangups();
+  }
+
+  log_stats();
+  evloop_unref(loop);
+  for (size_t i=0; i<device_count; i++) {
+    if (ports[i].conn_fd >= 0) {
+      close(ports[i].conn_fd);
+    }
+    close(ports[i].listen_fd);
+    unlink(ports[i].socket_name);
+    free(ports[i].socket_name);
+    emu_device_unref(ports[i].device);
+  }
+  free(ports);
+  return EXIT_SUCCESS;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,391 @@
+/** \file emulator/test-emu-device.c
+ * \brief Protocol tests for the emulated device
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Talks to emulated devices the way the hostware does, and checks
+ * their answers against the protocol definitions.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "frame-defs.h"
+#include "packet-defs.h"
+#include "checksum.h"
+#include "emu-device.h"
+
+
+/** A frame received from the device */
+typedef struct {
+  uint8_t type;
+  uint16_t size;
+  uint8_t payload[8192];
+} frame_t;
+
+
+static const emu_config_t default_config = { 1000, 0, 0, false };
+
+
+/** Send command frame to the device */
+static void send_command(emu_device_t *dev, const uint8_t cmd,
+                         const void *params, const uint8_t length)
+{
+  uint8_t buf[4 + 2 + MAX_PARAM_LENGTH + 1];
+  memcpy(buf, FRAME_MAGIC_STR, 4);
+  buf[4] = cmd;
+  buf[5] = length;
+  memcpy(&buf[6], params, length);
+  checksum_accu_t accu = checksum_reset();
+  for (size_t i=0; i<6u+length; i++) {
+    accu = checksum_update(accu, buf[i]);
+  }
+  buf[6+length] = (uint8_t)accu;
+  emu_device_recv(dev, buf, 7 + length);
+}
+
+
+/** Receive the next frame, return false if there is none
+ *
+ * Asserts that the frame is complete and its checksum matches.
+ */
+static bool recv_frame(emu_device_t *dev, frame_t *frame)
+{
+  const uint8_t *buf;
+  const size_t size = emu_device_tx_peek(dev, &buf);
+  if (size == 0) {
+    return false;
+  }
+  assert(size >= 8);
+  assert(memcmp(buf, FRAME_MAGIC_STR, 4) == 0);
+  frame->size = buf[4] | (buf[5] << 8);
+  frame->type = buf[6];
+  assert(size >= 8u + frame->size);
+  assert(frame->size <= sizeof(frame->payload));
+  memcpy(frame->payload, &buf[7], frame->size);
+  checksum_accu_t accu = checksum_reset();
+  for (size_t i=0; i<7u+frame->size; i++) {
+    accu = checksum_update(accu, buf[i]);
+  }
+  assert(checksum_matches(accu, buf[7+frame->size]));
+  emu_device_tx_consume(dev, 8 + frame->size);
+  return true;
+}
+
+
+/** Receive the next frame, which must be of the given type */
+static void expect_frame(emu_device_t *dev, frame_t *frame, const uint8_t type)
+{
+  assert(recv_frame(dev, frame));
+  assert(frame->type == type);
+}
+
+
+/** Receive the next frame, which must be the given state */
+static void expect_state(emu_device_t *dev, const char *state)
+{
+  frame_t frame;
+  expect_frame(dev, &frame, FRAME_TYPE_STATE);
+  assert(frame.size == strlen(state));
+  assert(memcmp(frame.payload, state, frame.size) == 0);
+}
+
+
+/** Receive the boot frames */
+static void expect_boot(emu_device_t *dev, const emu_personality_t *perso)
+{
+  frame_t frame;
+  expect_frame(dev, &frame, FRAME_TYPE_TEXT);
+  assert(memcmp(frame.payload, "freemcan ", 9) == 0);
+  expect_frame(dev, &frame, FRAME_TYPE_PERSONALITY_INFO);
+  const packet_personality_info_t *info =
+    (const packet_personality_info_t *)frame.payload;
+  assert(info->sizeof_table == perso->sizeof_table);
+  assert(info->bits_per_value == perso->bits_per_value);
+  assert(frame.size == sizeof(*info) + strlen(perso->name));
+  assert(memcmp(&frame.payload[sizeof(*info)], perso->name,
+                strlen(perso->name)) == 0);
+  expect_state(dev, "READY");
+}
+
+
+/** Element i of the value table in frame, after a header of head_size */
+static uint32_t element(const frame_t *frame, const size_t head_size,
+                        const unsigned int bytes_per_value, const size_t i)
+{
+  uint32_t value = 0;
+  for (unsigned int b=0; b<bytes_per_value; b++) {
+    value |= frame->payload[head_size + i*bytes_per_value + b] << (8*b);
+  }
+  return value;
+}
+
+
+static void test_boot_and_commands(void)
+{
+  for (unsigned int p=0; emu_personality_get(p); p++) {
+    const emu_personality_t *perso = emu_personality_get(p);
+    emu_device_t *dev = emu_device_new(perso, &default_config, p);
+    expect_boot(dev, perso);
+
+    send_command(dev, FRAME_CMD_STATE, NULL, 0);
+    expect_state(dev, "READY");
+    send_command(dev, FRAME_CMD_PARAMS_FROM_EEPROM, NULL, 0);
+    frame_t frame;
+    expect_frame(dev, &frame, FRAME_TYPE_TEXT);
+    expect_state(dev, "READY");
+
+    const uint8_t params[4] = { 7, 0, 1, 0 };
+    const uint8_t length =
+      perso->param_size_timer_count + perso->param_size_skip_samples;
+    send_command(dev, FRAME_CMD_PARAMS_TO_EEPROM, params, length);
+    expect_state(dev, "PARAMS_TO_EEPROM");
+    expect_state(dev, "READY");
+    send_command(dev, FRAME_CMD_RESET, NULL, 0);
+    expect_state(dev, "RESET");
+    expect_boot(dev, perso);
+    send_command(dev, FRAME_CMD_PARAMS_FROM_EEPROM, NULL, 0);
+    expect_frame(dev, &frame, FRAME_TYPE_PARAMS_FROM_EEPROM);
+    assert(frame.size == length);
+    assert(memcmp(frame.payload, params, length) == 0);
+    expect_state(dev, "READY");
+    assert(!recv_frame(dev, &frame));
+    emu_device_unref(dev);
+  }
+}
+
+
+static void test_broken_commands(void)
+{
+  const emu_personality_t *perso = emu_personality_find("adc-int-mca");
+  emu_device_t *dev = emu_device_new(perso, &default_config, 0);
+  expect_boot(dev, perso);
+
+  /* wrong checksum */
+  const uint8_t broken[] = { 'F', 'M', 'p', 'X', 's', 0, 0 };
+  emu_device_recv(dev, broken, sizeof(broken));
+  frame_t frame;
+  expect_frame(dev, &frame, FRAME_TYPE_TEXT);
+  assert(memcmp(frame.payload, "checksum fail", frame.size) == 0);
+
+  /* one parameter byte is too short for the measurement parameters */
+  const uint8_t param = 1;
+  send_command(dev, FRAME_CMD_MEASURE, &param, 1);
+  expect_frame(dev, &frame, FRAME_TYPE_TEXT);
+  assert(memcmp(frame.payload, "param length mismatch", frame.size) == 0);
+
+  /* the device still works */
+  send_command(dev, FRAME_CMD_STATE, NULL, 0);
+  expect_state(dev, "READY");
+  assert(emu_device_stats(dev)->rx_errors == 2);
+  emu_device_unref(dev);
+}
+
+
+static void test_histogram_measurement(void)
+{
+  const emu_personality_t *perso = emu_personality_find("adc-int-mca");
+  emu_device_t *dev = emu_device_new(perso, &default_config, 0);
+  expect_boot(dev, perso);
+
+  const uint16_t seconds = 3;
+  send_command(dev, FRAME_CMD_MEASURE, &seconds, sizeof(seconds));
+  expect_state(dev, "MEASURING");
+
+  emu_device_advance(dev, 1.5);
+  send_command(dev, FRAME_CMD_INTERMEDIATE, NULL, 0);
+  frame_t frame;
+  expect_frame(dev, &frame, FRAME_TYPE_VALUE_TABLE);
+  const packet_value_table_header_t *header =
+    (const packet_value_table_header_t *)frame.payload;
+  assert(header->bits_per_value == (24 | PACKET_VALUE_TABLE_EXTENDED));
+  assert(header->reason == PACKET_VALUE_TABLE_INTERMEDIATE);
+  assert(header->type == VALUE_TABLE_TYPE_HISTOGRAM);
+  assert(header->duration == 1);
+  assert(header->param_buf_length == sizeof(seconds));
+  const size_t head_size = sizeof(*header) + sizeof(seconds) +
+    sizeof(packet_value_table_ext_header_t);
+  const packet_value_table_ext_header_t *ext_header =
+    (const packet_value_table_ext_header_t *)&frame.payload[head_size -
+                                                            sizeof(*ext_header)];
+  assert(ext_header->dead_cycles == perso->dead_cycles);
+  assert(frame.size == head_size + 1024*3);
+  uint32_t total = 0;
+  for (size_t i=0; i<1024; i++) {
+    total += element(&frame, head_size, 3, i);
+  }
+  const emu_stats_t *stats = emu_device_stats(dev);
+  assert(total == stats->triggers - stats->lost);
+  /* about 1500 triggers, a few of them lost in the dead time */
+  assert((total > 1200) && (total < 1800));
+  assert(stats->lost > 0);
+  expect_state(dev, "MEASURING");
+
+  /* the first delta value table has all blocks */
+  const uint8_t ack = 0;
+  send_command(dev, FRAME_CMD_INTERMEDIATE_DELTA, &ack, 1);
+  expect_frame(dev, &frame, FRAME_TYPE_VALUE_TABLE_DELTA);
+  const packet_value_table_delta_header_t *delta_header =
+    (const packet_value_table_delta_header_t *)&frame.payload[head_size];
+  assert(delta_header->base_seq == 0);
+  assert(delta_header->seq == 1);
+  assert(delta_header->element_count == 1024);
+  assert(frame.size == head_size + sizeof(*delta_header) + 2 + 1024*3);
+  expect_state(dev, "MEASURING");
+
+  /* nothing has changed since */
+  const uint8_t seq = delta_header->seq;
+  send_command(dev, FRAME_CMD_INTERMEDIATE_DELTA, &seq, 1);
+  expect_frame(dev, &frame, FRAME_TYPE_VALUE_TABLE_DELTA);
+  assert(frame.size == head_size + sizeof(*delta_header));
+  expect_state(dev, "MEASURING");
+
+  /* the timer ends the measurement */
+  emu_device_advance(dev, 3.5);
+  expect_frame(dev, &frame, FRAME_TYPE_VALUE_TABLE);
+  assert(header->reason == PACKET_VALUE_TABLE_DONE);
+  assert(header->duration == seconds);
+  const uint64_t triggers = stats->triggers;
+  emu_device_advance(dev, 5.0);
+  assert(stats->triggers == triggers);
+  send_command(dev, FRAME_CMD_STATE, NULL, 0);
+  expect_state(dev, "DONE");
+  send_command(dev, FRAME_CMD_INTERMEDIATE, NULL, 0);
+  expect_frame(dev, &frame, FRAME_TYPE_VALUE_TABLE);
+  assert(header->reason == PACKET_VALUE_TABLE_RESEND);
+  expect_state(dev, "DONE");
+  emu_device_unref(dev);
+}
+
+
+static void test_time_series(void)
+{
+  const emu_personality_t *perso = emu_personality_find("geiger-time-series");
+  emu_device_t *dev = emu_device_new(perso, &default_config, 0);
+  expect_boot(dev, perso);
+
+  const uint16_t seconds = 2;
+  send_command(dev, FRAME_CMD_MEASURE, &seconds, sizeof(seconds));
+  expect_state(dev, "MEASURING");
+  emu_device_advance(dev, 7.0);
+
+  /* time series do not know about delta value tables */
+  const uint8_t ack = 0;
+  send_command(dev, FRAME_CMD_INTERMEDIATE_DELTA, &ack, 1);
+  frame_t frame;
+  expect_frame(dev, &frame, FRAME_TYPE_VALUE_TABLE);
+  const size_t head_size =
+    sizeof(packet_value_table_header_t) + sizeof(seconds);
+  assert(frame.size == head_size + 4*2);
+  for (size_t i=0; i<3; i++) {
+    const uint32_t counts = element(&frame, head_size, 2, i);
+    assert((counts > 1700) && (counts < 2300));
+  }
+  expect_state(dev, "MEASURING");
+
+  send_command(dev, FRAME_CMD_ABORT, NULL, 0);
+  expect_state(dev, "DONE");
+  expect_frame(dev, &frame, FRAME_TYPE_VALUE_TABLE);
+  assert(frame.payload[1] == PACKET_VALUE_TABLE_ABORTED);
+  expect_state(dev, "DONE");
+  emu_device_unref(dev);
+}
+
+
+/** Drain the device output at 1ms steps from *now, return bytes read */
+static size_t drain(emu_device_t *dev, double *now, const size_t size)
+{
+  size_t total = 0;
+  while (total < size) {
+    *now += 0.001;
+    emu_device_advance(dev, *now);
+    const uint8_t *buf;
+    const size_t n = emu_device_tx_peek(dev, &buf);
+    emu_device_tx_consume(dev, n);
+    total += n;
+  }
+  return total;
+}
+
+
+static void test_link_speed(void)
+{
+  const emu_personality_t *perso = emu_personality_find("adc-int-mca");
+  emu_device_t *fast = emu_device_new(perso, &default_config, 0);
+  const uint8_t *buf;
+  const size_t boot_size = emu_device_tx_peek(fast, &buf);
+  emu_device_unref(fast);
+
+  emu_config_t config = default_config;
+  config.baudrate = 9600;
+  emu_device_t *dev = emu_device_new(perso, &config, 0);
+  assert(emu_device_tx_peek(dev, &buf) == 0);
+
+  /* 960 bytes per second */
+  double now = 0.0;
+  assert(drain(dev, &now, boot_size) == boot_size);
+  const double expected = boot_size / 960.0;
+  assert((now > expected - 0.002) && (now < expected + 0.002));
+
+  /* commands wait until the output of the previous one has gone out */
+  for (unsigned int i=0; i<3; i++) {
+    send_command(dev, FRAME_CMD_PERSONALITY_INFO, NULL, 0);
+  }
+  assert(emu_device_stats(dev)->commands == 1);
+  const size_t reply_size = sizeof(packet_personality_info_t) +
+    strlen(perso->name) + 8 + strlen("READY") + 8;
+  assert(drain(dev, &now, 3*reply_size) == 3*reply_size);
+  assert(emu_device_stats(dev)->commands == 3);
+  emu_device_unref(dev);
+}
+
+
+static void test_faults(void)
+{
+  const emu_personality_t *perso = emu_personality_find("adc-int-mca");
+  emu_config_t config = default_config;
+  config.faults_per_mille = 1000;
+  emu_device_t *dev = emu_device_new(perso, &config, 0);
+  assert(emu_device_stats(dev)->frames == 3);
+  assert(emu_device_stats(dev)->faults == 3);
+  emu_device_unref(dev);
+}
+
+
+int main(void)
+{
+  test_boot_and_commands();
+  test_broken_commands();
+  test_histogram_measurement();
+  test_time_series();
+  test_link_speed();
+  test_faults();
+  printf("All emulated device tests passed.\n");
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
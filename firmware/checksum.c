@@ -31,23 +31,21 @@
 #include "checksum.h"
 
 
-/** Update checksum
+#ifndef __AVR__
+/** Portable version of checksum_update_block() for non-AVR builds
  *
- * \todo Use a good checksum algorithm with good values.
- *
- * We are calling this function twice - so not inlining the code saves
- * us some bytes that need to be programmed into the uC. For some
- * reason, gcc inlines the code anyway.
+ * On the AVR, the assembly language version from checksum-block.S is
+ * used instead.
  */
-
-checksum_accu_t checksum_update(const checksum_accu_t accu, const uint8_t data)
+checksum_accu_t checksum_update_block(checksum_accu_t accu,
+                                      const void *buf, size_t len)
 {
-  const uint8_t  n = data;
-  const uint16_t x = 8*n+2*n+n;
-  const uint16_t r = (accu << 3) | (accu >> 13);
-  const uint16_t v = r ^ x;
-  return v;
+  for (const uint8_t *s = (const uint8_t *)buf; len > 0; s++, len--) {
+    accu = checksum_update(accu, *s);
+  }
+  return accu;
 }
+#endif
 
 
 /** @} */
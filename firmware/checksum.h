@@ -28,6 +28,7 @@
 #define CHECKSUM_H
 
 
+#include <stddef.h>
 #include <stdint.h>
 
 
@@ -42,7 +43,50 @@ checksum_accu_t checksum_reset(void)
 }
 
 
-checksum_accu_t checksum_update(const checksum_accu_t accu, const uint8_t c);
+/** Update checksum
+ *
+ * \todo Use a good checksum algorithm with good values.
+ *
+ * Inline, as the UART transmit ISR calls this for every byte, and a
+ * function call would make the ISR save all call-clobbered registers.
+ */
+inline static
+checksum_accu_t checksum_update(const checksum_accu_t accu, const uint8_t data)
+{
+  const uint8_t  n = data;
+  const uint16_t x = 8*n+2*n+n;
+  const uint16_t r = (accu << 3) | (accu >> 13);
+  const uint16_t v = r ^ x;
+  return v;
+}
+
+
+/** Update checksum with a block of data bytes
+ *
+ * Same result as calling checksum_update() for every byte in buf.
+ * The AVR implementation lives in checksum-block.S.
+ */
+checksum_accu_t checksum_update_block(checksum_accu_t accu,
+                                      const void *buf, size_t len);
+
+
+/** Append the checksum of a block computed separately
+ *
+ * The checksum is linear: Starting from accu instead of 0 only
+ * rotates accu by 3 bits per byte into the result. So with
+ * sum = checksum_update_block(0, buf, len),
+ * checksum_combine(accu, sum, len) equals
+ * checksum_update_block(accu, buf, len).
+ */
+inline static
+checksum_accu_t checksum_combine(const checksum_accu_t accu,
+                                 const checksum_accu_t sum,
+                                 const uint8_t len)
+{
+  const uint8_t r = (3*len) & 15;
+  const uint16_t rotated = r ? ((accu << r) | (accu >> (16-r))) : accu;
+  return rotated ^ sum;
+}
 
 
 /** Check whether data byte matches checksum */
@@ -95,6 +95,17 @@ typedef struct {
 
   /** The size of a single table element */
   uint8_t bits_per_value;
+
+  /** Whether the personality marks changed elements with
+   *  #data_table_mark_dirty(), i.e. supports delta value tables */
+  uint8_t marks_dirty;
+
+  /** Dead time per recorded trigger in CPU cycles, 0 if unknown.
+   *  If set, value tables carry a #packet_value_table_ext_header_t.
+   *  Only the adc-int-mca personality built with the assembly
+   *  language ISR(ADC_vect) sets it (see \ref
+   *  packet_value_table_extended). */
+  uint16_t dead_cycles;
 } data_table_info_t;
 
 
@@ -105,6 +116,27 @@ typedef struct {
 extern data_table_info_t data_table_info;
 
 
+/** Maximum number of blocks covered by #data_table_dirty */
+#define DATA_TABLE_DIRTY_BLOCKS 64
+
+
+/** Dirty flags, one byte per block of table elements
+ *
+ * One byte per #PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE elements, so that
+ * the ISR only needs a single store to mark an element as changed.
+ * send_table_delta() clears the flags of the blocks it sends.
+ */
+extern volatile uint8_t data_table_dirty[DATA_TABLE_DIRTY_BLOCKS];
+
+
+/** Mark the table element at index as changed (call from ISR) */
+inline static
+void data_table_mark_dirty(const uint16_t index)
+{
+  data_table_dirty[index / PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE] = 1;
+}
+
+
 /** @} */
 
 #endif /* DATA_TABLE_H */
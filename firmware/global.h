@@ -72,6 +72,18 @@
 #define GF_MEASUREMENT_FINISHED 0
 
 
+/** Global flag: Signal that the frame parser has news
+ *
+ * Sends a signal from the UART receive ISR to the main event loop
+ * that a complete command frame with a matching checksum is waiting
+ * in the command queue, or that a broken frame has been dropped.
+ *
+ * Set only in the ISR code, cleared only in the main event loop
+ * (with interrupts disabled, after it has emptied the command queue).
+ */
+#define GF_COMMAND_RECEIVED 1
+
+
 /** Is given global flag set? */
 #define GF_ISSET(FLAG)                          \
   (0 != ((GLOBAL_FLAG_REGISTER) & _BV(FLAG)))
@@ -1,5 +1,5 @@
-/** \file hostware/freemcan-select.h
- * \brief select(2) helpers (interface)
+/** \file firmware/host/avr/eeprom.h
+ * \brief Host shim for <avr/eeprom.h>
  *
  * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
  *
@@ -18,41 +18,29 @@
  *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
  *  Boston, MA 02110-1301 USA
  *
- * \defgroup freemcan_select select(2) related definitions/documentation
- * \ingroup mainloop_select
+ * EEMEM variables go into a section of their own, which the shim
+ * fills with 0xff (like erased EEPROM) on every power-up.
  *
+ * \addtogroup firmware_host_shim
+ * @{
  */
 
+#ifndef SHIM_AVR_EEPROM_H
+#define SHIM_AVR_EEPROM_H
 
-#ifndef FREEMCAN_SELECT_H
-#define FREEMCAN_SELECT_H
 
-/* According to POSIX.1-2001 */
-#include <sys/select.h>
+#include <string.h>
 
-/* According to earlier standards */
-#include <sys/time.h>
-#include <sys/types.h>
-#include <unistd.h>
 
-/** \addtogroup freemcan_select
- * @{
- */
+#define EEMEM __attribute__((section("shim_eeprom")))
 
-/** Setup function main loop needs to call in every iteration
- *
- * \param in_fdset Run FD_SET on this
- * \param maxfd    The old maxfd value
- * \return New maxfd, i.e. MAX(maxfd, our_highest_fd_we_set)
- */
-typedef int (*select_set_in_t)(fd_set *in_fdset, int maxfd);
+#define eeprom_read_block(dst, src, n) memcpy((dst), (src), (n))
+#define eeprom_update_block(src, dst, n) memcpy((dst), (src), (n))
 
-/** IO function main loop needs to call in every iteration */
-typedef void (*select_do_io_t)(fd_set *in_fdset);
 
 /** @} */
 
-#endif /* !FREEMCAN_SELECT_H */
+#endif /* !SHIM_AVR_EEPROM_H */
 
 
 /*
@@ -0,0 +1,182 @@
+/** \file firmware/host/avr/io.h
+ * \brief Host shim for <avr/io.h>: ATmega644 IO registers as variables
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Only the registers and bits the firmware uses are defined, with the
+ * ATmega644 bit numbers. Most registers are plain variables. Reading
+ * SREG ticks the simulated MCU, and UCSR0A and UDR0 go through the
+ * simulated UART. UDR0 has 16 bits so that the shim can tell bytes
+ * written by the firmware from received bytes.
+ *
+ * \addtogroup firmware_host_shim
+ * @{
+ */
+
+#ifndef SHIM_AVR_IO_H
+#define SHIM_AVR_IO_H
+
+
+#include <stdint.h>
+
+#include "shim.h"
+
+
+#define _BV(bit) (1 << (bit))
+
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+
+#define loop_until_bit_is_set(sfr, bit)         \
+  do { shim_tick(); } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit)       \
+  do { shim_tick(); } while (bit_is_set(sfr, bit))
+
+
+/* Status register */
+#define SREG (*shim_sreg())
+#define SREG_I 7
+
+/* General purpose IO register, MCU status register */
+extern volatile uint8_t GPIOR0;
+extern volatile uint8_t MCUSR;
+
+/* Ports */
+extern volatile uint8_t DDRB;
+extern volatile uint8_t PORTB;
+extern volatile uint8_t PINB;
+extern volatile uint8_t DDRD;
+extern volatile uint8_t PORTD;
+extern volatile uint8_t PIND;
+
+#define DDB2 2
+#define PB2  2
+#define DDD2 2
+#define DDD4 4
+#define DDD5 5
+#define DDD6 6
+#define DDD7 7
+#define PD2  2
+#define PD4  4
+#define PD5  5
+#define PD6  6
+#define PD7  7
+
+/* External interrupts */
+extern volatile uint8_t EICRA;
+extern volatile uint8_t EIMSK;
+extern volatile uint8_t EIFR;
+
+#define ISC00 0
+#define ISC01 1
+#define INT0  0
+#define INTF0 0
+
+/* ADC */
+extern volatile uint8_t ADMUX;
+extern volatile uint8_t ADCSRA;
+extern volatile uint8_t ADCSRB;
+extern volatile uint16_t ADCW;
+
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+#define ADEN  7
+#define ADSC  6
+#define ADATE 5
+#define ADIF  4
+#define ADIE  3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define ADTS2 2
+#define ADTS1 1
+#define ADTS0 0
+
+/* Timer1 */
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+extern volatile uint16_t TCNT1;
+extern volatile uint16_t OCR1A;
+extern volatile uint16_t OCR1B;
+extern volatile uint16_t ICR1;
+extern volatile uint8_t TIMSK1;
+extern volatile uint8_t TIFR1;
+
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define WGM11  1
+#define WGM10  0
+#define WGM13  4
+#define WGM12  3
+#define CS12   2
+#define CS11   1
+#define CS10   0
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1  0
+#define OCF1B  2
+#define OCF1A  1
+#define TOV1   0
+
+/* USART0 */
+#define UCSR0A (*shim_ucsr0a())
+extern volatile uint8_t UCSR0B;
+extern volatile uint8_t UCSR0C;
+extern volatile uint8_t UBRR0H;
+extern volatile uint8_t UBRR0L;
+#define UDR0 (*shim_udr0())
+
+#define RXC0   7
+#define TXC0   6
+#define UDRE0  5
+#define U2X0   1
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0  4
+#define TXEN0  3
+#define UCSZ01 2
+#define UCSZ00 1
+
+
+/* Fuses (<avr/fuse.h>), only used for the FUSES declaration */
+#define FUSES static const uint8_t shim_fuses[3] __attribute__((unused))
+
+#define FUSE_CKSEL3    ((uint8_t)~_BV(3))
+#define FUSE_SUT1      ((uint8_t)~_BV(5))
+#define FUSE_BOOTSZ0   ((uint8_t)~_BV(1))
+#define FUSE_BOOTSZ1   ((uint8_t)~_BV(2))
+#define FUSE_SPIEN     ((uint8_t)~_BV(5))
+#define FUSE_BODLEVEL0 ((uint8_t)~_BV(0))
+#define FUSE_BODLEVEL1 ((uint8_t)~_BV(1))
+
+
+/** @} */
+
+#endif /* !SHIM_AVR_IO_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,56 @@
+/** \file firmware/host/avr/pgmspace.h
+ * \brief Host shim for <avr/pgmspace.h>: program memory is memory
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup firmware_host_shim
+ * @{
+ */
+
+#ifndef SHIM_AVR_PGMSPACE_H
+#define SHIM_AVR_PGMSPACE_H
+
+
+#include <stdint.h>
+#include <string.h>
+
+
+#define PROGMEM
+
+#define PGM_P const char *
+#define PGM_VOID_P const void *
+
+#define PSTR(s) (s)
+
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+
+#define strlen_P(s) strlen(s)
+#define memcpy_P(dest, src, n) memcpy((dest), (src), (n))
+
+
+/** @} */
+
+#endif /* !SHIM_AVR_PGMSPACE_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
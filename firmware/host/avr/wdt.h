@@ -0,0 +1,53 @@
+/** \file firmware/host/avr/wdt.h
+ * \brief Host shim for <avr/wdt.h>
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Enabling the watchdog resets the simulated MCU right away, as the
+ * firmware only does that to reset itself.
+ *
+ * \addtogroup firmware_host_shim
+ * @{
+ */
+
+#ifndef SHIM_AVR_WDT_H
+#define SHIM_AVR_WDT_H
+
+
+#include <avr/io.h>
+
+#include "shim.h"
+
+
+#define WDTO_15MS 0
+
+#define wdt_enable(timeout) shim_wdt_enable(timeout)
+#define wdt_disable() do { } while (0)
+
+
+/** @} */
+
+#endif /* !SHIM_AVR_WDT_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
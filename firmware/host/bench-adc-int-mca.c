@@ -0,0 +1,133 @@
+/** \file firmware/host/bench-adc-int-mca.c
+ * \brief Benchmark the adc-int-mca firmware on the simulated MCU
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Feeds pulses through ISR(ADC_vect) and has the main loop send full
+ * and delta value tables, and reports host time and simulated ticks
+ * (SREG reads) per event. Host time says little about the AVR, but
+ * tells whether a change makes the firmware code paths longer.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "frame-defs.h"
+#include "shim.h"
+
+
+#define PULSES 2000000
+#define TABLES 2000
+
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+/** Parse all frames the firmware has sent, return the payload bytes */
+static size_t drain(void)
+{
+  size_t bytes = 0;
+  shim_frame_t frame;
+  while (shim_uart_recv_frame(&frame)) {
+    bytes += frame.size;
+  }
+  assert(shim_uart_pending() == 0);
+  return bytes;
+}
+
+
+static void report(const char *name, const unsigned long events,
+                   const double t, const uint64_t ticks)
+{
+  printf("%-16s %8lu events %9.1f ns/event %10.0f events/s %7.1f ticks/event\n",
+         name, events, 1e9*t/events, events/t, (double)ticks/events);
+}
+
+
+int main(void)
+{
+  static const uint8_t timer_count[] = { 0xff, 0xff };
+
+  shim_boot();
+  drain();
+  shim_send_command(FRAME_CMD_MEASURE, timer_count, sizeof(timer_count), 0);
+  shim_run_until_idle();
+  drain();
+
+  /* one pulse per tick keeps the ISR busy all the time */
+  uint64_t isr_calls = shim_stats()->isr_calls;
+  uint64_t ticks = shim_stats()->ticks;
+  double t0 = now();
+  for (unsigned long i=0; i<PULSES; i++) {
+    shim_int0_pulse(i & 0x3ff);
+    shim_run_ticks(1);
+  }
+  double t1 = now();
+  assert(shim_stats()->isr_calls - isr_calls == PULSES);
+  assert(shim_stats()->lost_triggers == 0);
+  report("ADC ISR", PULSES, t1-t0, shim_stats()->ticks - ticks);
+
+  /* full intermediate value tables */
+  size_t bytes = 0;
+  ticks = shim_stats()->ticks;
+  t0 = now();
+  for (unsigned long i=0; i<TABLES; i++) {
+    shim_send_command(FRAME_CMD_INTERMEDIATE, NULL, 0, 0);
+    shim_run_until_idle();
+    bytes += drain();
+  }
+  t1 = now();
+  report("value table", TABLES, t1-t0, shim_stats()->ticks - ticks);
+  printf("%-16s %8zu bytes/table\n", "", bytes/TABLES);
+
+  /* delta value tables with a few changed blocks each */
+  bytes = 0;
+  ticks = shim_stats()->ticks;
+  t0 = now();
+  for (unsigned long i=0; i<TABLES; i++) {
+    const uint8_t ack = i % 255;
+    for (unsigned int p=0; p<4; p++) {
+      shim_int0_pulse((i*67 + p*251) & 0x3ff);
+      shim_run_ticks(1);
+    }
+    shim_send_command(FRAME_CMD_INTERMEDIATE_DELTA, &ack, 1, 0);
+    shim_run_until_idle();
+    bytes += drain();
+  }
+  t1 = now();
+  report("delta table", TABLES, t1-t0, shim_stats()->ticks - ticks);
+  printf("%-16s %8zu bytes/table\n", "", bytes/TABLES);
+
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
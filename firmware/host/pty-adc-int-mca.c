@@ -0,0 +1,286 @@
+/** \file firmware/host/pty-adc-int-mca.c
+ * \brief Run the adc-int-mca firmware on the simulated MCU behind a pty
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Connects the simulated USART0 to a pseudo terminal, and prints the
+ * name of its slave side on stdout. Open that with freemcan-tui, or
+ * have freemcan-rig do it. Simulated time passes in ticks (see
+ * shim.h):
+ *
+ *   -i TICKS  INT0 pulse every TICKS ticks, with random ADC values
+ *             around a peak (default 0: no pulses)
+ *   -s TICKS  timer1 compare match, i.e. one second, every TICKS
+ *             ticks (default 100000)
+ *   -u TICKS  UART time per sent byte (default 0: infinitely fast)
+ *
+ * A watchdog reset re-executes the program, keeping the pty. On
+ * SIGUSR1, it prints the statistics since the last reset, and on
+ * SIGTERM it prints them and exits:
+ *
+ *   pulses <n> lost <n> isr_calls <n> ticks <n> tx_bytes <n>
+ */
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "shim.h"
+
+
+/** Ticks to run between looking at the pty */
+#define CHUNK_TICKS 1000
+
+/** Tick count meaning "never" */
+#define NEVER UINT64_MAX
+
+
+static volatile sig_atomic_t terminate = 0;
+static volatile sig_atomic_t report = 0;
+
+
+static void signal_handler(int signo)
+{
+  if (signo == SIGUSR1) {
+    report = 1;
+  } else {
+    terminate = 1;
+  }
+}
+
+
+static void print_stats(const unsigned long pulses)
+{
+  const shim_stats_t *stats = shim_stats();
+  printf("pulses %lu lost %llu isr_calls %llu ticks %llu tx_bytes %llu\n",
+         pulses,
+         (unsigned long long)stats->lost_triggers,
+         (unsigned long long)stats->isr_calls,
+         (unsigned long long)stats->ticks,
+         (unsigned long long)stats->tx_bytes);
+  fflush(stdout);
+}
+
+
+/** Random ADC value: a peak at 512 on a flat background */
+static uint16_t adc_value(void)
+{
+  static uint32_t x = 2463534242UL;
+  uint16_t sum = 0;
+  for (unsigned int i=0; i<4; i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sum += x & 0x3ff;
+  }
+  return ((x >> 10) & 7) ? (sum / 4) : ((x >> 13) & 0x3ff);
+}
+
+
+static unsigned long parse_ticks(const char *arg)
+{
+  char *end;
+  const unsigned long ticks = strtoul(arg, &end, 0);
+  if (!*arg || *end) {
+    fprintf(stderr, "pty-adc-int-mca: invalid tick count: %s\n", arg);
+    exit(2);
+  }
+  return ticks;
+}
+
+
+/** Open the pty and print the name of its slave side */
+static int open_pty(void)
+{
+  const int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if ((master < 0) || grantpt(master) || unlockpt(master)) {
+    perror("pty-adc-int-mca: posix_openpt");
+    exit(1);
+  }
+  const char *name = ptsname(master);
+  assert(name);
+  /* Keep the slave side open, so that reading the master side does
+   * not fail with EIO while no hostware has the slave open. */
+  const int slave = open(name, O_RDWR | O_NOCTTY);
+  assert(slave >= 0);
+  struct termios tio;
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  printf("%s\n", name);
+  fflush(stdout);
+  return master;
+}
+
+
+/** Pass the bytes the firmware has sent on to the pty */
+static size_t pty_write(const int master)
+{
+  uint8_t buf[4096];
+  size_t total = 0;
+  size_t len;
+  while ((len = shim_uart_recv(buf, sizeof(buf))) > 0) {
+    for (size_t ofs=0; ofs<len; ) {
+      const ssize_t n = write(master, &buf[ofs], len - ofs);
+      if (n < 0) {
+        if (errno == EAGAIN) {
+          /* the hostware is behind with reading */
+          struct pollfd pfd = { master, POLLOUT, 0 };
+          poll(&pfd, 1, -1);
+        } else {
+          assert(errno == EINTR);
+        }
+        continue;
+      }
+      ofs += n;
+    }
+    total += len;
+  }
+  return total;
+}
+
+
+/** Pass bytes from the pty on to the firmware */
+static size_t pty_read(const int master)
+{
+  uint8_t buf[256];
+  size_t space = shim_uart_space();
+  if (space > sizeof(buf)) {
+    space = sizeof(buf);
+  }
+  const ssize_t n = read(master, buf, space);
+  if (n <= 0) {
+    return 0;
+  }
+  shim_uart_send(buf, n);
+  return n;
+}
+
+
+int main(int argc, char *argv[])
+{
+  unsigned long pulse_ticks = 0;
+  unsigned long second_ticks = 100000;
+  unsigned long uart_ticks = 0;
+  int master = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "i:s:u:f:")) != -1) {
+    switch (opt) {
+    case 'i': pulse_ticks = parse_ticks(optarg); break;
+    case 's': second_ticks = parse_ticks(optarg); break;
+    case 'u': uart_ticks = parse_ticks(optarg); break;
+    case 'f': master = parse_ticks(optarg); break;
+    default:
+      fprintf(stderr,
+              "Usage: %s [-i TICKS] [-s TICKS] [-u TICKS]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (master < 0) {
+    master = open_pty();
+  }
+  const int flags = fcntl(master, F_GETFL);
+  fcntl(master, F_SETFL, flags | O_NONBLOCK);
+
+  signal(SIGTERM, signal_handler);
+  signal(SIGINT, signal_handler);
+  signal(SIGUSR1, signal_handler);
+
+  shim_set_uart_ticks(uart_ticks);
+  shim_boot();
+
+  uint64_t now = 0;
+  uint64_t next_pulse = pulse_ticks ? pulse_ticks : NEVER;
+  uint64_t next_second = second_ticks ? second_ticks : NEVER;
+  unsigned long pulses = 0;
+
+  while (!terminate) {
+    if (report) {
+      report = 0;
+      print_stats(pulses);
+    }
+    size_t moved = pty_read(master);
+
+    const uint64_t chunk_end = now + CHUNK_TICKS;
+    while (now < chunk_end) {
+      uint64_t next = chunk_end;
+      if (next_pulse < next) {
+        next = next_pulse;
+      }
+      if (next_second < next) {
+        next = next_second;
+      }
+      shim_run_ticks(next - now);
+      now = next;
+      if (shim_reset_requested()) {
+        pty_write(master);
+        char fd_arg[16];
+        snprintf(fd_arg, sizeof(fd_arg), "%d", master);
+        char *args[] = { argv[0], "-i", NULL, "-s", NULL, "-u", NULL,
+                         "-f", fd_arg, NULL };
+        char arg_buf[3][24];
+        snprintf(arg_buf[0], sizeof(arg_buf[0]), "%lu", pulse_ticks);
+        snprintf(arg_buf[1], sizeof(arg_buf[1]), "%lu", second_ticks);
+        snprintf(arg_buf[2], sizeof(arg_buf[2]), "%lu", uart_ticks);
+        args[2] = arg_buf[0];
+        args[4] = arg_buf[1];
+        args[6] = arg_buf[2];
+        execv("/proc/self/exe", args);
+        perror("pty-adc-int-mca: execv");
+        return 1;
+      }
+      if (now == next_pulse) {
+        shim_int0_pulse(adc_value());
+        pulses++;
+        next_pulse += pulse_ticks;
+      }
+      if (now == next_second) {
+        shim_timer1_compare_a();
+        next_second += second_ticks;
+      }
+    }
+
+    moved += pty_write(master);
+    if (!moved && !pulse_ticks) {
+      /* nothing happening, do not burn the host CPU */
+      struct pollfd pfd = { master, POLLIN, 0 };
+      poll(&pfd, 1, 1);
+    }
+  }
+
+  print_stats(pulses);
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,667 @@
+/** \file firmware/host/shim.c
+ * \brief Simulated ATmega644 for running the firmware on the host
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup firmware_host_shim
+ * @{
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "checksum.h"
+#include "frame-defs.h"
+#include "shim.h"
+
+
+/** Default ticks without any activity after which the firmware is idle */
+#define IDLE_TICKS 256
+
+/** Ticks after which shim_run_until_idle() gives up */
+#define MAX_RUN_TICKS 100000000UL
+
+/** Stack size for the firmware coroutine */
+#define FIRMWARE_STACK_SIZE (256*1024)
+
+/** Maximum number of init functions */
+#define MAX_INIT_FUNCTIONS 32
+
+/** Size of the UART receive queue (power of 2) */
+#define RX_QUEUE_SIZE 4096
+
+/** UDR0 value meaning "no byte in the data register" */
+#define UDR_EMPTY 0xffff
+
+/** UDR0 flag for received bytes (written bytes are < 0x100) */
+#define UDR_RECEIVED 0x100
+
+
+/* The IO registers which are plain variables */
+
+volatile uint8_t GPIOR0;
+volatile uint8_t MCUSR;
+volatile uint8_t DDRB;
+volatile uint8_t PORTB;
+volatile uint8_t PINB;
+volatile uint8_t DDRD;
+volatile uint8_t PORTD;
+volatile uint8_t PIND;
+volatile uint8_t EICRA;
+volatile uint8_t EIMSK;
+volatile uint8_t EIFR;
+volatile uint8_t ADMUX;
+volatile uint8_t ADCSRA;
+volatile uint8_t ADCSRB;
+volatile uint16_t ADCW;
+volatile uint8_t TCCR1A;
+volatile uint8_t TCCR1B;
+volatile uint16_t TCNT1;
+volatile uint16_t OCR1A;
+volatile uint16_t OCR1B;
+volatile uint16_t ICR1;
+volatile uint8_t TIMSK1;
+volatile uint8_t TIFR1;
+volatile uint8_t UCSR0B;
+volatile uint8_t UCSR0C;
+volatile uint8_t UBRR0H;
+volatile uint8_t UBRR0L;
+
+
+/* The ISRs a personality may define */
+
+void INT0_vect(void) __attribute__((weak));
+void TIMER1_COMPA_vect(void) __attribute__((weak));
+void USART0_RX_vect(void) __attribute__((weak));
+void USART0_UDRE_vect(void) __attribute__((weak));
+void ADC_vect(void) __attribute__((weak));
+
+
+/** The firmware's main(), renamed by the GNUmakefile */
+int firmware_main(void);
+
+
+/** The EEMEM variables (see avr/eeprom.h) */
+extern uint8_t __start_shim_eeprom[] __attribute__((weak));
+extern uint8_t __stop_shim_eeprom[] __attribute__((weak));
+
+
+/** Registered init function */
+typedef struct {
+  const char *section;
+  void (*fun)(void);
+} init_function_t;
+
+static init_function_t init_functions[MAX_INIT_FUNCTIONS];
+static size_t init_function_count;
+
+
+/** What the firmware coroutine runs for */
+typedef enum {
+  RUN_UNTIL_IDLE,
+  RUN_TICKS
+} run_mode_t;
+
+
+/** State of the simulated MCU apart from the registers */
+static struct {
+  bool booted;
+  bool reset;
+  bool in_isr;
+
+  ucontext_t driver_ctx;
+  ucontext_t firmware_ctx;
+
+  run_mode_t run_mode;
+  unsigned long ticks_left;
+  unsigned long idle_ticks;
+  unsigned long idle_limit;
+  unsigned long run_ticks;
+  bool activity;
+
+  uint8_t sreg;
+  uint8_t ucsr0a;
+  unsigned long uart_ticks;
+  uint64_t tx_ready_tick;
+  uint16_t udr0;
+  bool udr0_accessed;
+
+  /** Interrupt flags as set by the hardware. The EIFR, TIFR1 and
+   *  ADCSRA variables only receive the firmware's flag clearing
+   *  writes. */
+  uint8_t eifr_flags;
+  uint8_t tifr1_flags;
+  bool adif;
+  uint16_t adc_input;
+
+  uint8_t rx_queue[RX_QUEUE_SIZE];
+  size_t rx_head;
+  size_t rx_tail;
+
+  uint8_t *tx_buf;
+  size_t tx_size;
+  size_t tx_alloc;
+  size_t tx_parsed;
+
+  shim_stats_t stats;
+} mcu;
+
+
+/* documented in shim.h */
+void shim_register_init_function(const char *section, void (*fun)(void))
+{
+  assert(init_function_count < MAX_INIT_FUNCTIONS);
+  init_functions[init_function_count].section = section;
+  init_functions[init_function_count].fun = fun;
+  init_function_count++;
+}
+
+
+/** Receive queue not empty? */
+static bool rx_pending(void)
+{
+  return mcu.rx_head != mcu.rx_tail;
+}
+
+
+/** Whether the UART can take the next byte to send */
+static bool tx_ready(void)
+{
+  return mcu.stats.ticks >= mcu.tx_ready_tick;
+}
+
+
+/** Deal with the firmware's last access to UDR0
+ *
+ * A value below #UDR_RECEIVED has been written by the firmware and
+ * is sent. If the received byte we have put there is still there,
+ * the firmware has read it. Either way, UDR0 then gets the next
+ * received byte, if any.
+ */
+static void uart_commit(void)
+{
+  if (mcu.udr0_accessed) {
+    mcu.udr0_accessed = false;
+    if (mcu.udr0 < UDR_RECEIVED) {
+      if (mcu.tx_size == mcu.tx_alloc) {
+        mcu.tx_alloc = mcu.tx_alloc ? 2*mcu.tx_alloc : 4096;
+        mcu.tx_buf = realloc(mcu.tx_buf, mcu.tx_alloc);
+        assert(mcu.tx_buf);
+      }
+      mcu.tx_buf[mcu.tx_size++] = mcu.udr0;
+      mcu.stats.tx_bytes++;
+      mcu.tx_ready_tick = mcu.stats.ticks + mcu.uart_ticks;
+    } else if (mcu.udr0 != UDR_EMPTY) {
+      mcu.rx_head++;
+      mcu.stats.rx_bytes++;
+    }
+    mcu.udr0 = UDR_EMPTY;
+    mcu.activity = true;
+  }
+  if ((mcu.udr0 == UDR_EMPTY) && rx_pending()) {
+    mcu.udr0 = UDR_RECEIVED | mcu.rx_queue[mcu.rx_head & (RX_QUEUE_SIZE-1)];
+  }
+}
+
+
+/* documented in shim.h */
+volatile uint16_t *shim_udr0(void)
+{
+  uart_commit();
+  mcu.udr0_accessed = true;
+  return &mcu.udr0;
+}
+
+
+/* documented in shim.h */
+volatile uint8_t *shim_ucsr0a(void)
+{
+  uart_commit();
+  mcu.ucsr0a &= ~(_BV(RXC0) | _BV(TXC0) | _BV(UDRE0));
+  if (tx_ready()) {
+    mcu.ucsr0a |= _BV(TXC0) | _BV(UDRE0);
+  }
+  if (rx_pending()) {
+    mcu.ucsr0a |= _BV(RXC0);
+  }
+  return &mcu.ucsr0a;
+}
+
+
+/** Apply the firmware's writes to the interrupt flag registers
+ *
+ * Writing a one to a flag clears it. Also finishes ADC conversions
+ * started by setting ADSC.
+ */
+static void apply_flag_writes(void)
+{
+  if (EIFR) {
+    mcu.eifr_flags &= ~EIFR;
+    EIFR = 0;
+  }
+  if (TIFR1) {
+    mcu.tifr1_flags &= ~TIFR1;
+    TIFR1 = 0;
+  }
+  if (ADCSRA & _BV(ADIF)) {
+    mcu.adif = false;
+    ADCSRA &= ~_BV(ADIF);
+  }
+  if ((ADCSRA & _BV(ADSC)) && (ADCSRA & _BV(ADEN))) {
+    ADCW = mcu.adc_input;
+    ADCSRA &= ~_BV(ADSC);
+    mcu.adif = true;
+  }
+}
+
+
+/** Call the ISR of the pending interrupt with the highest priority
+ *
+ * \return whether an ISR has been called
+ */
+static bool deliver_interrupt(void)
+{
+  void (*isr)(void);
+  if ((EIMSK & _BV(INT0)) && (mcu.eifr_flags & _BV(INTF0))) {
+    mcu.eifr_flags &= ~_BV(INTF0);
+    isr = INT0_vect;
+  } else if ((TIMSK1 & _BV(OCIE1A)) && (mcu.tifr1_flags & _BV(OCF1A))) {
+    mcu.tifr1_flags &= ~_BV(OCF1A);
+    isr = TIMER1_COMPA_vect;
+  } else if ((UCSR0B & _BV(RXCIE0)) && rx_pending()) {
+    isr = USART0_RX_vect;
+  } else if ((UCSR0B & _BV(UDRIE0)) && tx_ready()) {
+    isr = USART0_UDRE_vect;
+  } else if ((ADCSRA & _BV(ADIE)) && mcu.adif) {
+    mcu.adif = false;
+    isr = ADC_vect;
+  } else {
+    return false;
+  }
+  assert(isr);
+
+  uart_commit();
+  mcu.in_isr = true;
+  mcu.sreg &= ~_BV(SREG_I);
+  isr();
+  mcu.sreg |= _BV(SREG_I);
+  mcu.in_isr = false;
+  uart_commit();
+  apply_flag_writes();
+
+  mcu.stats.isr_calls++;
+  mcu.activity = true;
+  return true;
+}
+
+
+/** Switch from the firmware back to the test driver */
+static void yield(void)
+{
+  swapcontext(&mcu.firmware_ctx, &mcu.driver_ctx);
+}
+
+
+/* documented in shim.h */
+void shim_tick(void)
+{
+  mcu.stats.ticks++;
+  apply_flag_writes();
+  if (mcu.in_isr) {
+    return;
+  }
+  if (mcu.sreg & _BV(SREG_I)) {
+    deliver_interrupt();
+  }
+
+  switch (mcu.run_mode) {
+  case RUN_UNTIL_IDLE:
+    if (mcu.activity || !tx_ready()) {
+      mcu.activity = false;
+      mcu.idle_ticks = 0;
+    } else if (++mcu.idle_ticks >= mcu.idle_limit) {
+      yield();
+      return;
+    }
+    if (++mcu.run_ticks >= MAX_RUN_TICKS) {
+      fprintf(stderr, "shim: firmware does not become idle\n");
+      abort();
+    }
+    break;
+  case RUN_TICKS:
+    if (--mcu.ticks_left == 0) {
+      yield();
+    }
+    break;
+  }
+}
+
+
+/* documented in shim.h */
+volatile uint8_t *shim_sreg(void)
+{
+  shim_tick();
+  return &mcu.sreg;
+}
+
+
+/* documented in shim.h */
+void shim_cli(void)
+{
+  mcu.sreg &= ~_BV(SREG_I);
+}
+
+
+/* documented in shim.h */
+void shim_sei(void)
+{
+  mcu.sreg |= _BV(SREG_I);
+}
+
+
+/* documented in shim.h */
+void shim_wdt_enable(const uint8_t timeout __attribute__((unused)))
+{
+  mcu.reset = true;
+  yield();
+  fprintf(stderr, "shim: firmware resumed after reset\n");
+  abort();
+}
+
+
+/** Sort the init functions by section, keeping the link order within
+ *  a section like the linker does */
+static void sort_init_functions(void)
+{
+  for (size_t i=1; i<init_function_count; i++) {
+    const init_function_t f = init_functions[i];
+    size_t j = i;
+    while ((j > 0) &&
+           (strcmp(init_functions[j-1].section, f.section) > 0)) {
+      init_functions[j] = init_functions[j-1];
+      j--;
+    }
+    init_functions[j] = f;
+  }
+}
+
+
+/** Entry point of the firmware coroutine */
+static void firmware_entry(void)
+{
+  for (size_t i=0; i<init_function_count; i++) {
+    init_functions[i].fun();
+  }
+  firmware_main();
+  fprintf(stderr, "shim: firmware main() has returned\n");
+  abort();
+}
+
+
+/** Resume the firmware coroutine until it yields */
+static void resume(void)
+{
+  assert(mcu.booted);
+  assert(!mcu.reset);
+  swapcontext(&mcu.driver_ctx, &mcu.firmware_ctx);
+}
+
+
+/* documented in shim.h */
+void shim_boot(void)
+{
+  assert(!mcu.booted);
+  mcu.booted = true;
+
+  /* pull-ups keep the switch and INT0 pins high */
+  PINB = 0xff;
+  PIND = 0xff;
+  mcu.udr0 = UDR_EMPTY;
+  if (!mcu.idle_limit) {
+    mcu.idle_limit = IDLE_TICKS;
+  }
+  if (__start_shim_eeprom) {
+    memset(__start_shim_eeprom, 0xff,
+           __stop_shim_eeprom - __start_shim_eeprom);
+  }
+
+  sort_init_functions();
+
+  getcontext(&mcu.firmware_ctx);
+  mcu.firmware_ctx.uc_stack.ss_sp = malloc(FIRMWARE_STACK_SIZE);
+  assert(mcu.firmware_ctx.uc_stack.ss_sp);
+  mcu.firmware_ctx.uc_stack.ss_size = FIRMWARE_STACK_SIZE;
+  mcu.firmware_ctx.uc_link = NULL;
+  makecontext(&mcu.firmware_ctx, firmware_entry, 0);
+
+  shim_run_until_idle();
+}
+
+
+/* documented in shim.h */
+void shim_run_until_idle(void)
+{
+  mcu.run_mode = RUN_UNTIL_IDLE;
+  mcu.idle_ticks = 0;
+  mcu.run_ticks = 0;
+  mcu.activity = false;
+  resume();
+}
+
+
+/* documented in shim.h */
+void shim_run_ticks(const unsigned long ticks)
+{
+  if (ticks == 0) {
+    return;
+  }
+  mcu.run_mode = RUN_TICKS;
+  mcu.ticks_left = ticks;
+  resume();
+}
+
+
+/* documented in shim.h */
+bool shim_reset_requested(void)
+{
+  return mcu.reset;
+}
+
+
+/* documented in shim.h */
+const shim_stats_t *shim_stats(void)
+{
+  return &mcu.stats;
+}
+
+
+/* documented in shim.h */
+void shim_set_idle_ticks(const unsigned long ticks)
+{
+  mcu.idle_limit = ticks;
+}
+
+
+/* documented in shim.h */
+void shim_set_uart_ticks(const unsigned long ticks)
+{
+  mcu.uart_ticks = ticks;
+}
+
+
+/* documented in shim.h */
+size_t shim_uart_space(void)
+{
+  return RX_QUEUE_SIZE - (mcu.rx_tail - mcu.rx_head);
+}
+
+
+/* documented in shim.h */
+void shim_uart_send(const void *buf, const size_t len)
+{
+  assert(len <= shim_uart_space());
+  const uint8_t *b = buf;
+  for (size_t i=0; i<len; i++) {
+    mcu.rx_queue[mcu.rx_tail++ & (RX_QUEUE_SIZE-1)] = b[i];
+  }
+}
+
+
+/* documented in shim.h */
+void shim_send_command(const uint8_t cmd,
+                       const void *params, const uint8_t length,
+                       const uint8_t checksum_delta)
+{
+  uint8_t buf[4 + 2 + 256 + 1];
+  size_t i = 0;
+  memcpy(&buf[i], FRAME_MAGIC_STR, 4);
+  i += 4;
+  buf[i++] = cmd;
+  buf[i++] = length;
+  if (length) {
+    memcpy(&buf[i], params, length);
+    i += length;
+  }
+  const checksum_accu_t accu =
+    checksum_update_block(checksum_reset(), buf, i);
+  buf[i++] = (accu & 0xff) + checksum_delta;
+  shim_uart_send(buf, i);
+}
+
+
+/* documented in shim.h */
+bool shim_uart_recv_frame(shim_frame_t *frame)
+{
+  const uint8_t *buf = &mcu.tx_buf[mcu.tx_parsed];
+  const size_t avail = mcu.tx_size - mcu.tx_parsed;
+  if (avail < 4 + 2 + 1) {
+    return false;
+  }
+  if (memcmp(buf, FRAME_MAGIC_STR, 4)) {
+    fprintf(stderr, "shim: no frame magic at byte %zu\n", mcu.tx_parsed);
+    abort();
+  }
+  const uint16_t size = buf[4] | (buf[5] << 8);
+  if (avail < 4 + 2 + 1 + size + 1u) {
+    return false;
+  }
+  const checksum_accu_t accu =
+    checksum_update_block(checksum_reset(), buf, 4 + 2 + 1 + size);
+  if (!checksum_matches(accu, buf[4 + 2 + 1 + size])) {
+    fprintf(stderr, "shim: checksum mismatch in '%c' frame\n", buf[6]);
+    abort();
+  }
+  frame->type = buf[6];
+  frame->size = size;
+  frame->payload = &buf[7];
+  mcu.tx_parsed += 4 + 2 + 1 + size + 1;
+  return true;
+}
+
+
+/* documented in shim.h */
+size_t shim_uart_recv(void *buf, const size_t size)
+{
+  size_t len = mcu.tx_size - mcu.tx_parsed;
+  if (len > size) {
+    len = size;
+  }
+  if (len) {
+    memcpy(buf, &mcu.tx_buf[mcu.tx_parsed], len);
+    mcu.tx_parsed += len;
+  }
+  if (mcu.tx_parsed == mcu.tx_size) {
+    mcu.tx_parsed = 0;
+    mcu.tx_size = 0;
+  }
+  return len;
+}
+
+
+/* documented in shim.h */
+size_t shim_uart_pending(void)
+{
+  return mcu.tx_size - mcu.tx_parsed;
+}
+
+
+/* documented in shim.h */
+void shim_int0_pulse(const uint16_t adc_value)
+{
+  apply_flag_writes();
+  if (mcu.eifr_flags & _BV(INTF0)) {
+    mcu.stats.lost_triggers++;
+    return;
+  }
+  mcu.eifr_flags |= _BV(INTF0);
+  mcu.adc_input = adc_value;
+  /* auto trigger source "external interrupt request 0" */
+  if ((ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADATE)) &&
+      ((ADCSRB & (_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0))) == _BV(ADTS1))) {
+    ADCW = adc_value;
+    mcu.adif = true;
+  }
+}
+
+
+/* documented in shim.h */
+void shim_timer1_compare_a(void)
+{
+  if (TCCR1B & (_BV(CS12) | _BV(CS11) | _BV(CS10))) {
+    mcu.tifr1_flags |= _BV(OCF1A);
+  }
+}
+
+
+/* documented in shim.h */
+bool shim_run_test(const char *name, void (*test)(void))
+{
+  fflush(stdout);
+  fflush(stderr);
+  const pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    test();
+    exit(0);
+  }
+  int status;
+  const pid_t w = waitpid(pid, &status, 0);
+  assert(w == pid);
+  const bool ok = WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+  printf("%s: %s\n", ok ? "PASS" : "FAIL", name);
+  return ok;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
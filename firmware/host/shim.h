@@ -0,0 +1,228 @@
+/** \file firmware/host/shim.h
+ * \brief Simulated ATmega644 for running the firmware on the host
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup firmware_host_shim Host Shim
+ * \ingroup firmware
+ *
+ * The shim lets the unchanged firmware sources run on the host. The
+ * avr/ and util/ headers next to this file replace the avr-libc ones:
+ * IO registers become variables, ISR() defines a plain function, and
+ * cli()/sei() and the ATOMIC_BLOCK() macros work on a simulated SREG.
+ *
+ * The firmware runs as a coroutine of the test driver, in a single
+ * thread, so everything is deterministic. Every time the firmware
+ * reads SREG (which the main loop and all UART wait loops do), the
+ * shim "ticks":
+ *
+ *   - It applies the flag clearing writes to EIFR, TIFR1 and ADCSRA.
+ *   - If interrupts are enabled, it calls the ISR of one pending
+ *     interrupt, with interrupts disabled for the duration.
+ *   - It may switch back to the test driver.
+ *
+ * The UART receives infinitely fast, and sends infinitely fast
+ * unless shim_set_uart_ticks() says otherwise: Bytes the host sends
+ * are waiting in a receive queue, and bytes the firmware writes to
+ * UDR0 are captured in a transmit buffer for the test driver to
+ * parse with shim_uart_recv_frame() or pass on with shim_uart_recv().
+ *
+ * A watchdog reset ends the firmware coroutine. As there is no way to
+ * reset the firmware's global variables, every simulated power-up
+ * needs a fresh process. shim_run_test() forks one for each test.
+ *
+ * @{
+ */
+
+#ifndef SHIM_H
+#define SHIM_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** Frame received from the firmware */
+typedef struct {
+  /** Frame type (frame_type_t) */
+  uint8_t type;
+  /** Payload size in bytes */
+  uint16_t size;
+  /** Payload, valid until the next shim_uart_recv_frame() call */
+  const uint8_t *payload;
+} shim_frame_t;
+
+
+/** Simulated MCU statistics */
+typedef struct {
+  /** Number of ticks, i.e. of SREG reads by the firmware */
+  uint64_t ticks;
+  /** Number of ISR calls */
+  uint64_t isr_calls;
+  /** Number of bytes sent by the firmware */
+  uint64_t tx_bytes;
+  /** Number of bytes the firmware has read from UDR0 */
+  uint64_t rx_bytes;
+  /** Number of external triggers lost because INTF0 was still set */
+  uint64_t lost_triggers;
+} shim_stats_t;
+
+
+/** Register an init function (called via INIT_FUNCTION()) */
+void shim_register_init_function(const char *section, void (*fun)(void))
+  __attribute__((nonnull(1,2)));
+
+
+/** Power up the simulated MCU, run the init functions and main()
+ *
+ * Runs the firmware until it is idle (see shim_run_until_idle()).
+ */
+void shim_boot(void);
+
+
+/** Run the firmware until it is idle
+ *
+ * The firmware is idle when it has neither received nor sent a byte
+ * and no ISR has been called for a few hundred ticks (see
+ * shim_set_idle_ticks()). Aborts if that does not happen for a very
+ * long time.
+ */
+void shim_run_until_idle(void);
+
+
+/** Set the number of ticks without activity which make the firmware idle
+ *
+ * The default of a few hundred ticks is too short for firmware which
+ * polls the UART while it works through the value table with
+ * interrupts disabled: That looks just like the idle main loop.
+ */
+void shim_set_idle_ticks(const unsigned long ticks);
+
+
+/** Run the firmware for the given number of ticks */
+void shim_run_ticks(const unsigned long ticks);
+
+
+/** Whether the firmware has triggered a watchdog reset */
+bool shim_reset_requested(void);
+
+
+/** Simulated MCU statistics since shim_boot() */
+const shim_stats_t *shim_stats(void);
+
+
+/** Set the time the UART takes to send a byte
+ *
+ * The default of 0 ticks makes the UART infinitely fast. With more,
+ * the UDRE interrupt leaves ticks for the other interrupts while the
+ * firmware is sending, like a real UART would.
+ */
+void shim_set_uart_ticks(const unsigned long ticks);
+
+
+/** Number of bytes the receive queue can take */
+size_t shim_uart_space(void);
+
+
+/** Have the host send bytes to the firmware */
+void shim_uart_send(const void *buf, const size_t len)
+  __attribute__((nonnull(1)));
+
+
+/** Have the host send a command frame to the firmware
+ *
+ * \param cmd The command (frame_cmd_t)
+ * \param params The parameter bytes (may be NULL if length is 0)
+ * \param length The number of parameter bytes
+ * \param checksum_delta Added to the proper checksum, for sending
+ *                       broken frames
+ */
+void shim_send_command(const uint8_t cmd,
+                       const void *params, const uint8_t length,
+                       const uint8_t checksum_delta);
+
+
+/** Get the next frame the firmware has sent
+ *
+ * Aborts if the bytes sent by the firmware do not form a proper frame
+ * with a matching checksum.
+ *
+ * \return false if the firmware has not sent another frame
+ */
+bool shim_uart_recv_frame(shim_frame_t *frame)
+  __attribute__((nonnull(1)));
+
+
+/** Get the bytes the firmware has sent, without parsing them
+ *
+ * \return the number of bytes copied to buf
+ */
+size_t shim_uart_recv(void *buf, const size_t size)
+  __attribute__((nonnull(1)));
+
+
+/** Number of bytes sent by the firmware and not yet parsed */
+size_t shim_uart_pending(void);
+
+
+/** Feed a pulse into the INT0 pin
+ *
+ * Sets INTF0, which may auto trigger an ADC conversion. While INTF0
+ * is still set from the last pulse, the pulse is lost.
+ *
+ * \param adc_value The value the ADC will measure
+ */
+void shim_int0_pulse(const uint16_t adc_value);
+
+
+/** Let timer1 reach its output compare value A */
+void shim_timer1_compare_a(void);
+
+
+/** Run the test function in a fresh process
+ *
+ * \return true if the test function returned, false if it failed
+ */
+bool shim_run_test(const char *name, void (*test)(void))
+  __attribute__((nonnull(1,2)));
+
+
+/* Functions called from the replacement avr/ and util/ headers */
+
+void shim_tick(void);
+volatile uint8_t *shim_sreg(void);
+volatile uint8_t *shim_ucsr0a(void);
+volatile uint16_t *shim_udr0(void);
+void shim_cli(void);
+void shim_sei(void);
+void shim_wdt_enable(const uint8_t timeout)
+  __attribute__((noreturn));
+
+
+/** @} */
+
+#endif /* !SHIM_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
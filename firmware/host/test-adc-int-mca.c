@@ -0,0 +1,511 @@
+/** \file firmware/host/test-adc-int-mca.c
+ * \brief Protocol conformance tests for the adc-int-mca firmware
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Runs the unchanged firmware sources on the simulated MCU from
+ * shim.c, sends command frames as the hostware would, and checks the
+ * frames the firmware sends back against the communication protocol.
+ * Each test starts from a freshly powered up device.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "frame-defs.h"
+#include "packet-defs.h"
+#include "shim.h"
+
+
+/** Histogram size of the adc-int-mca personality */
+#define ELEMENT_COUNT 1024
+
+/** Bytes per histogram element */
+#define ELEMENT_SIZE 3
+
+
+/** Timer count parameter for starting a measurement */
+static const uint8_t timer_3[] = { 3, 0 };
+
+
+static shim_frame_t expect_frame(const uint8_t type)
+{
+  shim_frame_t frame;
+  assert(shim_uart_recv_frame(&frame));
+  if (frame.type != type) {
+    fprintf(stderr, "expected '%c' frame, got '%c' frame\n",
+            type, frame.type);
+    assert(frame.type == type);
+  }
+  return frame;
+}
+
+
+static void expect_string(const uint8_t type, const char *str)
+{
+  const shim_frame_t frame = expect_frame(type);
+  if ((frame.size != strlen(str)) ||
+      memcmp(frame.payload, str, frame.size)) {
+    fprintf(stderr, "expected '%c' frame \"%s\", got \"%.*s\"\n",
+            type, str, (int)frame.size, frame.payload);
+    assert(0);
+  }
+}
+
+
+static void expect_state(const char *state)
+{
+  expect_string(FRAME_TYPE_STATE, state);
+}
+
+
+static void expect_text(const char *text)
+{
+  expect_string(FRAME_TYPE_TEXT, text);
+}
+
+
+static void expect_nothing(void)
+{
+  assert(shim_uart_pending() == 0);
+}
+
+
+static void command(const uint8_t cmd, const void *params, const uint8_t length)
+{
+  shim_send_command(cmd, params, length, 0);
+  shim_run_until_idle();
+}
+
+
+/** Whether the last value table from expect_value_table() was compressed */
+static bool table_compressed;
+
+
+/** Read varint from compressed value table data */
+static uint64_t get_varint(const uint8_t *data, const size_t size, size_t *ofs)
+{
+  uint64_t value = 0;
+  for (unsigned int shift=0; ; shift+=7) {
+    assert(*ofs < size);
+    assert(shift < 64);
+    const uint8_t byte = data[(*ofs)++];
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+}
+
+
+/** Decompress value table data, see \ref packet_value_table_compressed */
+static const uint8_t *decompress_table(const uint8_t *data, const size_t size)
+{
+  static uint8_t table[ELEMENT_COUNT*ELEMENT_SIZE];
+  size_t ofs = 0;
+  assert(get_varint(data, size, &ofs) == ELEMENT_COUNT);
+  size_t i = 0;
+  while (ofs < size) {
+    const uint64_t token = get_varint(data, size, &ofs);
+    if (token & 1) {
+      const size_t zeros = (token >> 1) + 1;
+      assert(zeros <= ELEMENT_COUNT - i);
+      memset(&table[i*ELEMENT_SIZE], 0, zeros*ELEMENT_SIZE);
+      i += zeros;
+    } else {
+      const uint64_t value = token >> 1;
+      assert(value < (1UL << (8*ELEMENT_SIZE)));
+      assert(i < ELEMENT_COUNT);
+      for (size_t b=0; b<ELEMENT_SIZE; b++) {
+        table[i*ELEMENT_SIZE + b] = (value >> (8*b)) & 0xff;
+      }
+      i++;
+    }
+  }
+  assert(i == ELEMENT_COUNT);
+  return table;
+}
+
+
+/** Check a value table packet and return its value table
+ *
+ * Decompresses the value table if the firmware has been built with
+ * compressed final value tables.
+ */
+static const uint8_t *expect_value_table(const uint8_t reason,
+                                         const uint16_t duration)
+{
+  const shim_frame_t frame = expect_frame(FRAME_TYPE_VALUE_TABLE);
+  packet_value_table_header_t header;
+  /* the C ISR(ADC_vect) reports no dead time, so no extended header */
+  const size_t data_ofs = sizeof(header) + sizeof(timer_3);
+  assert(frame.size >= data_ofs);
+  memcpy(&header, frame.payload, sizeof(header));
+  table_compressed = header.bits_per_value & PACKET_VALUE_TABLE_COMPRESSED;
+  assert((header.bits_per_value & ~PACKET_VALUE_TABLE_COMPRESSED) == 24);
+  assert(header.reason == reason);
+  assert(header.type == VALUE_TABLE_TYPE_HISTOGRAM);
+  assert(header.duration == duration);
+  assert(header.param_buf_length == sizeof(timer_3));
+  assert(!memcmp(&frame.payload[sizeof(header)], timer_3, sizeof(timer_3)));
+  if (table_compressed) {
+    /* the ISR changes intermediate tables while they are sent */
+    assert(reason != PACKET_VALUE_TABLE_INTERMEDIATE);
+    return decompress_table(&frame.payload[data_ofs], frame.size - data_ofs);
+  }
+  assert(frame.size == data_ofs + ELEMENT_COUNT*ELEMENT_SIZE);
+  return &frame.payload[data_ofs];
+}
+
+
+static uint32_t element(const uint8_t *table, const size_t index)
+{
+  const uint8_t *e = &table[index * ELEMENT_SIZE];
+  return e[0] | (e[1] << 8) | ((uint32_t)e[2] << 16);
+}
+
+
+static void start_measurement(void)
+{
+  command(FRAME_CMD_MEASURE, timer_3, sizeof(timer_3));
+  expect_state("MEASURING");
+  expect_nothing();
+}
+
+
+static void pulse(const uint16_t adc_value)
+{
+  shim_int0_pulse(adc_value);
+  shim_run_until_idle();
+}
+
+
+static void test_boot(void)
+{
+  shim_boot();
+  const shim_frame_t text = expect_frame(FRAME_TYPE_TEXT);
+  assert(text.size >= strlen("freemcan "));
+  assert(!memcmp(text.payload, "freemcan ", strlen("freemcan ")));
+  const shim_frame_t frame = expect_frame(FRAME_TYPE_PERSONALITY_INFO);
+  packet_personality_info_t info;
+  assert(frame.size == sizeof(info) + strlen("adc-int-mca"));
+  memcpy(&info, frame.payload, sizeof(info));
+  assert(info.sizeof_table == ELEMENT_COUNT*ELEMENT_SIZE);
+  assert(info.bits_per_value == 24);
+  assert(info.param_data_size_timer_count == 2);
+  assert(!memcmp(&frame.payload[sizeof(info)], "adc-int-mca",
+                 strlen("adc-int-mca")));
+  expect_state("READY");
+  expect_nothing();
+}
+
+
+static void test_ready_commands(void)
+{
+  test_boot();
+  command(FRAME_CMD_STATE, NULL, 0);
+  expect_state("READY");
+  command(FRAME_CMD_PERSONALITY_INFO, NULL, 0);
+  expect_frame(FRAME_TYPE_PERSONALITY_INFO);
+  expect_state("READY");
+  command(FRAME_CMD_ABORT, NULL, 0);
+  expect_state("READY");
+  expect_nothing();
+}
+
+
+static void test_broken_frames(void)
+{
+  test_boot();
+  shim_send_command(FRAME_CMD_STATE, NULL, 0, 1);
+  shim_run_until_idle();
+  expect_text("checksum fail");
+  expect_nothing();
+
+  /* the parameter and checksum bytes are skipped as garbage */
+  command(FRAME_CMD_MEASURE, timer_3, 1);
+  expect_text("param length mismatch");
+  expect_nothing();
+
+  /* garbage before the next proper frame */
+  shim_uart_send("FMx", 3);
+  command(FRAME_CMD_STATE, NULL, 0);
+  expect_state("READY");
+  expect_nothing();
+}
+
+
+static void test_command_queue(void)
+{
+  test_boot();
+  /* all commands arrive before the main loop handles the first */
+  shim_send_command(FRAME_CMD_STATE, NULL, 0, 0);
+  shim_send_command(FRAME_CMD_STATE, NULL, 0, 0);
+  shim_send_command(FRAME_CMD_ABORT, NULL, 0, 0);
+  shim_run_until_idle();
+  expect_state("READY");
+  expect_state("READY");
+  expect_state("READY");
+  expect_nothing();
+}
+
+
+static void test_eeprom_params(void)
+{
+  test_boot();
+  command(FRAME_CMD_PARAMS_FROM_EEPROM, NULL, 0);
+  expect_text("Invalid EEPROM data");
+  expect_state("READY");
+
+  command(FRAME_CMD_PARAMS_TO_EEPROM, timer_3, sizeof(timer_3));
+  expect_state("PARAMS_TO_EEPROM");
+  expect_state("READY");
+
+  command(FRAME_CMD_PARAMS_FROM_EEPROM, NULL, 0);
+  const shim_frame_t frame = expect_frame(FRAME_TYPE_PARAMS_FROM_EEPROM);
+  assert(frame.size == sizeof(timer_3));
+  assert(!memcmp(frame.payload, timer_3, sizeof(timer_3)));
+  expect_state("READY");
+  expect_nothing();
+}
+
+
+static void test_measurement(void)
+{
+  test_boot();
+  start_measurement();
+
+  pulse(0);
+  pulse(1023);
+  pulse(1023);
+  pulse(500);
+  assert(shim_stats()->lost_triggers == 0);
+
+  /* the second pulse comes before the ISR has cleared INTF0 */
+  shim_int0_pulse(500);
+  shim_int0_pulse(500);
+  shim_run_until_idle();
+  assert(shim_stats()->lost_triggers == 1);
+
+  command(FRAME_CMD_INTERMEDIATE, NULL, 0);
+  const uint8_t *table =
+    expect_value_table(PACKET_VALUE_TABLE_INTERMEDIATE, 0);
+  uint32_t total = 0;
+  for (size_t i=0; i<ELEMENT_COUNT; i++) {
+    total += element(table, i);
+  }
+  /* adc_int_init() leaves ADIF set after its dummy conversion, so
+   * the ISR counts that (value 0 here) as soon as ADIE is set */
+  assert(total == 6);
+  assert(element(table, 0) == 2);
+  assert(element(table, 500) == 2);
+  assert(element(table, 1023) == 2);
+  expect_state("MEASURING");
+
+  /* commands which do not apply while measuring */
+  command(FRAME_CMD_MEASURE, timer_3, sizeof(timer_3));
+  expect_state("MEASURING");
+  command(FRAME_CMD_RESET, NULL, 0);
+  expect_state("MEASURING");
+  assert(!shim_reset_requested());
+
+  /* two seconds pass */
+  shim_timer1_compare_a();
+  shim_run_until_idle();
+  shim_timer1_compare_a();
+  shim_run_until_idle();
+  expect_nothing();
+  command(FRAME_CMD_INTERMEDIATE, NULL, 0);
+  expect_value_table(PACKET_VALUE_TABLE_INTERMEDIATE, 2);
+  expect_state("MEASURING");
+
+  /* the last second ends the measurement with interrupts disabled */
+  shim_timer1_compare_a();
+  shim_run_until_idle();
+  table = expect_value_table(PACKET_VALUE_TABLE_DONE, 3);
+  assert(element(table, 1023) == 2);
+  expect_nothing();
+
+  /* so the main loop polls for commands */
+  pulse(42);
+  command(FRAME_CMD_STATE, NULL, 0);
+  expect_state("DONE");
+  command(FRAME_CMD_INTERMEDIATE, NULL, 0);
+  table = expect_value_table(PACKET_VALUE_TABLE_RESEND, 3);
+  assert(element(table, 42) == 0);
+  expect_state("DONE");
+
+  command(FRAME_CMD_RESET, NULL, 0);
+  expect_state("RESET");
+  expect_nothing();
+  assert(shim_reset_requested());
+}
+
+
+/** Check a delta value table packet, return the number of runs */
+static size_t expect_delta(const uint8_t base_seq, const uint8_t seq,
+                           uint8_t *first_block)
+{
+  const shim_frame_t frame = expect_frame(FRAME_TYPE_VALUE_TABLE_DELTA);
+  const size_t ofs = sizeof(packet_value_table_header_t) + sizeof(timer_3);
+  packet_value_table_delta_header_t delta_header;
+  memcpy(&delta_header, &frame.payload[ofs], sizeof(delta_header));
+  assert(delta_header.base_seq == base_seq);
+  assert(delta_header.seq == seq);
+  assert(delta_header.element_count == ELEMENT_COUNT);
+
+  const size_t block_bytes = PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE*ELEMENT_SIZE;
+  size_t runs = 0;
+  for (size_t i=ofs+sizeof(delta_header); i<frame.size; runs++) {
+    if (runs == 0) {
+      *first_block = frame.payload[i];
+    }
+    const uint8_t count = frame.payload[i+1];
+    assert(count > 0);
+    i += 2 + count*block_bytes;
+    assert(i <= frame.size);
+  }
+  return runs;
+}
+
+
+static void test_delta(void)
+{
+  test_boot();
+  start_measurement();
+  uint8_t first_block = 0xff;
+
+  /* the first delta value table has all blocks */
+  command(FRAME_CMD_INTERMEDIATE_DELTA, "\0", 1);
+  assert(expect_delta(0, 1, &first_block) == 1);
+  assert(first_block == 0);
+  expect_state("MEASURING");
+
+  /* nothing has changed since the acknowledged table */
+  command(FRAME_CMD_INTERMEDIATE_DELTA, "\1", 1);
+  assert(expect_delta(1, 2, &first_block) == 0);
+  expect_state("MEASURING");
+
+  pulse(100);
+  command(FRAME_CMD_INTERMEDIATE_DELTA, "\2", 1);
+  assert(expect_delta(2, 3, &first_block) == 1);
+  assert(first_block == 100 / PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE);
+  expect_state("MEASURING");
+
+  /* table 3 got lost, so block 6 is sent again */
+  pulse(1000);
+  command(FRAME_CMD_INTERMEDIATE_DELTA, "\2", 1);
+  assert(expect_delta(2, 4, &first_block) == 2);
+  assert(first_block == 100 / PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE);
+  expect_state("MEASURING");
+  expect_nothing();
+}
+
+
+static void test_abort(void)
+{
+  test_boot();
+  start_measurement();
+  pulse(7);
+  command(FRAME_CMD_ABORT, NULL, 0);
+  expect_state("DONE");
+  const uint8_t *table =
+    expect_value_table(PACKET_VALUE_TABLE_ABORTED, 0);
+  assert(element(table, 7) == 1);
+  expect_state("DONE");
+  expect_nothing();
+}
+
+
+static void test_command_during_send_table(void)
+{
+  test_boot();
+  start_measurement();
+  pulse(42);
+  for (int i=0; i<3; i++) {
+    shim_timer1_compare_a();
+    shim_run_until_idle();
+  }
+  expect_value_table(PACKET_VALUE_TABLE_DONE, 3);
+  expect_nothing();
+
+  /* the second command arrives while the firmware, with interrupts
+   * disabled, works on the value table for the first */
+  shim_send_command(FRAME_CMD_INTERMEDIATE, NULL, 0, 0);
+  shim_send_command(FRAME_CMD_STATE, NULL, 0, 0);
+  const uint64_t rx_bytes = shim_stats()->rx_bytes + 2*(4+2+1);
+  while (shim_uart_pending() == 0) {
+    shim_run_ticks(1);
+  }
+  const uint64_t rx_bytes_before_table = shim_stats()->rx_bytes;
+  shim_run_until_idle();
+
+  const uint8_t *table = expect_value_table(PACKET_VALUE_TABLE_RESEND, 3);
+  assert(element(table, 42) == 1);
+  if (table_compressed) {
+    /* sizing the compressed table must not keep the receiver waiting */
+    assert(rx_bytes_before_table == rx_bytes);
+  }
+  expect_state("DONE");
+  expect_state("DONE");
+  expect_nothing();
+  assert(shim_stats()->rx_bytes == rx_bytes);
+}
+
+
+static void test_timer_value_1(void)
+{
+  test_boot();
+  command(FRAME_CMD_MEASURE, "\1\0", 2);
+  expect_text("Unsupported timer value <= 1");
+  expect_nothing();
+  assert(shim_reset_requested());
+}
+
+
+int main(void)
+{
+  /* sizing a compressed value table polls the UART once per element */
+  shim_set_idle_ticks(2*ELEMENT_COUNT);
+
+  int failed = 0;
+  failed += !shim_run_test("boot", test_boot);
+  failed += !shim_run_test("ready commands", test_ready_commands);
+  failed += !shim_run_test("broken frames", test_broken_frames);
+  failed += !shim_run_test("command queue", test_command_queue);
+  failed += !shim_run_test("eeprom params", test_eeprom_params);
+  failed += !shim_run_test("measurement", test_measurement);
+  failed += !shim_run_test("delta value tables", test_delta);
+  failed += !shim_run_test("abort", test_abort);
+  failed += !shim_run_test("command during send_table",
+                           test_command_during_send_table);
+  failed += !shim_run_test("timer value 1", test_timer_value_1);
+  return failed ? 1 : 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,65 @@
+/** \file firmware/host/util/atomic.h
+ * \brief Host shim for <util/atomic.h>
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Only ATOMIC_BLOCK(ATOMIC_RESTORESTATE) is supported.
+ *
+ * \addtogroup firmware_host_shim
+ * @{
+ */
+
+#ifndef SHIM_UTIL_ATOMIC_H
+#define SHIM_UTIL_ATOMIC_H
+
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+
+/** Re-enable interrupts at the end of the block if they were enabled */
+static inline
+void shim_atomic_restore(const uint8_t *sreg_save)
+{
+  if (*sreg_save & _BV(SREG_I)) {
+    sei();
+  }
+}
+
+
+#define ATOMIC_RESTORESTATE
+
+#define ATOMIC_BLOCK(type)                                              \
+  for (uint8_t sreg_save __attribute__((cleanup(shim_atomic_restore))) \
+         = SREG, shim_todo = (cli(), 1);                                \
+       shim_todo; shim_todo = 0)
+
+
+/** @} */
+
+#endif /* !SHIM_UTIL_ATOMIC_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
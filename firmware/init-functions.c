@@ -40,7 +40,8 @@
 #include "init-functions.h"
 
 
-/* No implementation code needed for AVR */
+/* No implementation code needed for AVR. Host builds register the
+ * functions with the shim, see host/shim.c. */
 
 
 /** @} */
@@ -45,13 +45,28 @@
  *     }
  * \endcode
  *
+ * For host builds (see host/shim.h), the function is registered with
+ * the shim instead, which runs it on every simulated reset.
  */
+#ifdef __AVR__
 #define INIT_FUNCTION(SECTION, FUN_NAME)	\
   static void FUN_NAME(void)			\
        __attribute__ ((naked))			\
        __attribute__ ((used))			\
        __attribute__ ((section("." #SECTION))); \
   static void FUN_NAME(void)
+#else
+void shim_register_init_function(const char *section, void (*fun)(void));
+#define INIT_FUNCTION(SECTION, FUN_NAME)                        \
+  static void FUN_NAME(void);                                   \
+  static void FUN_NAME ## _register(void)                       \
+       __attribute__ ((constructor));                           \
+  static void FUN_NAME ## _register(void)                       \
+  {                                                             \
+    shim_register_init_function(#SECTION, FUN_NAME);            \
+  }                                                             \
+  static void FUN_NAME(void)
+#endif
 
 
 #endif /* !INIT_FUNCTIONS_H */
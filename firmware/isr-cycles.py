@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Count the CPU cycles of ISR(ADC_vect) in avr-objdump listings
+
+Usage: isr-cycles.py [--vector SYMBOL] LISTING...
+
+Reads the disassembly of the ADC interrupt vector (__vector_24 on the
+ATmega644 and ATmega644P) from each LISTING, i.e. avr-objdump -d or
+-S output like firmware-adc-int-mca.lss, and prints the cycle at
+which the ISR discharges the peak hold capacitor, releases it again,
+and clears INTF0 (which is what ADC_ISR_DEAD_CYCLES in
+perso-adc-int-mca-ext-trig.c counts), and the total.
+
+"make isr-cycles" builds the adc-int-mca firmware with the C and with
+the assembly language ISR(ADC_vect) and compares the two.
+
+These are STATIC counts: Every instruction is counted once, in
+listing order. Conditional branches are counted as not taken, skip
+instructions as not skipping, and calls without the called function.
+The counts are flagged if the ISR contains any of those. Until a
+simulator run measures the ISRs, treat the numbers as what the code
+would take on a straight path, not as measurements.
+"""
+
+import re
+import sys
+
+
+# Interrupt response plus the jmp in the interrupt vector table, and
+# reti, for the ATmega644 (as in the hand counts in ISR-ADC_vect.S)
+RESPONSE_CYCLES = 5 + 3
+
+CYCLES = {}
+for m in ("add adc sub subi sbc sbci and andi or ori eor com neg "
+          "inc dec ser clr tst mov movw ldi swap lsl lsr rol ror asr "
+          "cp cpc cpi in out bset bclr bst bld nop sec clc sen cln sez "
+          "clz sei cli ses cls sev clv set clt seh clh sleep wdr").split():
+    CYCLES[m] = 1
+for m in ("adiw sbiw mul muls mulsu fmul fmuls fmulsu push pop "
+          "ld ldd lds st std sts sbi cbi rjmp ijmp").split():
+    CYCLES[m] = 2
+for m in "lpm elpm jmp".split():
+    CYCLES[m] = 3
+CYCLES["reti"] = 5
+CYCLES["ret"] = 5
+
+# counted as not taken/not skipping
+BRANCHES = set(("brbs brbc breq brne brcs brcc brsh brlo brmi brpl "
+                "brge brlt brhs brhc brts brtc brvs brvc brie brid "
+                "cpse sbrc sbrs sbic sbis").split())
+for m in BRANCHES:
+    CYCLES[m] = 1
+
+# counted without the called function
+CALLS = {"call": 5, "rcall": 4, "icall": 4}
+CYCLES.update(CALLS)
+
+
+# Instructions of interest: PORTD is I/O address 0x0b, EIFR 0x1c
+MILESTONES = [
+    (("sbi", "0x0b, 6"), "discharge peak hold capacitor"),
+    (("cbi", "0x0b, 6"), "release peak hold capacitor"),
+    (("sbi", "0x1c, 0"), "clear INTF0 (ADC_ISR_DEAD_CYCLES)"),
+]
+
+
+SYMBOL_RE = re.compile(r"^[0-9a-f]+ <([^>]+)>:")
+INSN_RE = re.compile(r"^\s+[0-9a-f]+:\s+(?:[0-9a-f]{2} )+\s*(\S+)\s*([^;]*)")
+
+
+def read_isr(filename, vector):
+    """Return the (mnemonic, operands) list of function vector"""
+    insns = []
+    inside = False
+    for line in open(filename):
+        m = SYMBOL_RE.match(line)
+        if m:
+            if inside:
+                break
+            inside = (m.group(1) == vector)
+            continue
+        if not inside:
+            continue
+        m = INSN_RE.match(line)
+        if m:
+            insns.append((m.group(1), m.group(2).strip()))
+            if m.group(1) == "reti":
+                break
+    return insns
+
+
+def count(filename, vector):
+    insns = read_isr(filename, vector)
+    if not insns:
+        sys.stderr.write("%s: no %s found\n" % (filename, vector))
+        return False
+    cycles = RESPONSE_CYCLES
+    milestones = []
+    caveats = set()
+    for mnemonic, operands in insns:
+        if mnemonic not in CYCLES:
+            caveats.add("unknown instruction %s counted as 1 cycle" % mnemonic)
+        cycles += CYCLES.get(mnemonic, 1)
+        if mnemonic in BRANCHES:
+            caveats.add("branches counted as not taken")
+        if mnemonic in CALLS:
+            caveats.add("called functions not counted")
+        for insn, text in MILESTONES:
+            if (mnemonic, operands) == insn:
+                milestones.append((cycles, "%s (%s %s)" % (text, mnemonic,
+                                                           operands)))
+    print("%s: %s, %d instructions, static count" % (filename, vector,
+                                                     len(insns)))
+    for cycle, text in milestones:
+        print("  %4d  %s" % (cycle, text))
+    print("  %4d  total" % cycles)
+    for caveat in sorted(caveats):
+        print("        CAUTION: %s" % caveat)
+    return True
+
+
+def main(args):
+    vector = "__vector_24"
+    if len(args) >= 2 and args[0] == "--vector":
+        vector = args[1]
+        args = args[2:]
+    if not args:
+        sys.stderr.write(__doc__)
+        return 2
+    ok = True
+    for filename in args:
+        ok = count(filename, vector) and ok
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
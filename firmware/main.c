@@ -82,6 +82,7 @@
 #include <avr/pgmspace.h>
 #include <avr/wdt.h>
 #include <avr/eeprom.h>
+#include <util/atomic.h>
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -154,37 +155,300 @@ personality_param_t pparam_eeprom EEMEM;
 BARE_COMPILE_TIME_ASSERT(sizeof(pparam_sram) == sizeof(pparam_eeprom));
 
 
-/** Send value table packet to controller via serial port (layer 3).
- *
- * \param reason The reason why we are sending the value table
- *               (#packet_value_table_reason_t).
+/** Size of what put_table_header() sends */
+inline static
+uint16_t table_header_size(void)
+{
+  return sizeof(packet_value_table_header_t) + pparam_sram.length +
+    (data_table_info.dead_cycles ? sizeof(packet_value_table_ext_header_t) : 0);
+}
+
+
+/** Send value table header, parameter buffer, and extended header (layer 3)
  *
- * Note that send_table() might take a significant amount of time.
- * For example, at 9600bps, transmitting a good 3KByte will take a
- * good 3 seconds.  If you disable interrupts for that time and want
- * to continue the measurement later, you will want to properly pause
- * the timer.  We are currently keeping interrupts enabled if we
- * continue measuring, which avoids this issue.
+ * \param flags Flags to set in header.bits_per_value
  *
- * Note that for 'I' value tables it is possible that we send fluked
- * values due to overflows.
+ * The extended header is only sent for personalities which know
+ * their dead time per trigger.
  */
-void send_table(const packet_value_table_reason_t reason)
+inline static
+void put_table_header(const packet_value_table_reason_t reason,
+                      const uint8_t flags)
 {
   const uint16_t duration = get_duration();
+  const uint8_t extended =
+    data_table_info.dead_cycles ? PACKET_VALUE_TABLE_EXTENDED : 0;
 
   packet_value_table_header_t header = {
-    data_table_info.bits_per_value,
+    data_table_info.bits_per_value | flags | extended,
     reason,
     data_table_info.type,
     duration,
     pparam_sram.length
   };
-  frame_start(FRAME_TYPE_VALUE_TABLE,
-              sizeof(header) + pparam_sram.length + data_table_info.size);
   uart_putb((const void *)&header, sizeof(header));
   uart_putb((const void *)pparam_sram.params, pparam_sram.length);
-  uart_putb((const void *)data_table, data_table_info.size);
+  if (extended) {
+    const packet_value_table_ext_header_t ext_header = {
+      data_table_info.dead_cycles,
+      F_CPU / 1000
+    };
+    uart_putb((const void *)&ext_header, sizeof(ext_header));
+  }
+}
+
+
+#ifdef COMPRESSED_VALUE_TABLES
+
+/** Send varint (if emit is set), return its size in bytes */
+static
+uint8_t put_varint(const uint8_t emit, uint32_t value)
+{
+  uint8_t size = 1;
+  while (value > 0x7f) {
+    if (emit) {
+      uart_putc((const char)((value & 0x7f) | 0x80));
+    }
+    value >>= 7;
+    size++;
+  }
+  if (emit) {
+    uart_putc((const char)value);
+  }
+  return size;
+}
+
+
+/** Send token 2*value+run_flag (if emit is set), return its size in bytes
+ *
+ * The token may have 33 bits, so we handle the first byte by hand.
+ */
+static
+uint8_t put_token(const uint8_t emit, const uint32_t value,
+                  const uint8_t run_flag)
+{
+  const uint8_t byte = (((uint8_t)value & 0x3f) << 1) | run_flag;
+  const uint32_t rest = value >> 6;
+  if (!rest) {
+    if (emit) {
+      uart_putc((const char)byte);
+    }
+    return 1;
+  }
+  if (emit) {
+    uart_putc((const char)(byte | 0x80));
+  }
+  return 1 + put_varint(emit, rest);
+}
+
+
+/** Send the compressed value table data (if emit is set)
+ *
+ * \return The size of the compressed data in bytes
+ *
+ * See \ref packet_value_table_compressed for the format. Called once
+ * to determine the frame size, and once to actually send the data,
+ * so that we need not buffer anything.
+ *
+ * We only compress final value tables, i.e. with interrupts
+ * disabled. Sending polls the UART receiver while it waits, but the
+ * sizing pass sends nothing and takes longer than the receiver's two
+ * byte buffer lasts, so we poll it for every element.
+ */
+static
+uint16_t put_table_compressed(const uint8_t emit)
+{
+  const uint8_t bytes_per_value = data_table_info.bits_per_value / 8;
+  const uint16_t element_count = data_table_info.size / bytes_per_value;
+  const uint8_t *element = (const uint8_t *)data_table;
+  uint16_t size = put_varint(emit, element_count);
+  uint16_t zeros = 0;
+  for (uint16_t i=0; i<element_count; i++) {
+    uart_recv_poll();
+    uint32_t value = 0;
+    for (uint8_t b=bytes_per_value; b>0; b--) {
+      value = (value << 8) | element[b-1];
+    }
+    element += bytes_per_value;
+    if (value == 0) {
+      zeros++;
+      continue;
+    }
+    if (zeros) {
+      size += put_token(emit, zeros-1, 1);
+      zeros = 0;
+    }
+    size += put_token(emit, value, 0);
+  }
+  if (zeros) {
+    size += put_token(emit, zeros-1, 1);
+  }
+  return size;
+}
+
+#endif /* COMPRESSED_VALUE_TABLES */
+
+
+/** Send value table packet to controller via serial port (layer 3).
+ *
+ * \param reason The reason why we are sending the value table
+ *               (#packet_value_table_reason_t).
+ *
+ * Note that sending the table takes a significant amount of time.
+ * For example, at 9600bps, transmitting a good 3KByte will take a
+ * good 3 seconds.  With interrupts enabled, send_table() only queues
+ * the table and returns, and the UART ISR sends the data table
+ * contents as they are at that time, one consistent element after
+ * the other.  With interrupts disabled,
+ * send_table() polls the UART until everything has been sent, so if
+ * you want to continue the measurement later, you will want to
+ * properly pause the timer.
+ *
+ * Note that for 'I' value tables it is possible that we send fluked
+ * values due to overflows.
+ */
+void send_table(const packet_value_table_reason_t reason)
+{
+#ifdef COMPRESSED_VALUE_TABLES
+  /* The ISR would change intermediate value tables between counting
+   * and sending the bytes, so only compress the final ones. */
+  if (reason != PACKET_VALUE_TABLE_INTERMEDIATE) {
+    const uint16_t size = put_table_compressed(0);
+    if (size < data_table_info.size) {
+      frame_start(FRAME_TYPE_VALUE_TABLE,
+                  table_header_size() + size);
+      put_table_header(reason, PACKET_VALUE_TABLE_COMPRESSED);
+      put_table_compressed(1);
+      frame_end();
+      return;
+    }
+  }
+#endif
+
+  frame_start(FRAME_TYPE_VALUE_TABLE,
+              table_header_size() + data_table_info.size);
+  put_table_header(reason, 0);
+  uart_putb_elements(data_table, data_table_info.size,
+                     data_table_info.bits_per_value / 8);
+  frame_end();
+}
+
+
+/** Dirty flags of the data table blocks, set by the ISR */
+volatile uint8_t data_table_dirty[DATA_TABLE_DIRTY_BLOCKS];
+
+
+/** Blocks changed since the value table the host has acknowledged
+ *
+ * One bit per block. Kept as a bitmap as we do not need to access it
+ * from the ISR.
+ */
+static uint8_t delta_unacked[DATA_TABLE_DIRTY_BLOCKS/8];
+
+
+/** Sequence number of the last delta value table sent, 0 if none */
+static uint8_t delta_seq;
+
+
+/** Sequence number of the last delta value table the host has
+ *  acknowledged, 0 if none */
+static uint8_t delta_acked_seq;
+
+
+/** Whether block has changed since the acknowledged value table */
+inline static
+uint8_t delta_block_unacked(const uint8_t block)
+{
+  return delta_unacked[block >> 3] & _BV(block & 7);
+}
+
+
+/** Send the changed blocks of the value table (layer 3).
+ *
+ * \param ack The sequence number of the last delta value table the
+ *            host has received, see \ref packet_value_table_delta.
+ *
+ * Takes a lot less time than send_table() if only a few blocks have
+ * changed, so the host can poll much more often. The same remarks
+ * about interrupts and fluked values apply, though.
+ */
+void send_table_delta(const uint8_t ack);
+void send_table_delta(const uint8_t ack)
+{
+  if (!data_table_info.marks_dirty) {
+    send_table(PACKET_VALUE_TABLE_INTERMEDIATE);
+    return;
+  }
+
+  const uint8_t bytes_per_value = data_table_info.bits_per_value / 8;
+  const size_t block_bytes =
+    PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE * bytes_per_value;
+  const uint16_t element_count = data_table_info.size / bytes_per_value;
+  const uint8_t block_count =
+    (element_count + PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE - 1) /
+    PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE;
+
+  if (delta_seq && (ack == delta_seq)) {
+    /* host has the last delta value table we sent */
+    memset(delta_unacked, 0, sizeof(delta_unacked));
+    delta_acked_seq = ack;
+  } else if (!delta_acked_seq || (ack != delta_acked_seq)) {
+    /* host has no value table we know of: send everything */
+    memset(delta_unacked, 0xff, sizeof(delta_unacked));
+    delta_acked_seq = 0;
+  }
+
+  /* Clear each dirty flag before the block is sent. If the ISR
+   * changes the block after that, it is marked dirty again and goes
+   * into the next delta value table. */
+  size_t runs_size = 0;
+  uint8_t prev_unacked = 0;
+  for (uint8_t b=0; b<block_count; b++) {
+    if (data_table_dirty[b]) {
+      data_table_dirty[b] = 0;
+      delta_unacked[b >> 3] |= _BV(b & 7);
+    }
+    const uint8_t unacked = delta_block_unacked(b);
+    if (unacked) {
+      if (!prev_unacked) {
+        runs_size += 2;
+      }
+      runs_size += block_bytes;
+    }
+    prev_unacked = unacked;
+  }
+  if (prev_unacked) {
+    /* the last block may be incomplete */
+    runs_size -= block_count * block_bytes - data_table_info.size;
+  }
+
+  delta_seq = (delta_seq == UINT8_MAX) ? 1 : (delta_seq + 1);
+
+  const packet_value_table_delta_header_t delta_header = {
+    delta_acked_seq,
+    delta_seq,
+    element_count
+  };
+  frame_start(FRAME_TYPE_VALUE_TABLE_DELTA,
+              table_header_size() + sizeof(delta_header) + runs_size);
+  put_table_header(PACKET_VALUE_TABLE_INTERMEDIATE, 0);
+  uart_putb((const void *)&delta_header, sizeof(delta_header));
+  for (uint8_t b=0; b<block_count; ) {
+    if (!delta_block_unacked(b)) {
+      b++;
+      continue;
+    }
+    const uint8_t first = b;
+    while ((b < block_count) && delta_block_unacked(b)) {
+      b++;
+    }
+    uart_putc((const char)first);
+    uart_putc((const char)(b - first));
+    const size_t start = first * block_bytes;
+    const size_t end =
+      (b == block_count) ? data_table_info.size : (b * block_bytes);
+    uart_putb_elements(&data_table[start], end - start, bytes_per_value);
+  }
   frame_end();
 }
 
@@ -232,6 +496,152 @@ void general_personality_start_measurement_sram(void)
 }
 
 
+/** Number of entries in the command queue (power of 2) */
+#define CMD_QUEUE_SIZE 4
+
+
+/** Command frame as received from the host */
+typedef struct {
+  uint8_t cmd;
+  uint8_t length;
+  uint8_t params[MAX_PARAM_LENGTH];
+} command_t;
+
+
+/** Command queue, filled by the frame parser, emptied by the main loop */
+static volatile command_t cmd_queue[CMD_QUEUE_SIZE];
+
+/** Index of next command for the main loop (modulo #CMD_QUEUE_SIZE) */
+static volatile uint8_t cmd_head;
+
+/** Index of next command for the frame parser (modulo #CMD_QUEUE_SIZE) */
+static volatile uint8_t cmd_tail;
+
+
+/** Frame parser error: frame with bad parameter length dropped */
+#define RX_ERROR_PARAM_LENGTH _BV(0)
+
+/** Frame parser error: frame with checksum mismatch dropped */
+#define RX_ERROR_CHECKSUM     _BV(1)
+
+/** Frame parser error: frame dropped because command queue was full */
+#define RX_ERROR_OVERFLOW     _BV(2)
+
+/** Frame parser errors (RX_ERROR_*) for the main loop to report */
+static volatile uint8_t rx_errors;
+
+
+/** Frame parser FSM state */
+typedef enum {
+  STF_MAGIC,
+  STF_COMMAND,
+  STF_LENGTH,
+  STF_PARAM,
+  STF_CHECKSUM,
+} frame_state_t;
+
+/** Frame parser state (only touched in ISR or with interrupts disabled) */
+static frame_state_t fstate;
+
+/** Frame parser offset/index into magic/data */
+static uint8_t fidx;
+
+/** Frame parser cached data for current frame */
+static command_t rx_cmd;
+
+
+/** Parse incoming bytes into command frames (frame parser FSM)
+ *
+ * Runs in the UART receive ISR, so it must never wait or send
+ * anything. Complete frames with a matching checksum go into the
+ * command queue, and #GF_COMMAND_RECEIVED tells the main loop to
+ * handle them. Dropped frames are only recorded in #rx_errors for the
+ * main loop to report.
+ *
+ * \dot
+ * digraph firmware_frame_fsm {
+ *   node [shape=ellipse, fontname=Helvetica, fontsize=10];
+ *   edge [fontname=Helvetica, fontsize=10];
+ *   magic [ label="STF_MAGIC" ];
+ *   command [ label="STF_COMMAND" ];
+ *   length [ label="STF_LENGTH" ];
+ *   param [ label="STF_PARAM" ];
+ *   checksum [ label="STF_CHECKSUM" ];
+ *   magic:nw -> magic:nw [ label="mismatch\ni:=0" ];
+ *   magic -> magic [ label="match magic[i++] && i<magic_size\n-/-" ];
+ *   magic -> command [ label="match magic[i++] && i>=magic_size\n-/-" ];
+ *   command -> length;
+ *   length -> param [ label="length>0\ni:=0" ];
+ *   length -> checksum [ label="length==0\n-/-" ];
+ *   param -> param [ label="i<length\ni++" ];
+ *   param -> checksum [ label="i>=length\n-/-" ];
+ *   checksum -> magic [ label="chksum match\nqueue frame, i:=0" ];
+ *   checksum -> magic [ label="chksum fail\ni:=0" ];
+ * }
+ * \enddot
+ */
+void uart_recv_byte(const uint8_t byte)
+{
+  switch (fstate) {
+  case STF_MAGIC:
+    if (byte == FRAME_MAGIC_STR[fidx++]) {
+      uart_recv_checksum_update(byte);
+      if (fidx >= 4) {
+        fstate = STF_COMMAND;
+      }
+      return;
+    }
+    /* syncing, not an error */
+    break;
+  case STF_COMMAND:
+    uart_recv_checksum_update(byte);
+    rx_cmd.cmd = byte;
+    fstate = STF_LENGTH;
+    return;
+  case STF_LENGTH:
+    uart_recv_checksum_update(byte);
+    rx_cmd.length = byte;
+    fidx = 0;
+    if (byte == 0) {
+      fstate = STF_CHECKSUM;
+      return;
+    } else if (((byte >= personality_param_size) &&
+                (byte < MAX_PARAM_LENGTH)) ||
+               ((rx_cmd.cmd == FRAME_CMD_INTERMEDIATE_DELTA) && (byte == 1))) {
+      fstate = STF_PARAM;
+      return;
+    }
+    /* whoever sent us that wrongly sized data frame made an error */
+    rx_errors |= RX_ERROR_PARAM_LENGTH;
+    GF_SET(GF_COMMAND_RECEIVED);
+    break;
+  case STF_PARAM:
+    uart_recv_checksum_update(byte);
+    rx_cmd.params[fidx++] = byte;
+    if (fidx >= rx_cmd.length) {
+      fstate = STF_CHECKSUM;
+    }
+    return;
+  case STF_CHECKSUM:
+    if (!uart_recv_checksum_matches(byte)) {
+      rx_errors |= RX_ERROR_CHECKSUM;
+    } else if ((uint8_t)(cmd_tail - cmd_head) == CMD_QUEUE_SIZE) {
+      rx_errors |= RX_ERROR_OVERFLOW;
+    } else {
+      cmd_queue[cmd_tail & (CMD_QUEUE_SIZE-1)] = rx_cmd;
+      cmd_tail++;
+    }
+    GF_SET(GF_COMMAND_RECEIVED);
+    break;
+  }
+
+  /* restart */
+  fstate = STF_MAGIC;
+  fidx = 0;
+  uart_recv_checksum_reset();
+}
+
+
 /**
  * \defgroup firmware_fsm Firmware FSM
  * \ingroup firmware_generic
@@ -313,6 +723,7 @@ firmware_state_t firmware_handle_switch_pressed(const firmware_state_t pstate)
  *
  * \param pstate current FSM state
  * \param cmd the command we are to handle
+ * \param param first parameter byte of the command (if any)
  * \return new state
  *
  * Implicit parameters via global variables:
@@ -321,7 +732,8 @@ firmware_state_t firmware_handle_switch_pressed(const firmware_state_t pstate)
  */
 inline static
 firmware_state_t firmware_handle_command(const firmware_state_t pstate,
-                                         const uint8_t cmd)
+                                         const uint8_t cmd,
+                                         const uint8_t param)
 {
   /* temp vars */
   const frame_cmd_t c = (frame_cmd_t)cmd;
@@ -336,6 +748,7 @@ firmware_state_t firmware_handle_command(const firmware_state_t pstate,
       /* fall through */
     case FRAME_CMD_ABORT:
     case FRAME_CMD_INTERMEDIATE:
+    case FRAME_CMD_INTERMEDIATE_DELTA:
     case FRAME_CMD_STATE:
       send_state_P(PSTR_READY);
       return STP_READY;
@@ -371,10 +784,12 @@ firmware_state_t firmware_handle_command(const firmware_state_t pstate,
     case FRAME_CMD_INTERMEDIATE:
       /** The value table will be updated asynchronously from ISRs
        * like ISR(ADC_vect) or ISR(TIMER1_foo), i.e. independent from
-       * this main loop.  This will cause glitches in the intermediate
-       * values as the values in the table often consist of more than
-       * a single 8bit machine word.  However, we have decided that
-       * for *intermediate* results, those glitches are acceptable.
+       * this main loop.  The values in the table often consist of
+       * more than a single 8bit machine word, but the UART ISR reads
+       * each element whole (see uart_putb_elements()), so we never
+       * send a partly updated value.  Different elements may come
+       * from different points in time, though.  We have decided that
+       * for *intermediate* results, this is acceptable.
        *
        * Keeping interrupts enabled has the additional advantage that
        * the measurement continues during send_table(), so we need not
@@ -395,6 +810,12 @@ firmware_state_t firmware_handle_command(const firmware_state_t pstate,
       send_state_P(PSTR_MEASURING);
       return STP_MEASURING;
       break;
+    case FRAME_CMD_INTERMEDIATE_DELTA:
+      /* Same remarks as for FRAME_CMD_INTERMEDIATE apply. */
+      send_table_delta(param);
+      send_state_P(PSTR_MEASURING);
+      return STP_MEASURING;
+      break;
     case FRAME_CMD_PERSONALITY_INFO:
       send_personality_info();
       /* fall through */
@@ -442,6 +863,62 @@ firmware_state_t firmware_handle_command(const firmware_state_t pstate,
 }
 
 
+/** Report dropped frames, and handle the next command from the queue
+ *
+ * The command queue entry is copied before we release it, so the
+ * frame parser can receive the next command while we are handling
+ * this one.
+ */
+inline static
+firmware_state_t firmware_handle_received(firmware_state_t pstate)
+{
+  uint8_t errors;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    errors = rx_errors;
+    rx_errors = 0;
+  }
+  /** \todo Find a way to report errors without resorting to
+   *        sending free text. */
+  if (errors & RX_ERROR_PARAM_LENGTH) {
+    send_text_P(PSTR("param length mismatch"));
+  }
+  if (errors & RX_ERROR_CHECKSUM) {
+    send_text_P(PSTR("checksum fail"));
+  }
+  if (errors & RX_ERROR_OVERFLOW) {
+    send_text_P(PSTR("command queue overflow"));
+  }
+
+  if (cmd_head != cmd_tail) {
+    volatile command_t *c = &cmd_queue[cmd_head & (CMD_QUEUE_SIZE-1)];
+    const uint8_t cmd = c->cmd;
+    const uint8_t len = c->length;
+    const uint8_t param = (len > 0) ? c->params[0] : 0;
+    if (pstate == STP_READY) {
+      /* We can only use the personality_param_sram buffer in the
+       * STP_READY state. By not writing to the buffer after
+       * transitioning from STP_READY, we keep the content of the
+       * buffer from the "start measurement" command for sending
+       * back later.
+       */
+      pparam_sram.length = len;
+      for (uint8_t i=0; i<len; i++) {
+        pparam_sram.params[i] = c->params[i];
+      }
+    }
+    cmd_head++;
+    pstate = firmware_handle_command(pstate, cmd, param);
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if ((cmd_head == cmd_tail) && !rx_errors) {
+      GF_CLEAR(GF_COMMAND_RECEIVED);
+    }
+  }
+  return pstate;
+}
+
+
 /** @} */
 
 
@@ -459,31 +936,10 @@ firmware_state_t firmware_handle_command(const firmware_state_t pstate,
  * well-defined default state when the next measurement is being set
  * up.
  *
- * The main event loop function directly integrates the following FSM
- * which parses the incoming bytes from the USART into command frames
- * in order to save code size.
- *
- * \dot
- * digraph firmware_frame_fsm {
- *   node [shape=ellipse, fontname=Helvetica, fontsize=10];
- *   edge [fontname=Helvetica, fontsize=10];
- *   magic [ label="STF_MAGIC" ];
- *   command [ label="STF_COMMAND" ];
- *   length [ label="STF_LENGTH" ];
- *   param [ label="STF_PARAM" ];
- *   checksum [ label="STF_CHECKSUM" ];
- *   magic:nw -> magic:nw [ label="mismatch\ni:=0" ];
- *   magic -> magic [ label="match magic[i++] && i<magic_size\n-/-" ];
- *   magic -> command [ label="match magic[i++] && i>=magic_size\n-/-" ];
- *   command -> length;
- *   length -> param [ label="length>0\ni:=0" ];
- *   length -> checksum [ label="length==0\n-/-" ];
- *   param -> param [ label="i<length\ni++" ];
- *   param -> checksum [ label="i>=length\n-/-" ];
- *   checksum -> magic [ label="chksum match\nhandle_frame, i:=0" ];
- *   checksum -> magic [ label="chksum fail\ni:=0" ];
- * }
- * \enddot
+ * Incoming bytes from the USART are parsed into command frames by
+ * uart_recv_byte() in the receive ISR, so they are not lost while we
+ * are busy, e.g. sending a value table or updating the display. We
+ * only see complete commands with a matching checksum.
  */
 inline static
 void main_event_loop(void)
@@ -491,23 +947,6 @@ void main_event_loop(void)
 inline static
 void main_event_loop(void)
 {
-  /** Frame parser FSM state */
-  typedef enum {
-    STF_MAGIC,
-    STF_COMMAND,
-    STF_LENGTH,
-    STF_PARAM,
-    STF_CHECKSUM,
-  } frame_state_t;
-  frame_state_t fstate = STF_MAGIC;
-
-  /** Frame parser offset/index into magic/data */
-  uint8_t idx = 0;
-  /** Frame parser cached data for current frame */
-  uint8_t cmd = 0;
-  /** Frame parser cached data for current frame */
-  uint8_t len = 0;
-
   /* Firmware FSM State */
   firmware_state_t pstate = STP_READY;
 
@@ -517,6 +956,9 @@ void main_event_loop(void)
   /* Firmware main event loop */
   while (1) {
 
+    /* receive byte ourselves if interrupts have been disabled */
+    uart_recv_poll();
+
     /* check for "measurement finished" event */
     if (GF_ISSET(GF_MEASUREMENT_FINISHED)) {
       pstate = firmware_handle_measurement_finished(pstate);
@@ -532,104 +974,11 @@ void main_event_loop(void)
 
     display_count_stats();
 
-    /* check whether a byte has arrived via UART */
-    if (bit_is_set(UCSR0A, RXC0)) {
-      const char ch = uart_getc();
-      const uint8_t byte = (uint8_t)ch;
-
-      frame_state_t next_fstate = fstate;
-
-      switch (fstate) {
-      case STF_MAGIC:
-        if (byte == FRAME_MAGIC_STR[idx++]) {
-          uart_recv_checksum_update(byte);
-          if (idx < 4) {
-            next_fstate = STF_MAGIC;
-          } else {
-            next_fstate = STF_COMMAND;
-          }
-        } else {
-          /* syncing, not an error */
-          goto restart;
-        }
-        break;
-      case STF_COMMAND:
-        uart_recv_checksum_update(byte);
-        cmd = byte;
-        next_fstate = STF_LENGTH;
-        break;
-      case STF_LENGTH:
-        uart_recv_checksum_update(byte);
-        len = byte;
-        if (pstate == STP_READY) {
-          /* We can only use the personality_param_sram buffer in the
-           * STP_READY state. By not writing to the buffer after
-           * transitioning from STP_READY, we keep the content of the
-           * buffer from the "start measurement" command for sending
-           * back later.
-           */
-          pparam_sram.length = len;
-        }
-        if (len == 0) {
-          next_fstate = STF_CHECKSUM;
-        } else if ((len >= personality_param_size) &&
-                   (len < MAX_PARAM_LENGTH)) {
-          idx = 0;
-          next_fstate = STF_PARAM;
-        } else {
-          /* whoever sent us that wrongly sized data frame made an error */
-          /** \todo Find a way to report errors without resorting to
-           *        sending free text. */
-          send_text_P(PSTR("param length mismatch"));
-          goto error_restart_nomsg;
-        }
-        break;
-      case STF_PARAM:
-        uart_recv_checksum_update(byte);
-        if (pstate == STP_READY) {
-          /* We can only use the personality_param_sram buffer in the
-           * STP_READY state. By not writing to the buffer after
-           * transitioning from STP_READY, we keep the content of the
-           * buffer from the "start measurement" command for sending
-           * back later.
-           */
-          pparam_sram.params[idx] = byte;
-        }
-        idx++;
-        if (idx < len) {
-          next_fstate = STF_PARAM;
-        } else {
-          next_fstate = STF_CHECKSUM;
-        }
-        break;
-      case STF_CHECKSUM:
-        if (uart_recv_checksum_matches(byte)) {
-          /* checksum successful */
-          pstate = firmware_handle_command(pstate, cmd);
-          goto restart;
-        } else {
-          /** \todo Find a way to report checksum failure without
-           *        resorting to sending free text. */
-          send_text_P(PSTR("checksum fail"));
-          goto error_restart_nomsg;
-        }
-        break;
-      }
-      //uprintf("idx=%u", idx);
-      goto skip_errors;
-
-    error_restart_nomsg:
-
-    restart:
-      next_fstate = STF_MAGIC;
-      idx = 0;
-      uart_recv_checksum_reset();
-
-    skip_errors:
-      fstate = next_fstate;
-
+    /* check whether a command has arrived via UART */
+    if (GF_ISSET(GF_COMMAND_RECEIVED)) {
+      pstate = firmware_handle_received(pstate);
       continue;
-    } /* character received on UART */
+    }
 
   } /* while (1) main event loop */
 
@@ -54,6 +54,37 @@
 #define MAX_COUNTER (1<<ADC_RESOLUTION)
 
 
+#ifdef ASM_ADC_ISR
+
+/** CPU cycles from the ADC interrupt until ISR(ADC_vect) has cleared INTF0
+ *
+ * Hand counted for ISR-ADC_vect.S, including the 5 cycles interrupt
+ * response and the 3 cycles jmp from the interrupt vector table.
+ */
+# define ADC_ISR_DEAD_CYCLES 66
+
+/** Dead time per recorded trigger in CPU cycles
+ *
+ * Further triggers are lost from the trigger until ISR(ADC_vect)
+ * clears INTF0: Up to one ADC clock cycle until the conversion
+ * starts, 13.5 ADC clock cycles of conversion, and the ISR.
+ */
+# define DEAD_CYCLES ((29 << ADC_PRESCALER) / 2 + ADC_ISR_DEAD_CYCLES)
+
+#else
+
+/** Dead time per recorded trigger unknown
+ *
+ * The cycles of the C version of ISR(ADC_vect) depend on the code
+ * avr-gcc generates, which nobody has counted. Rather than have the
+ * host work out a live time from a guess, we do not report any dead
+ * time, and the host does not report any live time.
+ */
+# define DEAD_CYCLES 0
+
+#endif
+
+
 /** Histogram table
  *
  * ATmega644P has 4Kbyte RAM.  When using 10bit ADC resolution,
@@ -74,7 +105,13 @@ data_table_info_t data_table_info = {
   VALUE_TABLE_TYPE_HISTOGRAM,
   /** Table element size */
   BITS_PER_VALUE,
+  /** ISR marks changed elements */
+  1,
+  /** Dead time per trigger, for the live time */
+  DEAD_CYCLES
 };
+BARE_COMPILE_TIME_ASSERT(MAX_COUNTER <=
+                         DATA_TABLE_DIRTY_BLOCKS*PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE);
 
 
 /** See * \see data_table */
@@ -98,11 +135,27 @@ INIT_FUNCTION(init5, personality_io_init)
 }
 
 
+#ifdef ASM_ADC_ISR
+
+/* ISR(ADC_vect) is implemented in ISR-ADC_vect.S, which hardcodes
+ * the element size and the dirty block size. */
+#if (BITS_PER_VALUE != 24)
+# error The assembly language ISR(ADC_vect) requires BITS_PER_VALUE == 24
+#endif
+#if (PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE != 16)
+# error The assembly language ISR(ADC_vect) requires 16 element dirty blocks
+#endif
+
+#else
+
 /** AD conversion complete interrupt entry point
  *
  * This function is called when an A/D conversion has completed.
  * Update histogram
  * Discharge peak hold capacitor
+ *
+ * Build with BUILD_FREEMCAN_ASM_ADC_ISR=yes to use the faster
+ * assembly language version from ISR-ADC_vect.S instead.
  */
 ISR(ADC_vect)
 {
@@ -126,6 +179,7 @@ ISR(ADC_vect)
    */
   volatile table_element_t *element = &(table[index]);
   table_element_inc(element);
+  data_table_mark_dirty(index);
 
   /* set pin to GND and release peak hold capacitor   */
   PORTD &=~ _BV(PD6);
@@ -138,6 +192,8 @@ ISR(ADC_vect)
   EIFR |= _BV(INTF0);
 }
 
+#endif /* !ASM_ADC_ISR */
+
 
 /** Setup of INT0
  *
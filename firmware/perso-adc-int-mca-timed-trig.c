@@ -75,8 +75,15 @@ data_table_info_t data_table_info = {
   /** Type of value table we send */
   VALUE_TABLE_TYPE_HISTOGRAM,
   /** Table element size */
-  BITS_PER_VALUE
+  BITS_PER_VALUE,
+  /** ISR marks changed elements */
+  1,
+  /** No dead time to report: timer 1 triggers every conversion, so
+   *  there are no external triggers the device could miss */
+  0
 };
+BARE_COMPILE_TIME_ASSERT(MAX_COUNTER <=
+                         DATA_TABLE_DIRTY_BLOCKS*PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE);
 
 
 /** See * \see data_table */
@@ -109,6 +116,7 @@ ISR(ADC_vect)
      */
     volatile table_element_t *element = &(table[index]);
     table_element_inc(element);
+    data_table_mark_dirty(index);
     skip_samples = orig_skip_samples;
   } else {
     skip_samples--;
@@ -57,7 +57,7 @@ typedef
   table_element_t;
 
 
-#if (BITS_PER_VALUE == 24)
+#if (BITS_PER_VALUE == 24) && defined(__AVR__)
 /** Increment 24bit unsigned integer */
 inline static
 void table_element_zero(volatile freemcan_uint24_t *dest)
@@ -179,6 +179,53 @@ uint8_t table_element_cmp_eq(volatile freemcan_uint24_t *element,
 }
 
 
+#elif (BITS_PER_VALUE == 24)
+
+
+/* Portable versions of the above for host builds (see
+ * host/shim.h), little endian like on the AVR. */
+
+inline static
+void table_element_zero(volatile freemcan_uint24_t *dest)
+{
+  (*dest)[0] = 0;
+  (*dest)[1] = 0;
+  (*dest)[2] = 0;
+}
+
+
+inline static
+void table_element_copy(volatile freemcan_uint24_t *dest,
+                        volatile freemcan_uint24_t *source)
+{
+  (*dest)[0] = (*source)[0];
+  (*dest)[1] = (*source)[1];
+  (*dest)[2] = (*source)[2];
+}
+
+
+inline static
+void table_element_inc(volatile freemcan_uint24_t *element)
+{
+  const uint32_t value = ((uint32_t)(*element)[0] |
+                          ((uint32_t)(*element)[1] << 8) |
+                          ((uint32_t)(*element)[2] << 16)) + 1;
+  (*element)[0] = value & 0xff;
+  (*element)[1] = (value >> 8) & 0xff;
+  (*element)[2] = (value >> 16) & 0xff;
+}
+
+
+inline static
+uint8_t table_element_cmp_eq(volatile freemcan_uint24_t *element,
+                             const uint32_t value)
+{
+  return (((*element)[0] == (value & 0xff)) &&
+          ((*element)[1] == ((value >> 8) & 0xff)) &&
+          ((*element)[2] == ((value >> 16) & 0xff)));
+}
+
+
 #else
 
 /** Zero 8bit, 16bit, or 32bit unsigned integer */
@@ -25,10 +25,39 @@
  * Implements the byte stream part of the communication protocol
  * (Layer 1).
  *
+ * Sending is interrupt driven: The uart_put*() functions append to a
+ * small transmit queue and return, and the UDRE interrupt sends one
+ * byte after the other and updates the checksum as it goes. Data
+ * table and program memory contents are not copied, only single
+ * bytes and small buffers which may live on the stack. The main loop
+ * only waits if the queue is full.
+ *
+ * Buffers sent with uart_putb() are copied and checksummed by the
+ * main loop in blocks of up to #TX_BLOCK_SIZE bytes with the
+ * assembly language checksum_update_block(), so the ISR only needs
+ * to fold in one precomputed checksum per block (see
+ * checksum_combine()) instead of updating it for every byte.
+ *
+ * Data table elements are read whole by the ISR (see
+ * uart_putb_elements()), and as no ISR can interrupt another, the
+ * ISRs counting into the table can never have updated only some of
+ * the bytes of an element we send.
+ *
+ * When interrupts are disabled, the uart_put*() functions send the
+ * bytes by polling before they return, like they always used to.
+ *
+ * Receiving is interrupt driven as well: The receive ISR hands every
+ * byte to uart_recv_byte(), so no byte is lost while the main loop is
+ * busy. While interrupts are disabled, bytes are received by polling
+ * in uart_recv_poll() and whenever we are waiting to send.
+ *
  * @{
  */
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include <stdint.h>
 
 #include "uart-comm.h"
@@ -86,7 +115,77 @@
 #define UBRRH_VALUE (UBRR_VALUE >> 8)
 
 
-static checksum_accu_t cs_accu_send;
+/** Number of entries in the transmit queue (power of 2) */
+#define TX_QUEUE_SIZE 8
+
+/** Number of bytes in the transmit byte ring (power of 2) */
+#define TX_RING_SIZE 32
+
+/** Maximum number of bytes in a #TX_BLOCK entry */
+#define TX_BLOCK_SIZE 16
+
+
+/** Kinds of transmit queue entries */
+typedef enum {
+  /** Send len bytes from SRAM at ptr, reading size bytes at a time */
+  TX_SRAM,
+  /** Send len bytes from program memory at ptr */
+  TX_PGM,
+  /** Send len bytes from #tx_ring */
+  TX_RING,
+  /** Send len bytes from #tx_ring, whose checksum is sum */
+  TX_BLOCK,
+  /** Send the checksum over the bytes since the last #TX_RESET */
+  TX_CHECKSUM,
+  /** Reset the checksum (sends nothing) */
+  TX_RESET
+} tx_type_t;
+
+
+/** Transmit queue entry
+ *
+ * Data in SRAM and program memory are not copied, the ISR reads
+ * (and checksums) them as it sends them.
+ */
+typedef struct {
+  const volatile uint8_t *ptr;
+  uint16_t len;
+  uint8_t size;
+  tx_type_t type;
+  checksum_accu_t sum;
+} tx_desc_t;
+
+
+/** Transmit queue, filled by main loop, emptied by ISR */
+static volatile tx_desc_t tx_queue[TX_QUEUE_SIZE];
+
+/** Index of next entry for the ISR (modulo #TX_QUEUE_SIZE) */
+static volatile uint8_t tx_head;
+
+/** Index of next entry for the main loop (modulo #TX_QUEUE_SIZE) */
+static volatile uint8_t tx_tail;
+
+
+/** Copies of single bytes and small buffers for #TX_RING entries */
+static volatile uint8_t tx_ring[TX_RING_SIZE];
+
+/** Index of next byte for the ISR (modulo #TX_RING_SIZE) */
+static volatile uint8_t tx_ring_head;
+
+/** Index of next byte for the main loop (modulo #TX_RING_SIZE) */
+static volatile uint8_t tx_ring_tail;
+
+
+/** Copy of the #TX_SRAM element currently being sent */
+static uint8_t tx_latch[4];
+
+/** Number of bytes of #tx_latch still to be sent */
+static uint8_t tx_latch_left;
+
+
+/** Send checksum, only touched by the ISR (or with interrupts disabled) */
+static checksum_accu_t tx_accu;
+
 static checksum_accu_t cs_accu_recv;
 
 
@@ -104,65 +203,260 @@ INIT_FUNCTION(init5, uart_init)
    * frame format) */
   UCSR0C = (_BV(UCSZ01) | _BV(UCSZ00));
 
-  /* Enable transmit and receive */
-  UCSR0B = (_BV(TXEN0) | _BV(RXEN0));
+  /* Enable transmit, receive, and the receive interrupt */
+  UCSR0B = (_BV(TXEN0) | _BV(RXEN0) | _BV(RXCIE0));
 
   /* Clear or set U2X0 baudrate doubling bit, depending on
    * UART_BAUDRATE. Also disable multi device mode, and do not clear
    * the TXC0 bit (you would *clear* TXC0 bit by writing a 1). */
   UCSR0A = (USE_2X<<U2X0);
 
-  cs_accu_send = checksum_reset();
+  tx_accu = checksum_reset();
   cs_accu_recv = checksum_reset();
 }
 
 
+/** Send the next byte from the transmit queue
+ *
+ * Called from the UDRE ISR, or by polling while interrupts are
+ * disabled. UDRE0 must be set.
+ *
+ * About 50 cycles plus the ISR overhead per byte at -Os, i.e. well
+ * below 5% of the CPU at 115200 baud and 16MHz.
+ */
+inline static
+void tx_next(void)
+{
+  if (tx_head == tx_tail) {
+    /* nothing left to send */
+    UCSR0B &= ~_BV(UDRIE0);
+    return;
+  }
+
+  volatile tx_desc_t *desc = &tx_queue[tx_head & (TX_QUEUE_SIZE-1)];
+  uint8_t c;
+  switch (desc->type) {
+  case TX_SRAM:
+    if (tx_latch_left == 0) {
+      /* latch the next element in one go */
+      for (uint8_t i=0; i<desc->size; i++) {
+        tx_latch[i] = desc->ptr[i];
+      }
+      desc->ptr += desc->size;
+      tx_latch_left = desc->size;
+    }
+    c = tx_latch[desc->size - tx_latch_left];
+    tx_latch_left--;
+    break;
+  case TX_PGM:
+    c = pgm_read_byte((const uint8_t *)desc->ptr);
+    desc->ptr++;
+    break;
+  case TX_RING:
+    c = tx_ring[tx_ring_head & (TX_RING_SIZE-1)];
+    tx_ring_head++;
+    break;
+  case TX_BLOCK:
+    UDR0 = tx_ring[tx_ring_head & (TX_RING_SIZE-1)];
+    tx_ring_head++;
+    if (--desc->len == 0) {
+      tx_accu = checksum_combine(tx_accu, desc->sum, desc->size);
+      tx_head++;
+    }
+    return;
+  case TX_CHECKSUM:
+    UDR0 = tx_accu & 0xff;
+    tx_head++;
+    return;
+  default: /* TX_RESET */
+    tx_accu = checksum_reset();
+    tx_head++;
+    return;
+  }
+  UDR0 = c;
+  tx_accu = checksum_update(tx_accu, c);
+  if (--desc->len == 0) {
+    tx_head++;
+  }
+}
+
+
+/** UART data register empty: send next byte */
+ISR(USART0_UDRE_vect)
+{
+  tx_next();
+}
+
+
+/** Whether interrupts are globally enabled */
+inline static
+uint8_t interrupts_enabled(void)
+{
+  return bit_is_set(SREG, SREG_I);
+}
+
+
+/** Wait a little for the ISR to make progress
+ *
+ * If interrupts are disabled (e.g. after the measurement has
+ * finished), we send the next byte ourselves, and receive whatever
+ * the host sends in the meantime.
+ */
+inline static
+void tx_wait(void)
+{
+  if (!interrupts_enabled()) {
+    if (bit_is_set(UCSR0A, UDRE0)) {
+      tx_next();
+    }
+    if (bit_is_set(UCSR0A, RXC0)) {
+      uart_recv_byte(UDR0);
+    }
+  }
+}
+
+
+/** Append transmit queue entry and have the ISR send it */
+static
+void tx_enqueue(const tx_type_t type, const volatile void *ptr,
+                const uint16_t len, const uint8_t size,
+                const checksum_accu_t sum)
+{
+  while ((uint8_t)(tx_tail - tx_head) == TX_QUEUE_SIZE) {
+    tx_wait();
+  }
+  volatile tx_desc_t *desc = &tx_queue[tx_tail & (TX_QUEUE_SIZE-1)];
+  desc->type = type;
+  desc->ptr = ptr;
+  desc->len = len;
+  desc->size = size;
+  desc->sum = sum;
+  tx_tail++;
+  UCSR0B |= _BV(UDRIE0);
+  if (!interrupts_enabled()) {
+    uart_flush();
+  }
+}
+
+
+/* documented in uart-comm.h */
+void uart_flush(void)
+{
+  while (tx_head != tx_tail) {
+    tx_wait();
+  }
+}
+
+
 /** Send checksum */
 void uart_send_checksum(void)
 {
-  const uint8_t v = cs_accu_send & 0xff;
-  uart_putc((const char)v);
+  tx_enqueue(TX_CHECKSUM, NULL, 1, 1, 0);
 }
 
 
 void uart_send_checksum_reset(void)
 {
-  cs_accu_send = checksum_reset();
+  tx_enqueue(TX_RESET, NULL, 1, 1, 0);
 }
 
 
-/** Write character to UART */
+/** Write character to UART
+ *
+ * The character goes into the byte ring. If the last queue entry
+ * sends from the ring and has not been finished yet, we just make it
+ * one byte longer.
+ */
 void uart_putc(const char c)
 {
-    /* poll until output buffer is empty */
-    loop_until_bit_is_set(UCSR0A, UDRE0);
+  while ((uint8_t)(tx_ring_tail - tx_ring_head) == TX_RING_SIZE) {
+    tx_wait();
+  }
+  tx_ring[tx_ring_tail & (TX_RING_SIZE-1)] = c;
+  tx_ring_tail++;
+
+  uint8_t appended = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (tx_head != tx_tail) {
+      volatile tx_desc_t *last = &tx_queue[(tx_tail-1) & (TX_QUEUE_SIZE-1)];
+      if (last->type == TX_RING) {
+        last->len++;
+        appended = 1;
+      }
+    }
+  }
+  if (!appended) {
+    tx_enqueue(TX_RING, NULL, 1, 1, 0);
+  } else if (!interrupts_enabled()) {
+    uart_flush();
+  }
+}
 
-    /* put the char */
-    UDR0 = c;
 
-    /* update the checksum state with c */
-    cs_accu_send = checksum_update(cs_accu_send, c);
+/** Write data buffer of arbitrary size and content to UART
+ *
+ * The data are copied into the byte ring, so buf may go away (e.g. be
+ * on the stack) as soon as we return. Each block of up to
+ * #TX_BLOCK_SIZE bytes is checksummed here, not in the ISR.
+ */
+void uart_putb(const void *buf, size_t len)
+{
+  const uint8_t *s = (const uint8_t *)buf;
+  while (len > 0) {
+    const uint8_t n = (len < TX_BLOCK_SIZE) ? len : TX_BLOCK_SIZE;
+    while ((uint8_t)(tx_ring_tail - tx_ring_head) > TX_RING_SIZE - n) {
+      tx_wait();
+    }
+    for (uint8_t i=0; i<n; i++) {
+      tx_ring[(tx_ring_tail + i) & (TX_RING_SIZE-1)] = s[i];
+    }
+    tx_ring_tail += n;
+    tx_enqueue(TX_BLOCK, NULL, n, n, checksum_update_block(0, s, n));
+    s += n;
+    len -= n;
+  }
 }
 
 
-/** Write data buffer of arbitrary size and content to UART */
-void uart_putb(const void *buf, size_t len)
+/* documented in uart-comm.h */
+void uart_putb_elements(const volatile void *buf, size_t len,
+                        const uint8_t element_size)
 {
-  for (const char *s = (const char *)buf; len > 0; s++, len--) {
-    uart_putc(*s);
+  if (len > 0) {
+    tx_enqueue(TX_SRAM, buf, len, element_size, 0);
   }
 }
 
 
 void uart_putb_P(PGM_VOID_P buf, size_t len)
 {
-  for (PGM_P s = buf; len > 0; s++, len--) {
-    uart_putc(pgm_read_byte(s));
+  if (len > 0) {
+    tx_enqueue(TX_PGM, buf, len, 1, 0);
   }
 }
 
 
-/** Read a character from the UART */
+/** UART receive complete: hand byte to the frame parser */
+ISR(USART0_RX_vect)
+{
+  uart_recv_byte(UDR0);
+}
+
+
+/* documented in uart-comm.h */
+void uart_recv_poll(void)
+{
+  if (!interrupts_enabled() && bit_is_set(UCSR0A, RXC0)) {
+    uart_recv_byte(UDR0);
+  }
+}
+
+
+/** Read a character from the UART
+ *
+ * Only useful while interrupts are disabled, as otherwise the receive
+ * ISR gets the character.
+ */
 char uart_getc()
 {
     /* Poll til a character is inside the input buffer */
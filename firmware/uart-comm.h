@@ -37,9 +37,43 @@ void uart_putb(const void *buf, size_t len);
 void uart_putb_P(PGM_VOID_P buf, size_t len);
 char uart_getc(void);
 
+
+/** Write array of elements to UART without copying it
+ *
+ * For large buffers which stay around, like the data table. The ISR
+ * reads each element (of element_size bytes, at most 4) in one go
+ * when it starts sending it, so if buf changes in the meantime, the
+ * changed elements are sent (and checksummed), but never an element
+ * which has only been partly updated by another ISR.
+ *
+ * len must be a multiple of element_size.
+ */
+void uart_putb_elements(const volatile void *buf, size_t len,
+                        const uint8_t element_size);
+
+
+/** Wait until everything queued has been sent */
+void uart_flush(void);
+
+
 void uart_send_checksum_reset(void);
 void uart_send_checksum(void);
 
+/** Handle byte received via UART
+ *
+ * Implemented by the frame parser in main.c. Called from the UART
+ * receive ISR, or from #uart_recv_poll while interrupts are disabled.
+ */
+void uart_recv_byte(const uint8_t byte);
+
+
+/** Receive byte by polling if interrupts are disabled
+ *
+ * With interrupts enabled, the receive ISR does the job.
+ */
+void uart_recv_poll(void);
+
+
 void uart_recv_checksum_reset(void);
 void uart_recv_checksum_update(const char ch);
 char uart_recv_checksum_matches(const uint8_t data);
@@ -29,8 +29,13 @@
 
 #include <avr/wdt.h>
 
+#include "uart-comm.h"
 
-/** Trigger AVR reset via watchdog device. */
+
+/** Trigger AVR reset via watchdog device.
+ *
+ * Sends whatever is still in the UART transmit queue first.
+ */
 static inline
 void wdt_soft_reset(void)
   __attribute__((noreturn));
@@ -38,6 +43,7 @@ static inline
 void wdt_soft_reset(void)
 {
   do {
+    uart_flush();
     wdt_enable(WDTO_15MS);
     while (1) {
       /* wait until watchdog has caused a system reset */
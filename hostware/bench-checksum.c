@@ -0,0 +1,121 @@
+/** \file hostware/bench-checksum.c
+ * \brief Benchmark the per-byte and the block checksum update
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Checksums a 3 KiB table (the size of a 1024 bin 24bit histogram)
+ * over and over, and makes sure both variants agree on the result
+ * for all lengths and alignments before timing them.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "freemcan-checksum.h"
+#include "freemcan-log.h"
+
+
+#define TABLE_SIZE 3072
+#define ROUNDS     20000
+
+
+static uint8_t checksum_bytewise(const uint8_t *buf, const size_t size)
+{
+  checksum_t *cs = checksum_new();
+  for (size_t i=0; i<size; i++) {
+    checksum_update(cs, buf[i]);
+  }
+  const uint8_t retval = checksum_get(cs);
+  checksum_unref(cs);
+  return retval;
+}
+
+
+static uint8_t checksum_blockwise(const uint8_t *buf, const size_t size)
+{
+  checksum_t *cs = checksum_new();
+  checksum_update_block(cs, buf, size);
+  const uint8_t retval = checksum_get(cs);
+  checksum_unref(cs);
+  return retval;
+}
+
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+int main()
+{
+  uint8_t *table = malloc(TABLE_SIZE);
+  assert(table);
+  srand(42);
+  for (size_t i=0; i<TABLE_SIZE; i++) {
+    table[i] = rand();
+  }
+
+  for (size_t ofs=0; ofs<16; ofs++) {
+    for (size_t size=0; size<=100; size++) {
+      assert(checksum_bytewise(&table[ofs], size) ==
+             checksum_blockwise(&table[ofs], size));
+    }
+  }
+  assert(checksum_bytewise(table, TABLE_SIZE) ==
+         checksum_blockwise(table, TABLE_SIZE));
+
+  checksum_t *cs = checksum_new();
+
+  const double t0 = now();
+  for (unsigned int r=0; r<ROUNDS; r++) {
+    for (size_t i=0; i<TABLE_SIZE; i++) {
+      checksum_update(cs, table[i]);
+    }
+  }
+  const double t1 = now();
+  for (unsigned int r=0; r<ROUNDS; r++) {
+    checksum_update_block(cs, table, TABLE_SIZE);
+  }
+  const double t2 = now();
+
+  /* keep the compiler from dropping the loops */
+  fmlog("checksum: 0x%02x", checksum_get(cs));
+  checksum_unref(cs);
+
+  const double mbytes = (double)ROUNDS * TABLE_SIZE / 1e6;
+  fmlog("%-10s %8.1f MB/s %8.2f us/table", "per-byte",
+        mbytes/(t1-t0), 1e6*(t1-t0)/ROUNDS);
+  fmlog("%-10s %8.1f MB/s %8.2f us/table", "block",
+        mbytes/(t2-t1), 1e6*(t2-t1)/ROUNDS);
+
+  free(table);
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,167 @@
+/** \file hostware/bench-device-reader.c
+ * \brief Benchmark reading from the device (layer 1)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Plays the device emulator: Listens on a UNIX socket, lets the
+ * device connect to it, and then writes frames in bursts of varying
+ * size, calling #device_do_io after every burst just like the main
+ * loop would. Logs the device receive statistics afterwards.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "frame-defs.h"
+#include "frame-parser.h"
+#include "freemcan-checksum.h"
+#include "freemcan-device.h"
+#include "freemcan-log.h"
+#include "packet-parser.h"
+
+
+#define PAYLOAD_SIZE 3072
+#define FRAME_COUNT  2000
+
+
+static unsigned long frames_seen = 0;
+
+
+static void count_frame(const void *params __attribute__((unused)),
+                        const size_t length,
+                        void *data __attribute__((unused)))
+{
+  assert(length == PAYLOAD_SIZE);
+  frames_seen++;
+}
+
+
+/** Write one complete frame to buf, return number of bytes written */
+static size_t write_frame(uint8_t *buf, checksum_t *cs, const unsigned int seed)
+{
+  size_t i = 0;
+  memcpy(&buf[i], FRAME_MAGIC_STR, 4);
+  i += 4;
+  buf[i++] = (PAYLOAD_SIZE >> 0) & 0xff;
+  buf[i++] = (PAYLOAD_SIZE >> 8) & 0xff;
+  buf[i++] = FRAME_TYPE_PARAMS_FROM_EEPROM;
+  for (size_t k=0; k<PAYLOAD_SIZE; k++) {
+    buf[i++] = (uint8_t)(seed*31 + k*7);
+  }
+  checksum_reset(cs);
+  checksum_update_block(cs, buf, i);
+  buf[i] = checksum_get(cs);
+  i++;
+  return i;
+}
+
+
+static void write_all(const int fd, const uint8_t *buf, const size_t size)
+{
+  size_t ofs = 0;
+  while (ofs < size) {
+    const ssize_t n = write(fd, &buf[ofs], size - ofs);
+    assert(n > 0);
+    ofs += n;
+  }
+}
+
+
+int main()
+{
+  char socket_name[64];
+  snprintf(socket_name, sizeof(socket_name),
+           "/tmp/bench-device-reader.%ld", (long)getpid());
+
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(listen_fd >= 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_name);
+  unlink(socket_name);
+  int ret = bind(listen_fd, (const struct sockaddr *)&addr, sizeof(addr));
+  assert(ret == 0);
+  ret = listen(listen_fd, 1);
+  assert(ret == 0);
+
+  packet_parser_t *pp =
+    packet_parser_new(NULL, NULL, NULL, NULL, count_frame, NULL);
+  frame_parser_t *fp = frame_parser_new(pp);
+  packet_parser_unref(pp);
+  device_t *device = device_new(fp);
+  const int open_ret = device_open(device, socket_name);
+  assert(open_ret == 0);
+  const int emu_fd = accept(listen_fd, NULL, NULL);
+  assert(emu_fd >= 0);
+  close(listen_fd);
+  unlink(socket_name);
+
+  const int sndbuf = 256*1024;
+  setsockopt(emu_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+  const size_t frame_size = 4+2+1+PAYLOAD_SIZE+1;
+  uint8_t *frame = malloc(frame_size);
+  assert(frame);
+  checksum_t *cs = checksum_new();
+
+  /* bursts of 1, 2, 3, 4 frames, and some frames split across bursts */
+  unsigned int sent = 0;
+  unsigned int burst = 1;
+  while (sent < FRAME_COUNT) {
+    for (unsigned int i=0; (i<burst) && (sent<FRAME_COUNT); i++, sent++) {
+      write_frame(frame, cs, sent);
+      if (sent % 5 == 4) {
+        write_all(emu_fd, frame, frame_size/2);
+        ret = device_do_io(device);
+        assert(ret == 0);
+        write_all(emu_fd, &frame[frame_size/2], frame_size - frame_size/2);
+      } else {
+        write_all(emu_fd, frame, frame_size);
+      }
+    }
+    ret = device_do_io(device);
+    assert(ret == 0);
+    burst = 1 + (burst % 4);
+  }
+  assert(frames_seen == FRAME_COUNT);
+
+  device_fmlog_stats(device);
+
+  checksum_unref(cs);
+  free(frame);
+  close(emu_fd);
+  device_close(device);
+  device_unref(device);
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
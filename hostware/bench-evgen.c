@@ -0,0 +1,130 @@
+/** \file hostware/bench-evgen.c
+ * \brief Benchmark the Monte Carlo event generator
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Logs the events per second one core generates
+ *
+ *   - drawing values from a 1024 element Cs-137 spectrum alone,
+ *   - counting arrivals without values (geiger counter),
+ *   - filling a histogram from the spectrum, without and with dead
+ *     time and pile-up,
+ *
+ * and the time to fill a whole histogram from the expected values
+ * with Poisson noise instead.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "evgen.h"
+#include "freemcan-log.h"
+
+
+#define EVENTS 20000000
+#define RATE   1e6
+#define COUNT  1024
+
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+static void log_rate(const char *name, const double events, const double t)
+{
+  fmlog("%-22s %7.1f M events/s %6.1f ns/event", name,
+        events/t/1e6, 1e9*t/events);
+}
+
+
+static void bench_histogram(const char *name, evgen_spectrum_t *spectrum,
+                            const evgen_config_t *config)
+{
+  uint32_t *table = calloc(COUNT, sizeof(table[0]));
+  assert(table);
+  evgen_t *evgen = evgen_new(config, spectrum, 1);
+  const double t0 = now();
+  evgen_fill_histogram(evgen, table, EVENTS / RATE);
+  const double t1 = now();
+  const evgen_stats_t *stats = evgen_stats(evgen);
+  uint64_t total = 0;
+  for (size_t i=0; i<COUNT; i++) {
+    total += table[i];
+  }
+  assert(total == stats->recorded);
+  log_rate(name, stats->events, t1-t0);
+  evgen_unref(evgen);
+  free(table);
+}
+
+
+int main()
+{
+  evgen_spectrum_t *spectrum = evgen_spectrum_new_cs137(COUNT);
+  evgen_rng_t rng;
+  evgen_rng_seed(&rng, 1);
+
+  uint32_t *table = calloc(COUNT, sizeof(table[0]));
+  assert(table);
+  const double t0 = now();
+  for (unsigned int i=0; i<EVENTS; i++) {
+    table[evgen_spectrum_sample(spectrum, &rng)]++;
+  }
+  const double t1 = now();
+  log_rate("alias sampling", EVENTS, t1-t0);
+
+  const evgen_config_t plain = { RATE, 0, false, 0 };
+  evgen_t *evgen = evgen_new(&plain, NULL, 1);
+  const double t2 = now();
+  const uint64_t n = evgen_count(evgen, EVENTS / RATE);
+  const double t3 = now();
+  evgen_unref(evgen);
+  log_rate("arrivals", n, t3-t2);
+
+  bench_histogram("histogram", spectrum, &plain);
+  /* the adc-int-mca dead time, and a 1us shaping time */
+  const evgen_config_t dead = { RATE, 62.4e-6, false, 1e-6 };
+  bench_histogram("histogram, dead time", spectrum, &dead);
+
+  const unsigned int rounds = 1000;
+  const double t4 = now();
+  for (unsigned int r=0; r<rounds; r++) {
+    evgen_spectrum_fill_poisson(spectrum, &rng, table, 1e7);
+  }
+  const double t5 = now();
+  fmlog("%-22s %7.1f us/table of 1e7 events", "Poisson table",
+        1e6*(t5-t4)/rounds);
+
+  free(table);
+  evgen_spectrum_unref(spectrum);
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,254 @@
+/** \file hostware/bench-evloop.c
+ * \brief Benchmark event loop wakeup latency
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * A child process writes timestamps into a pipe. The parent waits
+ * for them together with a number of idle pipes (standing in for
+ * many devices), once with the epoll(7) based #evloop_t and once with
+ * a select(2) loop rebuilding its fd_set every iteration like the
+ * old TUI main loop, and logs the time from write(2) to handler.
+ *
+ * Then a periodic timer runs with a busy fd next to it, and we log
+ * how far the timer expiries are from their fixed schedule.
+ */
+
+#include <assert.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+
+#include "compiler.h"
+#include "freemcan-evloop.h"
+#include "freemcan-log.h"
+
+
+#define IDLE_PIPES   400
+#define SAMPLES      2000
+#define INTERVAL_NS  200000L
+
+#define TIMER_MS     5
+#define TIMER_TICKS  200
+
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+
+static int compare_u64(const void *a, const void *b)
+{
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+
+static void log_latencies(const char *name, uint64_t *lat, const size_t count)
+{
+  qsort(lat, count, sizeof(lat[0]), compare_u64);
+  uint64_t sum = 0;
+  for (size_t i=0; i<count; i++) {
+    sum += lat[i];
+  }
+  fmlog("%-8s median %7.2f us  p99 %7.2f us  mean %7.2f us",
+        name, lat[count/2]/1e3, lat[(count*99)/100]/1e3, sum/1e3/count);
+}
+
+
+/** Fork child writing count timestamps into the returned fd */
+static int start_writer(pid_t *pid, const unsigned int count)
+{
+  int fds[2];
+  const int ret = pipe(fds);
+  assert(ret == 0);
+  *pid = fork();
+  assert(*pid >= 0);
+  if (*pid == 0) {
+    close(fds[0]);
+    const struct timespec pause = { 0, INTERVAL_NS };
+    for (unsigned int i=0; i<count; i++) {
+      nanosleep(&pause, NULL);
+      const uint64_t ts = now_ns();
+      const ssize_t n = write(fds[1], &ts, sizeof(ts));
+      assert(n == sizeof(ts));
+    }
+    _exit(0);
+  }
+  close(fds[1]);
+  return fds[0];
+}
+
+
+static uint64_t latencies[SAMPLES];
+static size_t latency_count = 0;
+
+
+static void read_timestamp(const int fd)
+{
+  uint64_t ts;
+  const ssize_t n = read(fd, &ts, sizeof(ts));
+  assert(n == sizeof(ts));
+  latencies[latency_count++] = now_ns() - ts;
+}
+
+
+static void evloop_read_timestamp(void *data, const uint64_t events)
+{
+  assert(events & EPOLLIN);
+  read_timestamp(*(const int *)data);
+}
+
+
+static void run_evloop(const int *idle_fds)
+{
+  evloop_t *loop = evloop_new();
+  for (unsigned int i=0; i<IDLE_PIPES; i++) {
+    evloop_add_fd(loop, idle_fds[i], EPOLLIN, evloop_read_timestamp, NULL);
+  }
+  pid_t pid;
+  int fd = start_writer(&pid, SAMPLES);
+  evloop_add_fd(loop, fd, EPOLLIN, evloop_read_timestamp, &fd);
+  latency_count = 0;
+  while (latency_count < SAMPLES) {
+    evloop_run_once(loop, -1);
+  }
+  waitpid(pid, NULL, 0);
+  evloop_unref(loop);
+  close(fd);
+  log_latencies("epoll", latencies, latency_count);
+}
+
+
+static void run_select(const int *idle_fds)
+{
+  pid_t pid;
+  const int fd = start_writer(&pid, SAMPLES);
+  latency_count = 0;
+  while (latency_count < SAMPLES) {
+    fd_set in_fdset;
+    FD_ZERO(&in_fdset);
+    int max_fd = fd;
+    FD_SET(fd, &in_fdset);
+    for (unsigned int i=0; i<IDLE_PIPES; i++) {
+      assert(idle_fds[i] < FD_SETSIZE);
+      FD_SET(idle_fds[i], &in_fdset);
+      if (idle_fds[i] > max_fd) {
+        max_fd = idle_fds[i];
+      }
+    }
+    const int n = select(max_fd+1, &in_fdset, NULL, NULL, NULL);
+    assert(n > 0);
+    if (FD_ISSET(fd, &in_fdset)) {
+      read_timestamp(fd);
+    }
+  }
+  waitpid(pid, NULL, 0);
+  close(fd);
+  log_latencies("select", latencies, latency_count);
+}
+
+
+static uint64_t timer_start;
+static unsigned long timer_ticks = 0;
+
+
+static void timer_tick(void *data, const uint64_t expirations)
+{
+  const uint64_t t = now_ns();
+  timer_ticks += expirations;
+  const uint64_t scheduled = timer_start + timer_ticks * TIMER_MS * 1000000ULL;
+  latencies[latency_count++] = t - scheduled;
+  if (timer_ticks >= TIMER_TICKS) {
+    evloop_quit((evloop_t *)data);
+  }
+}
+
+
+static void ignore_timestamp(void *data, const uint64_t UP(events))
+{
+  uint64_t ts;
+  const ssize_t n = read(*(const int *)data, &ts, sizeof(ts));
+  assert(n == sizeof(ts));
+}
+
+
+static void run_timer(void)
+{
+  evloop_t *loop = evloop_new();
+  pid_t pid;
+  /* keeps writing until killed */
+  int fd = start_writer(&pid, -1);
+  evloop_add_fd(loop, fd, EPOLLIN, ignore_timestamp, &fd);
+  evloop_watch_t *timer = evloop_add_timer(loop, timer_tick, loop);
+  latency_count = 0;
+  timer_start = now_ns();
+  evloop_timer_set(timer, TIMER_MS);
+  evloop_run(loop);
+  evloop_unref(loop);
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  close(fd);
+  fmlog("timer: %lu ticks of %d ms, %lu us total drift",
+        timer_ticks, TIMER_MS,
+        (unsigned long)(latencies[latency_count-1] / 1000));
+  log_latencies("timer", latencies, latency_count);
+}
+
+
+int main()
+{
+  int idle_fds[IDLE_PIPES];
+  int idle_writers[IDLE_PIPES];
+  for (unsigned int i=0; i<IDLE_PIPES; i++) {
+    int fds[2];
+    const int ret = pipe(fds);
+    assert(ret == 0);
+    idle_fds[i] = fds[0];
+    idle_writers[i] = fds[1];
+  }
+
+  fmlog("wakeup latency with %d idle fds:", IDLE_PIPES);
+  run_evloop(idle_fds);
+  run_select(idle_fds);
+  run_timer();
+
+  for (unsigned int i=0; i<IDLE_PIPES; i++) {
+    close(idle_fds[i]);
+    close(idle_writers[i]);
+  }
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
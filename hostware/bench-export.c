@@ -0,0 +1,196 @@
+/** \file hostware/bench-export.c
+ * \brief Benchmark exporting value tables to .dat files
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Exports a large histogram, time series and samples value table
+ * with #export_value_table, and the same rows with the one fprintf(3)
+ * per row (and localtime(3) plus strftime(3) per timestamp) the
+ * exporter used to do. Checks that the rows are byte-identical, and
+ * logs rows/s for both.
+ *
+ * The time series spans a month including the 2010 DST changes in
+ * the US, the EU and on Lord Howe Island, so run this with different
+ * TZ settings to check the incremental timestamp formatting.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freemcan-export.h"
+#include "freemcan-log.h"
+#include "packet-value-table.h"
+#include "personality-info.h"
+#include "value-table-archive.h"
+
+
+#define ELEMENTS     400000
+#define TIME_STEP    7
+/* 2010-03-10 00:00:00 UTC */
+#define START_TIME   1268179200
+
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+static packet_value_table_t *make_table(const personality_info_t *pi,
+                                        const packet_value_table_type_t type,
+                                        const time_t receive_time)
+{
+  packet_value_table_t *vtab =
+    packet_value_table_new_empty(pi, PACKET_VALUE_TABLE_DONE, type,
+                                 receive_time, 24, ELEMENTS, 0, 0, NULL);
+  vtab->duration = TIME_STEP;
+  vtab->total_duration = TIME_STEP;
+  const time_t start_time = START_TIME;
+  vtab->token = vtab->token_buf;
+  vtab->token_size = sizeof(start_time);
+  memcpy(vtab->token, &start_time, sizeof(start_time));
+  uint32_t x = 12345;
+  for (size_t i=0; i<ELEMENTS; i++) {
+    x = x*1103515245 + 12345;
+    vtab->elements[i] = (x >> 8) >> (x & 15);
+  }
+  return vtab;
+}
+
+
+/** The rows as the exporter used to write them */
+static void reference_rows(FILE *file, const packet_value_table_t *vtab)
+{
+  const time_t start_time = *((const time_t *)vtab->token);
+  for (size_t i=0; i<vtab->element_count; i++) {
+    if (vtab->type == VALUE_TABLE_TYPE_TIME_SERIES) {
+      const time_t ts = start_time + i * vtab->total_duration;
+      const struct tm *tm_ = localtime(&ts);
+      char st[64];
+      strftime(st, sizeof(st), "%Y-%m-%d %H:%M:%S%z", tm_);
+      fprintf(file, "%zu\t%u\t%ld\t%s\n", i, vtab->elements[i], ts, st);
+    } else {
+      fprintf(file, "%zu\t%u\n", i, vtab->elements[i]);
+    }
+  }
+}
+
+
+static char *read_file(const char *fname, size_t *size)
+{
+  FILE *file = fopen(fname, "r");
+  assert(file);
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *data = malloc(*size + 1);
+  assert(data);
+  const size_t n = fread(data, 1, *size, file);
+  assert(n == *size);
+  data[*size] = '\0';
+  fclose(file);
+  return data;
+}
+
+
+static void run(const char *name, const char *outdir,
+                const personality_info_t *pi,
+                const packet_value_table_type_t type,
+                const time_t receive_time,
+                const char *rows_after)
+{
+  packet_value_table_t *vtab = make_table(pi, type, receive_time);
+
+  const double t0 = now();
+  export_value_table(outdir, pi, vtab, false);
+  const double t1 = now();
+
+  char *ref_data;
+  size_t ref_size;
+  FILE *ref = open_memstream(&ref_data, &ref_size);
+  assert(ref);
+  const double t2 = now();
+  reference_rows(ref, vtab);
+  fclose(ref);
+  const double t3 = now();
+
+  const char *fname = export_value_table_get_filename(outdir, vtab, "dat");
+  size_t size;
+  char *data = read_file(fname, &size);
+  const char *rows = strstr(data, rows_after);
+  assert(rows);
+  rows += strlen(rows_after);
+  rows = strchr(rows, '\n') + 1;
+  if ((size_t)(&data[size] - rows) != ref_size ||
+      memcmp(rows, ref_data, ref_size) != 0) {
+    fmlog("%s: exported rows differ from reference rows", name);
+    abort();
+  }
+  unlink(fname);
+
+  fmlog("%-12s export %10.0f rows/s   fprintf %10.0f rows/s   (%.1fx)",
+        name, ELEMENTS/(t1-t0), ELEMENTS/(t3-t2), (t3-t2)/(t1-t0));
+
+  free(data);
+  free(ref_data);
+  packet_value_table_unref(vtab);
+}
+
+
+int main()
+{
+  char outdir[] = "/tmp/bench-export.XXXXXX";
+  const char *ret = mkdtemp(outdir);
+  assert(ret);
+
+  /* the table size does not matter except for some header lines */
+  personality_info_t *pi =
+    personality_info_new(0xffff, 24, 1, 2, 0, 5, "bench");
+
+  const char *tz = getenv("TZ");
+  fmlog("%d rows per table, TZ=%s", ELEMENTS, tz ? tz : "(unset)");
+  run("histogram",   outdir, pi, VALUE_TABLE_TYPE_HISTOGRAM,   START_TIME,
+      "channel\tcount");
+  run("time series", outdir, pi, VALUE_TABLE_TYPE_TIME_SERIES, START_TIME+1,
+      "idx\tcounts\ttime_t\tstrftime");
+  run("samples",     outdir, pi, VALUE_TABLE_TYPE_SAMPLES,     START_TIME+2,
+      "# maximum value:");
+
+  personality_info_unref(pi);
+  char archive_fname[FILENAME_MAX];
+  snprintf(archive_fname, sizeof(archive_fname), "%s/%s",
+           outdir, ARCHIVE_FILENAME);
+  unlink(archive_fname);
+  rmdir(outdir);
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
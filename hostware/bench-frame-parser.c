@@ -0,0 +1,293 @@
+/** \file hostware/bench-frame-parser.c
+ * \brief Benchmark the frame parser (layer 2)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Feeds a buffer of synthetic frames (3 KiB payload each, as sent by
+ * the MCA personalities, with some line noise in between) into the
+ * frame parser in read(2) sized chunks, once byte by byte and once
+ * with the bulk fast path enabled.
+ *
+ * Then feeds 24bit value table frames, with and without streaming
+ * decode (the latter also byte by byte), makes sure both produce the same value tables, and measures
+ * the time from handing the last frame byte to the parser until the
+ * value table has been dispatched.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame.h"
+#include "frame-defs.h"
+#include "frame-parser.h"
+#include "freemcan-checksum.h"
+#include "freemcan-log.h"
+#include "packet-defs.h"
+#include "packet-parser.h"
+#include "packet-value-table.h"
+
+
+#define PAYLOAD_SIZE 3072
+#define FRAME_COUNT  2000
+#define CHUNK_SIZE   4096
+
+#define VTAB_ELEMENTS 1024
+#define VTAB_BPV      24
+#define VTAB_PARAMS   4
+#define VTAB_PAYLOAD  (sizeof(packet_value_table_header_t) + VTAB_PARAMS + \
+                       VTAB_ELEMENTS*VTAB_BPV/8)
+
+
+static unsigned long frames_seen = 0;
+
+
+static void count_frame(const void *params __attribute__((unused)),
+                        const size_t length,
+                        void *data __attribute__((unused)))
+{
+  assert(length == PAYLOAD_SIZE);
+  frames_seen++;
+}
+
+
+/** Sum over all value table elements of all value tables received */
+static uint64_t vtab_sum = 0;
+
+
+static void count_value_table(packet_value_table_t *vtab,
+                              void *data __attribute__((unused)))
+{
+  assert(vtab->element_count == VTAB_ELEMENTS);
+  assert(vtab->total_duration == 0x1234);
+  for (size_t i=0; i<vtab->element_count; i++) {
+    vtab_sum += (i+1) * vtab->elements[i];
+  }
+  frames_seen++;
+}
+
+
+/** Write personality info frame matching the value table frames */
+static size_t write_personality_info_frame(uint8_t *buf, checksum_t *cs)
+{
+  const char name[] = "bench";
+  const size_t payload_size = sizeof(packet_personality_info_t) + strlen(name);
+  const uint16_t sizeof_table = VTAB_ELEMENTS*VTAB_BPV/8;
+  size_t i = 0;
+  memcpy(&buf[i], FRAME_MAGIC_STR, 4);
+  i += 4;
+  buf[i++] = (payload_size >> 0) & 0xff;
+  buf[i++] = (payload_size >> 8) & 0xff;
+  buf[i++] = FRAME_TYPE_PERSONALITY_INFO;
+  buf[i++] = (sizeof_table >> 0) & 0xff;
+  buf[i++] = (sizeof_table >> 8) & 0xff;
+  buf[i++] = VTAB_BPV;
+  buf[i++] = 1; /* units_per_second */
+  buf[i++] = 2; /* param_data_size_timer_count */
+  buf[i++] = 0; /* param_data_size_skip_samples */
+  memcpy(&buf[i], name, strlen(name));
+  i += strlen(name);
+  checksum_reset(cs);
+  checksum_update_block(cs, buf, i);
+  buf[i] = checksum_get(cs);
+  i++;
+  return i;
+}
+
+
+/** Append one complete value table frame to buf, return its size */
+static size_t write_value_table_frame(uint8_t *buf, checksum_t *cs,
+                                      const unsigned int seed)
+{
+  size_t i = 0;
+  memcpy(&buf[i], FRAME_MAGIC_STR, 4);
+  i += 4;
+  buf[i++] = (VTAB_PAYLOAD >> 0) & 0xff;
+  buf[i++] = (VTAB_PAYLOAD >> 8) & 0xff;
+  buf[i++] = FRAME_TYPE_VALUE_TABLE;
+  buf[i++] = VTAB_BPV;
+  buf[i++] = PACKET_VALUE_TABLE_INTERMEDIATE;
+  buf[i++] = VALUE_TABLE_TYPE_HISTOGRAM;
+  buf[i++] = 10; /* duration */
+  buf[i++] = 0;
+  buf[i++] = VTAB_PARAMS;
+  buf[i++] = 0x34; /* total_duration */
+  buf[i++] = 0x12;
+  buf[i++] = 'X'; /* token */
+  buf[i++] = 'Y';
+  for (size_t k=0; k<VTAB_ELEMENTS*VTAB_BPV/8; k++) {
+    buf[i++] = (uint8_t)(seed*13 + k*k);
+  }
+  checksum_reset(cs);
+  checksum_update_block(cs, buf, i);
+  buf[i] = checksum_get(cs);
+  i++;
+  return i;
+}
+
+
+/** Append one complete frame to buf, return number of bytes written */
+static size_t write_frame(uint8_t *buf, checksum_t *cs, const unsigned int seed)
+{
+  size_t i = 0;
+  memcpy(&buf[i], FRAME_MAGIC_STR, 4);
+  i += 4;
+  buf[i++] = (PAYLOAD_SIZE >> 0) & 0xff;
+  buf[i++] = (PAYLOAD_SIZE >> 8) & 0xff;
+  buf[i++] = FRAME_TYPE_PARAMS_FROM_EEPROM;
+  for (size_t k=0; k<PAYLOAD_SIZE; k++) {
+    buf[i++] = (uint8_t)(seed*31 + k*7);
+  }
+  checksum_reset(cs);
+  for (size_t k=0; k<i; k++) {
+    checksum_update(cs, buf[k]);
+  }
+  buf[i] = checksum_get(cs);
+  i++;
+  /* a little line noise between frames */
+  buf[i++] = 'F';
+  buf[i++] = 0x00;
+  return i;
+}
+
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+static void run(const char *name, const bool bulk,
+                const uint8_t *buf, const size_t size)
+{
+  packet_parser_t *pp =
+    packet_parser_new(NULL, NULL, NULL, NULL, count_frame, NULL);
+  frame_parser_t *fp = frame_parser_new(pp);
+  packet_parser_unref(pp);
+
+  enable_frame_parser_bulk = bulk;
+  frames_seen = 0;
+  const double t0 = now();
+  for (size_t i=0; i<size; i+=CHUNK_SIZE) {
+    const size_t n = (size-i < CHUNK_SIZE) ? (size-i) : CHUNK_SIZE;
+    frame_parser_handle_bytes(fp, &buf[i], n);
+  }
+  const double dt = now() - t0;
+  assert(frames_seen == FRAME_COUNT);
+
+  fmlog("%-10s %10.0f frames/s %8.1f MB/s",
+        name, frames_seen/dt, size/dt/1e6);
+  frame_parser_unref(fp);
+}
+
+
+/** Feed value table frames, timing the last byte of every frame */
+static uint64_t run_value_tables(const char *name,
+                                 const bool bulk, const bool streaming,
+                                 const uint8_t *buf, const size_t frame_size)
+{
+  packet_parser_t *pp =
+    packet_parser_new(count_value_table, NULL, NULL, NULL, NULL, NULL);
+  frame_parser_t *fp = frame_parser_new(pp);
+  packet_parser_unref(pp);
+
+  uint8_t pi_frame[64];
+  checksum_t *cs = checksum_new();
+  const size_t pi_frame_size = write_personality_info_frame(pi_frame, cs);
+  checksum_unref(cs);
+  frame_parser_handle_bytes(fp, pi_frame, pi_frame_size);
+
+  enable_frame_parser_bulk = bulk;
+  enable_value_table_streaming = streaming;
+  frames_seen = 0;
+  vtab_sum = 0;
+  double total = 0.0, last_byte = 0.0;
+  for (unsigned int f=0; f<FRAME_COUNT; f++) {
+    const uint8_t *frame = &buf[f*frame_size];
+    const double t0 = now();
+    for (size_t i=0; i<frame_size-1; i+=CHUNK_SIZE) {
+      const size_t left = frame_size-1-i;
+      const size_t n = (left < CHUNK_SIZE) ? left : CHUNK_SIZE;
+      frame_parser_handle_bytes(fp, &frame[i], n);
+    }
+    const double t1 = now();
+    frame_parser_handle_bytes(fp, &frame[frame_size-1], 1);
+    const double t2 = now();
+    total += t2 - t0;
+    last_byte += t2 - t1;
+  }
+  assert(frames_seen == FRAME_COUNT);
+
+  fmlog("%-10s %10.0f frames/s %8.2f us last byte to dispatch",
+        name, frames_seen/total, 1e6*last_byte/frames_seen);
+  frame_parser_unref(fp);
+  return vtab_sum;
+}
+
+
+int main()
+{
+  const size_t max_frame_size = 4+2+1+PAYLOAD_SIZE+1+2;
+  const size_t vtab_frame_size = 4+2+1+VTAB_PAYLOAD+1;
+  uint8_t *buf = malloc(FRAME_COUNT * ((max_frame_size > vtab_frame_size)
+                                       ? max_frame_size : vtab_frame_size));
+  assert(buf);
+  checksum_t *cs = checksum_new();
+  size_t size = 0;
+  for (unsigned int i=0; i<FRAME_COUNT; i++) {
+    size += write_frame(&buf[size], cs, i);
+  }
+  checksum_unref(cs);
+
+  run("per-byte", false, buf, size);
+  run("bulk",     true,  buf, size);
+
+  cs = checksum_new();
+  for (unsigned int i=0; i<FRAME_COUNT; i++) {
+    const size_t n = write_value_table_frame(&buf[i*vtab_frame_size], cs, i);
+    assert(n == vtab_frame_size);
+  }
+  checksum_unref(cs);
+
+  const uint64_t sum_buffered =
+    run_value_tables("buffered",  true,  false, buf, vtab_frame_size);
+  const uint64_t sum_streaming =
+    run_value_tables("streaming", true,  true,  buf, vtab_frame_size);
+  const uint64_t sum_per_byte =
+    run_value_tables("per-byte",  false, true,  buf, vtab_frame_size);
+  assert(sum_buffered == sum_streaming);
+  assert(sum_buffered == sum_per_byte);
+
+  frame_pool_fmlog_stats();
+  packet_value_table_pool_fmlog_stats();
+
+  free(buf);
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
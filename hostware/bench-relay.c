@@ -0,0 +1,157 @@
+/** \file hostware/bench-relay.c
+ * \brief Benchmark relaying a device stream to several clients
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * A writer thread sends as fast as it can as the device, and reader
+ * threads drain 1, 4, and 16 clients. Logs the rate every client
+ * gets, how much of it went without copying, and how many times the
+ * device byte rate at #UART_BAUDRATE that is.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include "device-relay.h"
+#include "freemcan-evloop.h"
+#include "freemcan-log.h"
+
+#include "uart-defs.h"
+
+
+#define TOTAL       (256*1024*1024)
+#define MAX_CLIENTS 16
+
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+static void *writer(void *data)
+{
+  const int fd = *(int *)data;
+  static uint8_t buf[65536];
+  memset(buf, 0x5a, sizeof(buf));
+  for (size_t ofs=0; ofs<TOTAL; ofs+=sizeof(buf)) {
+    size_t done = 0;
+    while (done < sizeof(buf)) {
+      const ssize_t n = write(fd, &buf[done], sizeof(buf) - done);
+      assert(n > 0);
+      done += n;
+    }
+  }
+  shutdown(fd, SHUT_WR);
+  return NULL;
+}
+
+
+typedef struct {
+  int fd;
+  size_t received;
+} reader_t;
+
+
+static void *reader(void *data)
+{
+  reader_t *r = data;
+  uint8_t buf[65536];
+  ssize_t n;
+  while ((n = read(r->fd, buf, sizeof(buf))) > 0) {
+    r->received += n;
+  }
+  assert(n == 0);
+  close(r->fd);
+  return NULL;
+}
+
+
+static void bench_relay(const unsigned int clients)
+{
+  int source[2];
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, source) == 0);
+  evloop_t *loop = evloop_new();
+  relay_t *relay = relay_new(loop, source[0]);
+
+  reader_t readers[MAX_CLIENTS];
+  pthread_t reader_threads[MAX_CLIENTS];
+  for (unsigned int i=0; i<clients; i++) {
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    relay_add_client(relay, fds[0]);
+    readers[i].fd = fds[1];
+    readers[i].received = 0;
+    assert(pthread_create(&reader_threads[i], NULL, reader, &readers[i]) == 0);
+  }
+
+  const double t0 = now();
+  pthread_t writer_thread;
+  assert(pthread_create(&writer_thread, NULL, writer, &source[1]) == 0);
+  while (!relay_is_closed(relay)) {
+    evloop_run_once(loop, -1);
+  }
+  const double t1 = now();
+  assert(pthread_join(writer_thread, NULL) == 0);
+
+  const relay_stats_t *stats = relay_stats(relay);
+  assert(stats->bytes_in == TOTAL);
+  const double rate = TOTAL / (t1 - t0);
+  fmlog("%2u clients: %7.1f MB/s each, %5.1f%% spliced, %lu pauses, "
+        "%.0f times the device",
+        clients, rate/1e6,
+        100.0 * stats->bytes_spliced / (stats->bytes_spliced + stats->bytes_copied),
+        stats->pauses, rate / (UART_BAUDRATE / 10.0));
+
+  relay_unref(relay);
+  evloop_unref(loop);
+  for (unsigned int i=0; i<clients; i++) {
+    assert(pthread_join(reader_threads[i], NULL) == 0);
+    assert(readers[i].received == TOTAL);
+  }
+  close(source[0]);
+  close(source[1]);
+}
+
+
+int main()
+{
+  fmlog("Relaying %u MiB, device at %lu baud",
+        TOTAL/(1024*1024), (unsigned long)UART_BAUDRATE);
+  bench_relay(1);
+  bench_relay(4);
+  bench_relay(MAX_CLIENTS);
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
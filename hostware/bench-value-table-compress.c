@@ -0,0 +1,262 @@
+/** \file hostware/bench-value-table-compress.c
+ * \brief Benchmark compressed value table transfers
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Builds value table frames the way the firmware sends them, for an
+ * MCA histogram and a geiger counter time series with Poisson noise
+ * from the event generator, and for random 24bit values (the worst
+ * case), both uncompressed and compressed. Feeds them through the
+ * frame parser and logs for each
+ *
+ *   - the bytes on the wire per table,
+ *   - the time those bytes take at #UART_BAUDRATE,
+ *   - the host time from the first frame byte to the dispatched
+ *     value table,
+ *
+ * and checks that both kinds of frame give the same value table. (The
+ * firmware sends random values uncompressed, as that is shorter.)
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "evgen.h"
+#include "frame-defs.h"
+#include "frame-parser.h"
+#include "freemcan-checksum.h"
+#include "freemcan-log.h"
+#include "packet-defs.h"
+#include "packet-parser.h"
+#include "packet-value-table.h"
+#include "uart-defs.h"
+#include "value-table-compress.h"
+
+
+#define ROUNDS 500
+#define PARAMS 4
+
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+/** The value table the parser dispatched last */
+static packet_value_table_t *last_vtab = NULL;
+
+
+static void keep_value_table(packet_value_table_t *vtab,
+                             void *data __attribute__((unused)))
+{
+  if (last_vtab) {
+    packet_value_table_unref(last_vtab);
+  }
+  packet_value_table_ref(vtab);
+  last_vtab = vtab;
+}
+
+
+/** Write frame with header, payload and checksum, return its size */
+static size_t write_frame(uint8_t *buf, const frame_type_t type,
+                          const uint8_t *payload, const size_t payload_size)
+{
+  size_t i = 0;
+  memcpy(&buf[i], FRAME_MAGIC_STR, 4);
+  i += 4;
+  buf[i++] = (payload_size >> 0) & 0xff;
+  buf[i++] = (payload_size >> 8) & 0xff;
+  buf[i++] = type;
+  memcpy(&buf[i], payload, payload_size);
+  i += payload_size;
+  checksum_t *cs = checksum_new();
+  checksum_update_block(cs, buf, i);
+  buf[i++] = checksum_get(cs);
+  checksum_unref(cs);
+  return i;
+}
+
+
+/** Write value table frame, compressed or not, return its size */
+static size_t write_value_table_frame(uint8_t *buf,
+                                      const uint32_t *elements,
+                                      const size_t count,
+                                      const unsigned int bits,
+                                      const bool compressed)
+{
+  uint8_t *payload = malloc(sizeof(packet_value_table_header_t) + PARAMS +
+                            value_table_compress_max_size(count));
+  assert(payload);
+  size_t i = 0;
+  payload[i++] = bits | (compressed ? PACKET_VALUE_TABLE_COMPRESSED : 0);
+  payload[i++] = PACKET_VALUE_TABLE_DONE;
+  payload[i++] = VALUE_TABLE_TYPE_HISTOGRAM;
+  payload[i++] = 10; /* duration */
+  payload[i++] = 0;
+  payload[i++] = PARAMS;
+  payload[i++] = 10; /* total_duration */
+  payload[i++] = 0;
+  payload[i++] = 'X'; /* token */
+  payload[i++] = 'Y';
+  if (compressed) {
+    i += value_table_compress(&payload[i], elements, count);
+  } else {
+    for (size_t k=0; k<count; k++) {
+      for (unsigned int b=0; b<bits; b+=8) {
+        payload[i++] = (elements[k] >> b) & 0xff;
+      }
+    }
+  }
+  const size_t size = write_frame(buf, FRAME_TYPE_VALUE_TABLE, payload, i);
+  free(payload);
+  return size;
+}
+
+
+/** Feed frame to a parser ROUNDS times, return seconds per frame */
+static double parse(const uint8_t *pi_frame, const size_t pi_size,
+                    const uint8_t *frame, const size_t size)
+{
+  packet_parser_t *pp =
+    packet_parser_new(keep_value_table, NULL, NULL, NULL, NULL, NULL);
+  frame_parser_t *fp = frame_parser_new(pp);
+  packet_parser_unref(pp);
+  frame_parser_handle_bytes(fp, pi_frame, pi_size);
+
+  const double t0 = now();
+  for (unsigned int r=0; r<ROUNDS; r++) {
+    frame_parser_handle_bytes(fp, frame, size);
+  }
+  const double t1 = now();
+  frame_parser_unref(fp);
+  return (t1-t0)/ROUNDS;
+}
+
+
+static void run(const char *name, const uint32_t *elements,
+                const size_t count, const unsigned int bits)
+{
+  uint8_t pi_payload[sizeof(packet_personality_info_t) + 5];
+  const uint16_t sizeof_table = count*bits/8;
+  pi_payload[0] = (sizeof_table >> 0) & 0xff;
+  pi_payload[1] = (sizeof_table >> 8) & 0xff;
+  pi_payload[2] = bits;
+  pi_payload[3] = 1; /* units_per_second */
+  pi_payload[4] = 2; /* param_data_size_timer_count */
+  pi_payload[5] = 0; /* param_data_size_skip_samples */
+  memcpy(&pi_payload[6], "bench", 5);
+  uint8_t pi_frame[64];
+  const size_t pi_size = write_frame(pi_frame, FRAME_TYPE_PERSONALITY_INFO,
+                                     pi_payload, sizeof(pi_payload));
+
+  const size_t max_size = 16 + PARAMS + value_table_compress_max_size(count);
+  uint8_t *raw = malloc(max_size);
+  uint8_t *comp = malloc(max_size);
+  assert(raw && comp);
+  const size_t raw_size =
+    write_value_table_frame(raw, elements, count, bits, false);
+  const size_t comp_size =
+    write_value_table_frame(comp, elements, count, bits, true);
+
+  const double raw_time = parse(pi_frame, pi_size, raw, raw_size);
+  assert(last_vtab && (last_vtab->element_count == count));
+  assert(!memcmp(last_vtab->elements, elements, count*sizeof(uint32_t)));
+  const double comp_time = parse(pi_frame, pi_size, comp, comp_size);
+  assert(last_vtab && (last_vtab->element_count == count));
+  assert(!memcmp(last_vtab->elements, elements, count*sizeof(uint32_t)));
+  assert(last_vtab->wire_size < comp_size);
+  packet_value_table_unref(last_vtab);
+  last_vtab = NULL;
+
+  /* 8N1: 10 bit times per byte */
+  const double raw_wire = 10.0*raw_size/UART_BAUDRATE;
+  const double comp_wire = 10.0*comp_size/UART_BAUDRATE;
+  fmlog("%-12s raw %6zu bytes %7.1f ms + %6.1f us host   "
+        "compressed %6zu bytes %7.1f ms + %6.1f us host   (%.1fx)",
+        name,
+        raw_size, 1e3*raw_wire, 1e6*raw_time,
+        comp_size, 1e3*comp_wire, 1e6*comp_time,
+        (raw_wire+raw_time)/(comp_wire+comp_time));
+  free(raw);
+  free(comp);
+}
+
+
+int main()
+{
+  fmlog("Value table transfer at %lu baud, wire time + host time per table:",
+        (unsigned long)UART_BAUDRATE);
+
+  /* MCA histogram: nothing at either end, two peaks on a background,
+   * with Poisson noise */
+  double weights[1024];
+  for (size_t i=0; i<1024; i++) {
+    const double c = i;
+    const double background = (i < 40 || i > 900) ? 0.0 : 5000.0*exp(-c/150.0);
+    const double peak1 = 20000.0*exp(-pow((c-300.0)/12.0, 2));
+    const double peak2 = 8000.0*exp(-pow((c-662.0)/15.0, 2));
+    weights[i] = background + peak1 + peak2;
+  }
+  weights[1023] = 3; /* ADC clamping */
+  double events = 0;
+  for (size_t i=0; i<1024; i++) {
+    events += weights[i];
+  }
+  evgen_spectrum_t *spectrum = evgen_spectrum_new(weights, 1024);
+  evgen_rng_t rng;
+  evgen_rng_seed(&rng, 1);
+  uint32_t histogram[1024];
+  evgen_spectrum_fill_poisson(spectrum, &rng, histogram, events);
+  evgen_spectrum_unref(spectrum);
+  run("histogram", histogram, 1024, 24);
+
+  /* geiger counter: small counts per time slot, rest of table empty */
+  uint32_t time_series[1800];
+  for (size_t i=0; i<1800; i++) {
+    time_series[i] = (i < 1200) ? evgen_rng_poisson(&rng, 32) : 0;
+  }
+  run("time series", time_series, 1800, 16);
+
+  uint32_t x = 1;
+
+  uint32_t random[1024];
+  for (size_t i=0; i<1024; i++) {
+    x = x*1103515245 + 12345;
+    random[i] = x >> 8;
+  }
+  run("random", random, 1024, 24);
+
+  frame_pool_fmlog_stats();
+  packet_value_table_pool_fmlog_stats();
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
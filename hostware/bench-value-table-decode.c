@@ -0,0 +1,86 @@
+/** \file hostware/bench-value-table-decode.c
+ * \brief Benchmark the value table widening kernels
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Decodes tables of a million elements with every implementation the
+ * CPU supports, for every element size.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "freemcan-log.h"
+#include "value-table-decode.h"
+
+
+#define ELEMENTS (1000*1000)
+#define ROUNDS   50
+
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+int main()
+{
+  uint8_t *src = malloc(4*ELEMENTS);
+  uint32_t *dest = malloc(ELEMENTS*sizeof(uint32_t));
+  assert(src && dest);
+  srand(42);
+  for (size_t i=0; i<4*ELEMENTS; i++) {
+    src[i] = rand();
+  }
+
+  static const unsigned int bpvs[] = { 8, 16, 24, 32 };
+  for (int impl=0; impl<VALUE_TABLE_DECODE_IMPL_COUNT; impl++) {
+    if (!value_table_decode_impl_supported(impl)) {
+      continue;
+    }
+    for (size_t k=0; k<sizeof(bpvs)/sizeof(bpvs[0]); k++) {
+      const double t0 = now();
+      for (unsigned int r=0; r<ROUNDS; r++) {
+        const bool ok = value_table_decode_impl(impl, dest, src,
+                                                ELEMENTS, bpvs[k]);
+        assert(ok);
+      }
+      const double dt = now() - t0;
+      fmlog("%-12s %2u bit: %8.1f Melements/s %8.2f ms/table",
+            value_table_decode_impl_name(impl), bpvs[k],
+            ((double)ROUNDS)*ELEMENTS/dt/1e6, 1e3*dt/ROUNDS);
+    }
+  }
+
+  free(src);
+  free(dest);
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,762 @@
+/** \file hostware/device-relay.c
+ * \brief Relay one device stream to several clients (implementation)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup device_relay Device Stream Relay
+ * \ingroup hostware_generic
+ *
+ * Passes everything a device (the source) sends to all connected
+ * clients, and everything the clients send to the device.
+ *
+ * The device data never enter user space: splice(2) moves them from
+ * the source into a pipe, tee(2) duplicates the pipe buffers into a
+ * pipe for each client, and splice(2) moves them on from there to
+ * the client socket whenever it can take more.
+ *
+ * A client whose pipe is full gets the rest of the data through a
+ * copy buffer instead, and no more tee(2) until that buffer is sent,
+ * to keep the order. Once a client has #RELAY_MAX_BACKLOG bytes in
+ * its copy buffer, the relay stops reading the source until the
+ * client catches up, and the kernel buffers in turn hold up the
+ * device, as flow control on a serial line would.
+ *
+ * If splice(2) cannot read the source (some tty drivers), the relay
+ * reads it into the copy buffers instead.
+ *
+ * In the other direction, each client's data are collected into
+ * command frames (\ref frame_host_to_emb), and only whole frames go
+ * to the source, so the commands of several clients cannot mix.
+ * Bytes which do not start a frame are dropped. The checksum is left
+ * for the firmware to check.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "device-relay.h"
+#include "frame-defs.h"
+#include "freemcan-log.h"
+
+
+/** Requested size of the pipes in bytes */
+#define RELAY_PIPE_SIZE (256*1024)
+
+
+/** Copy buffer size per client which pauses reading the source */
+#define RELAY_MAX_BACKLOG (4*1024*1024)
+
+
+/** Size of the buffer for data from the clients to the source */
+#define RELAY_TO_SOURCE_SIZE 4096
+
+
+/** Size of a command frame header: magic, command, and length */
+#define CMD_HEADER_SIZE 6
+
+
+/** Largest command frame: header, parameters, and checksum */
+#define CMD_FRAME_MAX (CMD_HEADER_SIZE + UINT8_MAX + 1)
+
+
+/** Client connection */
+typedef struct _client_t client_t;
+
+
+/** Internals of #client_t */
+struct _client_t {
+  /** The relay */
+  relay_t *relay;
+  /** Connection to the client */
+  int fd;
+  /** Watch for #fd */
+  evloop_watch_t *watch;
+  /** Pipe holding data for the client, read end and write end */
+  int pipe[2];
+  /** Bytes in #pipe */
+  size_t in_pipe;
+  /** Bytes of the current source chunk in #pipe */
+  size_t teed;
+  /** Copy buffer */
+  uint8_t *copy_buf;
+  /** Offset of the first byte in #copy_buf not sent yet */
+  size_t copy_start;
+  /** Offset of the end of the data in #copy_buf */
+  size_t copy_end;
+  /** Allocated size of #copy_buf */
+  size_t copy_alloc;
+  /** Command frame data received from the client */
+  uint8_t cmd_buf[CMD_FRAME_MAX];
+  /** Bytes in #cmd_buf */
+  size_t cmd_len;
+  /** Next client */
+  client_t *next;
+};
+
+
+/** Internals of opaque #relay_t */
+struct _relay_t {
+  /** Reference counter */
+  unsigned int refs;
+  /** Event loop */
+  evloop_t *loop;
+  /** Connection to the device */
+  int source_fd;
+  /** Watch for #source_fd, NULL while not watched */
+  evloop_watch_t *source_watch;
+  /** Whether splice(2) can read #source_fd */
+  bool source_splice;
+  /** Whether the source has hung up */
+  bool source_hup;
+  /** Whether the source has closed */
+  bool source_eof;
+  /** Whether reading the source is paused for slow clients */
+  bool paused;
+  /** Pipe for data from the source, read end and write end */
+  int pipe[2];
+  /** Capacity of #pipe, and the most we read from the source at once */
+  size_t pipe_size;
+  /** /dev/null, to drop the data every client has got */
+  int null_fd;
+  /** Buffer for the current source chunk where it needs copying */
+  uint8_t *chunk;
+  /** Data from the clients for the source */
+  uint8_t to_source[RELAY_TO_SOURCE_SIZE];
+  /** Bytes in #to_source */
+  size_t to_source_len;
+  /** Connected clients */
+  client_t *clients;
+  /** Number of connected clients */
+  unsigned int client_count;
+  /** Statistics */
+  relay_stats_t stats;
+};
+
+
+/** Create non-blocking pipe, as large as we may, return its capacity */
+static
+size_t open_pipe(int fds[2])
+{
+  if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+    return 0;
+  }
+  /* may fail beyond /proc/sys/fs/pipe-max-size, keep the default then */
+  fcntl(fds[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+  const int size = fcntl(fds[1], F_GETPIPE_SZ);
+  assert(size > 0);
+  return size;
+}
+
+
+/** Set O_NONBLOCK on fd */
+static
+void set_nonblock(const int fd)
+{
+  const int flags = fcntl(fd, F_GETFL);
+  if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+    fmlog_error("fcntl(2) O_NONBLOCK on fd %d", fd);
+    abort();
+  }
+}
+
+
+/** Whether errno only says to try again later */
+static
+bool try_again(void)
+{
+  return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR);
+}
+
+
+/************************************************************************
+ * Clients
+ ************************************************************************/
+
+
+/** Bytes in the copy buffer of client c */
+static
+size_t copy_pending(const client_t *c)
+{
+  return c->copy_end - c->copy_start;
+}
+
+
+/** Append size bytes to the copy buffer of client c */
+static
+void copy_append(client_t *c, const uint8_t *buf, const size_t size)
+{
+  if (c->copy_end + size > c->copy_alloc) {
+    memmove(c->copy_buf, &c->copy_buf[c->copy_start], copy_pending(c));
+    c->copy_end -= c->copy_start;
+    c->copy_start = 0;
+    if (c->copy_end + size > c->copy_alloc) {
+      while (c->copy_end + size > c->copy_alloc) {
+        c->copy_alloc = c->copy_alloc ? (2 * c->copy_alloc) : 65536;
+      }
+      c->copy_buf = realloc(c->copy_buf, c->copy_alloc);
+      assert(c->copy_buf);
+    }
+  }
+  memcpy(&c->copy_buf[c->copy_end], buf, size);
+  c->copy_end += size;
+}
+
+
+/** Disconnect client c */
+static
+void client_close(client_t *c)
+{
+  relay_t *relay = c->relay;
+  client_t **p = &relay->clients;
+  while (*p != c) {
+    assert(*p);
+    p = &(*p)->next;
+  }
+  *p = c->next;
+  relay->client_count--;
+
+  evloop_remove(relay->loop, c->watch);
+  close(c->fd);
+  close(c->pipe[0]);
+  close(c->pipe[1]);
+  free(c->copy_buf);
+  free(c);
+}
+
+
+/** Send client c what we can, first from its pipe, then the copies
+ *
+ * \return false if the client has gone
+ */
+static
+bool client_flush(client_t *c)
+{
+  while (c->in_pipe) {
+    const ssize_t n = splice(c->pipe[0], NULL, c->fd, NULL, c->in_pipe,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      c->in_pipe -= n;
+    } else if ((n < 0) && try_again()) {
+      return true;
+    } else {
+      return false;
+    }
+  }
+  while (copy_pending(c)) {
+    const ssize_t n = send(c->fd, &c->copy_buf[c->copy_start],
+                           copy_pending(c), MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n > 0) {
+      c->copy_start += n;
+    } else if ((n < 0) && try_again()) {
+      return true;
+    } else {
+      return false;
+    }
+  }
+  c->copy_start = c->copy_end = 0;
+  return true;
+}
+
+
+static void update_events(relay_t *self);
+
+
+/** Write what the clients have sent to the source */
+static
+void flush_to_source(relay_t *self)
+{
+  if (!self->to_source_len) {
+    return;
+  }
+  const ssize_t n = write(self->source_fd, self->to_source,
+                          self->to_source_len);
+  if (n > 0) {
+    memmove(self->to_source, &self->to_source[n], self->to_source_len - n);
+    self->to_source_len -= n;
+    self->stats.bytes_to_source += n;
+  } else if ((n < 0) && !try_again()) {
+    fmlog_error("write(2) to source, dropping %zu bytes",
+                self->to_source_len);
+    self->to_source_len = 0;
+  }
+}
+
+
+/** Size of the command frame at the start of the client's buffer
+ *
+ * \return 0 if its header has not arrived yet
+ */
+static
+size_t cmd_frame_size(const client_t *c)
+{
+  if (c->cmd_len < CMD_HEADER_SIZE) {
+    return 0;
+  }
+  return CMD_HEADER_SIZE + c->cmd_buf[CMD_HEADER_SIZE-1] + 1;
+}
+
+
+/** Drop the first size bytes of the client's command buffer */
+static
+void cmd_drop(client_t *c, const size_t size)
+{
+  memmove(c->cmd_buf, &c->cmd_buf[size], c->cmd_len - size);
+  c->cmd_len -= size;
+}
+
+
+/** Drop the bytes before the first possible frame magic */
+static
+void cmd_resync(client_t *c)
+{
+  size_t i = 0;
+  for (; i<c->cmd_len; i++) {
+    const size_t k = (c->cmd_len - i < 4) ? (c->cmd_len - i) : 4;
+    if (memcmp(&c->cmd_buf[i], FRAME_MAGIC_STR, k) == 0) {
+      break;
+    }
+  }
+  if (i > 0) {
+    fmlog("relay: dropping %zu bytes from client fd %d outside command frames",
+          i, c->fd);
+    cmd_drop(c, i);
+  }
+}
+
+
+/** Pass the client's complete command frames to the source, as far
+ *  as they fit into #_relay_t::to_source */
+static
+void client_forward(client_t *c)
+{
+  relay_t *relay = c->relay;
+  if (relay->source_eof || relay->source_hup) {
+    /* nobody to send commands to any more */
+    c->cmd_len = 0;
+    return;
+  }
+  while (true) {
+    cmd_resync(c);
+    const size_t size = cmd_frame_size(c);
+    if ((size == 0) || (c->cmd_len < size) ||
+        (relay->to_source_len + size > RELAY_TO_SOURCE_SIZE)) {
+      return;
+    }
+    memcpy(&relay->to_source[relay->to_source_len], c->cmd_buf, size);
+    relay->to_source_len += size;
+    relay->stats.commands++;
+    cmd_drop(c, size);
+  }
+}
+
+
+/** Whether the client has a complete command frame waiting */
+static
+bool client_cmd_waiting(const client_t *c)
+{
+  const size_t size = cmd_frame_size(c);
+  return (size > 0) && (c->cmd_len >= size);
+}
+
+
+/** Handle client events */
+static
+void client_do_io(void *data, const uint64_t events)
+{
+  client_t *c = data;
+  relay_t *relay = c->relay;
+  if ((events & EPOLLIN) && client_cmd_waiting(c)) {
+    /* wait for room in to_source before reading more */
+  } else if (events & EPOLLIN) {
+    const ssize_t n = read(c->fd, &c->cmd_buf[c->cmd_len],
+                           CMD_FRAME_MAX - c->cmd_len);
+    if (n > 0) {
+      c->cmd_len += n;
+      client_forward(c);
+      flush_to_source(relay);
+    } else if ((n == 0) || !try_again()) {
+      client_close(c);
+      update_events(relay);
+      return;
+    }
+  } else if (events & (EPOLLHUP | EPOLLERR)) {
+    client_close(c);
+    update_events(relay);
+    return;
+  }
+  if ((events & EPOLLOUT) && !client_flush(c)) {
+    client_close(c);
+  }
+  update_events(relay);
+}
+
+
+/************************************************************************
+ * Source
+ ************************************************************************/
+
+
+/** Read exactly size bytes from fd into buf */
+static
+void read_full(const int fd, uint8_t *buf, const size_t size)
+{
+  size_t ofs = 0;
+  while (ofs < size) {
+    const ssize_t n = read(fd, &buf[ofs], size - ofs);
+    if (n > 0) {
+      ofs += n;
+    } else if ((n < 0) && (errno == EINTR)) {
+      continue;
+    } else {
+      fmlog_error("read(2) from relay pipe");
+      abort();
+    }
+  }
+}
+
+
+/** Drop size bytes from the source pipe */
+static
+void drop_from_pipe(relay_t *self, const size_t size)
+{
+  size_t ofs = 0;
+  while (ofs < size) {
+    const ssize_t n = splice(self->pipe[0], NULL, self->null_fd, NULL,
+                             size - ofs, SPLICE_F_MOVE);
+    if (n > 0) {
+      ofs += n;
+    } else if ((n < 0) && (errno == EINTR)) {
+      continue;
+    } else {
+      read_full(self->pipe[0], self->chunk, size - ofs);
+      return;
+    }
+  }
+}
+
+
+/** Pass the size bytes in the source pipe on to all clients */
+static
+void distribute_pipe(relay_t *self, const size_t size)
+{
+  bool copy = false;
+  for (client_t *c = self->clients, *next; c; c = next) {
+    next = c->next;
+    c->teed = 0;
+    if (copy_pending(c)) {
+      /* no overtaking the copies */
+      copy = true;
+      continue;
+    }
+    /* tee(2) always starts at the head of the source pipe, so one
+     * call it is, and the rest needs copying */
+    const ssize_t n = tee(self->pipe[0], c->pipe[1], size,
+                          SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      c->teed = n;
+      c->in_pipe += n;
+      self->stats.bytes_spliced += n;
+    } else if ((n < 0) && !try_again()) {
+      fmlog_error("tee(2) for client fd %d", c->fd);
+      client_close(c);
+      continue;
+    }
+    if (c->teed < size) {
+      copy = true;
+    }
+  }
+
+  if (!copy) {
+    drop_from_pipe(self, size);
+    return;
+  }
+  read_full(self->pipe[0], self->chunk, size);
+  for (client_t *c = self->clients; c; c = c->next) {
+    if (c->teed < size) {
+      copy_append(c, &self->chunk[c->teed], size - c->teed);
+      self->stats.bytes_copied += size - c->teed;
+    }
+  }
+}
+
+
+/** Pass the size bytes in #_relay_t::chunk on to all clients */
+static
+void distribute_chunk(relay_t *self, const size_t size)
+{
+  for (client_t *c = self->clients; c; c = c->next) {
+    copy_append(c, self->chunk, size);
+    self->stats.bytes_copied += size;
+  }
+}
+
+
+/** Stop watching the source */
+static
+void source_unwatch(relay_t *self)
+{
+  if (self->source_watch) {
+    evloop_remove(self->loop, self->source_watch);
+    self->source_watch = NULL;
+  }
+}
+
+
+/** Read a chunk from the source and pass it on */
+static
+void read_source(relay_t *self)
+{
+  ssize_t n;
+  if (self->source_splice) {
+    n = splice(self->source_fd, NULL, self->pipe[1], NULL, self->pipe_size,
+               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if ((n < 0) && (errno == EINVAL)) {
+      fmlog("relay: cannot splice(2) from the source, copying instead");
+      self->source_splice = false;
+      return;
+    }
+  } else {
+    n = read(self->source_fd, self->chunk, self->pipe_size);
+  }
+  if ((n < 0) && try_again()) {
+    return;
+  } else if (n <= 0) {
+    if (n < 0) {
+      fmlog_error("reading from source");
+    }
+    self->source_eof = true;
+    self->to_source_len = 0;
+    source_unwatch(self);
+    return;
+  }
+
+  self->stats.bytes_in += n;
+  if (self->source_splice) {
+    distribute_pipe(self, n);
+  } else {
+    distribute_chunk(self, n);
+  }
+  for (client_t *c = self->clients, *next; c; c = next) {
+    next = c->next;
+    if (!client_flush(c)) {
+      client_close(c);
+    }
+  }
+}
+
+
+/** Handle source events */
+static
+void source_do_io(void *data, const uint64_t events)
+{
+  relay_t *self = data;
+  if (events & EPOLLOUT) {
+    flush_to_source(self);
+    for (client_t *c = self->clients; c; c = c->next) {
+      client_forward(c);
+    }
+  }
+  if (events & EPOLLIN) {
+    read_source(self);
+  } else if (events & (EPOLLHUP | EPOLLERR)) {
+    if (self->paused) {
+      /* read the rest once the clients have caught up */
+      self->source_hup = true;
+      self->to_source_len = 0;
+      source_unwatch(self);
+    } else {
+      read_source(self);
+    }
+  }
+  update_events(self);
+}
+
+
+/** Watch for what we can do now: read the source unless a client is
+ *  too far behind, and write wherever data are waiting */
+static
+void update_events(relay_t *self)
+{
+  bool backlog = false;
+  for (client_t *c = self->clients; c; c = c->next) {
+    if (copy_pending(c) >= RELAY_MAX_BACKLOG) {
+      backlog = true;
+    }
+    const bool pending = c->in_pipe || copy_pending(c);
+    evloop_fd_set_events(self->loop, c->watch,
+                         (client_cmd_waiting(c) ? 0 : EPOLLIN) |
+                         (pending ? EPOLLOUT : 0));
+  }
+
+  if (self->source_eof) {
+    return;
+  }
+  if (backlog && !self->paused) {
+    self->stats.pauses++;
+  }
+  self->paused = backlog;
+  const uint32_t events = (self->paused ? 0 : EPOLLIN) |
+    ((self->to_source_len && !self->source_hup) ? EPOLLOUT : 0);
+  if (self->source_watch) {
+    evloop_fd_set_events(self->loop, self->source_watch, events);
+  } else if (events) {
+    self->source_watch = evloop_add_fd(self->loop, self->source_fd, events,
+                                       source_do_io, self);
+  }
+}
+
+
+/************************************************************************
+ * Public interface
+ ************************************************************************/
+
+
+/* documented in device-relay.h */
+relay_t *relay_new(evloop_t *loop, const int source_fd)
+{
+  relay_t *self = calloc(1, sizeof(*self));
+  assert(self);
+  self->refs = 1;
+  self->loop = loop;
+  evloop_ref(loop);
+  self->source_fd = source_fd;
+  set_nonblock(source_fd);
+  self->source_splice = true;
+
+  self->pipe_size = open_pipe(self->pipe);
+  if (!self->pipe_size) {
+    fmlog_error("pipe2(2)");
+    abort();
+  }
+  self->null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (self->null_fd < 0) {
+    fmlog_error("open(2) /dev/null");
+    abort();
+  }
+  self->chunk = malloc(self->pipe_size);
+  assert(self->chunk);
+
+  /* splice(2) to a client which has gone raises SIGPIPE */
+  signal(SIGPIPE, SIG_IGN);
+
+  self->source_watch = evloop_add_fd(loop, source_fd, EPOLLIN,
+                                     source_do_io, self);
+  return self;
+}
+
+
+/* documented in device-relay.h */
+void relay_ref(relay_t *self)
+{
+  assert(self->refs > 0);
+  self->refs++;
+}
+
+
+/* documented in device-relay.h */
+void relay_unref(relay_t *self)
+{
+  assert(self->refs > 0);
+  self->refs--;
+  if (self->refs == 0) {
+    while (self->clients) {
+      client_close(self->clients);
+    }
+    source_unwatch(self);
+    close(self->pipe[0]);
+    close(self->pipe[1]);
+    close(self->null_fd);
+    free(self->chunk);
+    evloop_unref(self->loop);
+    free(self);
+  }
+}
+
+
+/* documented in device-relay.h */
+void relay_add_client(relay_t *self, const int fd)
+{
+  client_t *c = calloc(1, sizeof(*c));
+  assert(c);
+  if (!open_pipe(c->pipe)) {
+    fmlog_error("pipe2(2) for client fd %d", fd);
+    close(fd);
+    free(c);
+    return;
+  }
+  set_nonblock(fd);
+  c->relay = self;
+  c->fd = fd;
+  c->watch = evloop_add_fd(self->loop, fd, EPOLLIN, client_do_io, c);
+  c->next = self->clients;
+  self->clients = c;
+  self->client_count++;
+  self->stats.clients++;
+  update_events(self);
+}
+
+
+/* documented in device-relay.h */
+unsigned int relay_client_count(const relay_t *self)
+{
+  return self->client_count;
+}
+
+
+/* documented in device-relay.h */
+bool relay_is_closed(const relay_t *self)
+{
+  if (!self->source_eof) {
+    return false;
+  }
+  for (const client_t *c = self->clients; c; c = c->next) {
+    if (c->in_pipe || copy_pending(c)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/* documented in device-relay.h */
+const relay_stats_t *relay_stats(const relay_t *self)
+{
+  return &self->stats;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
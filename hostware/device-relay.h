@@ -0,0 +1,115 @@
+/** \file hostware/device-relay.h
+ * \brief Relay one device stream to several clients (interface)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup device_relay
+ * @{
+ */
+
+
+#ifndef DEVICE_RELAY_H
+#define DEVICE_RELAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freemcan-evloop.h"
+
+
+/** Relay statistics */
+typedef struct {
+  /** Bytes read from the source */
+  uint64_t bytes_in;
+  /** Bytes passed to clients without copying them */
+  uint64_t bytes_spliced;
+  /** Bytes passed to clients through the copy buffer */
+  uint64_t bytes_copied;
+  /** Bytes from clients written to the source */
+  uint64_t bytes_to_source;
+  /** Command frames from clients passed to the source */
+  unsigned long commands;
+  /** Times reading the source has been paused for slow clients */
+  unsigned long pauses;
+  /** Clients added so far */
+  unsigned long clients;
+} relay_stats_t;
+
+
+/** Device stream relay (opaque data type) */
+struct _relay_t;
+
+/** Device stream relay (opaque data type) */
+typedef struct _relay_t relay_t;
+
+
+/** Create relay for source_fd, watched by loop
+ *
+ * Sets source_fd non-blocking. The relay does not close it.
+ */
+relay_t *relay_new(evloop_t *loop, const int source_fd)
+  __attribute__(( nonnull(1) ))
+  __attribute__(( malloc ))
+  __attribute__(( warn_unused_result ));
+
+
+void relay_ref(relay_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Release relay reference, closing all client fds when the last
+ *  reference goes away */
+void relay_unref(relay_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Add client connected via fd, which the relay closes when done
+ *
+ * The client gets everything the source sends from now on, and the
+ * command frames it sends go to the source, each one whole.
+ */
+void relay_add_client(relay_t *self, const int fd)
+  __attribute__(( nonnull(1) ));
+
+
+/** Number of clients connected */
+unsigned int relay_client_count(const relay_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Whether the source has closed and all clients have got all of it */
+bool relay_is_closed(const relay_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Get relay statistics */
+const relay_stats_t *relay_stats(const relay_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** @} */
+
+#endif /* !DEVICE_RELAY_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
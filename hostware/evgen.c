@@ -0,0 +1,526 @@
+/** \file hostware/evgen.c
+ * \brief Monte Carlo event generator (implementation)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup evgen Monte Carlo Event Generator
+ * \ingroup hostware_generic
+ *
+ * Generates the events a detector sees, with statistically correct
+ * arrival times, values, dead time losses and pile-up, for the
+ * emulator, the benchmarks and the tests.
+ *
+ * Event values are drawn from an alias table (Vose's method): Every
+ * value gets a slot holding a threshold and an alias, and one 64 bit
+ * random number picks a slot with its upper half and decides between
+ * the slot's value and its alias with its lower half. That takes the
+ * same time for any spectrum.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "evgen.h"
+
+
+/************************************************************************
+ * Random numbers
+ ************************************************************************/
+
+
+/** Poisson random number for small means (Knuth) */
+static
+uint32_t poisson_small(evgen_rng_t *rng, const double mean)
+{
+  const double limit = exp(-mean);
+  uint32_t k = 0;
+  double p = evgen_rng_uniform(rng);
+  while (p > limit) {
+    k++;
+    p *= evgen_rng_uniform(rng);
+  }
+  return k;
+}
+
+
+/** Poisson random number for larger means
+ *
+ * Transformed rejection with squeeze (PTRS) after W. Hörmann, "The
+ * transformed rejection method for generating Poisson random
+ * variables", Insurance: Mathematics and Economics 12 (1993).
+ */
+static
+uint32_t poisson_ptrs(evgen_rng_t *rng, const double mean)
+{
+  const double slam = sqrt(mean);
+  const double loglam = log(mean);
+  const double b = 0.931 + 2.53 * slam;
+  const double a = -0.059 + 0.02483 * b;
+  const double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+  const double vr = 0.9277 - 3.6224 / (b - 2);
+
+  while (true) {
+    const double u = evgen_rng_uniform(rng) - 0.5;
+    const double v = evgen_rng_uniform(rng);
+    const double us = 0.5 - fabs(u);
+    const double k = floor((2 * a / us + b) * u + mean + 0.43);
+    if ((us >= 0.07) && (v <= vr)) {
+      return (uint32_t)k;
+    }
+    if ((k < 0) || ((us < 0.013) && (v > us))) {
+      continue;
+    }
+    if ((log(v) + log(invalpha) - log(a / (us * us) + b)) <=
+        (-mean + k * loglam - lgamma(k + 1))) {
+      return (uint32_t)k;
+    }
+  }
+}
+
+
+/* documented in evgen.h */
+uint32_t evgen_rng_poisson(evgen_rng_t *rng, const double mean)
+{
+  if (mean <= 0) {
+    return 0;
+  } else if (mean < 10) {
+    return poisson_small(rng, mean);
+  } else {
+    return poisson_ptrs(rng, mean);
+  }
+}
+
+
+/************************************************************************
+ * Spectra
+ ************************************************************************/
+
+
+/* documented in evgen.h */
+void evgen_weights_add_peak(double *weights, const size_t count,
+                            const double mean, const double sigma,
+                            const double area)
+{
+  assert(sigma > 0);
+  /* integrate the Gaussian over each element */
+  const double scale = 1.0 / (sigma * sqrt(2.0));
+  for (size_t i=0; i<count; i++) {
+    const double lo = erf((i - mean) * scale);
+    const double hi = erf((i + 1 - mean) * scale);
+    weights[i] += area * 0.5 * (hi - lo);
+  }
+}
+
+
+/* documented in evgen.h */
+void evgen_weights_add_background(double *weights, const size_t count,
+                                  const double scale, const double area)
+{
+  assert(scale > 0);
+  /* normalize to area over the count elements */
+  const double norm = area / (1.0 - exp(-(double)count / scale));
+  for (size_t i=0; i<count; i++) {
+    weights[i] += norm * (exp(-(i / scale)) - exp(-((i + 1) / scale)));
+  }
+}
+
+
+/** Alias table slot */
+typedef struct {
+  /** Take the slot's value if the lower random half is below this */
+  uint32_t threshold;
+  /** Value to take otherwise */
+  uint32_t alias;
+} alias_slot_t;
+
+
+/** Internals of opaque #evgen_spectrum_t */
+struct _evgen_spectrum_t {
+  /** Reference counter */
+  unsigned int refs;
+  /** Number of different values */
+  size_t count;
+  /** Normalized probabilities of the values */
+  double *probability;
+  /** Alias table with count slots */
+  alias_slot_t *slots;
+};
+
+
+/* documented in evgen.h */
+evgen_spectrum_t *evgen_spectrum_new(const double *weights, const size_t count)
+{
+  assert(count > 0);
+  assert(count <= UINT32_MAX);
+  evgen_spectrum_t *self = malloc(sizeof(*self));
+  assert(self);
+  self->refs = 1;
+  self->count = count;
+  self->probability = malloc(count * sizeof(self->probability[0]));
+  self->slots = malloc(count * sizeof(self->slots[0]));
+  assert(self->probability && self->slots);
+
+  double total = 0;
+  for (size_t i=0; i<count; i++) {
+    assert(weights[i] >= 0);
+    total += weights[i];
+  }
+  assert(total > 0);
+
+  /* Vose's method: pair each value below the average probability
+   * with one above it, which gives away what the former lacks */
+  double *scaled = malloc(count * sizeof(scaled[0]));
+  uint32_t *small = malloc(count * sizeof(small[0]));
+  uint32_t *large = malloc(count * sizeof(large[0]));
+  assert(scaled && small && large);
+  size_t small_count = 0, large_count = 0;
+  for (size_t i=0; i<count; i++) {
+    self->probability[i] = weights[i] / total;
+    scaled[i] = self->probability[i] * count;
+    if (scaled[i] < 1.0) {
+      small[small_count++] = (uint32_t)i;
+    } else {
+      large[large_count++] = (uint32_t)i;
+    }
+  }
+  while (small_count && large_count) {
+    const uint32_t s = small[--small_count];
+    const uint32_t l = large[large_count-1];
+    self->slots[s].threshold = (uint32_t)(scaled[s] * 4294967296.0);
+    self->slots[s].alias = l;
+    scaled[l] -= 1.0 - scaled[s];
+    if (scaled[l] < 1.0) {
+      large_count--;
+      small[small_count++] = l;
+    }
+  }
+  /* what is left has a probability of 1, give or take rounding */
+  while (large_count) {
+    const uint32_t l = large[--large_count];
+    self->slots[l].threshold = UINT32_MAX;
+    self->slots[l].alias = l;
+  }
+  while (small_count) {
+    const uint32_t s = small[--small_count];
+    self->slots[s].threshold = UINT32_MAX;
+    self->slots[s].alias = s;
+  }
+  free(scaled);
+  free(small);
+  free(large);
+  return self;
+}
+
+
+/* documented in evgen.h */
+evgen_spectrum_t *evgen_spectrum_new_cs137(const size_t count)
+{
+  double *weights = calloc(count, sizeof(weights[0]));
+  assert(weights);
+  /* value per keV */
+  const double scale = count / 1000.0;
+  /* 7% FWHM at 662keV, resolution going with the square root */
+  const double sigma_662 = 0.07 * 662 * scale / 2.355;
+  evgen_weights_add_peak(weights, count, 662 * scale, sigma_662, 0.30);
+  /* Ba-137 K x-rays and the backscatter peak */
+  evgen_weights_add_peak(weights, count, 32 * scale,
+                         sigma_662 * sqrt(32.0 / 662.0), 0.05);
+  evgen_weights_add_peak(weights, count, 184 * scale,
+                         sigma_662 * sqrt(184.0 / 662.0), 0.05);
+  /* Compton continuum up to the edge at 477keV, smeared by the
+   * resolution */
+  const double edge = 477 * scale;
+  const double sigma_edge = sigma_662 * sqrt(477.0 / 662.0);
+  for (size_t i=0; i<count; i++) {
+    weights[i] += 0.45 / edge *
+      0.5 * erfc((i + 0.5 - edge) / (sigma_edge * sqrt(2.0)));
+  }
+  evgen_weights_add_background(weights, count, count / 8.0, 0.15);
+
+  evgen_spectrum_t *self = evgen_spectrum_new(weights, count);
+  free(weights);
+  return self;
+}
+
+
+/* documented in evgen.h */
+void evgen_spectrum_ref(evgen_spectrum_t *self)
+{
+  assert(self->refs > 0);
+  self->refs++;
+}
+
+
+/* documented in evgen.h */
+void evgen_spectrum_unref(evgen_spectrum_t *self)
+{
+  assert(self->refs > 0);
+  self->refs--;
+  if (self->refs == 0) {
+    free(self->probability);
+    free(self->slots);
+    free(self);
+  }
+}
+
+
+/* documented in evgen.h */
+size_t evgen_spectrum_count(const evgen_spectrum_t *self)
+{
+  return self->count;
+}
+
+
+/* documented in evgen.h */
+double evgen_spectrum_probability(const evgen_spectrum_t *self,
+                                  const size_t value)
+{
+  assert(value < self->count);
+  return self->probability[value];
+}
+
+
+/** Draw random value from the alias table */
+static inline
+uint32_t spectrum_sample(const evgen_spectrum_t *self, evgen_rng_t *rng)
+{
+  const uint64_t r = evgen_rng_next(rng);
+  /* slot from the upper half without a division */
+  const uint32_t i = (uint32_t)(((r >> 32) * self->count) >> 32);
+  const alias_slot_t *slot = &self->slots[i];
+  return ((uint32_t)r < slot->threshold) ? i : slot->alias;
+}
+
+
+/* documented in evgen.h */
+uint32_t evgen_spectrum_sample(const evgen_spectrum_t *self, evgen_rng_t *rng)
+{
+  return spectrum_sample(self, rng);
+}
+
+
+/* documented in evgen.h */
+void evgen_spectrum_fill_poisson(const evgen_spectrum_t *self,
+                                 evgen_rng_t *rng,
+                                 uint32_t *table, const double events)
+{
+  for (size_t i=0; i<self->count; i++) {
+    table[i] = evgen_rng_poisson(rng, events * self->probability[i]);
+  }
+}
+
+
+/************************************************************************
+ * Event generator
+ ************************************************************************/
+
+
+/** Internals of opaque #evgen_t */
+struct _evgen_t {
+  /** Reference counter */
+  unsigned int refs;
+  /** Detector behaviour */
+  evgen_config_t config;
+  /** Spectrum of the event values, or NULL */
+  evgen_spectrum_t *spectrum;
+  /** Largest value a (piled up) event can have */
+  uint32_t max_value;
+  /** Mean interval between arriving events in seconds */
+  double mean_interval;
+  /** Random number generator */
+  evgen_rng_t rng;
+  /** Statistics */
+  evgen_stats_t stats;
+  /** Arrival time of the next event, already drawn */
+  double next_arrival;
+  /** End of the dead time */
+  double dead_until;
+};
+
+
+/** Draw the arrival time of the event after the next one */
+static inline
+void draw_arrival(evgen_t *self)
+{
+  /* 1-u is in (0, 1], so the log is finite */
+  self->next_arrival -= log(1.0 - evgen_rng_uniform(&self->rng)) *
+    self->mean_interval;
+}
+
+
+/* documented in evgen.h */
+evgen_t *evgen_new(const evgen_config_t *config,
+                   evgen_spectrum_t *spectrum, const uint64_t seed)
+{
+  assert(config->rate >= 0);
+  assert(config->dead_time >= 0);
+  assert(config->pileup_time >= 0);
+  evgen_t *self = calloc(1, sizeof(*self));
+  assert(self);
+  self->refs = 1;
+  self->config = *config;
+  self->spectrum = spectrum;
+  if (spectrum) {
+    evgen_spectrum_ref(spectrum);
+    self->max_value = (uint32_t)(spectrum->count - 1);
+  }
+  evgen_rng_seed(&self->rng, seed);
+  self->dead_until = -INFINITY;
+  if (config->rate > 0) {
+    self->mean_interval = 1.0 / config->rate;
+    self->next_arrival = 0;
+    draw_arrival(self);
+  } else {
+    self->next_arrival = INFINITY;
+  }
+  return self;
+}
+
+
+/* documented in evgen.h */
+void evgen_ref(evgen_t *self)
+{
+  assert(self->refs > 0);
+  self->refs++;
+}
+
+
+/* documented in evgen.h */
+void evgen_unref(evgen_t *self)
+{
+  assert(self->refs > 0);
+  self->refs--;
+  if (self->refs == 0) {
+    if (self->spectrum) {
+      evgen_spectrum_unref(self->spectrum);
+    }
+    free(self);
+  }
+}
+
+
+/** Value of a single event */
+static inline
+uint32_t draw_value(evgen_t *self)
+{
+  return self->spectrum ? spectrum_sample(self->spectrum, &self->rng) : 0;
+}
+
+
+/** Get the next recorded event arriving before time until
+ *
+ * Events piling up onto it are taken into account even if they
+ * arrive after until.
+ *
+ * \return false if there is none
+ */
+static inline
+bool next_event(evgen_t *self, const double until, evgen_event_t *event)
+{
+  while (self->next_arrival < until) {
+    const double t = self->next_arrival;
+    draw_arrival(self);
+    self->stats.events++;
+    if (t < self->dead_until) {
+      self->stats.dead++;
+      if (self->config.paralyzable) {
+        self->dead_until = t + self->config.dead_time;
+      }
+      continue;
+    }
+
+    uint32_t value = draw_value(self);
+    uint32_t pileup = 0;
+    double dead_until = t + self->config.dead_time;
+    const double pileup_until = t + self->config.pileup_time;
+    while (self->next_arrival < pileup_until) {
+      if (self->config.paralyzable) {
+        dead_until = self->next_arrival + self->config.dead_time;
+      }
+      draw_arrival(self);
+      value += draw_value(self);
+      pileup++;
+    }
+    self->stats.events += pileup;
+    self->stats.piled_up += pileup;
+    self->stats.recorded++;
+    self->dead_until = dead_until;
+
+    event->time = t;
+    event->value = (value > self->max_value) ? self->max_value : value;
+    event->pileup = pileup;
+    return true;
+  }
+  return false;
+}
+
+
+/* documented in evgen.h */
+size_t evgen_events(evgen_t *self, evgen_event_t *events, const size_t max,
+                    const double until)
+{
+  size_t n = 0;
+  while ((n < max) && next_event(self, until, &events[n])) {
+    n++;
+  }
+  return n;
+}
+
+
+/* documented in evgen.h */
+void evgen_fill_histogram(evgen_t *self, uint32_t *table, const double until)
+{
+  evgen_event_t event;
+  while (next_event(self, until, &event)) {
+    table[event.value]++;
+  }
+}
+
+
+/* documented in evgen.h */
+uint64_t evgen_count(evgen_t *self, const double until)
+{
+  uint64_t n = 0;
+  evgen_event_t event;
+  while (next_event(self, until, &event)) {
+    n++;
+  }
+  return n;
+}
+
+
+/* documented in evgen.h */
+const evgen_stats_t *evgen_stats(const evgen_t *self)
+{
+  return &self->stats;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
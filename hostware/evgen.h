@@ -0,0 +1,270 @@
+/** \file hostware/evgen.h
+ * \brief Monte Carlo event generator (interface)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup evgen
+ * @{
+ */
+
+
+#ifndef EVGEN_H
+#define EVGEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/** Random number generator (xorshift64*)
+ *
+ * Fast and good enough for Monte Carlo, but not for cryptography.
+ */
+typedef struct {
+  /** Generator state, never 0 */
+  uint64_t state;
+} evgen_rng_t;
+
+
+/** Seed random number generator; every seed gives a different sequence */
+static inline
+void evgen_rng_seed(evgen_rng_t *rng, const uint64_t seed)
+{
+  rng->state = seed ^ 0x9e3779b97f4a7c15ULL;
+  if (!rng->state) {
+    rng->state = 1;
+  }
+}
+
+
+/** Random 64 bit number */
+static inline
+uint64_t evgen_rng_next(evgen_rng_t *rng)
+{
+  rng->state ^= rng->state >> 12;
+  rng->state ^= rng->state << 25;
+  rng->state ^= rng->state >> 27;
+  return rng->state * 2685821657736338717ULL;
+}
+
+
+/** Random number in [0, 1) */
+static inline
+double evgen_rng_uniform(evgen_rng_t *rng)
+{
+  return (evgen_rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/** Poisson distributed random number with the given mean */
+uint32_t evgen_rng_poisson(evgen_rng_t *rng, const double mean)
+  __attribute__(( nonnull(1) ));
+
+
+/** Add Gaussian peak to count weights
+ *
+ * Adds area spread over the weights with the given mean and standard
+ * deviation (in elements), as a detector line would.
+ */
+void evgen_weights_add_peak(double *weights, const size_t count,
+                            const double mean, const double sigma,
+                            const double area)
+  __attribute__(( nonnull(1) ));
+
+
+/** Add exponentially falling background to count weights
+ *
+ * Adds area spread over the weights falling by a factor of e every
+ * scale elements, as Compton continuum and noise would.
+ */
+void evgen_weights_add_background(double *weights, const size_t count,
+                                  const double scale, const double area)
+  __attribute__(( nonnull(1) ));
+
+
+/** Spectrum to draw event values from (opaque data type) */
+struct _evgen_spectrum_t;
+
+/** Spectrum to draw event values from (opaque data type) */
+typedef struct _evgen_spectrum_t evgen_spectrum_t;
+
+
+/** Create spectrum with values 0 to count-1 from their weights
+ *
+ * The weights need not be normalized. Values are drawn in constant
+ * time using an alias table, whatever the shape of the spectrum.
+ */
+evgen_spectrum_t *evgen_spectrum_new(const double *weights, const size_t count)
+  __attribute__(( nonnull(1) ))
+  __attribute__(( malloc ))
+  __attribute__(( warn_unused_result ));
+
+
+/** Create the spectrum of a Cs-137 source on a scintillation detector
+ *
+ * The 662keV peak sits at 2/3 of the value range, with a Compton
+ * continuum below it.
+ */
+evgen_spectrum_t *evgen_spectrum_new_cs137(const size_t count)
+  __attribute__(( malloc ))
+  __attribute__(( warn_unused_result ));
+
+
+void evgen_spectrum_ref(evgen_spectrum_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+void evgen_spectrum_unref(evgen_spectrum_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Number of different values in the spectrum */
+size_t evgen_spectrum_count(const evgen_spectrum_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Probability of the given value */
+double evgen_spectrum_probability(const evgen_spectrum_t *self,
+                                  const size_t value)
+  __attribute__(( nonnull(1) ));
+
+
+/** Draw random value from the spectrum */
+uint32_t evgen_spectrum_sample(const evgen_spectrum_t *self, evgen_rng_t *rng)
+  __attribute__(( nonnull(1,2) ));
+
+
+/** Fill table with what a histogram of the spectrum shows on average
+ *  after events events, each element with Poisson noise
+ *
+ * Much faster than drawing single events for large numbers of events.
+ */
+void evgen_spectrum_fill_poisson(const evgen_spectrum_t *self,
+                                 evgen_rng_t *rng,
+                                 uint32_t *table, const double events)
+  __attribute__(( nonnull(1,2,3) ));
+
+
+/** How events turn into recorded events */
+typedef struct {
+  /** Mean rate of the events arriving at the detector, per second */
+  double rate;
+  /** Events arriving this long (in seconds) after a recorded one
+   *  are lost */
+  double dead_time;
+  /** Whether lost events extend the dead time (paralyzable detector)
+   *  or not (non-paralyzable detector) */
+  bool paralyzable;
+  /** Events arriving this long (in seconds) after a recorded one add
+   *  their value to it (pile-up). Should not exceed #dead_time. */
+  double pileup_time;
+} evgen_config_t;
+
+
+/** A recorded event */
+typedef struct {
+  /** Arrival time in seconds */
+  double time;
+  /** Value, or sum of values if other events have piled up, but at
+   *  most the largest value of the spectrum */
+  uint32_t value;
+  /** Number of events piled up onto this one */
+  uint32_t pileup;
+} evgen_event_t;
+
+
+/** Event generator statistics */
+typedef struct {
+  /** Events arriving at the detector */
+  uint64_t events;
+  /** Events recorded */
+  uint64_t recorded;
+  /** Events lost in the dead time of recorded ones */
+  uint64_t dead;
+  /** Events piled up onto recorded ones */
+  uint64_t piled_up;
+} evgen_stats_t;
+
+
+/** Event generator (opaque data type) */
+struct _evgen_t;
+
+/** Event generator (opaque data type) */
+typedef struct _evgen_t evgen_t;
+
+
+/** Create event generator, starting at time 0
+ *
+ * Events arrive at random with exponentially distributed intervals
+ * (a Poisson process), and their values are drawn from spectrum.
+ *
+ * \param spectrum The spectrum, or NULL if all values are 0.
+ */
+evgen_t *evgen_new(const evgen_config_t *config,
+                   evgen_spectrum_t *spectrum, const uint64_t seed)
+  __attribute__(( nonnull(1) ))
+  __attribute__(( malloc ))
+  __attribute__(( warn_unused_result ));
+
+
+void evgen_ref(evgen_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+void evgen_unref(evgen_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Get the recorded events arriving before time until
+ *
+ * \return Number of events written to events, at most max. If less
+ *         than max, there are no more events before until.
+ */
+size_t evgen_events(evgen_t *self, evgen_event_t *events, const size_t max,
+                    const double until)
+  __attribute__(( nonnull(1,2) ));
+
+
+/** Add the values of the recorded events arriving before time until
+ *  to the histogram table with the number of elements the spectrum
+ *  has */
+void evgen_fill_histogram(evgen_t *self, uint32_t *table, const double until)
+  __attribute__(( nonnull(1,2) ));
+
+
+/** Count the recorded events arriving before time until */
+uint64_t evgen_count(evgen_t *self, const double until)
+  __attribute__(( nonnull(1) ));
+
+
+/** Get event generator statistics */
+const evgen_stats_t *evgen_stats(const evgen_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** @} */
+
+#endif /* !EVGEN_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -26,6 +26,14 @@
  * received, it is handed to the next layer by calling
  * #packet_parser_handle_frame on it.
  *
+ * Value table frames are special cased: As soon as the value table
+ * header and parameters have arrived, the value table elements are
+ * decoded directly into a #packet_value_table_t while the rest of
+ * the payload is still coming in (see
+ * #packet_parser_value_table_start). The frame checksum is verified
+ * before that value table is handed on, just like for any other
+ * frame.
+ *
  * The only potential endianness issue in hostware/frame-parser.c is
  * the frame payload size in #_frame_parser_t::frame_size which is read byte by byte in
  * an endianness independent fashion.
@@ -36,6 +44,8 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 
@@ -44,7 +54,8 @@
 #include "frame-parser.h"
 #include "freemcan-log.h"
 #include "packet-parser.h"
-#include "freemcan-tui.h"
+#include "packet-value-table.h"
+#include "value-table-decode.h"
 
 
 /************************************************************************
@@ -98,9 +109,30 @@ struct _frame_parser_t {
   /** The parsed frame in progress */
   frame_t  *frame_wip; /* work in progress */
 
+  /** The value table being decoded from the frame in progress, if any */
+  packet_value_table_t *vtab_wip;
+
+  /** Whether we have already tried to start #vtab_wip for this frame */
+  bool vtab_tried;
+
+  /** Number of bytes per value table element */
+  size_t vtab_bytes_per_value;
+
+  /** Number of value table elements decoded so far */
+  size_t vtab_elem;
+
+  /** Bytes of an element split across two buffers */
+  uint8_t vtab_carry[4];
+
+  /** Number of valid bytes in #vtab_carry */
+  size_t vtab_carry_len;
+
   /** Count the number of checksum errors we get */
   unsigned int checksum_errors;
 
+  /** Count the number of valid frames we get */
+  unsigned long frame_count;
+
   /** Packet parser */
   packet_parser_t *packet_parser;
 
@@ -136,6 +168,12 @@ void frame_parser_unref(frame_parser_t *self)
   assert(self->refs > 0);
   self->refs--;
   if (self->refs == 0) {
+    if (self->vtab_wip) {
+      packet_value_table_unref(self->vtab_wip);
+    }
+    if (self->frame_wip) {
+      frame_unref(self->frame_wip);
+    }
     if (self->packet_parser) {
       packet_parser_unref(self->packet_parser);
     }
@@ -145,6 +183,13 @@ void frame_parser_unref(frame_parser_t *self)
 }
 
 
+/* documented in frame-parser.h */
+unsigned long frame_parser_get_frame_count(const frame_parser_t *self)
+{
+  return self->frame_count;
+}
+
+
 /************************************************************************
  * Frame Handler (next layer)
  ************************************************************************/
@@ -154,6 +199,146 @@ void frame_parser_unref(frame_parser_t *self)
 bool enable_layer2_dump = false;
 
 
+/* documented in freemcan-frame.h */
+bool enable_value_table_streaming = true;
+
+
+/** Decode value table elements from received payload bytes
+ *
+ * Elements split across two calls are put together in
+ * #_frame_parser_t::vtab_carry. Bytes beyond the last complete
+ * element are ignored, just like #packet_parser_handle_frame does.
+ */
+static
+void vtab_stream(frame_parser_t *self, const uint8_t *buf, const size_t size)
+{
+  packet_value_table_t *vtab = self->vtab_wip;
+  const size_t bpv = self->vtab_bytes_per_value;
+  size_t i = 0;
+
+  if (self->vtab_carry_len > 0) {
+    while ((self->vtab_carry_len < bpv) && (i < size)) {
+      self->vtab_carry[self->vtab_carry_len++] = buf[i++];
+    }
+    if (self->vtab_carry_len < bpv) {
+      return;
+    }
+    const bool ok = value_table_decode(&vtab->elements[self->vtab_elem],
+                                       self->vtab_carry, 1, 8*bpv);
+    assert(ok);
+    self->vtab_elem++;
+    self->vtab_carry_len = 0;
+  }
+
+  const size_t left = vtab->element_count - self->vtab_elem;
+  const size_t avail = (size - i) / bpv;
+  const size_t count = (avail < left) ? avail : left;
+  const bool ok = value_table_decode(&vtab->elements[self->vtab_elem],
+                                     &buf[i], count, 8*bpv);
+  assert(ok);
+  self->vtab_elem += count;
+  i += count * bpv;
+
+  if (self->vtab_elem < vtab->element_count) {
+    /* less than one element left over */
+    memcpy(self->vtab_carry, &buf[i], size - i);
+    self->vtab_carry_len = size - i;
+  }
+}
+
+
+/** Number of payload bytes before the value table elements start
+ *
+ * Only valid for value table frames. Until the fixed size header has
+ * arrived, this is the fixed header size.
+ */
+static
+size_t vtab_head_size(const frame_parser_t *self)
+{
+  const packet_value_table_header_t *header =
+    (const packet_value_table_header_t *)self->frame_wip->payload;
+  if (self->offset < sizeof(*header)) {
+    return sizeof(*header);
+  } else {
+    return packet_value_table_head_size(header);
+  }
+}
+
+
+/** Consume up to size payload bytes, return number of bytes consumed */
+static
+size_t consume_payload(frame_parser_t *self,
+                       const uint8_t *buf, const size_t size)
+{
+  const size_t missing = self->frame_size - self->offset;
+  size_t n = (size < missing) ? size : missing;
+
+  const bool vtab_head = ((self->frame_type == FRAME_TYPE_VALUE_TABLE) &&
+                          !self->vtab_tried);
+  if (self->vtab_wip) {
+    vtab_stream(self, buf, n);
+  } else {
+    if (vtab_head) {
+      /* stop at the end of header and parameters to start streaming */
+      const size_t head_size = vtab_head_size(self);
+      if (self->offset < head_size && head_size - self->offset < n) {
+        n = head_size - self->offset;
+      }
+    }
+    memcpy(&self->frame_wip->payload[self->offset], buf, n);
+  }
+  checksum_update_block(self->checksum_input, buf, n);
+  self->offset += n;
+
+  if (vtab_head) {
+    const size_t head_size = vtab_head_size(self);
+    if ((self->offset >= sizeof(packet_value_table_header_t)) &&
+        (self->offset == head_size)) {
+      self->vtab_tried = true;
+      self->vtab_wip =
+        packet_parser_value_table_start(self->packet_parser,
+                                        self->frame_wip->payload, head_size,
+                                        self->frame_size);
+      if (self->vtab_wip) {
+        const packet_value_table_header_t *header =
+          (const packet_value_table_header_t *)self->frame_wip->payload;
+        self->vtab_bytes_per_value =
+          (header->bits_per_value & ~PACKET_VALUE_TABLE_EXTENDED) / 8;
+        self->vtab_elem = 0;
+        self->vtab_carry_len = 0;
+      } else {
+        /* receive the rest of the frame the normal way */
+        frame_t *frame = frame_new(self->frame_size+1);
+        assert(frame);
+        memcpy(frame->payload, self->frame_wip->payload, self->offset);
+        frame_unref(self->frame_wip);
+        self->frame_wip = frame;
+      }
+    }
+  }
+
+  if (self->offset == self->frame_size) {
+    self->state = STATE_CHECKSUM;
+  }
+  return n;
+}
+
+
+/** Drop the frame in progress and look for the next one */
+static
+void finish_frame(frame_parser_t *self)
+{
+  if (self->vtab_wip) {
+    packet_value_table_unref(self->vtab_wip);
+    self->vtab_wip = NULL;
+  }
+  frame_unref(self->frame_wip);
+  self->frame_wip = NULL;
+  self->offset = 0;
+  self->state = STATE_MAGIC;
+}
+
+
 /** Step the parser FSM */
 static
 void step_fsm(frame_parser_t *self, const char ch)
@@ -211,26 +396,38 @@ void step_fsm(frame_parser_t *self, const char ch)
      *  - dynamic payload size
      *  - terminating convenience nul byte
      */
-    self->frame_wip = frame_new(self->frame_size+1);
+    /* layer 2 dumps need the complete payload in frame_wip */
+    self->vtab_tried = !enable_value_table_streaming || enable_layer2_dump;
+    if ((self->frame_type == FRAME_TYPE_VALUE_TABLE) && !self->vtab_tried) {
+      /* Only the header and parameters go into frame_wip, unless
+       * consume_payload() finds out the value table cannot be
+       * streamed. */
+      const size_t max_head_size =
+        sizeof(packet_value_table_header_t) + UINT8_MAX +
+        sizeof(packet_value_table_ext_header_t);
+      self->frame_wip = frame_new(((self->frame_size < max_head_size)
+                                   ? self->frame_size : max_head_size) + 1);
+    } else {
+      self->frame_wip = frame_new(self->frame_size+1);
+    }
     assert(self->frame_wip);
     self->state = STATE_PAYLOAD;
     return;
   case STATE_PAYLOAD:
-    checksum_update(self->checksum_input, u);
-    self->frame_wip->payload[self->offset] = u;
-    self->offset++;
     if (self->offset < self->frame_size) {
-      self->state = STATE_PAYLOAD;
-      return;
-    } else if (self->offset == self->frame_size) {
-      self->state = STATE_CHECKSUM;
+      consume_payload(self, &u, 1);
       return;
     }
     break;
   case STATE_CHECKSUM:
     self->frame_checksum = u;
     if (checksum_match(self->checksum_input, self->frame_checksum)) {
-      if (self->packet_parser) {
+      self->frame_count++;
+      if (self->vtab_wip) {
+        /* elements have already been decoded while receiving */
+        self->vtab_wip->receive_time = time(NULL);
+        packet_parser_handle_value_table(self->packet_parser, self->vtab_wip);
+      } else if (self->packet_parser) {
         /* nul-terminate the payload buffer for convenience */
         self->frame_wip->payload[self->offset] = '\0';
         self->frame_wip->type = self->frame_type;
@@ -247,17 +444,13 @@ void step_fsm(frame_parser_t *self, const char ch)
           }
           fmlog_data("<<", self->frame_wip->payload, size);
         }
-        update_last_received_size(self->frame_wip->size);
         packet_parser_handle_frame(self->packet_parser, self->frame_wip);
       }
-      frame_unref(self->frame_wip);
-      self->offset = 0;
-      self->state = STATE_MAGIC;
+      finish_frame(self);
       return;
     } else {
       self->checksum_errors++;
-      self->offset = 0;
-      self->state = STATE_MAGIC;
+      finish_frame(self);
       return;
     }
     break;
@@ -273,6 +466,56 @@ void step_fsm(frame_parser_t *self, const char ch)
 bool enable_layer1_dump = false;
 
 
+/* documented in freemcan-frame.h */
+bool enable_frame_parser_bulk = true;
+
+
+/** Consume as many bytes as possible without stepping the FSM
+ *
+ * Handles the two states in which the parser spends almost all its
+ * time: Skipping garbage while looking for the beginning of the
+ * magic, and copying payload bytes. Everything else (magic split
+ * across buffers, size, frame type, checksum) is left to #step_fsm.
+ *
+ * The results are the same as if every byte had been fed to
+ * #step_fsm individually.
+ *
+ * \return number of bytes consumed (0 if the caller must use #step_fsm)
+ */
+static
+size_t bulk_step(frame_parser_t *self, const char *buf, const size_t size)
+{
+  switch (self->state) {
+  case STATE_MAGIC:
+    if (self->offset == 0) {
+      const char *p = memchr(buf, magic[0], size);
+      if (!p) {
+        return size;
+      }
+      const size_t skip = p - buf;
+      const size_t magic_len = strlen(magic);
+      if ((size-skip >= magic_len) && (memcmp(p, magic, magic_len) == 0)) {
+        checksum_reset(self->checksum_input);
+        checksum_update_block(self->checksum_input, p, magic_len);
+        self->offset = 0;
+        self->state = STATE_SIZE;
+        return skip + magic_len;
+      }
+      return skip;
+    }
+    break;
+  case STATE_PAYLOAD:
+    if (self->offset < self->frame_size) {
+      return consume_payload(self, (const uint8_t *)buf, size);
+    }
+    break;
+  default:
+    break;
+  }
+  return 0;
+}
+
+
 /* documented in freemcan-frame.h */
 void frame_parser_handle_bytes(frame_parser_t *self,
                                const void *buf, const size_t size)
@@ -282,8 +525,17 @@ void frame_parser_handle_bytes(frame_parser_t *self,
     fmlog("<Received 0x%04zx=%zd bytes of layer 1 data", size, size);
     fmlog_data("<<", buf, size);
   }
-  for (size_t i=0; i<size; i++) {
+  size_t i = 0;
+  while (i<size) {
+    if (enable_frame_parser_bulk) {
+      const size_t n = bulk_step(self, &cbuf[i], size-i);
+      if (n > 0) {
+        i += n;
+        continue;
+      }
+    }
     step_fsm(self, cbuf[i]);
+    i++;
   }
 }
 
@@ -54,6 +54,11 @@ void frame_parser_unref(frame_parser_t *self)
   __attribute__(( nonnull(1) ));
 
 
+/** Number of frames with valid checksum received so far */
+unsigned long frame_parser_get_frame_count(const frame_parser_t *self)
+  __attribute__(( nonnull(1) ));
+
+
 /** Parse a few bytes as frame
  *
  * Call this function repeatedly as the data is trickling in. Whenever
@@ -73,6 +78,22 @@ extern bool enable_layer1_dump;
 extern bool enable_layer2_dump;
 
 
+/** Whether to decode value tables while their frames arrive
+ *
+ * If false, value table frames are received completely before the
+ * packet parser decodes them. Only useful for comparing the two.
+ */
+extern bool enable_value_table_streaming;
+
+
+/** Whether to skip garbage and copy payload in blocks
+ *
+ * If false, every received byte is run through the parser state
+ * machine individually. Only useful for comparing the two.
+ */
+extern bool enable_frame_parser_bulk;
+
+
 /** @} */
 
 #endif /* !FREEMCAN_FRAME_PARSER_H */
@@ -34,6 +34,7 @@
 #include "freemcan-checksum.h"
 #include "frame.h"
 #include "freemcan-log.h"
+#include "freemcan-pool.h"
 
 
 
@@ -42,11 +43,17 @@
  ************************************************************************/
 
 
+/** Recycled frames */
+static pool_t frame_pool = POOL_INITIALIZER("frame");
+
+
 frame_t *frame_new(const size_t payload_size)
 {
-  frame_t *frame = malloc(sizeof(frame_t) + payload_size);
-  assert(frame);
+  size_t capacity;
+  frame_t *frame = pool_alloc(&frame_pool, sizeof(frame_t) + payload_size,
+                              &capacity);
   frame->refs = 1;
+  frame->capacity = capacity;
   return frame;
 }
 
@@ -63,11 +70,23 @@ void frame_unref(frame_t *self)
   assert(self->refs > 0);
   self->refs--;
   if (self->refs == 0) {
-    free(self);
+    pool_release(&frame_pool, self, self->capacity);
   }
 }
 
 
+void frame_pool_reserve(const size_t payload_size)
+{
+  pool_reserve(&frame_pool, sizeof(frame_t) + payload_size);
+}
+
+
+void frame_pool_fmlog_stats(void)
+{
+  pool_fmlog_stats(&frame_pool);
+}
+
+
 /** @} */
 
 
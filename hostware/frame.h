@@ -40,6 +40,8 @@
 typedef struct {
   /** Reference counter */
   int refs;
+  /** Allocated size in bytes (for the frame pool) */
+  size_t capacity;
   /** Frame type */
   frame_type_t type;
   /** Payload size in bytes */
@@ -62,6 +64,17 @@ void frame_unref(frame_t *self)
   __attribute__(( nonnull(1) ));
 
 
+/** Make the frame pool allocate frames for at least payload_size bytes
+ *
+ * Call this with the largest payload size you expect to receive.
+ */
+void frame_pool_reserve(const size_t payload_size);
+
+
+/** Write frame pool allocation statistics into the log */
+void frame_pool_fmlog_stats(void);
+
+
 /** @} */
 
 #endif /* !FREEMCAN_FRAME_H */
@@ -0,0 +1,209 @@
+/** \file hostware/freemcan-archive.c
+ * \brief Read value tables from an archive
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup hostware_archive_tool Archive Tool
+ * \ingroup hostware
+ *
+ * Lists the value tables in an archive written by
+ * #export_value_table, or dumps one of them in a tab separated
+ * format for scripts to read. The output goes to stdout, log
+ * messages go to stderr.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freemcan-log.h"
+#include "value-table-archive.h"
+
+#include "git-version.h"
+
+
+static void fmlog_command_line_help(const char *const argv0)
+{
+  const char *last_slash = strrchr(argv0, '/');
+  const char *prog = last_slash?(last_slash+1):(argv0);
+  fmlog("Usage: %s list <ARCHIVE> [<FROM> [<TO>]]", prog);
+  fmlog("       %s dump <ARCHIVE> <INDEX>|@<TIME>", prog);
+  fmlog("       %s --help|--version\n", prog);
+  fmlog("list  List the value tables received between the times <FROM>");
+  fmlog("      and <TO> (seconds since the epoch), or all value tables.");
+  fmlog("dump  Dump the value table with the given <INDEX> from the list,");
+  fmlog("      or the first one received at or after <TIME>.");
+}
+
+
+/** Parse time or index argument, exit if invalid */
+static long long parse_number(const char *arg)
+{
+  char *end;
+  const long long value = strtoll(arg, &end, 0);
+  if ((*arg == '\0') || (*end != '\0')) {
+    fmlog("Fatal: Invalid number: %s", arg);
+    exit(EXIT_FAILURE);
+  }
+  return value;
+}
+
+
+/** Format time like the .dat files do */
+static const char *format_time(const time_t time)
+{
+  static char buf[64];
+  const struct tm *tm_ = localtime(&time);
+  assert(tm_);
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S%z", tm_);
+  return buf;
+}
+
+
+/** Read entry at index, exit if it is damaged */
+static void get_entry(const archive_t *archive, const size_t index,
+                      archive_entry_t *entry)
+{
+  if (!archive_get_entry(archive, index, entry)) {
+    fmlog("Fatal: Value table %zu is damaged", index);
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+static void list_tables(const archive_t *archive,
+                        const time_t from, const time_t to)
+{
+  printf("# index\treceive_time\treason\ttype\telements\tduration\ttotal_duration\tdate\n");
+  const size_t count = archive_get_count(archive);
+  for (size_t i=archive_find_time(archive, from);
+       (i<count) && (archive_get_time(archive, i) <= to); i++) {
+    archive_entry_t entry;
+    get_entry(archive, i, &entry);
+    printf("%zu\t%" PRId64 "\t%c\t%c\t%zu\t%u\t%d\t%s\n",
+           i, (int64_t)entry.receive_time, entry.reason, entry.type,
+           entry.element_count, entry.duration, (int)entry.total_duration,
+           format_time(entry.receive_time));
+  }
+}
+
+
+static void dump_table(const archive_t *archive, const size_t index)
+{
+  archive_entry_t entry;
+  get_entry(archive, index, &entry);
+  uint32_t *elements = malloc(entry.element_count*sizeof(uint32_t) + 1);
+  assert(elements);
+  if (!archive_decode_elements(&entry, elements)) {
+    fmlog("Fatal: Elements of value table %zu are damaged", index);
+    exit(EXIT_FAILURE);
+  }
+
+  printf("# receive_time:\t%" PRId64 "\t%s\n",
+         (int64_t)entry.receive_time, format_time(entry.receive_time));
+  printf("# reason:\t%c\n", entry.reason);
+  printf("# type:\t%c\n", entry.type);
+  printf("# bits_per_value:\t%zu\n", entry.orig_bits_per_value);
+  printf("# duration:\t%u\n", entry.duration);
+  printf("# total_duration:\t%d\n", (int)entry.total_duration);
+  printf("# skip_samples:\t%d\n", (int)entry.skip_samples);
+  if (entry.cpu_khz) {
+    printf("# dead_cycles:\t%u\n", entry.dead_cycles);
+    printf("# cpu_khz:\t%u\n", entry.cpu_khz);
+  }
+  if ((entry.token_size == sizeof(time_t)) &&
+      (entry.type == VALUE_TABLE_TYPE_TIME_SERIES)) {
+    time_t start_time;
+    memcpy(&start_time, entry.token, sizeof(start_time));
+    printf("# start_time:\t%" PRId64 "\t%s\n",
+           (int64_t)start_time, format_time(start_time));
+  }
+  printf("# element_count:\t%zu\n", entry.element_count);
+  printf("# idx\tvalue\n");
+  for (size_t i=0; i<entry.element_count; i++) {
+    printf("%zu\t%" PRIu32 "\n", i, elements[i]);
+  }
+  free(elements);
+}
+
+
+/** Archive tool main program */
+int main(int argc, char *argv[])
+{
+  if ((argc == 2) && (strcmp(argv[1], "--help") == 0)) {
+    fmlog_command_line_help(argv[0]);
+    exit(EXIT_SUCCESS);
+  } else if ((argc == 2) && (strcmp(argv[1], "--version") == 0)) {
+    fmlog("freemcan-archive " GIT_VERSION);
+    exit(EXIT_SUCCESS);
+  }
+
+  const bool list = (argc >= 3) && (argc <= 5) && (strcmp(argv[1], "list") == 0);
+  const bool dump = (argc == 4) && (strcmp(argv[1], "dump") == 0);
+  if (!list && !dump) {
+    fmlog_command_line_help(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  archive_t *archive = archive_open(argv[2]);
+  if (!archive) {
+    exit(EXIT_FAILURE);
+  }
+
+  if (list) {
+    const time_t from = (argc >= 4) ? (time_t)parse_number(argv[3]) : 0;
+    const time_t to =
+      (argc >= 5) ? (time_t)parse_number(argv[4]) :
+      (time_t)(((uint64_t)1 << (8*sizeof(time_t)-1)) - 1);
+    list_tables(archive, from, to);
+  } else {
+    const char *arg = argv[3];
+    size_t index;
+    if (arg[0] == '@') {
+      index = archive_find_time(archive, (time_t)parse_number(&arg[1]));
+    } else {
+      const long long n = parse_number(arg);
+      index = (n < 0) ? archive_get_count(archive) : (size_t)n;
+    }
+    if (index >= archive_get_count(archive)) {
+      fmlog("Fatal: No such value table: %s", arg);
+      exit(EXIT_FAILURE);
+    }
+    dump_table(archive, index);
+  }
+
+  archive_unref(archive);
+  exit(EXIT_SUCCESS);
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -115,6 +115,78 @@ void checksum_update(checksum_t *self, const uint8_t value)
 }
 
 
+/** Rotate 16bit value left by s bits */
+static inline uint16_t rotl16(const uint16_t v, const unsigned int s)
+{
+  const unsigned int k = s & 15;
+  return (k == 0) ? v : (uint16_t)((v << k) | (v >> (16-k)));
+}
+
+
+/** Number of bytes processed per step by #checksum_update_block */
+#define CHECKSUM_BLOCK_SIZE 16
+
+
+/** Precomputed contributions of each byte position within a block
+ *
+ * Both the rotation and the XOR are linear over GF(2), so after
+ * #CHECKSUM_BLOCK_SIZE bytes b[0..15] the accumulator is
+ *
+ *   rotl(accu, 3*16) ^ XOR_i rotl(11*b[i], 3*(15-i))
+ *
+ * As rotating a 16bit value by 48 bits is the identity, the old
+ * accumulator just passes through, and the contribution of each byte
+ * only depends on its value and position. The lookups for a block
+ * are independent of each other, unlike the per-byte update chain.
+ */
+static uint16_t checksum_block_table[CHECKSUM_BLOCK_SIZE][256];
+
+
+static void checksum_block_table_init(void)
+  __attribute__(( constructor ));
+
+static void checksum_block_table_init(void)
+{
+  for (unsigned int i=0; i<CHECKSUM_BLOCK_SIZE; i++) {
+    const unsigned int shift = 3*(CHECKSUM_BLOCK_SIZE-1-i);
+    for (unsigned int n=0; n<256; n++) {
+      checksum_block_table[i][n] = rotl16(8*n+2*n+n, shift);
+    }
+  }
+}
+
+
+void checksum_update_block(checksum_t *self, const void *buf, const size_t size)
+{
+  const uint8_t *b = (const uint8_t *)buf;
+  uint16_t accu = self->checksum_accu;
+  size_t i = 0;
+  for (; i+CHECKSUM_BLOCK_SIZE <= size; i+=CHECKSUM_BLOCK_SIZE) {
+    const uint8_t *p = &b[i];
+    const uint16_t t0 =
+      checksum_block_table[ 0][p[ 0]] ^ checksum_block_table[ 1][p[ 1]] ^
+      checksum_block_table[ 2][p[ 2]] ^ checksum_block_table[ 3][p[ 3]];
+    const uint16_t t1 =
+      checksum_block_table[ 4][p[ 4]] ^ checksum_block_table[ 5][p[ 5]] ^
+      checksum_block_table[ 6][p[ 6]] ^ checksum_block_table[ 7][p[ 7]];
+    const uint16_t t2 =
+      checksum_block_table[ 8][p[ 8]] ^ checksum_block_table[ 9][p[ 9]] ^
+      checksum_block_table[10][p[10]] ^ checksum_block_table[11][p[11]];
+    const uint16_t t3 =
+      checksum_block_table[12][p[12]] ^ checksum_block_table[13][p[13]] ^
+      checksum_block_table[14][p[14]] ^ checksum_block_table[15][p[15]];
+    accu ^= t0 ^ t1 ^ t2 ^ t3;
+  }
+  for (; i<size; i++) {
+    const uint8_t  n = b[i];
+    const uint16_t x = 8*n+2*n+n;
+    const uint16_t r = rotl16(accu, 3);
+    accu = r ^ x;
+  }
+  self->checksum_accu = accu;
+}
+
+
 /** @} */
 
 
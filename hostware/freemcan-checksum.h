@@ -56,6 +56,14 @@ void checksum_reset(checksum_t *self)
 void checksum_update(checksum_t *self, const uint8_t value)
   __attribute__(( nonnull(1) ));
 
+/** Update checksum state machine with a block of values
+ *
+ * Equivalent to calling #checksum_update for every byte in buf, but
+ * processes 16 bytes per step using precomputed tables.
+ */
+void checksum_update_block(checksum_t *self, const void *buf, const size_t size)
+  __attribute__(( nonnull(1,2) ));
+
 /** Write checksum to file descriptor */
 void checksum_write(checksum_t *self, const int fd)
   __attribute__(( nonnull(1) ));
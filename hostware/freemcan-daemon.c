@@ -0,0 +1,379 @@
+/** \file hostware/freemcan-daemon.c
+ * \brief Non-interactive freemcan hostware
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup hostware_daemon Daemon
+ * \ingroup hostware
+ *
+ * The daemon is the non-interactive frontend to the MCA hardware,
+ * meant to be run unattended by a service manager. Everything the
+ * TUI user would type in is given on the command line: The
+ * measurement parameters, whether to request intermediate results
+ * periodically, and a sequence of commands to send to each device.
+ *
+ * Each device works through the command sequence on its own: The
+ * next command is sent once the device has answered all previous
+ * ones, or after #COMMAND_TIMEOUT seconds. Value tables are exported
+ * exactly like in the TUI, but only a one line summary is logged for
+ * each table.
+ *
+ * A device which goes away is closed and counts as done, while the
+ * other devices go on measuring. The daemon exits once all devices
+ * are gone, and exits with a failure status whenever it has lost a
+ * device, so the service manager can restart it.
+ *
+ * Log messages go to stderr.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame-defs.h"
+#include "freemcan-devctx.h"
+#include "freemcan-evloop.h"
+#include "freemcan-export.h"
+#include "freemcan-log.h"
+#include "freemcan-pipeline.h"
+
+#include "git-version.h"
+
+
+/** Seconds to wait for the answer to a command before sending the next */
+#define COMMAND_TIMEOUT 10
+
+
+/** Commands valid in a command sequence */
+#define VALID_COMMANDS "aeEfimrsw"
+
+
+/** Per-device state of the daemon */
+typedef struct {
+  /** The device */
+  devctx_t *devctx;
+
+  /** Next command from the command sequence to send */
+  const char *next_command;
+
+  /** When the last command was sent */
+  time_t last_command_time;
+} daemon_device_t;
+
+
+/** Measurement duration in device clock periods */
+static uint16_t duration = 60;
+
+
+/** Number of samples to skip (in some personalities) */
+static uint16_t skip_samples = 0;
+
+
+/** Whether to request intermediate results periodically */
+static bool periodic_updates = false;
+
+
+/** Fixed periodic update interval, 0 for automatic */
+static unsigned long periodic_interval = 0;
+
+
+/** Whether to request intermediate results as delta value tables */
+static bool delta_updates = false;
+
+
+/** Command sequence to send to each device */
+static const char *commands = "";
+
+
+/** Whether to exit once all devices are done */
+static bool exit_when_done = false;
+
+
+/** Set by SIGINT, SIGTERM, or when all devices are done */
+static bool quit_flag = false;
+
+
+/** Send one command from the command sequence to the device */
+static void send_command(daemon_device_t *dev, const char cmd)
+{
+  switch (cmd) {
+  case 'm':
+    devctx_send_measurement_params(dev->devctx, true, duration, skip_samples);
+    break;
+  case 'e':
+    devctx_send_measurement_params(dev->devctx, false, duration, skip_samples);
+    break;
+  case 'i':
+    devctx_request_intermediate(dev->devctx, false);
+    break;
+  case 'w':
+    devctx_request_intermediate(dev->devctx, true);
+    break;
+  default:
+    devctx_send_simple_command(dev->devctx, cmd);
+    break;
+  }
+  dev->last_command_time = time(NULL);
+}
+
+
+/** Advance device through its command sequence
+ *
+ * \return Whether the device is done, i.e. has worked through the
+ *         command sequence and is not measuring, or has gone away.
+ */
+static bool step_device(daemon_device_t *dev)
+{
+  if (devctx_is_dead(dev->devctx)) {
+    return true;
+  }
+  const bool idle = devctx_is_idle(dev->devctx);
+  const bool timed_out =
+    (time(NULL) - dev->last_command_time) >= COMMAND_TIMEOUT;
+  if (!idle && !timed_out) {
+    return false;
+  }
+  if (*dev->next_command) {
+    if (!idle) {
+      fmlog("%sNo answer from device, sending next command anyway",
+            devctx_get_label(dev->devctx));
+    }
+    send_command(dev, *dev->next_command);
+    dev->next_command++;
+    return false;
+  }
+  return !devctx_is_measuring(dev->devctx);
+}
+
+
+/** SIGINT or SIGTERM received */
+static void daemon_evloop_signal(void *data, const uint64_t signo)
+{
+  fmlog("Received signal %d, exiting.", (int)signo);
+  quit_flag = true;
+  evloop_quit((evloop_t *)data);
+}
+
+
+static void daemon_fmlog_command_line_help(const char *const argv0)
+{
+  const char *last_slash = strrchr(argv0, '/');
+  const char *prog = last_slash?(last_slash+1):(argv0);
+  fmlog("Usage: %s [<option>...] <SERIAL_PORT>[,<OUTDIR>]...", prog);
+  fmlog("Run measurements on the FreeMCAn devices connected to the given");
+  fmlog("<SERIAL_PORT>s without user interaction. Value tables from each device");
+  fmlog("are written to its <OUTDIR>, which defaults to \".\" for a single device");
+  fmlog("and to the basename of <SERIAL_PORT> for multiple devices.\n");
+  fmlog("Options:");
+  fmlog("   -d --duration=N        measurement duration in device clock periods (%u)",
+        duration);
+  fmlog("   -s --skip-samples=N    number of samples to skip (%u)", skip_samples);
+  fmlog("   -p --periodic=SECONDS  request intermediate results periodically,");
+  fmlog("                          every SECONDS or automatically timed if 0");
+  fmlog("   -u --delta             request intermediate results as delta value tables");
+  fmlog("   -c --commands=SEQ      send command sequence SEQ to each device, e.g. \"m\"");
+  fmlog("   -x --exit              exit once all devices have finished the command");
+  fmlog("                          sequence and are not measuring");
+  fmlog("   -A --archive-only      only append value tables to the archive, write no");
+  fmlog("                          .dat files");
+  fmlog("   -h --help              print help message and exit");
+  fmlog("   -V --version           print version message and exit\n");
+  fmlog("Commands (same keys as in freemcan-tui):");
+  fmlog("   a  abort measurement      e  write parameters to EEPROM");
+  fmlog("   E  read EEPROM parameters f  request personality information");
+  fmlog("   i  intermediate result    m  start measurement");
+  fmlog("   r  reset device           s  request device state");
+  fmlog("   w  intermediate result, written to file");
+}
+
+
+/** Parse unsigned number option argument, abort if invalid */
+static unsigned long parse_number(const char *arg, const char *name,
+                                  const unsigned long max)
+{
+  char *end;
+  const unsigned long value = strtoul(arg, &end, 0);
+  if ((*arg == '\0') || (*end != '\0') || (value > max)) {
+    fmlog_error("Fatal: Invalid %s: %s", name, arg);
+    exit(EXIT_FAILURE);
+  }
+  return value;
+}
+
+
+/** Parse command line options, return index of first device argument */
+static int parse_options(int argc, char *argv[])
+{
+  static const struct option long_options[] = {
+    { "duration",     required_argument, NULL, 'd' },
+    { "skip-samples", required_argument, NULL, 's' },
+    { "periodic",     required_argument, NULL, 'p' },
+    { "delta",        no_argument,       NULL, 'u' },
+    { "commands",     required_argument, NULL, 'c' },
+    { "exit",         no_argument,       NULL, 'x' },
+    { "archive-only", no_argument,       NULL, 'A' },
+    { "help",         no_argument,       NULL, 'h' },
+    { "version",      no_argument,       NULL, 'V' },
+    { NULL, 0, NULL, 0 }
+  };
+  while (1) {
+    const int c = getopt_long(argc, argv, "d:s:p:uc:xAhV", long_options, NULL);
+    if (c == -1) {
+      break;
+    }
+    switch (c) {
+    case 'd':
+      duration = parse_number(optarg, "duration", UINT16_MAX);
+      break;
+    case 's':
+      skip_samples = parse_number(optarg, "skip_samples", UINT16_MAX);
+      break;
+    case 'p':
+      periodic_updates = true;
+      periodic_interval = parse_number(optarg, "periodic interval", 86400);
+      break;
+    case 'u':
+      delta_updates = true;
+      break;
+    case 'c':
+      if (optarg[strspn(optarg, VALID_COMMANDS)] != '\0') {
+        fmlog_error("Fatal: Invalid command sequence: %s", optarg);
+        exit(EXIT_FAILURE);
+      }
+      commands = optarg;
+      break;
+    case 'x':
+      exit_when_done = true;
+      break;
+    case 'A':
+      enable_dat_files = false;
+      break;
+    case 'h':
+      daemon_fmlog_command_line_help(argv[0]);
+      exit(EXIT_SUCCESS);
+    case 'V':
+      fmlog("freemcan-daemon " GIT_VERSION);
+      exit(EXIT_SUCCESS);
+    default:
+      daemon_fmlog_command_line_help(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (optind >= argc) {
+    fmlog_error("Fatal: No device given.");
+    daemon_fmlog_command_line_help(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  return optind;
+}
+
+
+/** Daemon main program */
+int main(int argc, char *argv[])
+{
+  const int first_device = parse_options(argc, argv);
+  const size_t device_count = argc - first_device;
+
+  fmlog("freemcan daemon " GIT_VERSION);
+
+  evloop_t *loop = evloop_new();
+  evloop_add_signal(loop, SIGINT,  daemon_evloop_signal, loop);
+  evloop_add_signal(loop, SIGTERM, daemon_evloop_signal, loop);
+
+  pipeline_t *pipeline = pipeline_new();
+
+  daemon_device_t devices[device_count];
+  size_t open_count = 0;
+  for (size_t i=0; i<device_count; i++) {
+    devctx_t *devctx =
+      devctx_new_from_spec(argv[first_device+i], device_count > 1);
+    if (!devctx) {
+      fmlog_error("Fatal: Cannot open device %s", argv[first_device+i]);
+      quit_flag = true;
+      break;
+    }
+    devctx_set_value_table_logging(devctx, false);
+    devctx_set_pipeline(devctx, pipeline);
+    devctx_set_periodic_interval(devctx, periodic_interval);
+    if (delta_updates) {
+      devctx_set_delta_updates(devctx, true);
+    }
+    devctx_attach(devctx, loop);
+    devices[i].devctx = devctx;
+    devices[i].next_command = commands;
+    open_count++;
+    send_command(&devices[i], FRAME_CMD_PERSONALITY_INFO);
+    devctx_send_simple_command(devctx, FRAME_CMD_STATE);
+    if (periodic_updates) {
+      devctx_set_periodic_updates(devctx, true);
+    }
+  }
+
+  /** main loop: wake up at least once a second for the command timeouts */
+  while (!quit_flag) {
+    evloop_run_once(loop, 1000);
+    bool all_done = true;
+    size_t lost_count = 0;
+    for (size_t i=0; i<device_count; i++) {
+      if (!step_device(&devices[i])) {
+        all_done = false;
+      }
+      if (devctx_is_dead(devices[i].devctx)) {
+        lost_count++;
+      }
+    }
+    if (lost_count == device_count) {
+      fmlog("Fatal: Lost all devices, exiting.");
+      quit_flag = true;
+    } else if (exit_when_done && all_done) {
+      fmlog("All devices done, exiting.");
+      quit_flag = true;
+    }
+  }
+
+  bool failed = (open_count < device_count);
+  for (size_t i=0; i<open_count; i++) {
+    if (devctx_is_dead(devices[i].devctx)) {
+      fmlog("%sDevice was lost", devctx_get_label(devices[i].devctx));
+      failed = true;
+    }
+    devctx_unref(devices[i].devctx);
+  }
+  pipeline_fmlog_stats(pipeline);
+  pipeline_unref(pipeline);
+  evloop_unref(loop);
+  exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,719 @@
+/** \file hostware/freemcan-devctx.c
+ * \brief Per-device context (implementation)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup freemcan_devctx Device Context
+ * \ingroup hostware_generic
+ *
+ * A device context (#devctx_t) is everything the hostware knows about
+ * one connected device: Its own #device_t, #frame_parser_t and
+ * #packet_parser_t (which keeps the device's personality info), the
+ * state of the measurement running on the device, and the directory
+ * its value tables are exported to. Nothing in here is shared between
+ * devices, so one process can drive any number of them at the same
+ * time.
+ *
+ * A device which goes away (read error or EOF, e.g. an unplugged
+ * USB serial adapter) only takes its own device context down: It is
+ * closed and removed from the event loop, and the other devices go
+ * on measuring. Its owner finds out with #devctx_is_dead.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "compiler.h"
+#include "endian-conversion.h"
+
+#include "frame-parser.h"
+#include "freemcan-devctx.h"
+#include "freemcan-device.h"
+#include "freemcan-export.h"
+#include "freemcan-log.h"
+#include "freemcan-packet.h"
+#include "freemcan-pipeline.h"
+#include "packet-parser.h"
+
+
+/** Internals of opaque #devctx_t */
+struct _devctx_t {
+  /** Reference counter */
+  unsigned int refs;
+
+  /** Log message prefix */
+  char *label;
+
+  /** Directory to export value tables to */
+  char *outdir;
+
+  /** The device (owns the frame parser) */
+  device_t *device;
+
+  /** The packet parser (owns the personality info) */
+  packet_parser_t *packet_parser;
+
+  /** Event loop we are attached to, NULL if none */
+  evloop_t *loop;
+
+  /** Device fd watch */
+  evloop_watch_t *fd_watch;
+
+  /** Periodic update timer */
+  evloop_watch_t *timer;
+
+  /** Whether the device has gone away and been closed */
+  bool dead;
+
+  /** Whether the device says it is measuring */
+  bool is_measuring;
+
+  /** Number of requests the device has not answered yet */
+  int waiting_for;
+
+  /** Last sent duration, used for calculating periodic update interval */
+  uint16_t last_sent_duration;
+
+  /** Size of largest received value table */
+  size_t last_received_size;
+
+  /** Whether to write the next intermediate value table to a file */
+  bool write_next_intermediate;
+
+  /** Whether to request intermediate results periodically */
+  bool periodic_updates;
+
+  /** Periodic update interval in seconds */
+  unsigned long periodic_update_interval;
+
+  /** Fixed periodic update interval in seconds, 0 for automatic */
+  unsigned long fixed_periodic_update_interval;
+
+  /** Whether to request intermediate results as delta value tables */
+  bool delta_updates;
+
+  /** Whether to log received value tables element by element */
+  bool log_value_tables;
+
+  /** Worker threads to log and export value tables, NULL if none */
+  pipeline_t *pipeline;
+};
+
+
+/** Arm the periodic update timer while the device is measuring
+ *
+ * Disarms it otherwise: Intermediate results only make sense during
+ * a measurement, and a device still starting up would just be sent
+ * requests it cannot answer yet.
+ */
+static
+void update_periodic_timer(devctx_t *self)
+{
+  if (self->timer) {
+    const bool armed = self->periodic_updates && self->is_measuring;
+    evloop_timer_set(self->timer,
+                     armed ? (1000UL * self->periodic_update_interval) : 0);
+  }
+}
+
+
+/** Recalculate the periodic update interval, re-arm timer if changed
+ *
+ * \bug Needs to work with personalities which only need skip_samples,
+ *      but no duration!
+ */
+static
+void recalculate_periodic_interval(devctx_t *self)
+{
+  const unsigned long last_interval = self->periodic_update_interval;
+  const personality_info_t *pi =
+    packet_parser_get_personality_info(self->packet_parser);
+  if (self->fixed_periodic_update_interval) {
+    self->periodic_update_interval = self->fixed_periodic_update_interval;
+  } else if (self->last_sent_duration && pi) {
+    const float clock_period = 1.0f/((float)pi->units_per_second);
+    const float tmp = 1.5*sqrt(self->last_sent_duration*clock_period);
+    self->periodic_update_interval =
+      tmp + ((self->last_received_size * 10UL) / 115200UL);
+    if (self->periodic_update_interval < 5) {
+      self->periodic_update_interval = 5;
+    }
+  } else {
+    self->periodic_update_interval = 20;
+  }
+  if (last_interval != self->periodic_update_interval) {
+    fmlog("%sPeriodic update interval updated from %lu to %lu",
+          self->label, last_interval, self->periodic_update_interval);
+    update_periodic_timer(self);
+  }
+}
+
+
+/** State data packet handler */
+static void packet_handler_state(const char *state, void *data)
+{
+  devctx_t *self = data;
+  if (self->waiting_for > 0) {
+    self->waiting_for--;
+  }
+  fmlog("%s<STATE: %s", self->label, state);
+  const bool was_measuring = self->is_measuring;
+  self->is_measuring = (strcmp("MEASURING", state) == 0);
+  if (self->is_measuring != was_measuring) {
+    update_periodic_timer(self);
+  }
+}
+
+
+/** Text data packet handler */
+static void packet_handler_text(const char *text, void *data)
+{
+  devctx_t *self = data;
+  if (self->waiting_for > 0) {
+    self->waiting_for--;
+  }
+  fmlog("%s<TEXT: %s", self->label, text);
+}
+
+
+/** Parameter data from EEPROM */
+static void packet_handler_params_from_eeprom(const void *params,
+                                              const size_t size,
+                                              void *data)
+{
+  devctx_t *self = data;
+  fmlog("%s<EEPROM PARAMS:", self->label);
+  fmlog_data("<<", params, size);
+}
+
+
+/** Firmware personality info packet handler */
+static void packet_handler_personality_info(personality_info_t *pi,
+                                            void *data)
+{
+  devctx_t *self = data;
+  fmlog("%s<PERSONALITY INFO: personality_name:\"%s\" units_per_second=%u",
+        self->label, pi->personality_name, pi->units_per_second);
+  fmlog("%s<                  sizeof_table:%zu bits_per_value:%zu",
+        self->label, pi->sizeof_table, pi->bits_per_value);
+  fmlog("%s<                  sz(timer_count):%zu sz(skip_samples):%zu",
+        self->label,
+        pi->param_data_size_timer_count, pi->param_data_size_skip_samples);
+  fmlog("%s<                  %zu elements of %zu bits each",
+        self->label,
+        8*pi->sizeof_table / pi->bits_per_value, pi->bits_per_value);
+  /* the packet parser keeps pi for us */
+}
+
+
+/** Value table data packet handler */
+static void packet_handler_value_table(packet_value_table_t *value_table_packet,
+                                       void *data)
+{
+  devctx_t *self = data;
+  if (self->waiting_for > 0) {
+    self->waiting_for--;
+  }
+
+  const size_t element_count = value_table_packet->element_count;
+  const packet_value_table_reason_t reason = value_table_packet->reason;
+  const packet_value_table_type_t type = value_table_packet->type;
+  self->last_sent_duration = value_table_packet->total_duration;
+  const size_t received_size = value_table_packet->wire_size;
+  if (received_size > self->last_received_size) {
+    self->last_received_size = received_size;
+  }
+  recalculate_periodic_interval(self);
+
+  char buf[128];
+  char reason_str[16];
+  if ((reason>=32)&&(reason<127)) {
+    snprintf(reason_str, sizeof(reason_str), "'%c'", reason);
+  } else {
+    snprintf(reason_str, sizeof(reason_str), "0x%02x=%d", reason, reason);
+  }
+  char type_str[16];
+  if ((type>=32)&&(type<127)) {
+    snprintf(type_str, sizeof(type_str), "'%c'", type);
+  } else {
+    snprintf(type_str, sizeof(type_str), "0x%02x=%d", type, type);
+  }
+  snprintf(buf, sizeof(buf),
+           "%s<Received %s type value table for reason %s: %%d elements, %%d seconds, %%zu bytes:",
+           self->label, type_str, reason_str);
+
+  fmlog(buf, (int)element_count, value_table_packet->duration, received_size);
+  /* export current value table to file(s) */
+  const bool write_intermediate = self->write_next_intermediate;
+  self->write_next_intermediate = false;
+  personality_info_t *pi =
+    packet_parser_get_personality_info(self->packet_parser);
+
+  if (self->pipeline) {
+    if (self->log_value_tables) {
+      pipeline_render(self->pipeline, self->label, value_table_packet);
+    }
+    pipeline_export(self->pipeline, self->outdir, pi,
+                    value_table_packet, write_intermediate);
+    return;
+  }
+
+  if (self->log_value_tables) {
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%s< ", self->label);
+    fmlog_value_table(prefix, value_table_packet->elements, element_count);
+  }
+  export_value_table(self->outdir, pi, value_table_packet, write_intermediate);
+}
+
+
+/** Copy a string (strdup(3) is not C99) */
+static char *copy_string(const char *str)
+{
+  const size_t size = strlen(str) + 1;
+  char *result = malloc(size);
+  assert(result);
+  memcpy(result, str, size);
+  return result;
+}
+
+
+/* documented in freemcan-devctx.h */
+devctx_t *devctx_new(const char *device_name, const char *outdir,
+                     const char *label)
+{
+  devctx_t *self = calloc(1, sizeof(*self));
+  assert(self);
+  self->refs = 1;
+  self->label = copy_string(label);
+  self->outdir = copy_string(outdir);
+  self->periodic_update_interval = 20;
+  self->log_value_tables = true;
+
+  if ((mkdir(outdir, 0777) < 0) && (errno != EEXIST)) {
+    fmlog_error("%sCannot create output directory %s", label, outdir);
+    free(self->outdir);
+    free(self->label);
+    free(self);
+    return NULL;
+  }
+
+  self->packet_parser =
+    packet_parser_new(packet_handler_value_table,
+                      packet_handler_state,
+                      packet_handler_text,
+                      packet_handler_personality_info,
+                      packet_handler_params_from_eeprom,
+                      self);
+  frame_parser_t *fp = frame_parser_new(self->packet_parser);
+  self->device = device_new(fp);
+  if (device_open(self->device, device_name) < 0) {
+    fmlog("%sCannot open device %s", label, device_name);
+    self->dead = true;
+    devctx_unref(self);
+    return NULL;
+  }
+  /* everything else initialized to 0 and NULL courtesy of calloc(3) */
+  return self;
+}
+
+
+/* documented in freemcan-devctx.h */
+devctx_t *devctx_new_from_spec(const char *spec, const bool multiple)
+{
+  const size_t len = strlen(spec);
+  char device_name[len+1];
+  memcpy(device_name, spec, len+1);
+  char *comma = strchr(device_name, ',');
+  if (comma) {
+    *comma = '\0';
+  }
+  const char *last_slash = strrchr(device_name, '/');
+  const char *basename = last_slash?(last_slash+1):(device_name);
+  const char *outdir = comma ? (comma+1) : (multiple ? basename : ".");
+  char label[len+4];
+  if (multiple) {
+    snprintf(label, sizeof(label), "[%s] ", basename);
+  } else {
+    label[0] = '\0';
+  }
+  return devctx_new(device_name, outdir, label);
+}
+
+
+void devctx_ref(devctx_t *self)
+{
+  assert(self->refs > 0);
+  self->refs++;
+}
+
+
+void devctx_unref(devctx_t *self)
+{
+  assert(self->refs > 0);
+  self->refs--;
+  if (self->refs == 0) {
+    if (self->loop) {
+      if (self->timer) {
+        evloop_remove(self->loop, self->timer);
+      }
+      if (self->fd_watch) {
+        evloop_remove(self->loop, self->fd_watch);
+      }
+      evloop_unref(self->loop);
+    }
+    if (!self->dead) {
+      device_close(self->device);
+    }
+    device_unref(self->device);
+    packet_parser_unref(self->packet_parser);
+    free(self->outdir);
+    free(self->label);
+    free(self);
+  }
+}
+
+
+/** Watch the device fd for writability while commands are queued */
+static void update_fd_events(devctx_t *self)
+{
+  if (self->fd_watch) {
+    evloop_fd_set_events(self->loop, self->fd_watch,
+                         EPOLLIN |
+                         (device_tx_pending(self->device) ? EPOLLOUT : 0));
+  }
+}
+
+
+/** Account for a command sent to the device */
+static void command_sent(devctx_t *self)
+{
+  if (!self->dead) {
+    update_fd_events(self);
+    self->waiting_for++;
+  }
+}
+
+
+/** The device has gone away: close it, keep the other devices going */
+static void devctx_lost(devctx_t *self)
+{
+  fmlog("%sLost device, closing it", self->label);
+  if (self->timer) {
+    evloop_remove(self->loop, self->timer);
+    self->timer = NULL;
+  }
+  if (self->fd_watch) {
+    evloop_remove(self->loop, self->fd_watch);
+    self->fd_watch = NULL;
+  }
+  device_close(self->device);
+  self->dead = true;
+  self->is_measuring = false;
+  self->waiting_for = 0;
+}
+
+
+/** Device fd is readable or writable */
+static void devctx_evloop_do_io(void *data, const uint64_t events)
+{
+  devctx_t *self = data;
+  if (((events & EPOLLOUT) && (device_do_write(self->device) < 0)) ||
+      ((events & ~EPOLLOUT) && (device_do_io(self->device) < 0))) {
+    devctx_lost(self);
+    return;
+  }
+  update_fd_events(self);
+}
+
+
+/** Request intermediate result, as delta value table if enabled */
+static void send_intermediate_request(devctx_t *self)
+{
+  if (self->delta_updates) {
+    uint8_t ack = packet_parser_get_delta_ack(self->packet_parser);
+    device_send_command_with_params(self->device,
+                                    FRAME_CMD_INTERMEDIATE_DELTA,
+                                    &ack, sizeof(ack));
+    command_sent(self);
+  } else {
+    devctx_send_simple_command(self, FRAME_CMD_INTERMEDIATE);
+  }
+}
+
+
+/** Periodic update timer has expired (once or several times) */
+static void devctx_evloop_timeout(void *data, const uint64_t UP(expirations))
+{
+  devctx_t *self = data;
+  if (self->waiting_for > 2) {
+    /* Not connected, apparently. Implies not measuring, either. */
+    self->is_measuring = false;
+    update_periodic_timer(self);
+  }
+  if (self->is_measuring) {
+    send_intermediate_request(self);
+  }
+}
+
+
+/* documented in freemcan-devctx.h */
+void devctx_attach(devctx_t *self, evloop_t *loop)
+{
+  assert(!self->loop);
+  evloop_ref(loop);
+  self->loop = loop;
+  self->fd_watch = evloop_add_fd(loop, device_get_fd(self->device), EPOLLIN,
+                                 devctx_evloop_do_io, self);
+  update_fd_events(self);
+  self->timer = evloop_add_timer(loop, devctx_evloop_timeout, self);
+  update_periodic_timer(self);
+}
+
+
+/* documented in freemcan-devctx.h */
+const char *devctx_get_label(const devctx_t *self)
+{
+  return self->label;
+}
+
+
+/* documented in freemcan-devctx.h */
+personality_info_t *devctx_get_personality_info(devctx_t *self)
+{
+  return packet_parser_get_personality_info(self->packet_parser);
+}
+
+
+/* documented in freemcan-devctx.h */
+void devctx_send_simple_command(devctx_t *self, const frame_cmd_t cmd)
+{
+  device_send_command(self->device, cmd);
+  command_sent(self);
+}
+
+
+/** Parameter layout with a single uint16_t param and time_t token */
+typedef struct {
+  /* to be read by firmware, needs endianness conversion */
+  uint16_t _a;
+
+  /* sent back as-is, not interpreted by firmware in any way */
+  time_t start_time;
+} PACKED measure_params_16_t;
+
+
+/** Parameter layout with two uint16_t params and time_t token */
+typedef struct {
+  /* to be read by firmware, needs endianness conversion */
+  uint16_t _a;
+  uint16_t _b;
+
+  /* sent back as-is, not interpreted by firmware in any way */
+  time_t start_time;
+} PACKED measure_params_16_16_t;
+
+
+static
+void send_command_16(devctx_t *self, const frame_cmd_t cmd,
+                     const time_t ts, const uint16_t a)
+{
+  measure_params_16_t params = {
+    htole16(a),
+    ts
+  };
+  device_send_command_with_params(self->device, cmd,
+                                  &params, sizeof(params));
+  command_sent(self);
+}
+
+
+static
+void send_command_16_16(devctx_t *self, const frame_cmd_t cmd,
+                        const time_t ts, const uint16_t a, const uint16_t b)
+{
+  measure_params_16_16_t params = {
+    htole16(a),
+    htole16(b),
+    ts
+  };
+  device_send_command_with_params(self->device, cmd,
+                                  &params, sizeof(params));
+  command_sent(self);
+}
+
+
+/* documented in freemcan-devctx.h */
+void devctx_send_measurement_params(devctx_t *self, const bool do_measure,
+                                    const uint16_t duration,
+                                    const uint16_t skip_samples)
+{
+  self->last_sent_duration = duration;
+  recalculate_periodic_interval(self);
+
+  const frame_cmd_t cmd =
+    do_measure?FRAME_CMD_MEASURE:FRAME_CMD_PARAMS_TO_EEPROM;
+  /* We cannot know when the measurement will be started with the
+   * parameters in the EEPROM, so we clearly mark this one with a
+   * start_time of 0 which cannot be mistaken for a contemporary
+   * time_t value.
+   */
+  const time_t ts =
+    do_measure?time(NULL):0;
+  if (do_measure) {
+    packet_parser_reset_delta(self->packet_parser);
+  }
+  const personality_info_t *pi =
+    packet_parser_get_personality_info(self->packet_parser);
+  if (pi) {
+    if ((pi->param_data_size_timer_count == 2) &&
+        (pi->param_data_size_skip_samples == 2)) {
+      send_command_16_16(self, cmd, ts, duration, skip_samples);
+    } else if ((pi->param_data_size_timer_count == 0) &&
+               (pi->param_data_size_skip_samples == 2)) {
+      send_command_16(self, cmd, ts, skip_samples);
+    } else if ((pi->param_data_size_timer_count == 2) &&
+               (pi->param_data_size_skip_samples == 0)) {
+      send_command_16(self, cmd, ts, duration);
+    } else {
+      fmlog("%sInvalid personality_info: timer_count:%zu skip_samples:%zu",
+            self->label,
+            pi->param_data_size_timer_count,
+            pi->param_data_size_skip_samples);
+    }
+  } else {
+    fmlog("%sMissing personality_info", self->label);
+  }
+}
+
+
+/* documented in freemcan-devctx.h */
+void devctx_request_intermediate(devctx_t *self, const bool write_to_file)
+{
+  if (write_to_file) {
+    self->write_next_intermediate = true;
+  }
+  send_intermediate_request(self);
+}
+
+
+/* documented in freemcan-devctx.h */
+void devctx_set_periodic_updates(devctx_t *self, const bool enable)
+{
+  self->periodic_updates = enable;
+  if (enable) {
+    recalculate_periodic_interval(self);
+    fmlog("%sPeriodic updates now enabled (every %lu seconds)",
+          self->label, self->periodic_update_interval);
+    if (self->is_measuring) {
+      send_intermediate_request(self);
+    }
+  } else {
+    fmlog("%sPeriodic updates now disabled", self->label);
+  }
+  update_periodic_timer(self);
+}
+
+
+/* documented in freemcan-devctx.h */
+void devctx_set_periodic_interval(devctx_t *self, const unsigned long seconds)
+{
+  self->fixed_periodic_update_interval = seconds;
+  recalculate_periodic_interval(self);
+}
+
+
+/* documented in freemcan-devctx.h */
+void devctx_set_delta_updates(devctx_t *self, const bool enable)
+{
+  self->delta_updates = enable;
+  fmlog("%sDelta value tables for intermediate results now %s",
+        self->label, enable ? "enabled" : "disabled");
+}
+
+
+/* documented in freemcan-devctx.h */
+void devctx_set_value_table_logging(devctx_t *self, const bool enable)
+{
+  self->log_value_tables = enable;
+}
+
+
+/* documented in freemcan-devctx.h */
+void devctx_set_pipeline(devctx_t *self, pipeline_t *pipeline)
+{
+  self->pipeline = pipeline;
+}
+
+
+/* documented in freemcan-devctx.h */
+bool devctx_is_measuring(const devctx_t *self)
+{
+  return self->is_measuring;
+}
+
+
+/* documented in freemcan-devctx.h */
+bool devctx_is_dead(const devctx_t *self)
+{
+  return self->dead;
+}
+
+
+/* documented in freemcan-devctx.h */
+bool devctx_is_idle(const devctx_t *self)
+{
+  return (self->waiting_for == 0);
+}
+
+
+/* documented in freemcan-devctx.h */
+void devctx_fmlog_status(const devctx_t *self)
+{
+  fmlog("%sDevice status:%s", self->label, self->dead ? " lost" : "");
+  fmlog("  output directory=%s", self->outdir);
+  fmlog("  measuring=%s waiting_for=%d",
+        self->is_measuring ? "yes" : "no", self->waiting_for);
+  fmlog("  periodic_update_interval=%lu%s", self->periodic_update_interval,
+        self->periodic_updates ? "" : " (disabled)");
+  fmlog("  delta value tables %s", self->delta_updates ? "enabled" : "disabled");
+  device_fmlog_stats(self->device);
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,211 @@
+/** \file hostware/freemcan-devctx.h
+ * \brief Per-device context (interface)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup freemcan_devctx
+ * @{
+ */
+
+
+#ifndef FREEMCAN_DEVCTX_H
+#define FREEMCAN_DEVCTX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "frame-defs.h"
+#include "freemcan-evloop.h"
+#include "freemcan-pipeline.h"
+#include "personality-info.h"
+
+
+/** Device context (opaque data type) */
+struct _devctx_t;
+
+/** Device context (opaque data type) */
+typedef struct _devctx_t devctx_t;
+
+
+/** Open device and set up its own protocol stack
+ *
+ * \param device_name Serial port or emulator socket to open.
+ * \param outdir Directory to export value tables to (created if
+ *               missing).
+ * \param label Prefix for all log messages concerning this device,
+ *              e.g. "" if there is only one device.
+ *
+ * \return The device context, or NULL (with a logged message) if the
+ *         output directory cannot be created or the device cannot be
+ *         opened.
+ */
+devctx_t *devctx_new(const char *device_name, const char *outdir,
+                     const char *label)
+  __attribute__(( malloc ))
+  __attribute__(( warn_unused_result ))
+  __attribute__(( nonnull(1,2,3) ));
+
+
+/** Open device given as "DEVICE[,OUTDIR]" on the command line
+ *
+ * If OUTDIR is not given, it defaults to "." if there is only one
+ * device, and to the basename of DEVICE if there are multiple
+ * devices. Multiple devices also get their basename as a log label.
+ *
+ * \return As for #devctx_new.
+ */
+devctx_t *devctx_new_from_spec(const char *spec, const bool multiple)
+  __attribute__(( malloc ))
+  __attribute__(( warn_unused_result ))
+  __attribute__(( nonnull(1) ));
+
+
+void devctx_ref(devctx_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+void devctx_unref(devctx_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Register device fd and periodic update timer with the event loop */
+void devctx_attach(devctx_t *self, evloop_t *loop)
+  __attribute__(( nonnull(1,2) ));
+
+
+/** Log message prefix of this device */
+const char *devctx_get_label(const devctx_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** The device's personality info, NULL if not received yet */
+personality_info_t *devctx_get_personality_info(devctx_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Send a command without parameters to the device */
+void devctx_send_simple_command(devctx_t *self, const frame_cmd_t cmd)
+  __attribute__(( nonnull(1) ));
+
+
+/** Send measurement parameters to the device
+ *
+ * Either to start a measurement (do_measure), or to store them in
+ * the device EEPROM. Which parameters are actually sent depends on
+ * the device's personality.
+ */
+void devctx_send_measurement_params(devctx_t *self, const bool do_measure,
+                                    const uint16_t duration,
+                                    const uint16_t skip_samples)
+  __attribute__(( nonnull(1) ));
+
+
+/** Request an intermediate result
+ *
+ * \param write_to_file Whether to export the result to a file.
+ */
+void devctx_request_intermediate(devctx_t *self, const bool write_to_file)
+  __attribute__(( nonnull(1) ));
+
+
+/** Enable or disable periodic requests for intermediate results
+ *
+ * The requests only go out while the device says it is measuring:
+ * The periodic timer is armed when the device reports MEASURING, and
+ * disarmed when it reports any other state. Enabling periodic
+ * updates during a measurement requests an intermediate result
+ * right away.
+ */
+void devctx_set_periodic_updates(devctx_t *self, const bool enable)
+  __attribute__(( nonnull(1) ));
+
+
+/** Use a fixed periodic update interval
+ *
+ * \param seconds Interval in seconds, or 0 to calculate the interval
+ *                from the measurement duration (the default).
+ */
+void devctx_set_periodic_interval(devctx_t *self, const unsigned long seconds)
+  __attribute__(( nonnull(1) ));
+
+
+/** Enable or disable requesting intermediate results as delta value tables
+ *
+ * Disabled by default. Delta value tables only contain the parts of
+ * the value table which have changed since the last one, which makes
+ * frequent periodic updates a lot cheaper. Needs firmware support
+ * (#FRAME_CMD_INTERMEDIATE_DELTA), but firmware personalities
+ * without change tracking just send a normal value table.
+ */
+void devctx_set_delta_updates(devctx_t *self, const bool enable)
+  __attribute__(( nonnull(1) ));
+
+
+/** Enable or disable logging received value tables element by element
+ *
+ * Enabled by default. A one line summary is logged in any case.
+ */
+void devctx_set_value_table_logging(devctx_t *self, const bool enable)
+  __attribute__(( nonnull(1) ));
+
+
+/** Hand received value tables to pipeline for logging and export
+ *
+ * Without a pipeline (the default), value tables are logged and
+ * exported right away. The pipeline must outlive the device context.
+ */
+void devctx_set_pipeline(devctx_t *self, pipeline_t *pipeline)
+  __attribute__(( nonnull(1) ));
+
+
+/** Whether the device has last reported to be measuring */
+bool devctx_is_measuring(const devctx_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Whether the device has gone away (read error or EOF)
+ *
+ * A lost device has been closed and removed from the event loop.
+ * Commands to it are not sent, and it is neither measuring nor
+ * waiting for answers.
+ */
+bool devctx_is_dead(const devctx_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Whether the device has answered all commands sent to it */
+bool devctx_is_idle(const devctx_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Log the device's state and statistics */
+void devctx_fmlog_status(const devctx_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** @} */
+
+#endif /* !FREEMCAN_DEVCTX_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -21,6 +21,18 @@
  * \defgroup freemcan_device Device Interface
  * \ingroup hostware_generic
  *
+ * Received data is read into a fixed size ring buffer with
+ * non-blocking read(2)/readv(2) calls until one of them comes back
+ * short (or with EAGAIN), and handed to the frame parser right where it is. In
+ * the common case, that is a single read(2) call per wakeup.
+ *
+ * As the device fd is non-blocking, command frames go into a send
+ * queue, and whatever the kernel does not take right away waits there
+ * until the main loop finds the fd writable (see #device_do_write).
+ * Later command frames are queued behind it, and a frame which does
+ * not fit into the queue any more is dropped as a whole: A command
+ * frame cut short would confuse the firmware's frame parser.
+ *
  * \todo Use libftdi to interface to the USB->RS232 adapter?
  *
  * @{
@@ -35,8 +47,11 @@
 #include <unistd.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -48,19 +63,67 @@
 #include "freemcan-device.h"
 #include "frame-parser.h"
 #include "freemcan-log.h"
-#include "freemcan-iohelpers.h"
 #include "freemcan-tui.h"
 #include "serial-setup.h"
 
 #include "uart-defs.h"
 
 
+/** Size of the receive ring buffer
+ *
+ * Larger than the largest frame we expect (a 3 KiB value table), and
+ * larger than the kernel is going to give us in one read(2) call from
+ * a serial port or UNIX socket anyway.
+ */
+#define DEVICE_RX_RING_SIZE 65536
+
+
+/** Size of the command send queue
+ *
+ * Room for more than a dozen of the largest command frames, which is
+ * a lot more than we ever send without waiting for an answer.
+ */
+#define DEVICE_TX_QUEUE_SIZE 4096
+
+
+/** Size of the largest command frame: magic, command, length,
+ *  parameters, checksum */
+#define DEVICE_CMD_FRAME_MAX (4 + 1 + 1 + UINT8_MAX + 1)
+
+
 /** Internals of opaque #device_t */
 struct _device_t {
   unsigned int refs;
   int fd;
   frame_parser_t *frame_parser;
   checksum_t *checksum_output;
+
+  /** Where the next read(2) puts its data into #rx_ring */
+  size_t rx_pos;
+
+  /** Number of #device_do_io calls */
+  unsigned long wakeups;
+
+  /** Number of read(2) and readv(2) calls */
+  unsigned long syscalls;
+
+  /** Number of bytes received */
+  unsigned long long bytes;
+
+  /** First byte in #tx_queue not written yet */
+  size_t tx_start;
+
+  /** End of the data in #tx_queue */
+  size_t tx_end;
+
+  /** Number of command frames dropped because of a full #tx_queue */
+  unsigned long tx_dropped;
+
+  /** Command frames waiting to be written */
+  uint8_t tx_queue[DEVICE_TX_QUEUE_SIZE];
+
+  /** Receive ring buffer */
+  uint8_t rx_ring[DEVICE_RX_RING_SIZE];
 };
 
 
@@ -72,6 +135,13 @@ device_t *device_new(frame_parser_t *frame_parser)
   device->fd = -1;
   device->frame_parser = frame_parser;
   device->checksum_output = checksum_new();
+  device->rx_pos = 0;
+  device->wakeups = 0;
+  device->syscalls = 0;
+  device->bytes = 0;
+  device->tx_start = 0;
+  device->tx_end = 0;
+  device->tx_dropped = 0;
   return device;
 }
 
@@ -142,43 +212,58 @@ int open_unix_socket(const char *socket_name)
 }
 
 
-void device_open(device_t *self, const char *device_name)
+int device_open_fd(const char *device_name)
 {
   struct stat sb;
   const int stat_ret = stat(device_name, &sb);
   if (stat_ret == -1) {
-    perror("stat()");
-    abort();
-  }
-  if (self->fd > 0) {
-    device_close(self);
+    fmlog_error("stat(2) on device %s", device_name);
+    return -1;
   }
   if (S_ISCHR(sb.st_mode)) { /* open serial port to the hardware device */
-    self->fd = open_char_device(device_name);
+    return open_char_device(device_name);
   } else if (S_ISSOCK(sb.st_mode)) { /* open UNIX domain socket to the emulator */
-    self->fd = open_unix_socket(device_name);
+    return open_unix_socket(device_name);
   } else {
     fmlog("device of unknown type: %s", device_name);
-    self->fd = -1;
+    return -1;
   }
 }
 
 
+int device_open(device_t *self, const char *device_name)
+{
+  if (self->fd > 0) {
+    device_close(self);
+  }
+  self->fd = device_open_fd(device_name);
+  if (self->fd < 0) {
+    return -1;
+  }
+  /* device_do_io() must never block in read(2) */
+  const int flags = fcntl(self->fd, F_GETFL);
+  if ((flags < 0) || (fcntl(self->fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+    fmlog_error("fcntl(2) O_NONBLOCK on device fd %d", self->fd);
+    device_close(self);
+    return -1;
+  }
+  return 0;
+}
+
+
 void device_close(device_t *self)
 {
   assert(self->fd > 0);
   close(self->fd);
   self->fd = -1;
+  self->tx_start = 0;
+  self->tx_end = 0;
 }
 
 
 void checksum_update_iovec(checksum_t *cs, struct iovec *iov)
 {
-  const uint8_t *buf = iov->iov_base;
-  const size_t  size = iov->iov_len;
-  for (size_t i=0; i<size; i++) {
-    checksum_update(cs, buf[i]);
-  }
+  checksum_update_block(cs, iov->iov_base, iov->iov_len);
 }
 
 
@@ -212,6 +297,92 @@ ssize_t my_writev(int fd, const struct iovec *iov, int iovcnt)
 }
 
 
+/** Account for the result n of a write(2) from the send queue
+ *
+ * \return 0, or -1 if the device is gone.
+ */
+static
+int device_tx_written(device_t *self, const ssize_t n)
+{
+  if (n > 0) {
+    self->tx_start += n;
+    if (self->tx_start == self->tx_end) {
+      self->tx_start = 0;
+      self->tx_end = 0;
+    }
+  } else if ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) &&
+             (errno != EINTR)) {
+    fmlog_error("write(2) to device fd %d, %zu queued command bytes not sent",
+                self->fd, self->tx_end - self->tx_start);
+    self->tx_start = 0;
+    self->tx_end = 0;
+    return -1;
+  }
+  return 0;
+}
+
+
+/** Queue the whole command frame in iov for writing to the device
+ *
+ * If nothing else is queued, write as much of it as the device takes
+ * right away. Either way, this never waits for the device.
+ */
+static
+void device_write_frame(device_t *self, const struct iovec *iov, int iovcnt)
+{
+  size_t size = 0;
+  for (int i=0; i<iovcnt; i++) {
+    size += iov[i].iov_len;
+  }
+  assert(size <= DEVICE_CMD_FRAME_MAX);
+  if (size > DEVICE_TX_QUEUE_SIZE - (self->tx_end - self->tx_start)) {
+    fmlog("Device fd %d send queue full, dropping %zu byte command frame",
+          self->fd, size);
+    self->tx_dropped++;
+    return;
+  }
+  if (size > DEVICE_TX_QUEUE_SIZE - self->tx_end) {
+    memmove(&self->tx_queue[0], &self->tx_queue[self->tx_start],
+            self->tx_end - self->tx_start);
+    self->tx_end -= self->tx_start;
+    self->tx_start = 0;
+  }
+
+  const bool was_empty = (self->tx_start == self->tx_end);
+  const struct iovec frame = { &self->tx_queue[self->tx_end], size };
+  for (int i=0; i<iovcnt; i++) {
+    memcpy(&self->tx_queue[self->tx_end], iov[i].iov_base, iov[i].iov_len);
+    self->tx_end += iov[i].iov_len;
+  }
+  if (was_empty) {
+    /* a lost device shows up as EOF or error in device_do_io() */
+    (void) device_tx_written(self, my_writev(self->fd, &frame, 1));
+  } else if (enable_layer1_dump) {
+    fmlog(">Queueing 0x%04zx=%zd bytes of layer 1 data", size, size);
+    fmlog_data(">>", frame.iov_base, size);
+  }
+}
+
+
+/* documented in freemcan-device.h */
+bool device_tx_pending(const device_t *self)
+{
+  return (self->tx_start != self->tx_end);
+}
+
+
+/* documented in freemcan-device.h */
+int device_do_write(device_t *self)
+{
+  if (self->tx_start != self->tx_end) {
+    return device_tx_written(self,
+                             write(self->fd, &self->tx_queue[self->tx_start],
+                                   self->tx_end - self->tx_start));
+  }
+  return 0;
+}
+
+
 void device_send_command(device_t *self, const frame_cmd_t cmd)
 {
   const int fd = self->fd;
@@ -237,7 +408,7 @@ void device_send_command(device_t *self, const frame_cmd_t cmd)
   checksum_unref(cs);
   out[3].iov_base = (void *)&checksum;
   out[3].iov_len = sizeof(checksum);
-  my_writev(fd, out, 4);
+  device_write_frame(self, out, 4);
 }
 
 
@@ -270,33 +441,78 @@ void device_send_command_with_params(device_t *self, const frame_cmd_t cmd,
   checksum_unref(cs);
   out[4].iov_base = (void *)&checksum;
   out[4].iov_len = sizeof(checksum);
-  my_writev(fd, out, 5);
+  device_write_frame(self, out, 5);
 }
 
 
 /* documented in freemcan-device.h */
-void device_do_io(device_t *self)
+int device_do_io(device_t *self)
 {
-    const int fd = self->fd;
-    const int bytes_to_read = read_size(fd);
-    if (bytes_to_read == 0) {
+  const int fd = self->fd;
+  self->wakeups++;
+  while (true) {
+    /* all free space in the ring, wrapping around if necessary */
+    struct iovec iov[2] = {
+      { &self->rx_ring[self->rx_pos], DEVICE_RX_RING_SIZE - self->rx_pos },
+      { &self->rx_ring[0], self->rx_pos }
+    };
+    const ssize_t read_bytes = (self->rx_pos == 0)
+      ? read(fd, iov[0].iov_base, iov[0].iov_len)
+      : readv(fd, iov, 2);
+    self->syscalls++;
+    if (read_bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        return 0;
+      }
+      fmlog_error("read(2) from device fd %d", fd);
+      return -1;
+    } else if (read_bytes == 0) {
       fmlog("EOF via device fd %d", fd);
-      abort();
+      return -1;
     }
-    assert(bytes_to_read > 0);
-    char buf[bytes_to_read+1];
-    const ssize_t read_bytes = read(fd, buf, bytes_to_read);
-    assert(read_bytes == bytes_to_read);
-    buf[bytes_to_read] = '\0';
+    self->bytes += read_bytes;
+
+    const size_t size = read_bytes;
+    const size_t first = (size < iov[0].iov_len) ? size : iov[0].iov_len;
     if (false) {
       /* Logging this by default becomes tedious quickly with larger
        * amounts of data, so we comment this out for now.
        */
       fmlog("<Received %zd bytes from device at fd %d", read_bytes, fd);
-      fmlog_data("<<", buf, read_bytes);
+      fmlog_data("<<", iov[0].iov_base, first);
+      fmlog_data("<<", iov[1].iov_base, size - first);
+    }
+    frame_parser_handle_bytes(self->frame_parser, iov[0].iov_base, first);
+    if (size > first) {
+      frame_parser_handle_bytes(self->frame_parser,
+                                iov[1].iov_base, size - first);
     }
-    frame_parser_handle_bytes(self->frame_parser,
-                              buf, read_bytes);
+    self->rx_pos = (self->rx_pos + size) % DEVICE_RX_RING_SIZE;
+
+    if (size < iov[0].iov_len + iov[1].iov_len) {
+      /* A short read means the kernel buffer has been drained. We
+       * could read(2) again just to be told EAGAIN, but the main loop
+       * polls level triggered and wakes us up again for anything
+       * which arrives later. */
+      return 0;
+    }
+  }
+}
+
+
+/* documented in freemcan-device.h */
+void device_fmlog_stats(const device_t *self)
+{
+  const unsigned long frames = frame_parser_get_frame_count(self->frame_parser);
+  fmlog("  device: %lu wakeups, %lu syscalls, %llu bytes, %lu frames",
+        self->wakeups, self->syscalls, self->bytes, frames);
+  fmlog("  device: %.1f syscalls/MB, %.3f wakeups/frame",
+        (self->bytes > 0) ? (1e6 * self->syscalls / self->bytes) : 0.0,
+        (frames > 0) ? ((double)self->wakeups / frames) : 0.0);
+  fmlog("  device: %zu command bytes queued, %lu command frames dropped",
+        self->tx_end - self->tx_start, self->tx_dropped);
 }
 
 
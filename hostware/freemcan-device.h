@@ -26,6 +26,8 @@
 #ifndef FREEMCAN_DEVICE_H
 #define FREEMCAN_DEVICE_H
 
+#include <stdbool.h>
+
 #include "frame-defs.h"
 
 
@@ -54,8 +56,21 @@ void device_unref(device_t *self)
   __attribute__(( nonnull(1) ));
 
 
-/** Open device */
-void device_open(device_t *self, const char *device_name)
+/** Open serial port or emulator socket device_name
+ *
+ * \return The file descriptor, or -1 on failure
+ */
+int device_open_fd(const char *device_name)
+  __attribute__(( warn_unused_result ))
+  __attribute__(( nonnull(1) ));
+
+
+/** Open device
+ *
+ * \return 0, or -1 (with a logged message) on failure
+ */
+int device_open(device_t *self, const char *device_name)
+  __attribute__(( warn_unused_result ))
   __attribute__(( nonnull(1,2) ));
 
 
@@ -71,6 +86,9 @@ int device_get_fd(device_t *self)
 
 
 /** Write a simple command (without parameters) to the device.
+ *
+ * Whatever the device does not take right away is queued, see
+ * #device_tx_pending.
  *
  * \param self The device object
  * \param cmd The #frame_cmd_t to send.
@@ -80,6 +98,9 @@ void device_send_command(device_t *self, const frame_cmd_t cmd)
 
 
 /** Write a command (with uint16_t parameter) to the device.
+ *
+ * Whatever the device does not take right away is queued, see
+ * #device_tx_pending.
  *
  * \param self The device object
  * \param cmd The #frame_cmd_t to send.
@@ -93,10 +114,44 @@ void device_send_command_with_params(device_t *self, const frame_cmd_t cmd,
 
 /** Do the actual IO
  *
- * Can be called from either the select(2) or poll(2) based main loop
- * hook functions (#device_select_do_io).
+ * Call this from the main loop whenever the device fd is readable
+ * (level triggered, see #evloop_add_fd). Reads and parses what the
+ * device has to offer until read(2) would block or returns less than
+ * the free space in the receive buffer. Anything arriving later makes
+ * the fd readable again.
+ *
+ * \return 0, or -1 (with a logged message) if the device is gone
+ *         (read error or EOF). Close the device then.
+ */
+int device_do_io(device_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Whether command frames are waiting to be written to the device
+ *
+ * Watch the device fd for writability while this is true, and call
+ * #device_do_write when it is.
+ */
+bool device_tx_pending(const device_t *self)
+  __attribute__(( warn_unused_result ))
+  __attribute__(( nonnull(1) ));
+
+
+/** Write as much of the queued command frames as the device takes
+ *
+ * Call this from the main loop whenever the device fd is writable.
+ * Never blocks.
+ *
+ * \return 0, or -1 (with a logged message) if the device is gone.
+ *         The queued command frames are dropped then.
  */
-void device_do_io(device_t *self)
+int device_do_write(device_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Log receive statistics (syscalls per MB, wakeups per frame) and
+ *  send queue state */
+void device_fmlog_stats(const device_t *self)
   __attribute__(( nonnull(1) ));
 
 
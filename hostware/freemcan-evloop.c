@@ -0,0 +1,355 @@
+/** \file hostware/freemcan-evloop.c
+ * \brief epoll(7) based event loop (implementation)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup freemcan_evloop Event Loop
+ * \ingroup hostware_generic
+ *
+ * Everything the main loop waits for is a file descriptor registered
+ * once with epoll(7): devices and stdin directly, timers as
+ * timerfd_create(2) fds, and signals as signalfd(2) fds. So the cost
+ * of a wakeup does not grow with the number of descriptors, a timer
+ * is not pushed back by other activity, and signals are just another
+ * event instead of a global flag and EINTR.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "freemcan-evloop.h"
+#include "freemcan-log.h"
+
+
+/** Maximum number of events handled per #evloop_run_once call */
+#define EVLOOP_MAX_EVENTS 32
+
+
+/** Kind of watch */
+typedef enum {
+  WATCH_FD,
+  WATCH_TIMER,
+  WATCH_SIGNAL
+} watch_type_t;
+
+
+/** Internals of opaque #evloop_watch_t */
+struct _evloop_watch_t {
+  /** Kind of watch */
+  watch_type_t type;
+  /** The fd registered with epoll */
+  int fd;
+  /** The epoll(7) events watched for */
+  uint32_t events;
+  /** Removed while handling events, to be freed afterwards */
+  bool removed;
+  /** Handler to call */
+  evloop_handler_t handler;
+  /** Data to pass to handler */
+  void *data;
+  /** Next watch in #_evloop_t::watches */
+  evloop_watch_t *next;
+};
+
+
+/** Internals of opaque #evloop_t */
+struct _evloop_t {
+  /** Reference counter */
+  unsigned int refs;
+  /** epoll(7) instance */
+  int epoll_fd;
+  /** Set by #evloop_quit */
+  bool quit;
+  /** All watches (for cleaning up) */
+  evloop_watch_t *watches;
+  /** Whether #evloop_run_once is calling handlers */
+  bool dispatching;
+  /** Watches removed by handlers in the current iteration */
+  evloop_watch_t *removed;
+};
+
+
+evloop_t *evloop_new(void)
+{
+  evloop_t *self = calloc(1, sizeof(*self));
+  assert(self);
+  self->refs = 1;
+  self->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (self->epoll_fd < 0) {
+    fmlog_error("epoll_create1(2)");
+    abort();
+  }
+  return self;
+}
+
+
+void evloop_ref(evloop_t *self)
+{
+  assert(self->refs > 0);
+  self->refs++;
+}
+
+
+void evloop_unref(evloop_t *self)
+{
+  assert(self->refs > 0);
+  self->refs--;
+  if (self->refs == 0) {
+    while (self->watches) {
+      evloop_remove(self, self->watches);
+    }
+    close(self->epoll_fd);
+    free(self);
+  }
+}
+
+
+/** Register fd with epoll and remember the watch */
+static
+evloop_watch_t *add_watch(evloop_t *self, const watch_type_t type,
+                          const int fd, const uint32_t events,
+                          evloop_handler_t handler, void *data)
+{
+  evloop_watch_t *watch = malloc(sizeof(*watch));
+  assert(watch);
+  watch->type = type;
+  watch->fd = fd;
+  watch->events = events;
+  watch->removed = false;
+  watch->handler = handler;
+  watch->data = data;
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = watch;
+  if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    fmlog_error("epoll_ctl(2) EPOLL_CTL_ADD fd %d", fd);
+    abort();
+  }
+
+  watch->next = self->watches;
+  self->watches = watch;
+  return watch;
+}
+
+
+/* documented in freemcan-evloop.h */
+evloop_watch_t *evloop_add_fd(evloop_t *self, const int fd,
+                              const uint32_t events,
+                              evloop_handler_t handler, void *data)
+{
+  assert(fd >= 0);
+  return add_watch(self, WATCH_FD, fd, events, handler, data);
+}
+
+
+/* documented in freemcan-evloop.h */
+void evloop_fd_set_events(evloop_t *self, evloop_watch_t *watch,
+                          const uint32_t events)
+{
+  assert(watch->type == WATCH_FD);
+  if (watch->events == events) {
+    return;
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = watch;
+  if (epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, watch->fd, &ev) < 0) {
+    fmlog_error("epoll_ctl(2) EPOLL_CTL_MOD fd %d", watch->fd);
+    abort();
+  }
+  watch->events = events;
+}
+
+
+/* documented in freemcan-evloop.h */
+evloop_watch_t *evloop_add_timer(evloop_t *self,
+                                 evloop_handler_t handler, void *data)
+{
+  const int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+  if (fd < 0) {
+    fmlog_error("timerfd_create(2)");
+    abort();
+  }
+  return add_watch(self, WATCH_TIMER, fd, EPOLLIN, handler, data);
+}
+
+
+/* documented in freemcan-evloop.h */
+void evloop_timer_set(evloop_watch_t *timer, const unsigned long interval_ms)
+{
+  assert(timer->type == WATCH_TIMER);
+  struct itimerspec its;
+  its.it_interval.tv_sec  = interval_ms / 1000;
+  its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+  its.it_value = its.it_interval;
+  if (timerfd_settime(timer->fd, 0, &its, NULL) < 0) {
+    fmlog_error("timerfd_settime(2)");
+    abort();
+  }
+}
+
+
+/* documented in freemcan-evloop.h */
+evloop_watch_t *evloop_add_signal(evloop_t *self, const int signo,
+                                  evloop_handler_t handler, void *data)
+{
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, signo);
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+    fmlog_error("sigprocmask(2)");
+    abort();
+  }
+  const int fd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+  if (fd < 0) {
+    fmlog_error("signalfd(2)");
+    abort();
+  }
+  return add_watch(self, WATCH_SIGNAL, fd, EPOLLIN, handler, data);
+}
+
+
+/* documented in freemcan-evloop.h */
+void evloop_remove(evloop_t *self, evloop_watch_t *watch)
+{
+  evloop_watch_t **p = &self->watches;
+  while (*p != watch) {
+    assert(*p);
+    p = &(*p)->next;
+  }
+  *p = watch->next;
+
+  if (epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, watch->fd, NULL) < 0) {
+    fmlog_error("epoll_ctl(2) EPOLL_CTL_DEL fd %d", watch->fd);
+  }
+  if (watch->type != WATCH_FD) {
+    close(watch->fd);
+  }
+  if (self->dispatching) {
+    /* events for it may still be waiting in evloop_run_once() */
+    watch->removed = true;
+    watch->next = self->removed;
+    self->removed = watch;
+  } else {
+    free(watch);
+  }
+}
+
+
+/** Call the handler for one event */
+static
+void dispatch(evloop_watch_t *watch, const uint32_t events)
+{
+  if (watch->removed) {
+    return;
+  }
+  switch (watch->type) {
+  case WATCH_FD:
+    watch->handler(watch->data, events);
+    return;
+  case WATCH_TIMER: {
+    uint64_t expirations;
+    const ssize_t n = read(watch->fd, &expirations, sizeof(expirations));
+    if (n == sizeof(expirations)) {
+      watch->handler(watch->data, expirations);
+    }
+    /* else: timer has been re-armed since the expiry */
+    return;
+  }
+  case WATCH_SIGNAL: {
+    struct signalfd_siginfo si;
+    while (read(watch->fd, &si, sizeof(si)) == sizeof(si)) {
+      watch->handler(watch->data, si.ssi_signo);
+    }
+    return;
+  }
+  /* No "default:" case on purpose: Let compiler complain about
+   * unhandled values. */
+  }
+  fmlog("Illegal watch type %d.", watch->type);
+  abort();
+}
+
+
+/* documented in freemcan-evloop.h */
+int evloop_run_once(evloop_t *self, const int timeout_ms)
+{
+  struct epoll_event events[EVLOOP_MAX_EVENTS];
+  const int n = epoll_wait(self->epoll_fd, events, EVLOOP_MAX_EVENTS,
+                           timeout_ms);
+  if (n < 0) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    fmlog_error("epoll_wait(2)");
+    abort();
+  }
+  self->dispatching = true;
+  for (int i=0; i<n; i++) {
+    dispatch(events[i].data.ptr, events[i].events);
+  }
+  self->dispatching = false;
+  while (self->removed) {
+    evloop_watch_t *watch = self->removed;
+    self->removed = watch->next;
+    free(watch);
+  }
+  return n;
+}
+
+
+/* documented in freemcan-evloop.h */
+void evloop_run(evloop_t *self)
+{
+  self->quit = false;
+  while (!self->quit) {
+    evloop_run_once(self, -1);
+  }
+}
+
+
+/* documented in freemcan-evloop.h */
+void evloop_quit(evloop_t *self)
+{
+  self->quit = true;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,159 @@
+/** \file hostware/freemcan-evloop.h
+ * \brief epoll(7) based event loop (interface)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup freemcan_evloop
+ * @{
+ */
+
+
+#ifndef FREEMCAN_EVLOOP_H
+#define FREEMCAN_EVLOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** Event loop (opaque data type) */
+struct _evloop_t;
+
+/** Event loop (opaque data type) */
+typedef struct _evloop_t evloop_t;
+
+
+/** Something the event loop watches (opaque data type) */
+struct _evloop_watch_t;
+
+/** Something the event loop watches (opaque data type) */
+typedef struct _evloop_watch_t evloop_watch_t;
+
+
+/** Event handler
+ *
+ * \param data The data pointer given when adding the watch.
+ * \param arg  For fd watches, the epoll(7) event mask. For timer
+ *             watches, the number of timer expirations since the last
+ *             call (more than 1 if we have been too slow). For signal
+ *             watches, the signal number.
+ */
+typedef void (*evloop_handler_t)(void *data, const uint64_t arg);
+
+
+evloop_t *evloop_new(void)
+  __attribute__(( malloc ))
+  __attribute__(( warn_unused_result ));
+
+
+void evloop_ref(evloop_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Release event loop reference, removing all watches when the last
+ * reference goes away. */
+void evloop_unref(evloop_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Watch file descriptor fd for the given epoll(7) events
+ *
+ * The watch is level triggered, i.e. the handler is called again
+ * and again as long as there is data left to read.
+ */
+evloop_watch_t *evloop_add_fd(evloop_t *self, const int fd,
+                              const uint32_t events,
+                              evloop_handler_t handler, void *data)
+  __attribute__(( nonnull(1,4) ));
+
+
+/** Change the epoll(7) events watched for on an fd watch
+ *
+ * EPOLLHUP and EPOLLERR are always reported, even with events 0.
+ */
+void evloop_fd_set_events(evloop_t *self, evloop_watch_t *watch,
+                          const uint32_t events)
+  __attribute__(( nonnull(1,2) ));
+
+
+/** Add an (initially disarmed) periodic timer
+ *
+ * \see evloop_timer_set
+ */
+evloop_watch_t *evloop_add_timer(evloop_t *self,
+                                 evloop_handler_t handler, void *data)
+  __attribute__(( nonnull(1,2) ));
+
+
+/** Arm periodic timer to expire every interval_ms milliseconds
+ *
+ * The expiry times are fixed multiples of interval_ms from now, no
+ * matter how long the handlers take or how much else is going on in
+ * the event loop. An interval_ms of 0 disarms the timer.
+ */
+void evloop_timer_set(evloop_watch_t *timer, const unsigned long interval_ms)
+  __attribute__(( nonnull(1) ));
+
+
+/** Handle signal signo in the event loop instead of a signal handler
+ *
+ * Blocks the signal for normal delivery.
+ */
+evloop_watch_t *evloop_add_signal(evloop_t *self, const int signo,
+                                  evloop_handler_t handler, void *data)
+  __attribute__(( nonnull(1,3) ));
+
+
+/** Remove and free watch (closing the timer or signal fd if ours)
+ *
+ * May be called from within an event handler, also for the watch
+ * being handled. Its handler is not called again.
+ */
+void evloop_remove(evloop_t *self, evloop_watch_t *watch)
+  __attribute__(( nonnull(1,2) ));
+
+
+/** Wait for events and call their handlers
+ *
+ * \param timeout_ms As for epoll_wait(2): -1 means wait forever.
+ * \return Number of handlers called.
+ */
+int evloop_run_once(evloop_t *self, const int timeout_ms)
+  __attribute__(( nonnull(1) ));
+
+
+/** Run #evloop_run_once until #evloop_quit is called */
+void evloop_run(evloop_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Make #evloop_run return after the current iteration */
+void evloop_quit(evloop_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** @} */
+
+#endif /* !FREEMCAN_EVLOOP_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
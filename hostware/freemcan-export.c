@@ -20,23 +20,46 @@
  *
  * \defgroup freemcan_export Export Value Table Files
  * \ingroup hostware_generic
+ *
+ * A value table can have hundreds of thousands of elements, so the
+ * rows are not written with one fprintf(3) each. Instead, the whole
+ * file is put together in memory with hand-rolled number formatting
+ * (#outbuf_t), and then written with a single write(2).
+ *
+ * The time series timestamps are formatted incrementally as well: The
+ * local date, hour and time zone are only determined once per 15
+ * minutes of UTC time (#ts_cache_t). Every time zone offset in use is
+ * a multiple of 15 minutes, so within such a bucket only minutes and
+ * seconds change. Buckets for which that does not hold, e.g. because
+ * of a DST change at an odd time, are formatted the slow way.
+ *
  * @{
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include "freemcan-export.h"
 #include "freemcan-log.h"
+#include "value-table-archive.h"
 
 
 /* documented in freemcan-export.h */
-char *export_value_table_get_filename(const packet_value_table_t *value_table_packet,
+char *export_value_table_get_filename(const char *outdir,
+                                      const packet_value_table_t *value_table_packet,
                                       const char *extension)
 {
   const struct tm *tm_ = localtime(&value_table_packet->receive_time);
@@ -61,8 +84,9 @@ char *export_value_table_get_filename(const packet_value_table_t *value_table_pa
 
   char date[128];
   strftime(date, sizeof(date), "%Y-%m-%d.%H:%M:%S", tm_);
-  static char fname[256];
-  snprintf(fname, sizeof(fname), "%s.%s.%c.%s", prefix, date, reason, extension);
+  static char fname[FILENAME_MAX];
+  snprintf(fname, sizeof(fname), "%s/%s.%s.%c.%s",
+           outdir, prefix, date, reason, extension);
   return fname;
 }
 
@@ -77,6 +101,225 @@ const char *time_rfc_3339(const time_t time)
 }
 
 
+/** Growable in-memory output file */
+typedef struct {
+  /** File content */
+  char *data;
+  /** Number of bytes used */
+  size_t size;
+  /** Number of bytes allocated */
+  size_t capacity;
+} outbuf_t;
+
+
+/** Make room for at least more additional bytes */
+static void outbuf_reserve(outbuf_t *out, const size_t more)
+{
+  if (out->size + more <= out->capacity) {
+    return;
+  }
+  size_t capacity = out->capacity ? out->capacity : 4096;
+  while (capacity < out->size + more) {
+    capacity *= 2;
+  }
+  out->data = realloc(out->data, capacity);
+  assert(out->data);
+  out->capacity = capacity;
+}
+
+
+static void outbuf_printf(outbuf_t *out, const char *format, ...)
+  __attribute__(( format(printf, 2, 3) ));
+
+static void outbuf_printf(outbuf_t *out, const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  const int r = vsnprintf(NULL, 0, format, ap);
+  va_end(ap);
+  assert(r >= 0);
+  outbuf_reserve(out, r+1);
+  va_start(ap, format);
+  vsnprintf(&out->data[out->size], r+1, format, ap);
+  va_end(ap);
+  out->size += r;
+}
+
+
+/** Append string of known length, space reserved by caller */
+static inline void outbuf_mem(outbuf_t *out, const char *str, const size_t len)
+{
+  memcpy(&out->data[out->size], str, len);
+  out->size += len;
+}
+
+
+/** Append character, space reserved by caller */
+static inline void outbuf_char(outbuf_t *out, const char ch)
+{
+  out->data[out->size++] = ch;
+}
+
+
+/** "00" to "99" for formatting two digits at a time */
+static const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+
+/** Append value like printf("%02u"), for value < 100 */
+static inline void outbuf_u2(outbuf_t *out, const unsigned int value)
+{
+  outbuf_mem(out, &digit_pairs[2*value], 2);
+}
+
+
+/** Append value like printf("%llu"), space reserved by caller */
+static inline void outbuf_uint(outbuf_t *out, unsigned long long value)
+{
+  char buf[20];
+  char *p = &buf[sizeof(buf)];
+  while (value >= 100) {
+    const unsigned int pair = value % 100;
+    value /= 100;
+    p -= 2;
+    memcpy(p, &digit_pairs[2*pair], 2);
+  }
+  if (value >= 10) {
+    p -= 2;
+    memcpy(p, &digit_pairs[2*value], 2);
+  } else {
+    *--p = '0' + value;
+  }
+  outbuf_mem(out, p, &buf[sizeof(buf)] - p);
+}
+
+
+/** Append value like printf("%lld"), space reserved by caller */
+static inline void outbuf_int(outbuf_t *out, const long long value)
+{
+  if (value < 0) {
+    outbuf_char(out, '-');
+    outbuf_uint(out, -(unsigned long long)value);
+  } else {
+    outbuf_uint(out, value);
+  }
+}
+
+
+/** Space needed for one #outbuf_uint or #outbuf_int */
+#define OUTBUF_INT_SIZE 21
+
+
+/** Write buffer content to newly created file fname */
+static void outbuf_write_file(const outbuf_t *out, const char *fname)
+{
+  const int fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+  assert(fd >= 0);
+  size_t ofs = 0;
+  while (ofs < out->size) {
+    const ssize_t n = write(fd, &out->data[ofs], out->size - ofs);
+    if ((n < 0) && (errno == EINTR)) {
+      continue;
+    }
+    assert(n > 0);
+    ofs += n;
+  }
+  const int ret = close(fd);
+  assert(ret == 0);
+}
+
+
+/** Length of a #ts_cache_t bucket in seconds */
+#define TS_BUCKET 900
+
+
+/** Length of a timestamp as formatted by #time_rfc_3339 */
+#define TS_SIZE 64
+
+
+/** Timestamp formatting cache for #outbuf_time_rfc_3339 */
+typedef struct {
+  /** Whether the other fields describe a bucket */
+  bool valid;
+  /** Whether timestamps in this bucket can be formatted incrementally */
+  bool fast;
+  /** Start of the bucket */
+  time_t bucket;
+  /** Local minute at bucket start */
+  unsigned int minute;
+  /** "YYYY-MM-DD HH:" */
+  char date_hour[32];
+  size_t date_hour_len;
+  /** Time zone as printed by strftime(3) "%z" */
+  char zone[16];
+  size_t zone_len;
+} ts_cache_t;
+
+
+/** Look up the bucket t is in */
+static void ts_cache_update(ts_cache_t *cache, const time_t t)
+{
+  const time_t rem = t % TS_BUCKET;
+  const time_t bucket = t - ((rem < 0) ? (rem + TS_BUCKET) : rem);
+  if (cache->valid && (cache->bucket == bucket)) {
+    return;
+  }
+  cache->valid = true;
+  cache->bucket = bucket;
+
+  const time_t last = bucket + TS_BUCKET - 1;
+  struct tm first_tm, last_tm;
+  if (!localtime_r(&bucket, &first_tm) || !localtime_r(&last, &last_tm)) {
+    cache->fast = false;
+    return;
+  }
+  cache->fast =
+    (first_tm.tm_sec == 0) &&
+    ((first_tm.tm_min % 15) == 0) &&
+    (last_tm.tm_sec == 59) &&
+    (last_tm.tm_min == first_tm.tm_min + 14) &&
+    (last_tm.tm_hour == first_tm.tm_hour) &&
+    (last_tm.tm_mday == first_tm.tm_mday) &&
+    (last_tm.tm_isdst == first_tm.tm_isdst);
+  if (cache->fast) {
+    cache->minute = first_tm.tm_min;
+    cache->date_hour_len = strftime(cache->date_hour, sizeof(cache->date_hour),
+                                    "%Y-%m-%d %H:", &first_tm);
+    cache->zone_len = strftime(cache->zone, sizeof(cache->zone),
+                               "%z", &first_tm);
+    cache->fast = (cache->date_hour_len > 0) && (cache->zone_len > 0);
+  }
+}
+
+
+/** Append time_rfc_3339(t), space (#TS_SIZE) reserved by caller */
+static void outbuf_time_rfc_3339(outbuf_t *out, ts_cache_t *cache,
+                                 const time_t t)
+{
+  ts_cache_update(cache, t);
+  if (!cache->fast) {
+    const char *str = time_rfc_3339(t);
+    outbuf_mem(out, str, strlen(str));
+    return;
+  }
+  const unsigned int ofs = t - cache->bucket;
+  outbuf_mem(out, cache->date_hour, cache->date_hour_len);
+  outbuf_u2(out, cache->minute + ofs / 60);
+  outbuf_char(out, ':');
+  outbuf_u2(out, ofs % 60);
+  outbuf_mem(out, cache->zone, cache->zone_len);
+}
+
+
 /** Some statistical data for event counter time series */
 typedef struct {
   double counts;
@@ -101,10 +344,10 @@ typedef struct {
 
 
 static
-void export_common_vtable(FILE *datfile,
+void export_common_vtable(outbuf_t *out,
                           const packet_value_table_t *value_table_packet)
 {
-  if (datfile) {
+  if (out) {
     const char *type_str = "unknown data type";
     switch (value_table_packet->type) {
     case VALUE_TABLE_TYPE_HISTOGRAM:
@@ -114,8 +357,8 @@ void export_common_vtable(FILE *datfile,
     case VALUE_TABLE_TYPE_SAMPLES:
       type_str = "samples"; break;
     }
-    fprintf(datfile, "# value table type:         '%c' (%s)\n",
-            value_table_packet->type, type_str);
+    outbuf_printf(out, "# value table type:         '%c' (%s)\n",
+                  value_table_packet->type, type_str);
 
     const char *reason_str = "unknown type";
     switch (value_table_packet->reason) {
@@ -128,63 +371,84 @@ void export_common_vtable(FILE *datfile,
     case PACKET_VALUE_TABLE_INTERMEDIATE:
       reason_str = "intermediate result"; break;
     }
-    fprintf(datfile, "# reason:                   '%c' (%s)\n",
-            value_table_packet->reason, reason_str);
+    outbuf_printf(out, "# reason:                   '%c' (%s)\n",
+                  value_table_packet->reason, reason_str);
 
     const time_t start_time = (value_table_packet->token)?
       *((const time_t *)value_table_packet->token) : 0 ;
-    fprintf(datfile, "# start_time:               %lu (%s)\n",
-            start_time, time_rfc_3339(start_time));
+    outbuf_printf(out, "# start_time:               %lu (%s)\n",
+                  start_time, time_rfc_3339(start_time));
 
     const time_t receive_time = value_table_packet->receive_time;
-    fprintf(datfile, "# receive_time:             %lu (%s)\n",
-            receive_time, time_rfc_3339(receive_time));
+    outbuf_printf(out, "# receive_time:             %lu (%s)\n",
+                  receive_time, time_rfc_3339(receive_time));
 
-    fprintf(datfile, "# orig_element_size:        %zd bit\n",
-            value_table_packet->orig_bits_per_value);
+    outbuf_printf(out, "# orig_element_size:        %zd bit\n",
+                  value_table_packet->orig_bits_per_value);
   }
 }
 
 
+/** Append "index<TAB>value<LF>" rows for all elements */
 static
-void export_histogram_vtable(FILE *datfile, const packet_value_table_t *value_table_packet)
+void export_index_value_rows(outbuf_t *out,
+                             const packet_value_table_t *value_table_packet)
 {
-  if (datfile) {
+  const size_t element_count = value_table_packet->element_count;
+  outbuf_reserve(out, element_count * (2*OUTBUF_INT_SIZE + 2));
+  for (size_t i=0; i<element_count; i++) {
+    outbuf_uint(out, i);
+    outbuf_char(out, '\t');
+    outbuf_uint(out, value_table_packet->elements[i]);
+    outbuf_char(out, '\n');
+  }
+}
+
+
+static
+void export_histogram_vtable(outbuf_t *out, const packet_value_table_t *value_table_packet)
+{
+  if (out) {
     const size_t element_count = value_table_packet->element_count;
-    uint32_t max_value = 0;
-    for (size_t i=0; i<element_count; i++) {
-      const uint32_t v = value_table_packet->elements[i];
-      if ((i+1<element_count) && (v > max_value)) {
-        max_value = v;
+    outbuf_printf(out, "# element_count:            %zd\n",
+                  element_count);
+    outbuf_printf(out, "# time elapsed since start: %d\n",
+                  value_table_packet->duration);
+    outbuf_printf(out, "# total_duration:           %d\n",
+                  value_table_packet->total_duration);
+    if (value_table_packet->dead_time_per_trigger > 0.0) {
+      const uint64_t triggers = packet_value_table_triggers(value_table_packet);
+      const double live = packet_value_table_live_duration(value_table_packet);
+      outbuf_printf(out, "# recorded triggers:        %llu\n",
+                    (unsigned long long)triggers);
+      outbuf_printf(out, "# dead time per trigger:    %g\n",
+                    value_table_packet->dead_time_per_trigger);
+      outbuf_printf(out, "# live time (est.):         %.3f\n", live);
+      outbuf_printf(out, "# missed triggers (est.):   %.1f\n",
+                    packet_value_table_missed_triggers(value_table_packet));
+      if (live > 0.0) {
+        outbuf_printf(out, "# triggers per live time:   %.3f\n",
+                      triggers / live);
       }
-      }
-    fprintf(datfile, "# element_count:            %zd\n",
-            element_count);
-    fprintf(datfile, "# time elapsed since start: %d\n",
-            value_table_packet->duration);
-    fprintf(datfile, "# total_duration:           %d\n",
-            value_table_packet->total_duration);
-    fprintf(datfile, "channel\tcount\n");
-    for (size_t i=0; i<element_count; i++) {
-      fprintf(datfile, "%zd\t%u\n", i, value_table_packet->elements[i]);
     }
+    outbuf_printf(out, "channel\tcount\n");
+    export_index_value_rows(out, value_table_packet);
   }
 }
 
 
 static
-void time_series_stats(FILE *datfile, const char *prefix, const char *eol,
-                       const statistics_t *s)
+void time_series_stats(outbuf_t *out, const char *prefix, const statistics_t *s)
 {
-  fprintf(datfile, "%sTotal statistics (so far)%s", prefix, eol);
-  fprintf(datfile, "%s  giving a %1.1f %% confidence level the true count rates are within: %s",
-          prefix, s->confidence, eol);
-  fprintf(datfile, "%s  total duration:         %.1f seconds = %.2f minutes = %.4f hours%s",
-          prefix, s->duration, s->duration/60.0, s->duration/3600.0, eol);
-  fprintf(datfile, "%s  total counts:           %.0f +- %1.2f counts %s",
-          prefix, s->counts, s->counts_error, eol);
-  fprintf(datfile, "%s  counts per minute:      %1.2f +- %1.2f cpm %s",
-          prefix, s->avg_cpm, s->avg_cpm_error, eol);
+  outbuf_printf(out, "%sTotal statistics (so far)%s", prefix, "\n");
+  outbuf_printf(out, "%s  giving a %1.1f %% confidence level the true count rates are within: %s",
+                prefix, s->confidence, "\n");
+  outbuf_printf(out, "%s  total duration:         %.1f seconds = %.2f minutes = %.4f hours%s",
+                prefix, s->duration, s->duration/60.0, s->duration/3600.0, "\n");
+  outbuf_printf(out, "%s  total counts:           %.0f +- %1.2f counts %s",
+                prefix, s->counts, s->counts_error, "\n");
+  outbuf_printf(out, "%s  counts per minute:      %1.2f +- %1.2f cpm %s",
+                prefix, s->avg_cpm, s->avg_cpm_error, "\n");
 }
 
 
@@ -247,7 +511,7 @@ void time_series_stats(FILE *datfile, const char *prefix, const char *eol,
 
 
 static
-void export_time_series_vtable(FILE *datfile,
+void export_time_series_vtable(outbuf_t *out,
                                const personality_info_t *personality_info,
                                const packet_value_table_t *value_table_packet)
 {
@@ -284,37 +548,39 @@ void export_time_series_vtable(FILE *datfile,
     total_count += v;
   }
 
-  if (datfile) {
-    fprintf(datfile, "# time elapsed since start: %u sec\n", elapsed_time);
-    fprintf(datfile, "# minimum value:            %u\n", min_value);
-    fprintf(datfile, "# maximum value:            %u\n", max_value);
+  if (out) {
+    outbuf_printf(out, "# time elapsed since start: %u sec\n", elapsed_time);
+    outbuf_printf(out, "# minimum value:            %u\n", min_value);
+    outbuf_printf(out, "# maximum value:            %u\n", max_value);
 
-    fprintf(datfile, "# measurements done:        %zu\n", element_count);
+    outbuf_printf(out, "# measurements done:        %zu\n", element_count);
     const size_t total_element_count =
       (8 * personality_info->sizeof_table / personality_info->bits_per_value);
     const size_t elements_to_go = total_element_count - element_count;
-    fprintf(datfile, "# measurements to do:       %zu\n", elements_to_go);
-    fprintf(datfile, "# space for measurements:   %zu\n", total_element_count);
+    outbuf_printf(out, "# measurements to do:       %zu\n", elements_to_go);
+    outbuf_printf(out, "# space for measurements:   %zu\n", total_element_count);
 
-    fprintf(datfile, "# time per measurement:     %u sec\n",
-            value_table_packet->total_duration);
-    fprintf(datfile, "# time for last meas'mt:    %u\n",
-            value_table_packet->duration);
+    outbuf_printf(out, "# time per measurement:     %u sec\n",
+                  value_table_packet->total_duration);
+    outbuf_printf(out, "# time for last meas'mt:    %u\n",
+                  value_table_packet->duration);
     const double time_to_go = elements_to_go * value_table_packet->total_duration;
-    fprintf(datfile, "# time to go:               "
-            "%.1f seconds = "
-            "%.2f minutes = "
-            "%.4f hours = "
-            "%.2f days\n",
-            time_to_go,
-            time_to_go/60.0f,
-            time_to_go/3600.0f,
-            time_to_go/86400.0f);
+    outbuf_printf(out, "# time to go:               "
+                  "%.1f seconds = "
+                  "%.2f minutes = "
+                  "%.4f hours = "
+                  "%.2f days\n",
+                  time_to_go,
+                  time_to_go/60.0f,
+                  time_to_go/3600.0f,
+                  time_to_go/86400.0f);
   }
 
   statistics_t s;
   s.counts = total_count;
-  s.duration = (double)(elapsed_time);
+  /* normalize by live time if the device has told us its dead time */
+  s.duration = (double)(elapsed_time) -
+    value_table_packet->dead_time_per_trigger * total_count;
   s.avg_cpm = 60.0*s.counts/s.duration;
   s.deviation = sqrt(s.counts);
   /* k=1.0: 68.27% confidence
@@ -326,25 +592,43 @@ void export_time_series_vtable(FILE *datfile,
   s.counts_error = s.k*s.deviation;
   s.avg_cpm_error = s.k*s.deviation*60.0/s.duration;
 
-  time_series_stats(stdout,  "<    ", "\r\n", &s);
-  if (datfile) {
-    time_series_stats(datfile, "# ",    "\n",   &s);
+  outbuf_t log = { NULL, 0, 0 };
+  time_series_stats(&log, "<    ", &s);
+  for (size_t ofs=0; ofs<log.size; ) {
+    const char *eol = memchr(&log.data[ofs], '\n', log.size - ofs);
+    assert(eol);
+    const int len = eol - &log.data[ofs];
+    fmlog("%.*s", len, &log.data[ofs]);
+    ofs += len + 1;
+  }
+  free(log.data);
+
+  if (out) {
+    time_series_stats(out, "# ", &s);
 
     const time_t tdur  = value_table_packet->total_duration;
-    fprintf(datfile, "%s\t%s\t%s\t%s\n", "idx", "counts", "time_t", "strftime");
+    outbuf_printf(out, "%s\t%s\t%s\t%s\n", "idx", "counts", "time_t", "strftime");
     const time_t start_time = (value_table_packet->token)?
       *((const time_t *)value_table_packet->token) : 0 ;
+    outbuf_reserve(out, element_count * (3*OUTBUF_INT_SIZE + TS_SIZE + 4));
+    ts_cache_t cache = { false, false, 0, 0, "", 0, "", 0 };
     for (size_t i=0; i<element_count; i++) {
       const time_t ts = start_time + i * tdur;
-      const char *st = time_rfc_3339(ts);
-      fprintf(datfile, "%zu\t%u\t%ld\t%s\n", i, value_table_packet->elements[i], ts, st);
+      outbuf_uint(out, i);
+      outbuf_char(out, '\t');
+      outbuf_uint(out, value_table_packet->elements[i]);
+      outbuf_char(out, '\t');
+      outbuf_int(out, ts);
+      outbuf_char(out, '\t');
+      outbuf_time_rfc_3339(out, &cache, ts);
+      outbuf_char(out, '\n');
     }
   }
 }
 
 
 static
-void export_samples_vtable(FILE *datfile,
+void export_samples_vtable(outbuf_t *out,
                            const packet_value_table_t *value_table_packet)
 {
   uint32_t max_value = 0;
@@ -359,50 +643,58 @@ void export_samples_vtable(FILE *datfile,
       min_value = v;
     }
   }
-  if (datfile) {
-    fprintf(datfile, "# minimum value:            %u\n", min_value);
-    fprintf(datfile, "# maximum value:            %u\n", max_value);
-    for (size_t i=0; i<element_count; i++) {
-      /** \todo Write timestamps */
-      fprintf(datfile, "%zu\t%u\n", i, value_table_packet->elements[i]);
-    }
+  if (out) {
+    outbuf_printf(out, "# minimum value:            %u\n", min_value);
+    outbuf_printf(out, "# maximum value:            %u\n", max_value);
+    /** \todo Write timestamps */
+    export_index_value_rows(out, value_table_packet);
   }
 }
 
 
-bool write_next_intermediate_packet = false;
+/* documented in freemcan-export.h */
+bool enable_dat_files = true;
 
 
 /* documented in freemcan-export.h */
-void export_value_table(const personality_info_t *personality_info,
-                        const packet_value_table_t *value_table_packet)
+void export_value_table(const char *outdir,
+                        const personality_info_t *personality_info,
+                        const packet_value_table_t *value_table_packet,
+                        const bool write_intermediate)
 {
-  FILE *datfile = NULL;
-  if (write_next_intermediate_packet ||
-      (value_table_packet->reason != PACKET_VALUE_TABLE_INTERMEDIATE)) {
-    write_next_intermediate_packet = false;
-    const char *fname = export_value_table_get_filename(value_table_packet, "dat");
-    datfile = fopen(fname, "w");
-    assert(datfile);
-    fmlog("Writing value table to file %s", fname);
+  outbuf_t datfile = { NULL, 0, 0 };
+  outbuf_t *out = NULL;
+  if (enable_dat_files &&
+      (write_intermediate ||
+       (value_table_packet->reason != PACKET_VALUE_TABLE_INTERMEDIATE))) {
+    out = &datfile;
   }
 
-  export_common_vtable(datfile, value_table_packet);
+  export_common_vtable(out, value_table_packet);
   switch (value_table_packet->type) {
   case VALUE_TABLE_TYPE_HISTOGRAM: /* histogram data */
-    export_histogram_vtable(datfile, value_table_packet);
+    export_histogram_vtable(out, value_table_packet);
     break;
   case VALUE_TABLE_TYPE_TIME_SERIES: /* series of counter data */
-    export_time_series_vtable(datfile, personality_info, value_table_packet);
+    export_time_series_vtable(out, personality_info, value_table_packet);
     break;
   case VALUE_TABLE_TYPE_SAMPLES: /* data table of samples */
-    export_samples_vtable(datfile, value_table_packet);
+    export_samples_vtable(out, value_table_packet);
     break;
   }
 
-  if (datfile) {
-    fclose(datfile);
+  if (out) {
+    const char *fname =
+      export_value_table_get_filename(outdir, value_table_packet, "dat");
+    fmlog("Writing value table to file %s", fname);
+    outbuf_write_file(out, fname);
+    free(datfile.data);
   }
+
+  char archive_fname[FILENAME_MAX];
+  snprintf(archive_fname, sizeof(archive_fname), "%s/%s",
+           outdir, ARCHIVE_FILENAME);
+  archive_append(archive_fname, value_table_packet);
 }
 
 
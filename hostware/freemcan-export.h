@@ -31,23 +31,28 @@
 #include "freemcan-packet.h"
 
 
-/** Flag that next 'I' packet is to be written
+/** Whether #export_value_table writes .dat files
  *
- * Hackish, but works - as follows:
- *
- * The main loop requests intermediate values either with
- * write_next_intermediate_packet set or cleared. If set,
- * export_value_table() will clear write_next_intermediate_packet and
- * write the packet to a file. If write_next_intermediate_packet is
- * cleared, export_value_table() will not write intermediate values to
- * a file.
+ * If false, value tables only go to the archive.
  */
-bool write_next_intermediate_packet;
+extern bool enable_dat_files;
 
 
-/** \brief Write the given value table to a newly created file
+/** \brief Archive the given value table, and write it to a newly created file
  * \ingroup freemcan_export
  *
+ * Every value table is appended to the archive #ARCHIVE_FILENAME in
+ * outdir (see #archive_append), intermediate ones included.
+ *
+ * Unless #enable_dat_files is false, the value table is also written
+ * to a .dat file of its own. The file is created in the directory
+ * outdir, so that several devices can export their value tables at
+ * the same time without overwriting each other's files.
+ *
+ * Intermediate ('I') value tables are only written to .dat files if
+ * write_intermediate is set, e.g. because the user explicitly asked
+ * for it.
+ *
  * The name of the newly created file is created based on the current
  * local time of day. Given the rate at which we can receive new
  * value tables is much less than one per second, this should avoid file
@@ -59,15 +64,18 @@ bool write_next_intermediate_packet;
  * You can plot the most recent histogram with the helper utility
  * "pltHist.pl" from this very directory.
  */
-void export_value_table(const personality_info_t *personality_info,
-                        const packet_value_table_t *value_table_packet);
+void export_value_table(const char *outdir,
+                        const personality_info_t *personality_info,
+                        const packet_value_table_t *value_table_packet,
+                        const bool write_intermediate);
 
 
 /** Compute default file name for exporting given value packet packet data to.
  *
  * \return The return value points to a global static buffer.
  */
-char *export_value_table_get_filename(const packet_value_table_t *value_table_packet,
+char *export_value_table_get_filename(const char *outdir,
+                                      const packet_value_table_t *value_table_packet,
                                       const char *extension);
 
 /** @} */
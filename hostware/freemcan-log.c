@@ -25,12 +25,17 @@
  * messages, error messages (including errno codes) in a way that can
  * be used with different user interfaces.
  *
+ * Messages may be logged from any thread. Each message is formatted
+ * and handed to the log handler as a whole while holding a mutex, so
+ * the log handler does not need to care about threads.
+ *
  * @{
  */
 
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -64,17 +69,25 @@ static fmlog_handler_t fmlog_handler = default_fmlog_handler;
 static void *fmlog_handler_data = NULL;
 
 
+/** Serializes the formatting buffers and calls to the log handler */
+static pthread_mutex_t fmlog_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
 void fmlog_reset_handler(void)
 {
+  pthread_mutex_lock(&fmlog_mutex);
   fmlog_handler = default_fmlog_handler;
   fmlog_handler_data = NULL;
+  pthread_mutex_unlock(&fmlog_mutex);
 }
 
 
 void fmlog_set_handler(fmlog_handler_t the_fmlog_handler,  void *the_data)
 {
+  pthread_mutex_lock(&fmlog_mutex);
   fmlog_handler = the_fmlog_handler;
   fmlog_handler_data = the_data;
+  pthread_mutex_unlock(&fmlog_mutex);
 }
 
 
@@ -82,6 +95,7 @@ void fmlog(const char *format, ...)
 {
   va_list ap;
   if (fmlog_handler) {
+    pthread_mutex_lock(&fmlog_mutex);
     /** \bug Use va_copy? */
     va_start(ap, format);
     static char buf[4096];
@@ -90,6 +104,7 @@ void fmlog(const char *format, ...)
     va_end(ap);
 
     fmlog_handler(fmlog_handler_data, buf, r);
+    pthread_mutex_unlock(&fmlog_mutex);
   }
 }
 
@@ -99,6 +114,7 @@ void fmlog_error(const char *format, ...)
   const int errno_copy = errno;
   va_list ap;
   if (fmlog_handler) {
+    pthread_mutex_lock(&fmlog_mutex);
     /** \bug Use va_copy? */
     va_start(ap, format);
     static char buf[4096];
@@ -122,6 +138,7 @@ void fmlog_error(const char *format, ...)
     ssize_t to_write = p-buf;
 
     fmlog_handler(fmlog_handler_data, buf, to_write);
+    pthread_mutex_unlock(&fmlog_mutex);
   }
 }
 
@@ -0,0 +1,415 @@
+/** \file hostware/freemcan-pipeline.c
+ * \brief Value table render and export worker threads (implementation)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup freemcan_pipeline Value Table Pipeline
+ * \ingroup hostware_generic
+ *
+ * Logging a value table element by element and writing it to a
+ * file can take much longer than receiving it, and used to happen on
+ * the thread reading the serial ports. A slow terminal or disk could
+ * then stall the serial reads long enough for the kernel tty buffer
+ * to overflow.
+ *
+ * The pipeline moves both jobs to worker threads of their own: The
+ * I/O thread (the producer) only reads and parses, and hands each
+ * value table reference to the render and export workers (the
+ * consumers) through one #spsc_queue_t per worker.
+ *
+ * The producer never waits for a worker. When a render queue is
+ * full, the value table is not logged. When an export queue is full,
+ * the producer starts a queue twice the size and chains it behind the
+ * full one: The last slot of every queue is kept free for a link job
+ * telling the worker where to continue once it is done with the full
+ * queue. Each such growth is counted as a stall.
+ *
+ * Every stage counts its jobs, the queue depth it has seen, the time
+ * jobs spend waiting in the queue, and the time it takes to do the
+ * actual work.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freemcan-export.h"
+#include "freemcan-log.h"
+#include "freemcan-pipeline.h"
+#include "freemcan-spsc.h"
+
+
+/** Initial queue capacity per stage */
+#define PIPELINE_QUEUE_SIZE 64
+
+
+/** A value table to be rendered or exported */
+typedef struct {
+  /** Log label (render) or output directory (export), our own copy */
+  char *text;
+
+  /** Personality info reference (export only) */
+  personality_info_t *personality_info;
+
+  /** Value table reference */
+  packet_value_table_t *value_table;
+
+  /** Whether to write intermediate value table (export only) */
+  bool write_intermediate;
+
+  /** When the job was queued (CLOCK_MONOTONIC, ns) */
+  uint64_t queued_ns;
+
+  /** Queue to continue with, for link jobs only (NULL otherwise) */
+  spsc_queue_t *next_queue;
+} job_t;
+
+
+/** Statistics of one stage
+ *
+ * The producer writes the first block of fields, the worker the
+ * second one. Everybody may read everything at any time.
+ */
+typedef struct {
+  /** Number of jobs queued */
+  uint64_t queued;
+  /** Number of jobs dropped because the queue was full */
+  uint64_t dropped;
+  /** Number of times the producer has found the queue full and has
+   *  chained a larger one behind it */
+  uint64_t stalls;
+  /** Maximum queue depth seen by the producer */
+  uint64_t max_depth;
+
+  /** Number of jobs done */
+  uint64_t done;
+  /** Total time jobs have waited in the queue */
+  uint64_t wait_ns;
+  /** Maximum time a job has waited in the queue */
+  uint64_t max_wait_ns;
+  /** Total time spent working */
+  uint64_t work_ns;
+  /** Maximum time spent working on a single job */
+  uint64_t max_work_ns;
+} stage_stats_t;
+
+
+/** One worker thread and its queue */
+typedef struct {
+  /** Stage name for stats output */
+  const char *name;
+  /** The work */
+  void (*work)(const job_t *job);
+  /** Queue from the producer to the worker (the last one of the
+   *  chain, which the worker may not have reached yet) */
+  spsc_queue_t *queue;
+  /** Capacity of #queue */
+  size_t capacity;
+  /** The worker thread */
+  pthread_t thread;
+  /** Statistics */
+  stage_stats_t stats;
+} stage_t;
+
+
+/** Internals of opaque #pipeline_t */
+struct _pipeline_t {
+  /** Log value tables */
+  stage_t render;
+  /** Write value tables to files */
+  stage_t export;
+};
+
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+
+/** Add value to a counter only ever written by the calling thread */
+static void stat_add(uint64_t *counter, const uint64_t value)
+{
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value,
+                   __ATOMIC_RELAXED);
+}
+
+
+/** Raise a maximum only ever written by the calling thread */
+static void stat_max(uint64_t *max, const uint64_t value)
+{
+  if (value > __atomic_load_n(max, __ATOMIC_RELAXED)) {
+    __atomic_store_n(max, value, __ATOMIC_RELAXED);
+  }
+}
+
+
+static uint64_t stat_get(const uint64_t *counter)
+{
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+
+static void render_work(const job_t *job)
+{
+  char prefix[64];
+  snprintf(prefix, sizeof(prefix), "%s< ", job->text);
+  fmlog_value_table(prefix, job->value_table->elements,
+                    job->value_table->element_count);
+}
+
+
+static void export_work(const job_t *job)
+{
+  export_value_table(job->text, job->personality_info, job->value_table,
+                     job->write_intermediate);
+}
+
+
+static job_t *job_new(const char *text,
+                      personality_info_t *personality_info,
+                      packet_value_table_t *value_table,
+                      const bool write_intermediate)
+{
+  job_t *job = malloc(sizeof(*job));
+  assert(job);
+  const size_t size = strlen(text) + 1;
+  job->text = malloc(size);
+  assert(job->text);
+  memcpy(job->text, text, size);
+  if (personality_info) {
+    personality_info_ref(personality_info);
+  }
+  job->personality_info = personality_info;
+  packet_value_table_ref(value_table);
+  job->value_table = value_table;
+  job->write_intermediate = write_intermediate;
+  job->queued_ns = now_ns();
+  job->next_queue = NULL;
+  return job;
+}
+
+
+static void job_free(job_t *job)
+{
+  packet_value_table_unref(job->value_table);
+  if (job->personality_info) {
+    personality_info_unref(job->personality_info);
+  }
+  free(job->text);
+  free(job);
+}
+
+
+/** Worker thread main function, runs until it pops a NULL job */
+static void *stage_thread(void *data)
+{
+  stage_t *stage = data;
+  spsc_queue_t *queue = stage->queue;
+  job_t *job;
+  while ((job = spsc_queue_pop(queue))) {
+    if (job->next_queue) {
+      /* link job: the producer has moved on to a larger queue */
+      spsc_queue_free(queue);
+      queue = job->next_queue;
+      free(job);
+      continue;
+    }
+    const uint64_t start_ns = now_ns();
+    stage->work(job);
+    const uint64_t end_ns = now_ns();
+    stat_add(&stage->stats.wait_ns, start_ns - job->queued_ns);
+    stat_max(&stage->stats.max_wait_ns, start_ns - job->queued_ns);
+    stat_add(&stage->stats.work_ns, end_ns - start_ns);
+    stat_max(&stage->stats.max_work_ns, end_ns - start_ns);
+    job_free(job);
+    stat_add(&stage->stats.done, 1);
+  }
+  return NULL;
+}
+
+
+static void stage_init(stage_t *stage, const char *name,
+                       void (*work)(const job_t *job))
+{
+  memset(stage, 0, sizeof(*stage));
+  stage->name = name;
+  stage->work = work;
+  stage->capacity = PIPELINE_QUEUE_SIZE;
+  stage->queue = spsc_queue_new(stage->capacity);
+  const int ret = pthread_create(&stage->thread, NULL, stage_thread, stage);
+  assert(ret == 0);
+}
+
+
+/** Number of jobs queued but not done yet, in all chained queues */
+static uint64_t stage_depth(const stage_t *stage)
+{
+  return stat_get(&stage->stats.queued) - stat_get(&stage->stats.done);
+}
+
+
+/** Queue job, chaining a larger queue behind a full one if grow is set
+ *
+ * Never waits for the worker. The depth seen here can only be larger
+ * than the real one, as only the worker removes jobs, so a queue with
+ * less than capacity-1 jobs always has room for the job plus a link
+ * job.
+ *
+ * \return false if the job has been dropped.
+ */
+static bool stage_push(stage_t *stage, job_t *job, const bool grow)
+{
+  if (spsc_queue_depth(stage->queue) >= stage->capacity - 1) {
+    if (!grow) {
+      stat_add(&stage->stats.dropped, 1);
+      return false;
+    }
+    stat_add(&stage->stats.stalls, 1);
+    job_t *link = malloc(sizeof(*link));
+    assert(link);
+    memset(link, 0, sizeof(*link));
+    stage->capacity *= 2;
+    spsc_queue_t *next_queue = spsc_queue_new(stage->capacity);
+    link->next_queue = next_queue;
+    /* the worker frees link as soon as it has popped it */
+    const bool linked = spsc_queue_push(stage->queue, link);
+    assert(linked);
+    stage->queue = next_queue;
+  }
+  /* count before the worker can see the job, or depth underflows */
+  if (job) {
+    stat_add(&stage->stats.queued, 1);
+  }
+  const bool pushed = spsc_queue_push(stage->queue, job);
+  assert(pushed);
+  stat_max(&stage->stats.max_depth, stage_depth(stage));
+  return true;
+}
+
+
+static void stage_fini(stage_t *stage)
+{
+  stage_push(stage, NULL, true);
+  const int ret = pthread_join(stage->thread, NULL);
+  assert(ret == 0);
+  spsc_queue_free(stage->queue);
+}
+
+
+/* documented in freemcan-pipeline.h */
+pipeline_t *pipeline_new(void)
+{
+  pipeline_t *self = malloc(sizeof(*self));
+  assert(self);
+
+  /* Signals are for the main thread's event loop, so keep them
+   * blocked in the workers. */
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  stage_init(&self->render, "render", render_work);
+  stage_init(&self->export, "export", export_work);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+  return self;
+}
+
+
+/* documented in freemcan-pipeline.h */
+void pipeline_unref(pipeline_t *self)
+{
+  stage_fini(&self->render);
+  stage_fini(&self->export);
+  free(self);
+}
+
+
+/* documented in freemcan-pipeline.h */
+void pipeline_render(pipeline_t *self, const char *label,
+                     packet_value_table_t *value_table)
+{
+  job_t *job = job_new(label, NULL, value_table, false);
+  if (!stage_push(&self->render, job, false)) {
+    job_free(job);
+  }
+}
+
+
+/* documented in freemcan-pipeline.h */
+void pipeline_export(pipeline_t *self, const char *outdir,
+                     personality_info_t *personality_info,
+                     packet_value_table_t *value_table,
+                     const bool write_intermediate)
+{
+  job_t *job = job_new(outdir, personality_info, value_table,
+                       write_intermediate);
+  stage_push(&self->export, job, true);
+}
+
+
+static void stage_fmlog_stats(const stage_t *stage)
+{
+  const stage_stats_t *s = &stage->stats;
+  const uint64_t done = stat_get(&s->done);
+  fmlog("  %s: %llu queued, %llu done, %llu dropped, %llu stalls, "
+        "depth %llu (max %llu), queue size %zu", stage->name,
+        (unsigned long long)stat_get(&s->queued),
+        (unsigned long long)done,
+        (unsigned long long)stat_get(&s->dropped),
+        (unsigned long long)stat_get(&s->stalls),
+        (unsigned long long)stage_depth(stage),
+        (unsigned long long)stat_get(&s->max_depth),
+        stage->capacity);
+  fmlog("  %s: queue wait %.3f ms avg %.3f ms max, "
+        "work %.3f ms avg %.3f ms max", stage->name,
+        done ? stat_get(&s->wait_ns)/1e6/done : 0.0,
+        stat_get(&s->max_wait_ns)/1e6,
+        done ? stat_get(&s->work_ns)/1e6/done : 0.0,
+        stat_get(&s->max_work_ns)/1e6);
+}
+
+
+/* documented in freemcan-pipeline.h */
+void pipeline_fmlog_stats(const pipeline_t *self)
+{
+  fmlog("Value table pipeline:");
+  stage_fmlog_stats(&self->render);
+  stage_fmlog_stats(&self->export);
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,95 @@
+/** \file hostware/freemcan-pipeline.h
+ * \brief Value table render and export worker threads (interface)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup freemcan_pipeline
+ * @{
+ */
+
+
+#ifndef FREEMCAN_PIPELINE_H
+#define FREEMCAN_PIPELINE_H
+
+#include <stdbool.h>
+
+#include "packet-value-table.h"
+#include "personality-info.h"
+
+
+/** Value table pipeline (opaque data type) */
+struct _pipeline_t;
+
+/** Value table pipeline (opaque data type) */
+typedef struct _pipeline_t pipeline_t;
+
+
+/** Start the render and export worker threads */
+pipeline_t *pipeline_new(void)
+  __attribute__(( malloc ))
+  __attribute__(( warn_unused_result ));
+
+
+/** Finish all queued work, then stop the worker threads */
+void pipeline_unref(pipeline_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Have the render worker log the value table element by element
+ *
+ * If the render queue is full, the value table is not logged.
+ *
+ * Must always be called from the same thread.
+ */
+void pipeline_render(pipeline_t *self, const char *label,
+                     packet_value_table_t *value_table)
+  __attribute__(( nonnull(1,2,3) ));
+
+
+/** Have the export worker write the value table to a file
+ *
+ * Arguments as for #export_value_table. If the export queue is full,
+ * the job goes into a larger queue chained behind it, as we never
+ * want to lose measurement data, nor wait for the export worker to
+ * catch up.
+ *
+ * Must always be called from the same thread.
+ */
+void pipeline_export(pipeline_t *self, const char *outdir,
+                     personality_info_t *personality_info,
+                     packet_value_table_t *value_table,
+                     const bool write_intermediate)
+  __attribute__(( nonnull(1,2,3,4) ));
+
+
+/** Log queue depths and stage latencies */
+void pipeline_fmlog_stats(const pipeline_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** @} */
+
+#endif /* !FREEMCAN_PIPELINE_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
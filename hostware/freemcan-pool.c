@@ -0,0 +1,132 @@
+/** \file hostware/freemcan-pool.c
+ * \brief Recycling memory pool for frames and value tables (implementation)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup freemcan_pool Recycling Memory Pool
+ * \ingroup hostware_generic
+ *
+ * Every received frame and every value table used to be malloc(3)ed
+ * and free(3)d again shortly after. The pool keeps released objects
+ * around and hands them out again instead.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+
+#include "freemcan-log.h"
+#include "freemcan-pool.h"
+
+
+/* documented in freemcan-pool.h */
+void *pool_alloc(pool_t *pool, const size_t size, size_t *capacity)
+{
+  pthread_mutex_lock(&pool->mutex);
+  pool->stats.allocs++;
+
+  /* most recently released fitting object first */
+  for (unsigned int i=pool->free_count; i>0; i--) {
+    if (pool->free_size[i-1] >= size) {
+      void *obj = pool->free_obj[i-1];
+      *capacity = pool->free_size[i-1];
+      pool->free_count--;
+      pool->free_obj[i-1]  = pool->free_obj[pool->free_count];
+      pool->free_size[i-1] = pool->free_size[pool->free_count];
+      pthread_mutex_unlock(&pool->mutex);
+      return obj;
+    }
+  }
+
+  const size_t alloc_size = (size > pool->min_size) ? size : pool->min_size;
+  pool->stats.mallocs++;
+  pthread_mutex_unlock(&pool->mutex);
+  void *obj = malloc(alloc_size);
+  assert(obj);
+  *capacity = alloc_size;
+  return obj;
+}
+
+
+/* documented in freemcan-pool.h */
+void pool_release(pool_t *pool, void *obj, const size_t capacity)
+{
+  pthread_mutex_lock(&pool->mutex);
+  if ((pool->free_count < POOL_MAX_FREE) && (capacity >= pool->min_size)) {
+    pool->free_obj[pool->free_count]  = obj;
+    pool->free_size[pool->free_count] = capacity;
+    pool->free_count++;
+    pthread_mutex_unlock(&pool->mutex);
+  } else {
+    pool->stats.frees++;
+    pthread_mutex_unlock(&pool->mutex);
+    free(obj);
+  }
+}
+
+
+/* documented in freemcan-pool.h */
+void pool_reserve(pool_t *pool, const size_t size)
+{
+  pthread_mutex_lock(&pool->mutex);
+  if (size <= pool->min_size) {
+    pthread_mutex_unlock(&pool->mutex);
+    return;
+  }
+  pool->min_size = size;
+  unsigned int k = 0;
+  for (unsigned int i=0; i<pool->free_count; i++) {
+    if (pool->free_size[i] >= size) {
+      pool->free_obj[k]  = pool->free_obj[i];
+      pool->free_size[k] = pool->free_size[i];
+      k++;
+    } else {
+      free(pool->free_obj[i]);
+      pool->stats.frees++;
+    }
+  }
+  pool->free_count = k;
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+
+/* documented in freemcan-pool.h */
+void pool_fmlog_stats(pool_t *pool)
+{
+  pthread_mutex_lock(&pool->mutex);
+  const pool_stats_t stats = pool->stats;
+  const size_t min_size = pool->min_size;
+  pthread_mutex_unlock(&pool->mutex);
+  const unsigned long allocs = stats.allocs;
+  const double per_alloc = allocs ? ((double)stats.mallocs)/allocs : 0.0;
+  fmlog("  %s pool: %lu allocs, %lu mallocs (%.3f per alloc), %lu frees, "
+        "min size %zu", pool->name, allocs, stats.mallocs, per_alloc,
+        stats.frees, min_size);
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
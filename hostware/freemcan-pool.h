@@ -0,0 +1,122 @@
+/** \file hostware/freemcan-pool.h
+ * \brief Recycling memory pool for frames and value tables (interface)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup freemcan_pool
+ * @{
+ */
+
+
+#ifndef FREEMCAN_POOL_H
+#define FREEMCAN_POOL_H
+
+#include <pthread.h>
+#include <stdlib.h>
+
+
+/** Maximum number of released objects kept around for recycling */
+#define POOL_MAX_FREE 8
+
+
+/** Allocation statistics for a pool */
+typedef struct {
+  /** Number of objects handed out */
+  unsigned long allocs;
+  /** Number of objects which had to be malloc(3)ed */
+  unsigned long mallocs;
+  /** Number of objects which have been free(3)d */
+  unsigned long frees;
+} pool_stats_t;
+
+
+/** Recycling memory pool
+ *
+ * Keeps up to #POOL_MAX_FREE released objects and hands them out
+ * again if they are large enough. Every object is allocated with at
+ * least #min_size bytes, so once #pool_reserve has been told about
+ * the largest object size to expect, the steady state does not call
+ * malloc(3) or free(3) at all.
+ *
+ * Objects may be allocated and released from different threads.
+ *
+ * Define pools statically with #POOL_INITIALIZER.
+ */
+typedef struct {
+  /** Name for debug output */
+  const char *name;
+  /** Protects everything below */
+  pthread_mutex_t mutex;
+  /** Minimum allocation size */
+  size_t min_size;
+  /** Number of valid entries in #free_obj and #free_size */
+  unsigned int free_count;
+  /** Released objects */
+  void *free_obj[POOL_MAX_FREE];
+  /** Allocated sizes of released objects */
+  size_t free_size[POOL_MAX_FREE];
+  /** Allocation statistics */
+  pool_stats_t stats;
+} pool_t;
+
+
+/** Static initializer for #pool_t */
+#define POOL_INITIALIZER(NAME) \
+  { (NAME), PTHREAD_MUTEX_INITIALIZER, 0, 0, { NULL }, { 0 }, { 0, 0, 0 } }
+
+
+/** Get an object of at least size bytes from the pool
+ *
+ * \param capacity Returns the actual size of the object, which needs
+ *                 to be given back to #pool_release.
+ */
+void *pool_alloc(pool_t *pool, const size_t size, size_t *capacity)
+  __attribute__(( nonnull(1,3) ))
+  __attribute__(( warn_unused_result ))
+  __attribute__(( malloc ));
+
+
+/** Give an object back to the pool */
+void pool_release(pool_t *pool, void *obj, const size_t capacity)
+  __attribute__(( nonnull(1,2) ));
+
+
+/** Make all future objects at least size bytes large
+ *
+ * Released objects smaller than that are freed.
+ */
+void pool_reserve(pool_t *pool, const size_t size)
+  __attribute__(( nonnull(1) ));
+
+
+/** Write pool statistics into the log */
+void pool_fmlog_stats(pool_t *pool)
+  __attribute__(( nonnull(1) ));
+
+
+/** @} */
+
+#endif /* !FREEMCAN_POOL_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
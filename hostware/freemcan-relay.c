@@ -0,0 +1,265 @@
+/** \file hostware/freemcan-relay.c
+ * \brief Share one device among several hostware programs
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup hostware_relay Relay
+ * \ingroup hostware
+ *
+ * Opens a device (serial port or emulator socket) and offers it on a
+ * UNIX domain socket, which any number of hostware programs can open
+ * as their device at the same time: e.g. the daemon running the
+ * measurements, and a TUI or two watching the value tables arrive.
+ * All of them get everything the device sends, and the device gets
+ * the commands from all of them (see \ref device_relay).
+ *
+ * Exits when the device goes away.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "device-relay.h"
+#include "freemcan-device.h"
+#include "freemcan-evloop.h"
+#include "freemcan-log.h"
+
+#include "git-version.h"
+
+
+/** Maximum number of clients (-c) */
+static unsigned long max_clients = 16;
+
+
+/** Set by SIGINT or SIGTERM */
+static bool quit = false;
+
+
+/** The relay */
+static relay_t *relay;
+
+
+/** Accept client connection */
+static void relay_do_accept(void *data, const uint64_t events
+                            __attribute__((unused)))
+{
+  const int listen_fd = *(int *)data;
+  const int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  if (relay_client_count(relay) >= max_clients) {
+    fmlog("Refusing client beyond the maximum of %lu", max_clients);
+    close(fd);
+    return;
+  }
+  relay_add_client(relay, fd);
+  fmlog("Client connected, %u now", relay_client_count(relay));
+}
+
+
+/** Log relay statistics */
+static void log_stats(void)
+{
+  const relay_stats_t *stats = relay_stats(relay);
+  fmlog("Relay statistics: %u clients connected (%lu so far)",
+        relay_client_count(relay), stats->clients);
+  fmlog("  %llu bytes from the device, %llu to clients spliced, "
+        "%llu copied", (unsigned long long)stats->bytes_in,
+        (unsigned long long)stats->bytes_spliced,
+        (unsigned long long)stats->bytes_copied);
+  fmlog("  %lu commands (%llu bytes) to the device, "
+        "paused %lu times for slow clients", stats->commands,
+        (unsigned long long)stats->bytes_to_source, stats->pauses);
+}
+
+
+/** SIGINT, SIGTERM, or SIGUSR1 received */
+static void relay_evloop_signal(void *data __attribute__((unused)),
+                                const uint64_t signo)
+{
+  if (signo == SIGUSR1) {
+    log_stats();
+    return;
+  }
+  fmlog("Received signal %d, exiting.", (int)signo);
+  quit = true;
+}
+
+
+/** Open listening socket at socket_name */
+static int open_listen_socket(const char *socket_name)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_name) >= sizeof(addr.sun_path)) {
+    fmlog_error("Fatal: Socket name too long: %s", socket_name);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, socket_name);
+
+  /* remove the socket a previous run has left behind, but nothing else */
+  struct stat sb;
+  if ((stat(socket_name, &sb) == 0) && S_ISSOCK(sb.st_mode)) {
+    unlink(socket_name);
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fmlog_error("Fatal: socket(2)");
+    exit(EXIT_FAILURE);
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fmlog_error("Fatal: Cannot bind socket %s", socket_name);
+    exit(EXIT_FAILURE);
+  }
+  if (listen(fd, 4) < 0) {
+    fmlog_error("Fatal: Cannot listen on socket %s", socket_name);
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+
+static void relay_fmlog_command_line_help(const char *const argv0)
+{
+  const char *last_slash = strrchr(argv0, '/');
+  const char *prog = last_slash?(last_slash+1):(argv0);
+  fmlog("Usage: %s [<option>...] <SERIAL_PORT> <SOCKET>", prog);
+  fmlog("Share the FreeMCAn device at <SERIAL_PORT> (or an emulator socket)");
+  fmlog("among several hostware programs, which open the UNIX domain socket");
+  fmlog("<SOCKET> as their device.\n");
+  fmlog("Options:");
+  fmlog("   -c --max-clients=N     accept at most N clients at a time (%lu)",
+        max_clients);
+  fmlog("   -h --help              print help message and exit");
+  fmlog("   -V --version           print version message and exit\n");
+  fmlog("Send SIGUSR1 to log the relay statistics.");
+}
+
+
+/** Parse command line options, return index of first non-option */
+static int parse_options(int argc, char *argv[])
+{
+  static const struct option long_options[] = {
+    { "max-clients", required_argument, NULL, 'c' },
+    { "help",        no_argument,       NULL, 'h' },
+    { "version",     no_argument,       NULL, 'V' },
+    { NULL, 0, NULL, 0 }
+  };
+  while (1) {
+    const int c = getopt_long(argc, argv, "c:hV", long_options, NULL);
+    if (c == -1) {
+      break;
+    }
+    switch (c) {
+    case 'c': {
+      char *end;
+      max_clients = strtoul(optarg, &end, 0);
+      if ((*optarg == '\0') || (*end != '\0') || (max_clients == 0)) {
+        fmlog_error("Fatal: Invalid maximum number of clients: %s", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    }
+    case 'h':
+      relay_fmlog_command_line_help(argv[0]);
+      exit(EXIT_SUCCESS);
+    case 'V':
+      fmlog("freemcan-relay " GIT_VERSION);
+      exit(EXIT_SUCCESS);
+    default:
+      relay_fmlog_command_line_help(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (optind + 2 != argc) {
+    fmlog_error("Fatal: Need a device and a socket name.");
+    relay_fmlog_command_line_help(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  return optind;
+}
+
+
+/** Relay main program */
+int main(int argc, char *argv[])
+{
+  const int first_arg = parse_options(argc, argv);
+  const char *device_name = argv[first_arg];
+  const char *socket_name = argv[first_arg+1];
+
+  fmlog("freemcan relay " GIT_VERSION);
+
+  const int device_fd = device_open_fd(device_name);
+  if (device_fd < 0) {
+    fmlog("Fatal: Cannot open device %s", device_name);
+    exit(EXIT_FAILURE);
+  }
+
+  evloop_t *loop = evloop_new();
+  evloop_add_signal(loop, SIGINT,  relay_evloop_signal, NULL);
+  evloop_add_signal(loop, SIGTERM, relay_evloop_signal, NULL);
+  evloop_add_signal(loop, SIGUSR1, relay_evloop_signal, NULL);
+
+  relay = relay_new(loop, device_fd);
+  int listen_fd = open_listen_socket(socket_name);
+  evloop_add_fd(loop, listen_fd, EPOLLIN, relay_do_accept, &listen_fd);
+  fmlog("Relaying %s at %s", device_name, socket_name);
+
+  while (!quit) {
+    evloop_run_once(loop, -1);
+    if (relay_is_closed(relay)) {
+      fmlog("Device has gone, exiting.");
+      break;
+    }
+  }
+
+  log_stats();
+  relay_unref(relay);
+  evloop_unref(loop);
+  close(listen_fd);
+  unlink(socket_name);
+  close(device_fd);
+  return 0;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,415 @@
+/** \file hostware/freemcan-rig.c
+ * \brief Measure the hostware and a simulated device end to end
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup hostware_rig Integration Rig
+ * \ingroup hostware
+ *
+ * Starts a device program like firmware/host/pty-adc-int-mca, which
+ * runs the firmware on a simulated MCU behind a pty, and talks to it
+ * through #device_open like freemcan-tui does. Reports
+ *
+ *   - the command round trip time ('s' command to state packet),
+ *   - the value table transfer time ('i' and 'u' commands),
+ *   - the INT0 event rate at which the firmware starts losing
+ *     events while the host keeps polling delta value tables.
+ *
+ * Event rates are in pulses per simulated tick (see the device
+ * program), so they compare firmware versions, not devices.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+#include "frame-defs.h"
+#include "frame-parser.h"
+#include "freemcan-device.h"
+#include "freemcan-log.h"
+#include "packet-parser.h"
+
+#include "git-version.h"
+
+
+/** Seconds to wait for the device before giving up */
+#define TIMEOUT 10
+
+
+/** Running device program and our connection to it */
+typedef struct {
+  pid_t pid;
+  FILE *out;
+  packet_parser_t *packet_parser;
+  device_t *device;
+
+  unsigned long states;
+  char state[32];
+  unsigned long tables;
+  size_t table_bytes;
+  unsigned long table_total;
+} rig_t;
+
+
+/** Statistics line printed by the device program */
+typedef struct {
+  unsigned long pulses;
+  unsigned long lost;
+} rig_stats_t;
+
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+static void handle_state(const char *state, void *data)
+{
+  rig_t *rig = data;
+  snprintf(rig->state, sizeof(rig->state), "%s", state);
+  rig->states++;
+}
+
+
+static void handle_text(const char *text,
+                        void *data __attribute__((unused)))
+{
+  fmlog("Device text: %s", text);
+}
+
+
+static void handle_value_table(packet_value_table_t *vtab, void *data)
+{
+  rig_t *rig = data;
+  rig->table_bytes = vtab->wire_size;
+  rig->table_total = 0;
+  for (size_t i=0; i<vtab->element_count; i++) {
+    rig->table_total += vtab->elements[i];
+  }
+  rig->tables++;
+}
+
+
+/** Read from the device until the counter has moved away from start
+ *
+ * Take start before sending the command: One read may well bring the
+ * answer frame and the status frame following it.
+ */
+static void wait_for(rig_t *rig, const unsigned long *counter,
+                     const unsigned long start)
+{
+  const int fd = device_get_fd(rig->device);
+  while (*counter == start) {
+    struct pollfd pfd = {
+      fd, POLLIN | (device_tx_pending(rig->device) ? POLLOUT : 0), 0
+    };
+    const int ret = poll(&pfd, 1, TIMEOUT*1000);
+    if (ret == 0) {
+      fmlog("Fatal: Device has not answered for %d seconds", TIMEOUT);
+      exit(EXIT_FAILURE);
+    } else if (ret < 0) {
+      assert(errno == EINTR);
+      continue;
+    }
+    if (((pfd.revents & POLLOUT) && (device_do_write(rig->device) < 0)) ||
+        ((pfd.revents & ~POLLOUT) && (device_do_io(rig->device) < 0))) {
+      fmlog("Fatal: Lost connection to device");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+
+static void wait_for_state(rig_t *rig, const char *state)
+{
+  while (true) {
+    wait_for(rig, &rig->states, rig->states);
+    if (strcmp(rig->state, state) == 0) {
+      return;
+    }
+  }
+}
+
+
+/** Start device program, connect to its pty, wait for READY */
+static void rig_start(rig_t *rig, const char *program,
+                      const char *const args[])
+{
+  int pipefd[2];
+  int ret = pipe(pipefd);
+  assert(ret == 0);
+  rig->pid = fork();
+  assert(rig->pid >= 0);
+  if (rig->pid == 0) {
+    close(pipefd[0]);
+    dup2(pipefd[1], STDOUT_FILENO);
+    close(pipefd[1]);
+    const char *argv[16] = { program };
+    for (size_t i=0; args[i]; i++) {
+      assert(i+2 < sizeof(argv)/sizeof(argv[0]));
+      argv[i+1] = args[i];
+    }
+    execv(program, (char *const *)argv);
+    fmlog_error("execv(%s)", program);
+    _exit(EXIT_FAILURE);
+  }
+  close(pipefd[1]);
+  rig->out = fdopen(pipefd[0], "r");
+  assert(rig->out);
+
+  char pty_name[128];
+  if (!fgets(pty_name, sizeof(pty_name), rig->out)) {
+    fmlog("Fatal: %s did not tell its pty", program);
+    exit(EXIT_FAILURE);
+  }
+  pty_name[strcspn(pty_name, "\n")] = '\0';
+
+  rig->states = 0;
+  rig->tables = 0;
+  rig->packet_parser =
+    packet_parser_new(handle_value_table, handle_state, handle_text,
+                      NULL, NULL, rig);
+  /* the device takes over our frame parser reference */
+  rig->device = device_new(frame_parser_new(rig->packet_parser));
+  if (device_open(rig->device, pty_name) < 0) {
+    fmlog("Fatal: Cannot open %s", pty_name);
+    exit(EXIT_FAILURE);
+  }
+
+  /* The packet parser needs the personality info for decoding value
+   * tables, and we may have missed the one sent on boot. */
+  device_send_command(rig->device, FRAME_CMD_PERSONALITY_INFO);
+  wait_for_state(rig, "READY");
+}
+
+
+/** Have the device program print its statistics */
+static void rig_get_stats(rig_t *rig, const int signo, rig_stats_t *stats)
+{
+  kill(rig->pid, signo);
+  char line[256];
+  if (!fgets(line, sizeof(line), rig->out) ||
+      (sscanf(line, "pulses %lu lost %lu", &stats->pulses, &stats->lost) != 2)) {
+    fmlog("Fatal: Cannot read device statistics");
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+static void rig_stop(rig_t *rig, rig_stats_t *stats)
+{
+  rig_get_stats(rig, SIGTERM, stats);
+  int status;
+  waitpid(rig->pid, &status, 0);
+  fclose(rig->out);
+  device_close(rig->device);
+  device_unref(rig->device);
+  packet_parser_unref(rig->packet_parser);
+}
+
+
+static void start_measurement(rig_t *rig)
+{
+  uint16_t timer_count = 0xffff;
+  device_send_command_with_params(rig->device, FRAME_CMD_MEASURE,
+                                  &timer_count, sizeof(timer_count));
+  wait_for_state(rig, "MEASURING");
+}
+
+
+/** Send a delta value table request with the parser's ack */
+static void request_delta(rig_t *rig)
+{
+  const unsigned long tables = rig->tables, states = rig->states;
+  uint8_t ack = packet_parser_get_delta_ack(rig->packet_parser);
+  device_send_command_with_params(rig->device, FRAME_CMD_INTERMEDIATE_DELTA,
+                                  &ack, sizeof(ack));
+  wait_for(rig, &rig->tables, tables);
+  wait_for(rig, &rig->states, states);
+}
+
+
+static void report(const char *name, const double *t, const unsigned int n)
+{
+  double min = t[0], max = t[0], sum = 0;
+  for (unsigned int i=0; i<n; i++) {
+    min = (t[i] < min) ? t[i] : min;
+    max = (t[i] > max) ? t[i] : max;
+    sum += t[i];
+  }
+  fmlog("%-20s min %8.1f us  avg %8.1f us  max %8.1f us",
+        name, 1e6*min, 1e6*sum/n, 1e6*max);
+}
+
+
+static void measure_latencies(const char *program, const char *uart_ticks,
+                              const unsigned int rounds)
+{
+  const char *const args[] = { "-u", uart_ticks, NULL };
+  rig_t rig;
+  rig_start(&rig, program, args);
+  double *t = calloc(rounds, sizeof(double));
+  assert(t);
+
+  for (unsigned int i=0; i<rounds; i++) {
+    const unsigned long states = rig.states;
+    const double t0 = now();
+    device_send_command(rig.device, FRAME_CMD_STATE);
+    wait_for(&rig, &rig.states, states);
+    t[i] = now() - t0;
+  }
+  report("command round trip", t, rounds);
+
+  start_measurement(&rig);
+  for (unsigned int i=0; i<rounds; i++) {
+    const unsigned long tables = rig.tables, states = rig.states;
+    const double t0 = now();
+    device_send_command(rig.device, FRAME_CMD_INTERMEDIATE);
+    wait_for(&rig, &rig.tables, tables);
+    t[i] = now() - t0;
+    wait_for(&rig, &rig.states, states);
+  }
+  report("value table", t, rounds);
+  fmlog("%-20s %zu bytes", "", rig.table_bytes);
+
+  for (unsigned int i=0; i<rounds; i++) {
+    const double t0 = now();
+    request_delta(&rig);
+    t[i] = now() - t0;
+  }
+  report("delta value table", t, rounds);
+  fmlog("%-20s %zu bytes", "", rig.table_bytes);
+
+  free(t);
+  rig_stats_t stats;
+  rig_stop(&rig, &stats);
+}
+
+
+/** Events lost at one pulse every pulse_ticks ticks */
+static unsigned long measure_loss(const char *program, const char *uart_ticks,
+                                  const unsigned long pulse_ticks,
+                                  const unsigned int rounds)
+{
+  char pulse_arg[24];
+  snprintf(pulse_arg, sizeof(pulse_arg), "%lu", pulse_ticks);
+  const char *const args[] = { "-u", uart_ticks, "-i", pulse_arg, NULL };
+  rig_t rig;
+  rig_start(&rig, program, args);
+
+  /* INTF0 stays set until the measurement starts */
+  rig_stats_t before, after, end;
+  start_measurement(&rig);
+  rig_get_stats(&rig, SIGUSR1, &before);
+  for (unsigned int i=0; i<rounds; i++) {
+    request_delta(&rig);
+  }
+  rig_get_stats(&rig, SIGUSR1, &after);
+  rig_stop(&rig, &end);
+
+  const unsigned long pulses = after.pulses - before.pulses;
+  const unsigned long lost = after.lost - before.lost;
+  fmlog("one pulse per %5lu ticks: %8lu pulses %8lu lost (%5.2f%%)",
+        pulse_ticks, pulses, lost, pulses ? (100.0*lost/pulses) : 0.0);
+  return lost;
+}
+
+
+static void fmlog_command_line_help(const char *const argv0)
+{
+  const char *last_slash = strrchr(argv0, '/');
+  const char *prog = last_slash?(last_slash+1):(argv0);
+  fmlog("Usage: %s [-n ROUNDS] [-u UART_TICKS] <DEVICE_PROGRAM>", prog);
+  fmlog("       %s --help|--version\n", prog);
+  fmlog("DEVICE_PROGRAM  e.g. ../firmware/host/pty-adc-int-mca");
+  fmlog("ROUNDS          number of commands per measurement (default 200)");
+  fmlog("UART_TICKS      simulated UART time per byte (default 16)");
+}
+
+
+/** Integration rig main program */
+int main(int argc, char *argv[])
+{
+  if ((argc == 2) && (strcmp(argv[1], "--help") == 0)) {
+    fmlog_command_line_help(argv[0]);
+    exit(EXIT_SUCCESS);
+  } else if ((argc == 2) && (strcmp(argv[1], "--version") == 0)) {
+    fmlog("freemcan-rig " GIT_VERSION);
+    exit(EXIT_SUCCESS);
+  }
+
+  unsigned int rounds = 200;
+  const char *uart_ticks = "16";
+  int opt;
+  while ((opt = getopt(argc, argv, "n:u:")) != -1) {
+    switch (opt) {
+    case 'n': rounds = atoi(optarg); break;
+    case 'u': uart_ticks = optarg; break;
+    default:
+      fmlog_command_line_help(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if ((optind+1 != argc) || (rounds == 0)) {
+    fmlog_command_line_help(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  const char *program = argv[optind];
+
+  measure_latencies(program, uart_ticks, rounds);
+
+  /* halve the pulse spacing until events get lost */
+  unsigned long lossless = 0;
+  for (unsigned long pulse_ticks=4096; pulse_ticks>0; pulse_ticks/=2) {
+    if (measure_loss(program, uart_ticks, pulse_ticks, rounds/10 + 1)) {
+      break;
+    }
+    lossless = pulse_ticks;
+  }
+  if (lossless) {
+    fmlog("max event rate before loss: one pulse per %lu ticks", lossless);
+  } else {
+    fmlog("events lost even at the lowest event rate");
+  }
+  return 0;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,134 @@
+/** \file hostware/freemcan-spsc.c
+ * \brief Single producer single consumer queue (implementation)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup freemcan_spsc Single Producer Single Consumer Queue
+ * \ingroup hostware_generic
+ *
+ * A ring buffer of pointers handed from one thread to exactly one
+ * other thread. The producer only ever writes #tail and the consumer
+ * only ever writes #head, so neither needs a lock: Each publishes its
+ * index with release semantics after touching the slot, and reads the
+ * other's index with acquire semantics before touching it.
+ *
+ * The consumer sleeps on a semaphore counting the queued items, so
+ * it does not need to poll. The producer never blocks.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <semaphore.h>
+#include <stdlib.h>
+
+#include "freemcan-spsc.h"
+
+
+/** Internals of opaque #spsc_queue_t */
+struct _spsc_queue_t {
+  /** Index of next slot to pop (written by consumer only) */
+  size_t head;
+
+  /** Index of next slot to push (written by producer only) */
+  size_t tail;
+
+  /** Number of items in the queue for the consumer to wait on */
+  sem_t items;
+
+  /** Capacity - 1, to map indices to slots */
+  size_t mask;
+
+  /** The slots */
+  void *slots[];
+};
+
+
+/* documented in freemcan-spsc.h */
+spsc_queue_t *spsc_queue_new(const size_t capacity)
+{
+  assert((capacity > 0) && ((capacity & (capacity-1)) == 0));
+  spsc_queue_t *self = malloc(sizeof(*self) + capacity*sizeof(self->slots[0]));
+  assert(self);
+  self->head = 0;
+  self->tail = 0;
+  self->mask = capacity - 1;
+  const int ret = sem_init(&self->items, 0, 0);
+  assert(ret == 0);
+  return self;
+}
+
+
+/* documented in freemcan-spsc.h */
+void spsc_queue_free(spsc_queue_t *self)
+{
+  assert(spsc_queue_depth(self) == 0);
+  sem_destroy(&self->items);
+  free(self);
+}
+
+
+/* documented in freemcan-spsc.h */
+bool spsc_queue_push(spsc_queue_t *self, void *item)
+{
+  const size_t tail = self->tail;
+  const size_t head = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+  if (tail - head > self->mask) {
+    return false;
+  }
+  self->slots[tail & self->mask] = item;
+  __atomic_store_n(&self->tail, tail+1, __ATOMIC_RELEASE);
+  sem_post(&self->items);
+  return true;
+}
+
+
+/* documented in freemcan-spsc.h */
+void *spsc_queue_pop(spsc_queue_t *self)
+{
+  while (sem_wait(&self->items) < 0) {
+    assert(errno == EINTR);
+  }
+  const size_t head = self->head;
+  assert(head != __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE));
+  void *item = self->slots[head & self->mask];
+  __atomic_store_n(&self->head, head+1, __ATOMIC_RELEASE);
+  return item;
+}
+
+
+/* documented in freemcan-spsc.h */
+size_t spsc_queue_depth(const spsc_queue_t *self)
+{
+  const size_t head = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+  const size_t tail = __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE);
+  return tail - head;
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,88 @@
+/** \file hostware/freemcan-spsc.h
+ * \brief Single producer single consumer queue (interface)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup freemcan_spsc
+ * @{
+ */
+
+
+#ifndef FREEMCAN_SPSC_H
+#define FREEMCAN_SPSC_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+
+/** Single producer single consumer queue (opaque data type) */
+struct _spsc_queue_t;
+
+/** Single producer single consumer queue (opaque data type) */
+typedef struct _spsc_queue_t spsc_queue_t;
+
+
+/** Create queue holding up to capacity pointers
+ *
+ * \param capacity Must be a power of two.
+ */
+spsc_queue_t *spsc_queue_new(const size_t capacity)
+  __attribute__(( malloc ))
+  __attribute__(( warn_unused_result ));
+
+
+/** Free queue (which must be empty, and no thread waiting on) */
+void spsc_queue_free(spsc_queue_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Append item to queue (producer thread only)
+ *
+ * Never blocks.
+ *
+ * \return false if the queue is full, true otherwise.
+ */
+bool spsc_queue_push(spsc_queue_t *self, void *item)
+  __attribute__(( nonnull(1) ))
+  __attribute__(( warn_unused_result ));
+
+
+/** Remove first item from queue (consumer thread only)
+ *
+ * Blocks until there is an item to remove.
+ */
+void *spsc_queue_pop(spsc_queue_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Number of items in the queue right now */
+size_t spsc_queue_depth(const spsc_queue_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** @} */
+
+#endif /* !FREEMCAN_SPSC_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,118 @@
+/** \file hostware/freemcan-tui-main-epoll.c
+ * \brief TUI main program with epoll(7) based event loop (implementation)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ */
+
+
+#include <assert.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+
+#include "compiler.h"
+
+#include "freemcan-evloop.h"
+#include "freemcan-log.h"
+#include "freemcan-signals.h"
+#include "freemcan-tui.h"
+
+/**
+ * \defgroup freemcan_tui_epoll TUI handling for epoll(7) based main loop
+ * \ingroup hostware_tui
+ * \ingroup mainloop_epoll
+ * @{
+ */
+
+
+/** Do TUI's IO stuff (stdin readable) */
+static void tui_evloop_do_io(void *UP(data), const uint64_t UP(events))
+{
+  tui_do_io();
+}
+
+
+/** SIGINT or SIGTERM received */
+static void tui_evloop_signal(void *data, const uint64_t signo)
+{
+  if (signo == SIGINT) {
+    sigint = true;
+  } else if (signo == SIGTERM) {
+    sigterm = true;
+  }
+  evloop_quit((evloop_t *)data);
+}
+
+
+/** @} */
+
+
+/************************************************************************/
+/** \defgroup mainloop_epoll Main loop based on epoll(7)
+ * \ingroup hostware_tui
+ * @{
+ */
+/************************************************************************/
+
+
+/** TUI's main program with epoll(7) based main loop */
+int main(int argc, char *argv[])
+{
+  main_init(argc, argv);
+
+  /** initialize output module */
+  tui_init();
+
+  /** set up event loop */
+  evloop_t *loop = evloop_new();
+  evloop_add_fd(loop, STDIN_FILENO, EPOLLIN, tui_evloop_do_io, NULL);
+  evloop_add_signal(loop, SIGINT,  tui_evloop_signal, loop);
+  evloop_add_signal(loop, SIGTERM, tui_evloop_signal, loop);
+
+  /** startup messages */
+  tui_startup_messages();
+
+  /** device init and setting up each device's "network stack" */
+  tui_devices_open(loop);
+
+  /** main loop */
+  while (!(sigint || sigterm || quit_flag)) {
+    evloop_run_once(loop, -1);
+  } /* main loop */
+
+  /* clean up */
+  tui_devices_close();
+  evloop_unref(loop);
+  tui_fini();
+
+  /* implicitly call atexit_func */
+  exit(EXIT_SUCCESS);
+}
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -58,9 +58,10 @@
 #include "frame-parser.h"
 #include "packet-parser.h"
 
+#include "freemcan-devctx.h"
 #include "freemcan-device.h"
 #include "freemcan-packet.h"
-#include "freemcan-export.h"
+#include "freemcan-pipeline.h"
 #include "freemcan-iohelpers.h"
 #include "freemcan-log.h"
 #include "freemcan-tui.h"
@@ -68,79 +69,100 @@
 #include "git-version.h"
 
 
-/* Forward declaration */
-static void packet_handler_state(const char *state, void *data);
-static void packet_handler_text(const char *text, void *data);
-static void packet_handler_value_table(packet_value_table_t *value_table_packet, void *data);
-static void packet_handler_personality_info(personality_info_t *pi,
-                                            void *UP(data));
-static void packet_handler_params_from_eeprom(const void *params,
-                                              const size_t size,
-                                              void *UP(data));
+/** Quit flag for the main loop. */
+bool quit_flag = false;
 
 
-personality_info_t *personality_info = NULL;
+/** Whether to dump the user input into log */
+bool enable_user_input_dump = false;
 
 
+/** Whether to trigger periodic updates */
+static bool periodic_update_flag = false;
 
-bool is_measuring = false;
-int waiting_for = 0;
 
+/** Whether to request intermediate results as delta value tables */
+static bool delta_update_flag = false;
 
-/** Quit flag for the main loop. */
-bool quit_flag = false;
 
+/** \section tui_devices TUI Device List
+ * @{
+ */
 
-/** Whether to dump the user input into log */
-bool enable_user_input_dump = false;
 
+/** Command line arguments describing the devices (DEVICE[,OUTDIR]) */
+static char **device_args = NULL;
 
-/** Whether to trigger periodic updates */
-bool periodic_update_flag = false;
 
+/** The devices we are talking to */
+static devctx_t **devices = NULL;
 
-/** Interval in seconds */
-unsigned long periodic_update_interval = 20;
 
+/** Number of entries in #devices and #device_args */
+static size_t device_count = 0;
 
-/** Size of last received packet */
-size_t last_received_size = 0;
 
+/** Worker threads logging and exporting the value tables */
+static pipeline_t *pipeline = NULL;
 
-/** Last sent duration, used for calculating periodic update interval */
-uint16_t last_sent_duration = 0;
 
+/** Index of the device commands are sent to, or device_count for all */
+static size_t target_index = 0;
 
-/** \bug Needs to work with personalities which only need skip_samples, but no duration! */
-static void recalculate_periodic_interval(void)
+
+/** Whether device index i is a target for commands */
+static bool is_target(const size_t i)
 {
-  const unsigned long last_periodic_update_interval = periodic_update_interval;
-  if (last_sent_duration && personality_info) {
-    const float clock_period = 1.0f/((float)personality_info->units_per_second);
-    const float tmp = 1.5*sqrt(last_sent_duration*clock_period);
-    periodic_update_interval = tmp + ((last_received_size * 10UL) / 115200UL);
-    if (periodic_update_interval < 5) {
-      periodic_update_interval = 5;
-    }
+  return (target_index == device_count) || (target_index == i);
+}
+
+
+/** Log current command target */
+static
+void fmlog_target(void)
+{
+  if (target_index == device_count) {
+    fmlog("Sending commands to all %zu devices", device_count);
   } else {
-    periodic_update_interval = 20;
+    fmlog("Sending commands to device %zu %s",
+          target_index, devctx_get_label(devices[target_index]));
+  }
+}
+
+
+/** Personality info of the first target device which has one */
+static
+personality_info_t *get_target_personality_info(void)
+{
+  if (!devices) {
+    return NULL;
   }
-  if (last_periodic_update_interval != periodic_update_interval) {
-    fmlog("Periodic update interval updated from %lu to %lu",
-          last_periodic_update_interval, periodic_update_interval);
+  for (size_t i=0; i<device_count; i++) {
+    if (is_target(i)) {
+      personality_info_t *pi = devctx_get_personality_info(devices[i]);
+      if (pi) {
+        return pi;
+      }
+    }
   }
+  return NULL;
 }
 
 
-void update_last_received_size(const uint16_t size)
+/** Send a simple command to all target devices */
+static
+void tui_send_simple_command(const frame_cmd_t cmd)
 {
-  if (size >= last_received_size) {
-    last_received_size = size;
+  for (size_t i=0; i<device_count; i++) {
+    if (is_target(i)) {
+      devctx_send_simple_command(devices[i], cmd);
+    }
   }
-  recalculate_periodic_interval();
 }
 
 
+/** @} */
+
 
 /** \section tui_measurement_params TUI Measurement parameter set handling
  * @{
@@ -334,6 +356,7 @@ void tui_fmlog_help(void)
   fmlog("    2           toggle hexdump of received layer 2 data (frames)");
   fmlog("    9           toggle dump of user input (typed characters)");
   fmlog("  Local settings");
+  const personality_info_t *personality_info = get_target_personality_info();
   if (personality_info) {
     fmlog("    +/-         increase/decrease measurement duration (%.3f seconds)",
           duration_list[duration_index]*(1.0f/((float)personality_info->units_per_second)));
@@ -345,6 +368,10 @@ void tui_fmlog_help(void)
   fmlog("    <space>     print current hostware parameters that would be sent");
   fmlog("                with 'e' or 'm'");
   fmlog("    p           toggle (p)eriodical requests of intermediate results");
+  fmlog("    u           toggle delta encoded intermediate results (for fast (u)pdates)");
+  if (device_count > 1) {
+    fmlog("    <tab>       cycle the device(s) commands are sent to");
+  }
   fmlog("  Send commands/requests:");
   fmlog("    a           send command \"(a)bort\"");
   fmlog("    e           write measurement parameters to (e)eprom");
@@ -363,9 +390,6 @@ void tui_startup_messages(void)
 }
 
 
-packet_parser_t *tui_packet_parser = NULL;
-
-
 /** Initialize TTY stuff */
 void tui_init()
 {
@@ -374,13 +398,6 @@ void tui_init()
   stdlog = fopen("freemcan-tui.log", "w");
   fmlog_set_handler(tui_log_handler, NULL);
 
-  tui_packet_parser = packet_parser_new(packet_handler_value_table,
-                                        packet_handler_state,
-                                        packet_handler_text,
-                                        packet_handler_personality_info,
-                                        packet_handler_params_from_eeprom,
-                                        NULL);
-
   fmlog("freemcan TUI " GIT_VERSION);
   fmlog("Text user interface (TUI) set up");
 }
@@ -391,7 +408,7 @@ void tui_fini()
   /** \bug: Hack: Avoid running tui_fini() twice using a flag. */
   static volatile bool tui_fini_run = false;
   if (!tui_fini_run) {
-    packet_parser_unref(tui_packet_parser);
+    tui_devices_close();
     tty_reset();
     fmlog_reset_handler();
     if (stdlog) {
@@ -411,46 +428,16 @@ void tui_fini()
  */
 
 
-void tui_do_timeout(void)
-{
-  if (waiting_for > 2) {
-    /* Not connected, apparently. Implies not measuring, either. */
-    is_measuring = false;
-  }
-  if (is_measuring) {
-    tui_device_send_simple_command(FRAME_CMD_INTERMEDIATE);
-  }
-}
-
-
+/** Send measurement parameters to all target devices */
+static
 void tui_send_parametrized_command(const bool do_measure)
 {
-  const frame_cmd_t cmd =
-    do_measure?FRAME_CMD_MEASURE:FRAME_CMD_PARAMS_TO_EEPROM;
-  /* We cannot know when the measurement will be started with the
-   * parameters in the EEPROM, so we clearly mark this one with a
-   * start_time of 0 which cannot be mistaken for a contemporary
-   * time_t value.
-   */
-  const time_t ts =
-    do_measure?time(NULL):0;
-  if (personality_info) {
-    if ((personality_info->param_data_size_timer_count == 2) &&
-        (personality_info->param_data_size_skip_samples == 2)) {
-      tui_device_send_command_16_16(cmd, ts, last_sent_duration, skip_samples);
-    } else if ((personality_info->param_data_size_timer_count == 0) &&
-               (personality_info->param_data_size_skip_samples == 2)) {
-      tui_device_send_command_16(cmd, ts, skip_samples);
-    } else if ((personality_info->param_data_size_timer_count == 2) &&
-               (personality_info->param_data_size_skip_samples == 0)) {
-      tui_device_send_command_16(cmd, ts, last_sent_duration);
-    } else {
-      fmlog("Invalid personality_info: timer_count:%zu skip_samples:%zu",
-            personality_info->param_data_size_timer_count,
-            personality_info->param_data_size_skip_samples);
+  for (size_t i=0; i<device_count; i++) {
+    if (is_target(i)) {
+      devctx_send_measurement_params(devices[i], do_measure,
+                                     duration_list[duration_index],
+                                     skip_samples);
     }
-  } else {
-    fmlog("Missing personality_info");
   }
 }
 
@@ -491,15 +478,24 @@ void tui_do_io(void)
         break;
       case 'p':
         periodic_update_flag = !periodic_update_flag;
-        if (periodic_update_flag) {
-          recalculate_periodic_interval();
-          fmlog("Periodic updates now enabled (every %lu seconds)",
-                periodic_update_interval);
-          tui_device_send_simple_command(FRAME_CMD_INTERMEDIATE);
-        } else {
-          fmlog("Periodic updates now disabled");
+        for (size_t k=0; k<device_count; k++) {
+          if (is_target(k)) {
+            devctx_set_periodic_updates(devices[k], periodic_update_flag);
+          }
         }
         break;
+      case 'u':
+        delta_update_flag = !delta_update_flag;
+        for (size_t k=0; k<device_count; k++) {
+          if (is_target(k)) {
+            devctx_set_delta_updates(devices[k], delta_update_flag);
+          }
+        }
+        break;
+      case '\t':
+        target_index = (target_index + 1) % (device_count + 1);
+        fmlog_target();
+        break;
       case '1':
         enable_layer1_dump = !enable_layer1_dump;
         fmlog("Layer 1 data dump now %s", enable_layer1_dump?"enabled":"disabled");
@@ -540,39 +536,49 @@ void tui_do_io(void)
         }
         break;
       case 'f':
-        tui_device_send_simple_command(FRAME_CMD_PERSONALITY_INFO);
+        tui_send_simple_command(FRAME_CMD_PERSONALITY_INFO);
         break;
       case 'm':
-        last_sent_duration = duration_list[duration_index];
-        recalculate_periodic_interval();
         tui_send_parametrized_command(true);
         break;
       case 'e':
-        last_sent_duration = duration_list[duration_index];
-        recalculate_periodic_interval();
         tui_send_parametrized_command(false);
         break;
       case 'E':
-        tui_device_send_simple_command(FRAME_CMD_PARAMS_FROM_EEPROM);
+        tui_send_simple_command(FRAME_CMD_PARAMS_FROM_EEPROM);
         break;
       case ' ':
         /** \todo Make this depend on the configured personality? */
         fmlog("Hostware status:");
         fmlog("  duration=%u clock cycles", duration_list[duration_index]);
         fmlog("  skip_samples=%u", skip_samples);
-        fmlog("  periodic_update_interval=%lu", periodic_update_interval);
+        fmlog("  periodic updates %s",
+              periodic_update_flag ? "enabled" : "disabled");
+        fmlog("  delta updates %s",
+              delta_update_flag ? "enabled" : "disabled");
+        frame_pool_fmlog_stats();
+        packet_value_table_pool_fmlog_stats();
+        if (pipeline) {
+          pipeline_fmlog_stats(pipeline);
+        }
+        for (size_t k=0; k<device_count; k++) {
+          if (is_target(k)) {
+            devctx_fmlog_status(devices[k]);
+          }
+        }
         break;
       case FRAME_CMD_ABORT:
       case FRAME_CMD_RESET:
       case FRAME_CMD_STATE:
-        tui_device_send_simple_command(buf[i]);
+        tui_send_simple_command(buf[i]);
         break;
       case 'i':
-        tui_device_send_simple_command(FRAME_CMD_INTERMEDIATE);
-        break;
       case 'w':
-        write_next_intermediate_packet = true;
-        tui_device_send_simple_command(FRAME_CMD_INTERMEDIATE);
+        for (size_t k=0; k<device_count; k++) {
+          if (is_target(k)) {
+            devctx_request_intermediate(devices[k], buf[i] == 'w');
+          }
+        }
         break;
       default:
         /* Ignore all other input characters, but print a warning. */
@@ -606,124 +612,16 @@ void atexit_func(void)
 /** @} */
 
 
-/************************************************************************/
-/** \defgroup tui_data_handling TUI Data Handling
- * \ingroup freemcan_tui
- *
- * Application Layer (Communication Layer 4).
- *
- * @{
- */
-/************************************************************************/
-
-
-/** State data packet handler (TUI specific) */
-static void packet_handler_state(const char *state, void *UP(data))
-{
-  if (waiting_for > 0) {
-    waiting_for--;
-  }
-  fmlog("<STATE: %s", state);
-  bool new_is_measuring = (strcmp("MEASURING", state) == 0);
-  if (new_is_measuring != is_measuring) {
-    if (new_is_measuring) {
-    } else {
-    }
-    is_measuring = new_is_measuring;
-  }
-}
-
-
-/** Text data packet handler (TUI specific) */
-static void packet_handler_text(const char *text, void *UP(data))
-{
-  if (waiting_for > 0) {
-    waiting_for--;
-  }
-  fmlog("<TEXT: %s", text);
-}
-
-
-/** Parameter data from EEPROM */
-static void packet_handler_params_from_eeprom(const void *params,
-                                              const size_t size,
-                                              void *UP(data))
-{
-  fmlog("<EEPROM PARAMS:");
-  fmlog_data("<<", params, size);
-}
-
-
-/** Firmware personality info packet handler (TUI specific) */
-static void packet_handler_personality_info(personality_info_t *pi,
-                                            void *UP(data))
-{
-  fmlog("<PERSONALITY INFO: personality_name:\"%s\" units_per_second=%u",
-        pi->personality_name, pi->units_per_second);
-  fmlog("<                  sizeof_table:%zu bits_per_value:%zu",
-        pi->sizeof_table, pi->bits_per_value);
-  fmlog("<                  sz(timer_count):%zu sz(skip_samples):%zu",
-        pi->param_data_size_timer_count, pi->param_data_size_skip_samples);
-  fmlog("<                  %zu elements of %zu bits each",
-
-        8*pi->sizeof_table / pi->bits_per_value, pi->bits_per_value);
-  if (personality_info) {
-    personality_info_unref(personality_info);
-  }
-  personality_info_ref(pi);
-  personality_info = pi;
-}
-
-
-/** Value table data packet handler (TUI specific) */
-static void packet_handler_value_table(packet_value_table_t *value_table_packet,
-                                       void *UP(data))
-{
-  if (waiting_for > 0) {
-    waiting_for--;
-  }
-  packet_value_table_ref(value_table_packet);
-
-  const size_t element_count = value_table_packet->element_count;
-  const packet_value_table_reason_t reason = value_table_packet->reason;
-  const packet_value_table_type_t type = value_table_packet->type;
-  last_sent_duration = value_table_packet->total_duration;
-  char buf[128];
-  char reason_str[16];
-  if ((reason>=32)&&(reason<127)) {
-    snprintf(reason_str, sizeof(reason_str), "'%c'", reason);
-  } else {
-    snprintf(reason_str, sizeof(reason_str), "0x%02x=%d", reason, reason);
-  }
-  char type_str[16];
-  if ((type>=32)&&(type<127)) {
-    snprintf(type_str, sizeof(type_str), "'%c'", type);
-  } else {
-    snprintf(type_str, sizeof(type_str), "0x%02x=%d", type, type);
-  }
-  snprintf(buf, sizeof(buf),
-           "<Received %s type value table for reason %s: %%d elements, %%d seconds:",
-           type_str, reason_str);
-
-  fmlog(buf, element_count, value_table_packet->duration);
-  fmlog_value_table("< ", value_table_packet->elements, element_count);
-
-  /* export current value table to file(s) */
-  export_value_table(personality_info, value_table_packet);
-
-  packet_value_table_unref(value_table_packet);
-}
-
-/** @} */
-
-
 void tui_fmlog_command_line_help(const char *const argv0)
 {
   const char *last_slash = strrchr(argv0, '/');
   const char *prog = last_slash?(last_slash+1):(argv0);
-  fmlog("Usage: %s <SERIAL_PORT>", prog);
+  fmlog("Usage: %s <SERIAL_PORT>[,<OUTDIR>]...", prog);
   fmlog("       %s <option>", prog);
-  fmlog("Connect to and communicate with a FreeMCAn device connected to <SERIAL_PORT>.\n");
+  fmlog("Connect to and communicate with the FreeMCAn devices connected to the");
+  fmlog("given <SERIAL_PORT>s. Value tables from each device are written to its");
+  fmlog("<OUTDIR>, which defaults to \".\" for a single device and to the basename");
+  fmlog("of <SERIAL_PORT> for multiple devices.\n");
   fmlog("Options:");
   fmlog("   -h --help     Print help message and and exit");
   fmlog("   -V --version  Print version message and exit\n");
@@ -735,15 +633,14 @@ void tui_fmlog_command_line_help(const char *const argv0)
  *
  * Parse command line parameters, etc.
  */
-const char *main_init(int argc, char *argv[])
+void main_init(int argc, char *argv[])
 {
   assert(argv[0]);
-  if (argc != 2) {
+  if (argc < 2) {
     fmlog_error("Fatal: Wrong command line parameter count.");
     tui_fmlog_command_line_help(argv[0]);
     abort();
   }
-  assert(argc == 2);
   assert(argv[1]);
 
   if ((0 == strcmp("-h", argv[1])) || (0 == strcmp("--help", argv[1]))) {
@@ -762,7 +659,51 @@ const char *main_init(int argc, char *argv[])
     abort();
   }
 
-  return argv[1];
+  device_args = &argv[1];
+  device_count = argc - 1;
+  target_index = (device_count == 1) ? 0 : device_count;
+}
+
+
+/* documented in freemcan-tui.h */
+void tui_devices_open(evloop_t *loop)
+{
+  pipeline = pipeline_new();
+  devices = calloc(device_count, sizeof(devices[0]));
+  assert(devices);
+  for (size_t i=0; i<device_count; i++) {
+    devices[i] = devctx_new_from_spec(device_args[i], device_count > 1);
+    if (!devices[i]) {
+      fmlog("Fatal: Cannot open device %s", device_args[i]);
+      exit(EXIT_FAILURE);
+    }
+    devctx_set_pipeline(devices[i], pipeline);
+    devctx_attach(devices[i], loop);
+    devctx_send_simple_command(devices[i], FRAME_CMD_PERSONALITY_INFO);
+    devctx_send_simple_command(devices[i], FRAME_CMD_STATE);
+  }
+  if (device_count > 1) {
+    fmlog_target();
+  }
+}
+
+
+/* documented in freemcan-tui.h */
+void tui_devices_close(void)
+{
+  if (devices) {
+    for (size_t i=0; i<device_count; i++) {
+      if (devices[i]) {
+        devctx_unref(devices[i]);
+      }
+    }
+    free(devices);
+    devices = NULL;
+  }
+  if (pipeline) {
+    pipeline_unref(pipeline);
+    pipeline = NULL;
+  }
 }
 
 
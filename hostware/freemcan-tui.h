@@ -27,36 +27,23 @@
 
 #include <stdbool.h>
 
-#include "packet-parser.h"
+#include "freemcan-evloop.h"
 
 bool quit_flag;
-bool periodic_update_flag;
-unsigned long periodic_update_interval;
 
 
 void tui_init();
 void tui_fini();
 void tui_do_io(void);
-void tui_do_timeout(void);
-const char *main_init(int argc, char *argv[]);
+void main_init(int argc, char *argv[]);
 
-void update_last_received_size(const uint16_t size);
 
+/** Open all devices from the command line and attach them to loop */
+void tui_devices_open(evloop_t *loop);
 
 
-extern packet_parser_t *tui_packet_parser;
-
-
-void tui_device_send_simple_command(const frame_cmd_t cmd);
-
-void tui_device_send_command_16(const frame_cmd_t cmd,
-                                const time_t ts,
-                                const uint16_t a);
-
-void tui_device_send_command_16_16(const frame_cmd_t cmd,
-                                   const time_t ts,
-                                   const uint16_t a,
-                                   const uint16_t b);
+/** Close all devices */
+void tui_devices_close(void);
 
 
 void tui_startup_messages(void);
@@ -40,6 +40,7 @@
 #include "frame-parser.h"
 #include "freemcan-packet.h"
 #include "endian-conversion.h"
+#include "value-table-decode.h"
 
 #include "packet-parser.h"
 
@@ -62,6 +63,15 @@ struct _packet_parser_t {
 
   /** private data for callback functions*/
   void *                     packet_handler_data;
+
+  /** Most recently received personality info, NULL if none yet */
+  personality_info_t *personality_info;
+
+  /** Last delta value table, for applying the next delta to. NULL if none */
+  packet_value_table_t *delta_base;
+
+  /** Sequence number of delta_base, 0 if none */
+  uint8_t delta_seq;
 };
 
 
@@ -98,11 +108,206 @@ void packet_parser_unref(packet_parser_t *self)
   assert(self->refs > 0);
   self->refs--;
   if (self->refs == 0) {
+    if (self->personality_info) {
+      personality_info_unref(self->personality_info);
+    }
+    packet_parser_reset_delta(self);
     free(self);
   }
 }
 
 
+/* documented in packet-parser.h */
+personality_info_t *packet_parser_get_personality_info(packet_parser_t *self)
+{
+  return self->personality_info;
+}
+
+
+/* documented in packet-parser.h */
+uint8_t packet_parser_get_delta_ack(packet_parser_t *self)
+{
+  return self->delta_seq;
+}
+
+
+/* documented in packet-parser.h */
+void packet_parser_reset_delta(packet_parser_t *self)
+{
+  if (self->delta_base) {
+    packet_value_table_unref(self->delta_base);
+    self->delta_base = NULL;
+  }
+  self->delta_seq = 0;
+}
+
+
+/** Whether we can make sense of a value table, logging why if not */
+static
+bool have_personality_info(packet_parser_t *self)
+{
+  if (self->personality_info) {
+    return true;
+  }
+  fmlog_error("Dropping value table: We have not received a "
+              "personality_info packet yet.");
+  fmlog_error("Maybe the firmware interrupt load is too high so it drops "
+              "the command frames?");
+  return false;
+}
+
+
+/* documented in packet-parser.h */
+packet_value_table_t *
+packet_parser_value_table_start(packet_parser_t *self,
+                                const void *head, const size_t head_size,
+                                const size_t payload_size)
+{
+  if (!self->packet_handler_value_table) {
+    return NULL;
+  }
+  if (!self->personality_info) {
+    /* let packet_parser_handle_frame() complain */
+    return NULL;
+  }
+  const packet_value_table_header_t *header =
+    (const packet_value_table_header_t *)head;
+  assert(head_size == packet_value_table_head_size(header));
+  const uint8_t bits_per_value =
+    header->bits_per_value & ~PACKET_VALUE_TABLE_EXTENDED;
+  switch (bits_per_value) {
+  case 8: case 16: case 24: case 32:
+    break;
+  default:
+    return NULL;
+  }
+  if (payload_size <= head_size) {
+    return NULL;
+  }
+  const size_t value_table_size = payload_size - head_size;
+  const size_t element_count = 8*value_table_size/bits_per_value;
+  const uint8_t *params = &((const uint8_t *)head)[sizeof(*header)];
+  return packet_value_table_new_empty(self->personality_info,
+                                      header->reason,
+                                      header->type,
+                                      time(NULL),
+                                      header->bits_per_value,
+                                      element_count,
+                                      header->duration,
+                                      header->param_buf_length,
+                                      params);
+}
+
+
+/* documented in packet-parser.h */
+void packet_parser_handle_value_table(packet_parser_t *self,
+                                      packet_value_table_t *vtab)
+{
+  if (vtab->reason != PACKET_VALUE_TABLE_INTERMEDIATE) {
+    /* the measurement is over, later deltas belong to a new one */
+    packet_parser_reset_delta(self);
+  }
+  if (self->packet_handler_value_table) {
+    self->packet_handler_value_table(vtab, self->packet_handler_data);
+  }
+}
+
+
+/** Reconstruct value table from delta value table frame
+ *
+ * \return The value table, or NULL if the frame is broken or does not
+ *         apply to our delta_base.
+ */
+static
+packet_value_table_t *apply_delta(packet_parser_t *self, const frame_t *frame)
+{
+  const packet_value_table_header_t *header =
+    (const packet_value_table_header_t *)&(frame->payload[0]);
+  if ((frame->size < sizeof(*header)) ||
+      (frame->size < (packet_value_table_head_size(header) +
+                      sizeof(packet_value_table_delta_header_t)))) {
+    fmlog("Dropping delta value table: Frame too short");
+    return NULL;
+  }
+  const size_t head_size = packet_value_table_head_size(header);
+  const uint8_t bits_per_value =
+    header->bits_per_value & ~PACKET_VALUE_TABLE_EXTENDED;
+  switch (bits_per_value) {
+  case 8: case 16: case 24: case 32:
+    break;
+  default:
+    fmlog("Dropping delta value table: Unhandled bits_per_value: %d",
+          header->bits_per_value);
+    return NULL;
+  }
+  const packet_value_table_delta_header_t *delta_header =
+    (const packet_value_table_delta_header_t *)&(frame->payload[head_size]);
+  const size_t element_count = letoh16(delta_header->element_count);
+  const uint8_t base_seq = delta_header->base_seq;
+  packet_value_table_t *base = self->delta_base;
+  if (base_seq &&
+      ((base_seq != self->delta_seq) || (base->element_count != element_count))) {
+    fmlog("Dropping delta value table %u: Do not have value table %u it applies to",
+          delta_header->seq, base_seq);
+    return NULL;
+  }
+
+  packet_value_table_t *vtab =
+    packet_value_table_new_empty(self->personality_info,
+                                 header->reason,
+                                 header->type,
+                                 time(NULL),
+                                 header->bits_per_value,
+                                 element_count,
+                                 header->duration,
+                                 header->param_buf_length,
+                                 &(frame->payload[sizeof(*header)]));
+  if (base_seq) {
+    memcpy(vtab->elements, base->elements, element_count*sizeof(uint32_t));
+  } else {
+    memset(vtab->elements, 0, element_count*sizeof(uint32_t));
+  }
+
+  const size_t bytes_per_value = bits_per_value / 8;
+  size_t ofs = head_size + sizeof(*delta_header);
+  while (ofs < frame->size) {
+    if (frame->size - ofs < 2) {
+      break;
+    }
+    const size_t first = frame->payload[ofs]*PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE;
+    size_t end = first +
+      frame->payload[ofs+1]*PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE;
+    if (end > element_count) {
+      end = element_count;
+    }
+    ofs += 2;
+    if ((first >= end) ||
+        ((frame->size - ofs) < (end - first)*bytes_per_value)) {
+      break;
+    }
+    const bool decoded =
+      value_table_decode(&vtab->elements[first], &frame->payload[ofs],
+                         end - first, bits_per_value);
+    assert(decoded);
+    ofs += (end - first)*bytes_per_value;
+  }
+  if (ofs != frame->size) {
+    fmlog("Dropping delta value table %u: Broken block run at offset %zu",
+          delta_header->seq, ofs);
+    packet_value_table_unref(vtab);
+    return NULL;
+  }
+
+  vtab->wire_size = frame->size - head_size - sizeof(*delta_header);
+
+  packet_parser_reset_delta(self);
+  packet_value_table_ref(vtab);
+  self->delta_base = vtab;
+  self->delta_seq = delta_header->seq;
+  return vtab;
+}
+
+
 void packet_parser_handle_frame(packet_parser_t *self, const frame_t *frame)
 {
   switch (frame->type) {
@@ -113,12 +318,22 @@ void packet_parser_handle_frame(packet_parser_t *self, const frame_t *frame)
                                               self->packet_handler_data);
     }
     return;
-  case FRAME_TYPE_PERSONALITY_INFO:
-    if (self->packet_handler_personality_info) {
+  case FRAME_TYPE_PERSONALITY_INFO: {
       const packet_personality_info_t *ppi =
         (const packet_personality_info_t *)frame->payload;
+      if (frame->size <= sizeof(*ppi)) {
+        fmlog("Dropping personality info: No personality name");
+        return;
+      }
+      switch (ppi->bits_per_value) {
+      case 8: case 16: case 24: case 32:
+        break;
+      default:
+        fmlog("Dropping personality info: Invalid bits per value: %d",
+              ppi->bits_per_value);
+        return;
+      }
       const size_t personality_name_size = frame->size - sizeof(*ppi);
-      assert(personality_name_size > 0);
       personality_info_t *pi = personality_info_new(ppi->sizeof_table,
                                                     ppi->bits_per_value,
                                                     ppi->units_per_second,
@@ -126,8 +341,19 @@ void packet_parser_handle_frame(packet_parser_t *self, const frame_t *frame)
                                                     ppi->param_data_size_skip_samples,
                                                     personality_name_size,
                                                     (const char *)&(frame->payload[sizeof(*ppi)]));
-      self->packet_handler_personality_info(pi, self->packet_handler_data);
-      personality_info_unref(pi);
+      /* Size the frame and value table pools for the largest value
+       * table this personality can send. */
+      frame_pool_reserve(sizeof(packet_value_table_header_t) +
+                         sizeof(packet_value_table_ext_header_t) +
+                         UINT8_MAX + pi->sizeof_table + 1);
+      packet_value_table_pool_reserve(8*pi->sizeof_table/pi->bits_per_value);
+      if (self->personality_info) {
+        personality_info_unref(self->personality_info);
+      }
+      self->personality_info = pi;
+      if (self->packet_handler_personality_info) {
+        self->packet_handler_personality_info(pi, self->packet_handler_data);
+      }
     }
     return;
   case FRAME_TYPE_STATE:
@@ -142,25 +368,39 @@ void packet_parser_handle_frame(packet_parser_t *self, const frame_t *frame)
                                 self->packet_handler_data);
     }
     return;
+  case FRAME_TYPE_VALUE_TABLE_DELTA:
+    if (self->packet_handler_value_table && have_personality_info(self)) {
+      packet_value_table_t *vtab = apply_delta(self, frame);
+      if (vtab) {
+        packet_parser_handle_value_table(self, vtab);
+        packet_value_table_unref(vtab);
+      } else {
+        /* make the firmware send the complete table next time */
+        packet_parser_reset_delta(self);
+      }
+    }
+    return;
   case FRAME_TYPE_VALUE_TABLE:
-    if (self->packet_handler_value_table) {
+    if (self->packet_handler_value_table && have_personality_info(self)) {
       const packet_value_table_header_t *header =
         (const packet_value_table_header_t *)&(frame->payload[0]);
       const size_t value_table_size =
-        frame->size - sizeof(*header) - header->param_buf_length;
+        frame->size - packet_value_table_head_size(header);
       assert(value_table_size > 0);
-      const size_t element_count = 8*value_table_size/header->bits_per_value;
       packet_value_table_t *vtab =
-        packet_value_table_new(header->reason,
+        packet_value_table_new(self->personality_info,
+                               header->reason,
                                header->type,
                                time(NULL),
                                header->bits_per_value,
-                               element_count,
+                               value_table_size,
                                header->duration,
                                header->param_buf_length,
                                &(frame->payload[sizeof(*header)]));
-      self->packet_handler_value_table(vtab, self->packet_handler_data);
-      packet_value_table_unref(vtab);
+      if (vtab) {
+        packet_parser_handle_value_table(self, vtab);
+        packet_value_table_unref(vtab);
+      }
     }
     return;
   /* No "default:" case on purpose: Let compiler complain about
@@ -55,11 +55,65 @@ void packet_parser_unref(packet_parser_t *self)
   __attribute__(( nonnull(1) ));
 
 
+/** Most recently received personality info of the device
+ *
+ * The packet parser keeps a reference to it, and uses it for decoding
+ * value tables. NULL if no personality info has been received yet.
+ */
+personality_info_t *packet_parser_get_personality_info(packet_parser_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Sequence number to acknowledge with #FRAME_CMD_INTERMEDIATE_DELTA
+ *
+ * The sequence number of the last delta value table received, or 0
+ * if there is none to apply the next delta to.
+ */
+uint8_t packet_parser_get_delta_ack(packet_parser_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Forget the last delta value table
+ *
+ * Call this when a new measurement starts, so that the firmware sends
+ * the complete table with the next delta value table.
+ */
+void packet_parser_reset_delta(packet_parser_t *self)
+  __attribute__(( nonnull(1) ));
+
+
 #include "frame.h"
 
 void packet_parser_handle_frame(packet_parser_t *self, const frame_t *frame)
   __attribute__(( nonnull(1,2) ));
 
+/** Begin a value table while its frame is still being received.
+ *
+ * Called by the frame parser as soon as the value table header and
+ * the parameter buffer (head, head_size bytes) of a value table frame
+ * with payload_size bytes of payload have arrived. The frame parser
+ * then decodes the table elements directly into the returned value
+ * table as they arrive, and hands it to
+ * #packet_parser_handle_value_table once the frame checksum has been
+ * verified.
+ *
+ * \return The new value table with uninitialized elements, or NULL if
+ *         the frame needs to be handled the normal way by
+ *         #packet_parser_handle_frame.
+ */
+packet_value_table_t *
+packet_parser_value_table_start(packet_parser_t *self,
+                                const void *head, const size_t head_size,
+                                const size_t payload_size)
+  __attribute__(( nonnull(1,2) ))
+  __attribute__(( warn_unused_result ));
+
+
+/** Hand a completely received value table to the value table handler */
+void packet_parser_handle_value_table(packet_parser_t *self,
+                                      packet_value_table_t *vtab)
+  __attribute__(( nonnull(1,2) ));
+
 /** Reset packet handler callbacks.
  *
  * This also unregisters the packet parser callback from the frame
@@ -35,45 +35,62 @@
 #include "frame-parser.h"
 #include "freemcan-packet.h"
 #include "endian-conversion.h"
+#include "freemcan-pool.h"
+#include "value-table-compress.h"
+#include "value-table-decode.h"
 
 #include "personality-info.h"
 
 
-/** Create new value table object in host conventions.
- *
- * Note that all multi-byte parameters which need endianness
- * conversion have a underscore prefix ("_duration") to make it
- * obvious that we should not use their values without doing
- * endianness conversion.
- */
-packet_value_table_t *packet_value_table_new(const packet_value_table_reason_t reason,
-                                             const packet_value_table_type_t type,
-                                             const time_t receive_time,
-                                             const uint8_t bits_per_value,
-                                             const size_t element_count,
-                                             const uint16_t _duration,
-                                             const uint8_t param_buf_length,
-                                             const void *data)
+/** Recycled value tables */
+static pool_t value_table_pool = POOL_INITIALIZER("value table");
+
+
+/* documented in packet-value-table.h */
+packet_value_table_t *packet_value_table_new_empty(const personality_info_t *personality_info,
+                                                   const packet_value_table_reason_t reason,
+                                                   const packet_value_table_type_t type,
+                                                   const time_t receive_time,
+                                                   const uint8_t bits_per_value,
+                                                   const size_t element_count,
+                                                   const uint16_t _duration,
+                                                   const uint8_t param_buf_length,
+                                                   const void *data)
 {
+  size_t capacity;
   packet_value_table_t *result =
-    malloc(sizeof(packet_value_table_t)+element_count*sizeof(uint32_t));
-  assert(result != NULL);
+    pool_alloc(&value_table_pool,
+               sizeof(packet_value_table_t)+element_count*sizeof(uint32_t),
+               &capacity);
 
   result->refs              = 1;
+  result->capacity          = capacity;
   result->reason            = reason;
   result->type              = type;
   result->receive_time      = receive_time;
   result->element_count     = element_count;
-  result->orig_bits_per_value = bits_per_value;
+  const uint8_t bpv = bits_per_value & ~PACKET_VALUE_TABLE_EXTENDED;
+  assert(!(bpv & PACKET_VALUE_TABLE_COMPRESSED));
+  result->orig_bits_per_value = bpv;
+  result->wire_size         = element_count * bpv / 8;
   result->duration          = letoh16(_duration);
   size_t ofs = 0;
   const char *cdata = (const char *)data;
 
-  if (!personality_info) {
-    fmlog_error("We have not received a personality_info packet yet. Aborting.");
-    fmlog_error("Maybe the firmware interrupt load is too high so it drops "
-                "the command frames?");
-    abort();
+  /* read extended header if present */
+  result->dead_time_per_trigger = 0.0;
+  result->dead_cycles = 0;
+  result->cpu_khz = 0;
+  if (bits_per_value & PACKET_VALUE_TABLE_EXTENDED) {
+    packet_value_table_ext_header_t ext_header;
+    memcpy(&ext_header, &cdata[param_buf_length], sizeof(ext_header));
+    result->dead_cycles = letoh16(ext_header.dead_cycles);
+    result->cpu_khz = letoh16(ext_header.cpu_khz);
+    if (result->cpu_khz) {
+      result->dead_time_per_trigger =
+        result->dead_cycles * personality_info->units_per_second /
+        (1000.0 * result->cpu_khz);
+    }
   }
 
   /* read total_duration parameter from packet if present */
@@ -98,95 +115,180 @@ packet_value_table_t *packet_value_table_new(const packet_value_table_reason_t r
 
   /* read token from packet if present */
   result->token = NULL;
+  result->token_size = 0;
   if (ofs < param_buf_length) {
     const size_t token_size = param_buf_length-ofs;
     if (token_size) {
-      result->token = malloc(token_size);
-      assert(result->token);
+      assert(token_size <= sizeof(result->token_buf));
+      result->token = result->token_buf;
+      result->token_size = token_size;
       memcpy(result->token, &cdata[ofs], token_size);
     }
   }
 
-  const void *elements = (const void *)&cdata[param_buf_length];
-
-  if (!elements) {
-    memset(result->elements, '\0', sizeof(result->elements[0])*element_count);
-    return result;
-  }
+  return result;
+}
 
-  const uint8_t *e8  = elements;
 
-  switch (bits_per_value) {
-  case 8:
-    for (size_t i=0; i<element_count; i++) {
-      const uint32_t v = e8[i];
-      result->elements[i] = v;
-    }
-    break;
-  case 16:
-    for (size_t i=0; i<element_count; i++) {
-      const uint32_t v =
-        (((uint32_t)e8[2*i+0]) << 0) +
-        (((uint32_t)e8[2*i+1]) << 8);
-      result->elements[i] = v;
-    }
+/** Create new value table object in host conventions.
+ *
+ * Note that all multi-byte parameters which need endianness
+ * conversion have a underscore prefix ("_duration") to make it
+ * obvious that we should not use their values without doing
+ * endianness conversion.
+ */
+packet_value_table_t *packet_value_table_new(const personality_info_t *personality_info,
+                                             const packet_value_table_reason_t reason,
+                                             const packet_value_table_type_t type,
+                                             const time_t receive_time,
+                                             const uint8_t bits_per_value,
+                                             const size_t value_table_size,
+                                             const uint16_t _duration,
+                                             const uint8_t param_buf_length,
+                                             const void *data)
+{
+  const char *cdata = (const char *)data;
+  const size_t ext_size = (bits_per_value & PACKET_VALUE_TABLE_EXTENDED) ?
+    sizeof(packet_value_table_ext_header_t) : 0;
+  const void *elements = (const void *)&cdata[param_buf_length + ext_size];
+  const uint8_t bpv = bits_per_value &
+    ~(PACKET_VALUE_TABLE_COMPRESSED | PACKET_VALUE_TABLE_EXTENDED);
+  switch (bpv) {
+  case 8: case 16: case 24: case 32:
     break;
-  case 24:
-    for (size_t i=0; i<element_count; i++) {
-      const uint32_t v =
-        (((uint32_t)e8[3*i+0]) << 0) +
-        (((uint32_t)e8[3*i+1]) << 8) +
-        (((uint32_t)e8[3*i+2]) << 16);
-      result->elements[i] = v;
+  default:
+    fmlog("Dropping value table: Invalid bits per value: %d", bpv);
+    return NULL;
+  }
+
+  if (bits_per_value & PACKET_VALUE_TABLE_COMPRESSED) {
+    const size_t max_count = 8*personality_info->sizeof_table/bpv;
+    size_t element_count;
+    if (!value_table_compressed_count(elements, value_table_size,
+                                      &element_count) ||
+        (element_count > max_count)) {
+      fmlog("Dropping compressed value table: Invalid element count");
+      return NULL;
     }
-    break;
-  case 32:
-    for (size_t i=0; i<element_count; i++) {
-      const uint32_t v =
-        (((uint32_t)e8[4*i+0]) << 0) +
-        (((uint32_t)e8[4*i+1]) << 8) +
-        (((uint32_t)e8[4*i+2]) << 16) +
-        (((uint32_t)e8[4*i+3]) << 24);
-      result->elements[i] = v;
+    packet_value_table_t *result =
+      packet_value_table_new_empty(personality_info, reason, type,
+                                   receive_time,
+                                   bits_per_value & ~PACKET_VALUE_TABLE_COMPRESSED,
+                                   element_count, _duration,
+                                   param_buf_length, data);
+    result->wire_size = value_table_size;
+    if (!value_table_decompress(result->elements, element_count,
+                                elements, value_table_size, bpv)) {
+      fmlog("Dropping compressed value table: Broken data");
+      packet_value_table_unref(result);
+      return NULL;
     }
-    break;
-  default:
-    fmlog("Fatal: Unhandled bits_per_value: %d\n", bits_per_value);
+    return result;
+  }
+
+  const size_t element_count = 8*value_table_size/bpv;
+  packet_value_table_t *result =
+    packet_value_table_new_empty(personality_info, reason, type, receive_time, bits_per_value,
+                                 element_count, _duration,
+                                 param_buf_length, data);
+
+  if (!value_table_decode(result->elements, elements,
+                          element_count, bpv)) {
+    fmlog("Fatal: Unhandled bits_per_value: %d\n", bpv);
     abort(); /* invalid value table element size */
-    break;
   }
 
   return result;
 }
 
 
+/* documented in packet-value-table.h */
+size_t packet_value_table_head_size(const packet_value_table_header_t *header)
+{
+  return sizeof(*header) + header->param_buf_length +
+    ((header->bits_per_value & PACKET_VALUE_TABLE_EXTENDED) ?
+     sizeof(packet_value_table_ext_header_t) : 0);
+}
+
+
+/* documented in packet-value-table.h */
+uint64_t packet_value_table_triggers(const packet_value_table_t *value_table)
+{
+  uint64_t sum = 0;
+  for (size_t i=0; i<value_table->element_count; i++) {
+    sum += value_table->elements[i];
+  }
+  return sum;
+}
+
+
+/* documented in packet-value-table.h */
+double packet_value_table_live_duration(const packet_value_table_t *value_table)
+{
+  const double dead_time = value_table->dead_time_per_trigger *
+    packet_value_table_triggers(value_table);
+  return value_table->duration - dead_time;
+}
+
+
+/* documented in packet-value-table.h */
+double packet_value_table_missed_triggers(const packet_value_table_t *value_table)
+{
+  const double t = value_table->dead_time_per_trigger;
+  if ((t <= 0.0) || (value_table->duration == 0)) {
+    return 0.0;
+  }
+  const double recorded = packet_value_table_triggers(value_table);
+  const double m = recorded / value_table->duration;
+  if (m*t >= 1.0) {
+    /* saturated, no sensible estimate */
+    return 0.0;
+  }
+  return m/(1.0 - m*t) * value_table->duration - recorded;
+}
+
+
 void packet_value_table_ref(packet_value_table_t *value_table_packet)
 {
-  assert(value_table_packet->refs > 0);
-  value_table_packet->refs++;
+  const int old_refs =
+    __atomic_fetch_add(&value_table_packet->refs, 1, __ATOMIC_RELAXED);
+  assert(old_refs > 0);
 }
 
 
 static
 void packet_value_table_free(packet_value_table_t *value_table_packet)
 {
-  if (value_table_packet->token) {
-    free(value_table_packet->token);
-  }
-  free(value_table_packet);
+  pool_release(&value_table_pool, value_table_packet,
+               value_table_packet->capacity);
 }
 
 
 void packet_value_table_unref(packet_value_table_t *hist_pack)
 {
-  assert(hist_pack->refs > 0);
-  hist_pack->refs--;
-  if (hist_pack->refs == 0) {
+  const int refs = __atomic_sub_fetch(&hist_pack->refs, 1, __ATOMIC_ACQ_REL);
+  assert(refs >= 0);
+  if (refs == 0) {
     packet_value_table_free(hist_pack);
   }
 }
 
 
+/* documented in packet-value-table.h */
+void packet_value_table_pool_reserve(const size_t element_count)
+{
+  pool_reserve(&value_table_pool,
+               sizeof(packet_value_table_t)+element_count*sizeof(uint32_t));
+}
+
+
+/* documented in packet-value-table.h */
+void packet_value_table_pool_fmlog_stats(void)
+{
+  pool_fmlog_stats(&value_table_pool);
+}
+
+
 /** @} */
 
 
@@ -25,16 +25,22 @@
 #ifndef FREEMCAN_PACKET_VALUE_TABLE_H
 #define FREEMCAN_PACKET_VALUE_TABLE_H
 
+#include <stdint.h>
 #include <time.h>
 
 #include "packet-defs.h"
+#include "personality-info.h"
 
 
 /** Parsed value table packet. */
 typedef struct {
-  /** Reference counter */
+  /** Reference counter (atomic, as value tables are shared between
+   *  threads) */
   int refs;
 
+  /** Allocated size in bytes (for the value table pool) */
+  size_t capacity;
+
   /** The reason for sending the value table */
   packet_value_table_reason_t reason;
 
@@ -50,6 +56,10 @@ typedef struct {
   /** Size of each received value table element in bytes */
   size_t orig_bits_per_value;
 
+  /** Number of element data bytes received from the device (less
+   *  than element_count*orig_bits_per_value/8 if compressed) */
+  size_t wire_size;
+
   /** Duration of measurement which lead to the value table data, or
    * time spent recording the last item in the time series. */
   unsigned int duration;
@@ -62,9 +72,27 @@ typedef struct {
   /** Skip samples value. "-1" if undefined. */
   unsigned int skip_samples;
 
-  /** Token bytes (value sent back unchanged) */
+  /** Dead time per recorded trigger in duration units, from the
+   *  extended header (see \ref packet_value_table_extended). 0 if
+   *  unknown. */
+  double dead_time_per_trigger;
+
+  /** ISR dead time per trigger in CPU cycles, as in the extended
+   *  header. 0 if unknown. */
+  unsigned int dead_cycles;
+
+  /** CPU clock in kHz, as in the extended header. 0 if unknown. */
+  unsigned int cpu_khz;
+
+  /** Token bytes (value sent back unchanged), NULL if none */
   char *token;
 
+  /** Number of token bytes */
+  size_t token_size;
+
+  /** Storage for the token bytes */
+  char token_buf[UINT8_MAX];
+
   /** Value table array (native endian uint32_t) */
   uint32_t elements[];
 } packet_value_table_t;
@@ -72,16 +100,22 @@ typedef struct {
 
 /** Create (allocate and initialize) a new packet_value_table_t instance.
  *
+ * \param personality_info Personality of the device which sent the
+ *                         value table (for decoding the parameters).
  * \param reason Reason for sending the value table packet
  * \param type Type of value table
  * \param receive_time Timestamp at which the packet was received.
- * \param element_size Size of each element in bytes (1,2,3,4).
- * \param element_count The number of elements received from device.
+ * \param bits_per_value Size of each element in bits (8,16,24,32),
+ *                       possibly with #PACKET_VALUE_TABLE_COMPRESSED
+ *                       and #PACKET_VALUE_TABLE_EXTENDED.
+ * \param value_table_size The number of element data bytes received
+ *                         from device (after the extended header).
  * \param _duration The duration of the measurement which produced
  *                  the data in elements.
  * \param param_buf_length Length of parameter buffer in bytes.
  * \param data Pointer to the remaining memory as received from the
- *             device. The memory contains first the parameter buffer
+ *             device. The memory contains first the parameter buffer,
+ *             then the extended header if bits_per_value says so,
  *             followed by the actual value table.
  *             A NULL pointer is interpreted like an
  *             array consisting entirely of zeros.
@@ -92,19 +126,77 @@ typedef struct {
  *
  * Note that the parameters starting with an underscore are in device
  * endianness.
+ *
+ * \return The new value table, or NULL (with a logged message) if
+ *         the element size is invalid or compressed value table data
+ *         are broken.
  */
-packet_value_table_t *packet_value_table_new(const packet_value_table_reason_t reason,
+packet_value_table_t *packet_value_table_new(const personality_info_t *personality_info,
+                                             const packet_value_table_reason_t reason,
                                              const packet_value_table_type_t type,
                                              const time_t receive_time,
                                              const uint8_t bits_per_value,
-                                             const size_t element_count,
+                                             const size_t value_table_size,
                                              const uint16_t _duration,
                                              const uint8_t param_buf_length,
                                              const void *data)
+  __attribute__((nonnull(1)))
   __attribute__((warn_unused_result))
   __attribute__((malloc));
 
 
+/** Create a new packet_value_table_t instance without element data.
+ *
+ * Like #packet_value_table_new, but data only needs to contain the
+ * parameter buffer (and extended header), and the elements are left
+ * uninitialized for the caller to fill in. bits_per_value must not
+ * have #PACKET_VALUE_TABLE_COMPRESSED set.
+ */
+packet_value_table_t *packet_value_table_new_empty(const personality_info_t *personality_info,
+                                                   const packet_value_table_reason_t reason,
+                                                   const packet_value_table_type_t type,
+                                                   const time_t receive_time,
+                                                   const uint8_t bits_per_value,
+                                                   const size_t element_count,
+                                                   const uint16_t _duration,
+                                                   const uint8_t param_buf_length,
+                                                   const void *data)
+  __attribute__((nonnull(1)))
+  __attribute__((warn_unused_result))
+  __attribute__((malloc));
+
+
+/** Size of value table header, parameter buffer and extended header */
+size_t packet_value_table_head_size(const packet_value_table_header_t *header)
+  __attribute__((nonnull(1)));
+
+
+/** Number of triggers recorded in a histogram (sum of all elements) */
+uint64_t packet_value_table_triggers(const packet_value_table_t *value_table)
+  __attribute__((nonnull(1)));
+
+
+/** Time in which the device has been able to record triggers
+ *
+ * \return duration minus the dead time of all recorded triggers, in
+ *         duration units. Just duration if the dead time is unknown.
+ */
+double packet_value_table_live_duration(const packet_value_table_t *value_table)
+  __attribute__((nonnull(1)));
+
+
+/** Estimated number of triggers the device has missed during its dead time
+ *
+ * Uses the non-paralyzable dead time model: With the recorded rate m
+ * and the dead time t per trigger, the true rate is m/(1-m*t).
+ *
+ * \return The estimate, or 0 if the dead time is unknown or the
+ *         recorded rate leaves no live time at all.
+ */
+double packet_value_table_missed_triggers(const packet_value_table_t *value_table)
+  __attribute__((nonnull(1)));
+
+
 /** Call this when you want to use value_table and store a pointer to it. */
 void packet_value_table_ref(packet_value_table_t *value_table)
   __attribute__((nonnull(1)));
@@ -115,6 +207,17 @@ void packet_value_table_unref(packet_value_table_t *value_table)
   __attribute__((nonnull(1)));
 
 
+/** Make the value table pool allocate tables for at least element_count elements
+ *
+ * Call this with the largest table size you expect to receive.
+ */
+void packet_value_table_pool_reserve(const size_t element_count);
+
+
+/** Write value table pool allocation statistics into the log */
+void packet_value_table_pool_fmlog_stats(void);
+
+
 /** @} */
 
 #endif /* !FREEMCAN_PACKET_VALUE_TABLE_H */
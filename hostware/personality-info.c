@@ -66,8 +66,8 @@ personality_info_t *personality_info_new(const uint16_t _sizeof_table,
 
 void personality_info_ref(personality_info_t *pi)
 {
-  assert(pi->refs > 0);
-  pi->refs++;
+  const int old_refs = __atomic_fetch_add(&pi->refs, 1, __ATOMIC_RELAXED);
+  assert(old_refs > 0);
 }
 
 
@@ -80,9 +80,9 @@ void personality_info_free(personality_info_t *pi)
 
 void personality_info_unref(personality_info_t *pi)
 {
-  assert(pi->refs > 0);
-  pi->refs--;
-  if (pi->refs == 0) {
+  const int refs = __atomic_sub_fetch(&pi->refs, 1, __ATOMIC_ACQ_REL);
+  assert(refs >= 0);
+  if (refs == 0) {
     personality_info_free(pi);
   }
 }
@@ -66,10 +66,6 @@ void personality_info_unref(personality_info_t *pi)
   __attribute__(( nonnull(1) ));
 
 
-/** Personality info from TUI (HACK) */
-extern personality_info_t *personality_info;
-
-
 /** @} */
 
 #endif /* !FREEMCAN_PACKET_PERSONALITY_INFO_H */
@@ -0,0 +1,207 @@
+/** \file hostware/test-devctx.c
+ * \brief Test losing one of several devices
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Two device contexts talk to two emulated devices behind UNIX
+ * domain sockets. One emulated device hangs up, and the other one
+ * must go on being talked to. Periodic updates enabled before the
+ * remaining device measures must not send anything until it reports
+ * that it is measuring.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "frame-defs.h"
+#include "freemcan-checksum.h"
+#include "freemcan-devctx.h"
+#include "freemcan-evloop.h"
+#include "freemcan-log.h"
+
+
+/** Size of a command frame without parameters */
+#define CMD_FRAME_SIZE (4+1+1+1)
+
+
+static char tmpdir[] = "/tmp/test-devctx-XXXXXX";
+
+
+/** Listen on socket dir/name, return listening fd */
+static int listen_at(const char *path)
+{
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(fd >= 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  assert(strlen(path) < sizeof(addr.sun_path));
+  strcpy(addr.sun_path, path);
+  int ret = bind(fd, (const struct sockaddr *)&addr, sizeof(addr));
+  assert(ret == 0);
+  ret = listen(fd, 1);
+  assert(ret == 0);
+  return fd;
+}
+
+
+/** Open device context for a new emulated device, return its peer fd */
+static devctx_t *open_device(const char *name, int *peer_fd)
+{
+  char path[64], outdir[64], label[16];
+  snprintf(path, sizeof(path), "%s/%s", tmpdir, name);
+  snprintf(outdir, sizeof(outdir), "%s/%s.out", tmpdir, name);
+  snprintf(label, sizeof(label), "[%s] ", name);
+  const int listen_fd = listen_at(path);
+  devctx_t *devctx = devctx_new(path, outdir, label);
+  assert(devctx);
+  *peer_fd = accept(listen_fd, NULL, NULL);
+  assert(*peer_fd >= 0);
+  close(listen_fd);
+  unlink(path);
+  rmdir(outdir);
+  return devctx;
+}
+
+
+/** Read a command frame from the emulated device's side */
+static void expect_command(const int fd, const frame_cmd_t cmd)
+{
+  uint8_t buf[CMD_FRAME_SIZE];
+  size_t ofs = 0;
+  while (ofs < sizeof(buf)) {
+    const ssize_t n = read(fd, &buf[ofs], sizeof(buf) - ofs);
+    assert(n > 0);
+    ofs += n;
+  }
+  assert(memcmp(buf, FRAME_MAGIC_STR, 4) == 0);
+  assert(buf[4] == cmd);
+  assert(buf[5] == 0);
+}
+
+
+/** Check that nothing has been sent to the emulated device */
+static void expect_nothing(const int fd)
+{
+  uint8_t byte;
+  const ssize_t n = recv(fd, &byte, 1, MSG_DONTWAIT);
+  assert((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)));
+}
+
+
+/** Send a state frame from the emulated device's side */
+static void send_state(const int fd, const char *state)
+{
+  const size_t len = strlen(state);
+  uint8_t buf[4+2+1+len+1];
+  memcpy(buf, FRAME_MAGIC_STR, 4);
+  buf[4] = len & 0xff;
+  buf[5] = len >> 8;
+  buf[6] = FRAME_TYPE_STATE;
+  memcpy(&buf[7], state, len);
+  checksum_t *cs = checksum_new();
+  checksum_update_block(cs, buf, sizeof(buf)-1);
+  buf[sizeof(buf)-1] = checksum_get(cs);
+  checksum_unref(cs);
+  const ssize_t n = write(fd, buf, sizeof(buf));
+  assert(n == (ssize_t)sizeof(buf));
+}
+
+
+int main()
+{
+  assert(mkdtemp(tmpdir));
+
+  /* a device which cannot be opened gives NULL, no abort() */
+  char missing[64];
+  snprintf(missing, sizeof(missing), "%s/missing", tmpdir);
+  assert(devctx_new(missing, tmpdir, "[missing] ") == NULL);
+
+  evloop_t *loop = evloop_new();
+  int peer_a, peer_b;
+  devctx_t *a = open_device("a", &peer_a);
+  devctx_t *b = open_device("b", &peer_b);
+  devctx_attach(a, loop);
+  devctx_attach(b, loop);
+
+  /* no intermediate request while the device is not measuring */
+  devctx_set_periodic_interval(b, 1);
+  devctx_set_periodic_updates(b, true);
+  expect_nothing(peer_b);
+
+  devctx_send_simple_command(a, FRAME_CMD_STATE);
+  devctx_send_simple_command(b, FRAME_CMD_STATE);
+  expect_command(peer_a, FRAME_CMD_STATE);
+  expect_command(peer_b, FRAME_CMD_STATE);
+  assert(!devctx_is_idle(a));
+  assert(!devctx_is_idle(b));
+
+  /* device a goes away, with its command unanswered */
+  close(peer_a);
+  for (int i=0; (i<10) && !devctx_is_dead(a); i++) {
+    evloop_run_once(loop, 1000);
+  }
+  assert(devctx_is_dead(a));
+  assert(devctx_is_idle(a));
+  assert(!devctx_is_measuring(a));
+  devctx_send_simple_command(a, FRAME_CMD_STATE);
+  assert(devctx_is_idle(a));
+
+  /* device b goes on */
+  assert(!devctx_is_dead(b));
+  send_state(peer_b, "MEASURING");
+  for (int i=0; (i<10) && !devctx_is_idle(b); i++) {
+    evloop_run_once(loop, 1000);
+  }
+  assert(devctx_is_idle(b));
+  assert(devctx_is_measuring(b));
+
+  /* measuring now, so the periodic timer sends a request */
+  for (int i=0; (i<30) && devctx_is_idle(b); i++) {
+    evloop_run_once(loop, 100);
+  }
+  expect_command(peer_b, FRAME_CMD_INTERMEDIATE);
+
+  devctx_send_simple_command(b, FRAME_CMD_ABORT);
+  expect_command(peer_b, FRAME_CMD_ABORT);
+  assert(!devctx_is_dead(b));
+
+  devctx_unref(a);
+  devctx_unref(b);
+  close(peer_b);
+  evloop_unref(loop);
+  rmdir(tmpdir);
+  fmlog("device loss OK");
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
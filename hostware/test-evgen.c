@@ -0,0 +1,272 @@
+/** \file hostware/test-evgen.c
+ * \brief Test the statistics of the Monte Carlo event generator
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Checks with fixed seeds that
+ *
+ *   - spectra give their values with the right probabilities
+ *     (chi-square test),
+ *   - Poisson random numbers have the right mean and variance,
+ *   - events arrive at the right rate, with exponential intervals,
+ *   - the recorded rate matches the dead time formulas for
+ *     non-paralyzable (n = m/(1+m*tau)) and paralyzable
+ *     (n = m*exp(-m*tau)) detectors,
+ *   - pile-up happens as often as it should and adds up the values.
+ *
+ * The tolerances are five standard deviations or so.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "evgen.h"
+#include "freemcan-log.h"
+
+
+/** Whether observed is within sigmas standard deviations of expected */
+static bool near(const double observed, const double expected,
+                 const double sigma, const double sigmas)
+{
+  return fabs(observed - expected) <= sigmas * sigma;
+}
+
+
+/** Chi-square of histogram table against spectrum after n draws */
+static double chi_square(const evgen_spectrum_t *spectrum,
+                         const uint32_t *table, const double n)
+{
+  double chi2 = 0;
+  for (size_t i=0; i<evgen_spectrum_count(spectrum); i++) {
+    const double expected = n * evgen_spectrum_probability(spectrum, i);
+    if (expected > 0) {
+      chi2 += (table[i] - expected) * (table[i] - expected) / expected;
+    } else {
+      assert(table[i] == 0);
+    }
+  }
+  return chi2;
+}
+
+
+static void test_spectrum(void)
+{
+  const double weights[] = { 1, 2, 0, 3, 4, 0.001, 0 };
+  const size_t count = sizeof(weights)/sizeof(weights[0]);
+  evgen_spectrum_t *spectrum = evgen_spectrum_new(weights, count);
+  assert(evgen_spectrum_count(spectrum) == count);
+  assert(evgen_spectrum_probability(spectrum, 4) == 4 / 10.001);
+
+  evgen_rng_t rng;
+  evgen_rng_seed(&rng, 1);
+  uint32_t table[7] = { 0 };
+  const unsigned int n = 1000000;
+  for (unsigned int i=0; i<n; i++) {
+    table[evgen_spectrum_sample(spectrum, &rng)]++;
+  }
+  /* 4 degrees of freedom, 0.01% quantile at 23.5 */
+  assert(chi_square(spectrum, table, n) < 23.5);
+  evgen_spectrum_unref(spectrum);
+
+  /* a realistic spectrum with 1023 degrees of freedom */
+  spectrum = evgen_spectrum_new_cs137(1024);
+  double total = 0;
+  size_t peak = 256;
+  for (size_t i=0; i<1024; i++) {
+    total += evgen_spectrum_probability(spectrum, i);
+    /* the 662keV peak, above the x-ray peak */
+    if ((i > 256) &&
+        (evgen_spectrum_probability(spectrum, i) >
+         evgen_spectrum_probability(spectrum, peak))) {
+      peak = i;
+    }
+  }
+  assert(near(total, 1.0, 1e-9, 1));
+  assert((peak >= 676) && (peak <= 679));
+  uint32_t *hist = calloc(1024, sizeof(hist[0]));
+  assert(hist);
+  for (unsigned int i=0; i<10*n; i++) {
+    hist[evgen_spectrum_sample(spectrum, &rng)]++;
+  }
+  assert(near(chi_square(spectrum, hist, 10*n), 1023, sqrt(2*1023), 5));
+
+  /* the same table from Poisson noise on the expected values */
+  evgen_spectrum_fill_poisson(spectrum, &rng, hist, 10*n);
+  assert(near(chi_square(spectrum, hist, 10*n), 1024, sqrt(2*1024), 5));
+  free(hist);
+  evgen_spectrum_unref(spectrum);
+}
+
+
+static void test_poisson(void)
+{
+  evgen_rng_t rng;
+  evgen_rng_seed(&rng, 2);
+  const double means[] = { 0, 0.5, 5, 9.9, 10, 50, 5000, 1e6 };
+  for (size_t m=0; m<sizeof(means)/sizeof(means[0]); m++) {
+    const unsigned int n = 200000;
+    double sum = 0, sum2 = 0;
+    for (unsigned int i=0; i<n; i++) {
+      const double k = evgen_rng_poisson(&rng, means[m]);
+      sum += k;
+      sum2 += k * k;
+    }
+    const double mean = sum / n;
+    const double variance = sum2 / n - mean * mean;
+    /* the variance of the variance is mean + 2*mean^2 */
+    assert(near(mean, means[m], sqrt(means[m] / n), 5));
+    assert(near(variance, means[m],
+                sqrt((means[m] + 2 * means[m] * means[m]) / n), 5));
+  }
+}
+
+
+static void test_arrivals(void)
+{
+  const evgen_config_t config = { 1e5, 0, false, 0 };
+  evgen_t *evgen = evgen_new(&config, NULL, 3);
+  evgen_event_t events[1000];
+  double last = 0;
+  uint64_t longer = 0;
+  uint64_t n = 0;
+  size_t got;
+  while ((got = evgen_events(evgen, events, 1000, 10.0)) > 0) {
+    for (size_t i=0; i<got; i++) {
+      assert(events[i].time >= last);
+      assert(events[i].time < 10.0);
+      assert(events[i].value == 0);
+      assert(events[i].pileup == 0);
+      /* exponential intervals: exp(-1) of them exceed the mean */
+      if (events[i].time - last > 1e-5) {
+        longer++;
+      }
+      last = events[i].time;
+    }
+    n += got;
+  }
+  assert(near(n, 1e6, sqrt(1e6), 5));
+  assert(near(longer, n * exp(-1), sqrt(n * exp(-1) * (1 - exp(-1))), 5));
+  const evgen_stats_t *stats = evgen_stats(evgen);
+  assert(stats->events == n);
+  assert(stats->recorded == n);
+  assert(stats->dead == 0);
+
+  /* nothing more before the same time, and no events at all at 0/s */
+  assert(evgen_count(evgen, 10.0) == 0);
+  evgen_unref(evgen);
+  const evgen_config_t silent = { 0, 0, false, 0 };
+  evgen = evgen_new(&silent, NULL, 3);
+  assert(evgen_count(evgen, 1e9) == 0);
+  evgen_unref(evgen);
+}
+
+
+/** Check the recorded rate, and that batches count the same */
+static void test_dead_time(const bool paralyzable, const double expected)
+{
+  const double m = 1e5, tau = 2e-6, seconds = 20;
+  const evgen_config_t config = { m, tau, paralyzable, 0 };
+  evgen_t *evgen = evgen_new(&config, NULL, 4);
+  evgen_t *batched = evgen_new(&config, NULL, 4);
+  const uint64_t n = evgen_count(evgen, seconds);
+  evgen_event_t events[100];
+  uint64_t n_batched = 0;
+  size_t got;
+  double last = -1;
+  while ((got = evgen_events(batched, events, 100, seconds)) > 0) {
+    for (size_t i=0; i<got; i++) {
+      if (!paralyzable) {
+        assert(events[i].time >= last + tau);
+      }
+      last = events[i].time;
+    }
+    n_batched += got;
+  }
+  assert(n == n_batched);
+  /* fewer recorded events fluctuate less than Poisson, this is loose */
+  assert(near(n / seconds, expected, sqrt(expected / seconds), 5));
+  const evgen_stats_t *stats = evgen_stats(evgen);
+  assert(stats->events == stats->recorded + stats->dead);
+  assert(near(stats->events / seconds, m, sqrt(m / seconds), 5));
+  evgen_unref(evgen);
+  evgen_unref(batched);
+}
+
+
+static void test_pileup(void)
+{
+  const double m = 1e5, tau = 2e-6, tau_p = 1e-6, seconds = 20;
+  const evgen_config_t config = { m, tau, false, tau_p };
+  /* every event has the value 10 */
+  double weights[100] = { 0 };
+  weights[10] = 1;
+  evgen_spectrum_t *spectrum = evgen_spectrum_new(weights, 100);
+  evgen_t *evgen = evgen_new(&config, spectrum, 5);
+  evgen_spectrum_unref(spectrum);
+
+  uint32_t *hist = calloc(100, sizeof(hist[0]));
+  assert(hist);
+  evgen_fill_histogram(evgen, hist, seconds);
+  const evgen_stats_t *stats = evgen_stats(evgen);
+  assert(stats->events == stats->recorded + stats->dead + stats->piled_up);
+
+  /* pile-up is within the dead time, so the recorded rate stays */
+  const double expected = m / (1 + m * tau);
+  assert(near(stats->recorded / seconds, expected,
+              sqrt(expected / seconds), 5));
+  /* Poisson number of events piling up, with mean m*tau_p */
+  const double p1 = m * tau_p * exp(-m * tau_p);
+  assert(near(hist[20], stats->recorded * p1,
+              sqrt(stats->recorded * p1), 5));
+  assert(near((double)stats->piled_up / stats->recorded, m * tau_p,
+              sqrt(m * tau_p / stats->recorded), 5));
+  uint64_t total = 0;
+  for (size_t i=0; i<100; i++) {
+    if (hist[i]) {
+      assert((i % 10) == 0);
+    }
+    total += hist[i];
+  }
+  assert(total == stats->recorded);
+  free(hist);
+  evgen_unref(evgen);
+}
+
+
+int main()
+{
+  test_spectrum();
+  test_poisson();
+  test_arrivals();
+  test_dead_time(false, 1e5 / (1 + 1e5 * 2e-6));
+  test_dead_time(true, 1e5 * exp(-1e5 * 2e-6));
+  test_pileup();
+  fmlog("All event generator tests passed.");
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,90 @@
+/** \file hostware/test-packet-parser.c
+ * \brief Test the packet parser against broken packets
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * A personality info packet whose element size the hostware cannot
+ * divide by, or without a personality name, must be dropped before it
+ * reaches the packet handler.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "frame.h"
+#include "freemcan-log.h"
+#include "packet-defs.h"
+#include "packet-parser.h"
+#include "personality-info.h"
+
+
+static unsigned int personality_infos = 0;
+
+
+static void handle_personality_info(personality_info_t *pi,
+                                    void *data __attribute__((unused)))
+{
+  /* what the packet handlers do with it */
+  assert(8*pi->sizeof_table/pi->bits_per_value == 1024);
+  personality_infos++;
+}
+
+
+/** Pass a personality info frame to the packet parser */
+static void send_personality_info(packet_parser_t *parser,
+                                  const uint8_t bits_per_value,
+                                  const char *name)
+{
+  const packet_personality_info_t ppi = { 3072, bits_per_value, 1, 2, 0 };
+  frame_t *frame = frame_new(sizeof(ppi) + strlen(name));
+  frame->type = FRAME_TYPE_PERSONALITY_INFO;
+  frame->size = sizeof(ppi) + strlen(name);
+  memcpy(frame->payload, &ppi, sizeof(ppi));
+  memcpy(&frame->payload[sizeof(ppi)], name, strlen(name));
+  packet_parser_handle_frame(parser, frame);
+  frame_unref(frame);
+}
+
+
+int main()
+{
+  packet_parser_t *parser =
+    packet_parser_new(NULL, NULL, NULL, handle_personality_info, NULL, NULL);
+
+  send_personality_info(parser, 24, "tests");
+  assert(personality_infos == 1);
+
+  fmlog("expect messages about dropping personality info:");
+  send_personality_info(parser, 0, "tests");
+  send_personality_info(parser, 12, "tests");
+  send_personality_info(parser, 24, "");
+  assert(personality_infos == 1);
+
+  packet_parser_unref(parser);
+  fmlog("packet parser OK");
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,217 @@
+/** \file hostware/test-relay.c
+ * \brief Test relaying a device stream to several clients
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * A writer thread sends a known byte sequence as the device, and
+ * reader threads check what arrives at
+ *
+ *   - two fast clients,
+ *   - a slow client, which makes the relay copy and pause,
+ *   - a client hanging up early, which must not disturb the others.
+ *
+ * Two clients send commands in pieces at the same time, after some
+ * garbage, and the commands must arrive at the device whole.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include "device-relay.h"
+#include "freemcan-evloop.h"
+#include "freemcan-log.h"
+
+
+#define TOTAL   (32*1024*1024)
+#define CLIENTS 4
+#define SLOW    2
+#define QUITTER 3
+#define COMMAND  "FMpXs\0\x2a"
+#define COMMAND2 "FMpXm\x03" "abc\x55"
+#define GARBAGE  "xFMp"
+
+
+/** The byte at offset i of the device stream */
+static uint8_t pattern(const size_t i)
+{
+  return (uint8_t)(i * 7 + (i >> 11));
+}
+
+
+static void *writer(void *data)
+{
+  const int fd = *(int *)data;
+  uint8_t buf[65536];
+  size_t ofs = 0;
+  while (ofs < TOTAL) {
+    for (size_t i=0; i<sizeof(buf); i++) {
+      buf[i] = pattern(ofs + i);
+    }
+    size_t done = 0;
+    while (done < sizeof(buf)) {
+      const ssize_t n = write(fd, &buf[done], sizeof(buf) - done);
+      assert(n > 0);
+      done += n;
+    }
+    ofs += sizeof(buf);
+  }
+  shutdown(fd, SHUT_WR);
+  return NULL;
+}
+
+
+typedef struct {
+  int fd;
+  unsigned int index;
+  size_t received;
+} reader_t;
+
+
+/** Write size bytes in pieces of piece bytes, with pauses between */
+static void write_pieces(const int fd, const char *buf, const size_t size,
+                         const size_t piece)
+{
+  const struct timespec ts = { 0, 1000000 };
+  for (size_t ofs=0; ofs<size; ofs+=piece) {
+    const size_t n = (size - ofs < piece) ? (size - ofs) : piece;
+    assert(write(fd, &buf[ofs], n) == (ssize_t)n);
+    nanosleep(&ts, NULL);
+  }
+}
+
+
+static void *reader(void *data)
+{
+  reader_t *r = data;
+  if (r->index == 0) {
+    write_pieces(r->fd, GARBAGE, sizeof(GARBAGE)-1, 2);
+    write_pieces(r->fd, COMMAND, sizeof(COMMAND)-1, 3);
+  } else if (r->index == 1) {
+    write_pieces(r->fd, COMMAND2, sizeof(COMMAND2)-1, 1);
+  }
+  uint8_t buf[65536];
+  while (true) {
+    const ssize_t n = read(r->fd, buf, sizeof(buf));
+    assert(n >= 0);
+    if (n == 0) {
+      break;
+    }
+    for (ssize_t i=0; i<n; i++) {
+      assert(buf[i] == pattern(r->received + i));
+    }
+    r->received += n;
+    if (r->index == SLOW) {
+      const struct timespec ts = { 0, 2000000 };
+      nanosleep(&ts, NULL);
+    }
+    if ((r->index == QUITTER) && (r->received >= 1024*1024)) {
+      break;
+    }
+  }
+  close(r->fd);
+  return NULL;
+}
+
+
+int main()
+{
+  int source[2];
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, source) == 0);
+
+  evloop_t *loop = evloop_new();
+  relay_t *relay = relay_new(loop, source[0]);
+
+  reader_t readers[CLIENTS];
+  pthread_t reader_threads[CLIENTS];
+  for (unsigned int i=0; i<CLIENTS; i++) {
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    relay_add_client(relay, fds[0]);
+    readers[i].fd = fds[1];
+    readers[i].index = i;
+    readers[i].received = 0;
+    assert(pthread_create(&reader_threads[i], NULL, reader, &readers[i]) == 0);
+  }
+  assert(relay_client_count(relay) == CLIENTS);
+
+  pthread_t writer_thread;
+  assert(pthread_create(&writer_thread, NULL, writer, &source[1]) == 0);
+  while (!relay_is_closed(relay)) {
+    evloop_run_once(loop, -1);
+  }
+  assert(pthread_join(writer_thread, NULL) == 0);
+  assert(relay_client_count(relay) == CLIENTS - 1);
+
+  const relay_stats_t *stats = relay_stats(relay);
+  fmlog("relayed %llu bytes: %llu spliced, %llu copied, %lu pauses",
+        (unsigned long long)stats->bytes_in,
+        (unsigned long long)stats->bytes_spliced,
+        (unsigned long long)stats->bytes_copied,
+        stats->pauses);
+  assert(stats->bytes_in == TOTAL);
+  assert(stats->bytes_spliced > 0);
+  assert(stats->bytes_copied > 0);
+  assert(stats->pauses > 0);
+  assert(stats->bytes_to_source == sizeof(COMMAND)-1 + sizeof(COMMAND2)-1);
+  assert(stats->commands == 2);
+  assert(stats->clients == CLIENTS);
+
+  /* closes the client connections, which ends the readers */
+  relay_unref(relay);
+  evloop_unref(loop);
+  for (unsigned int i=0; i<CLIENTS; i++) {
+    assert(pthread_join(reader_threads[i], NULL) == 0);
+    if (i == QUITTER) {
+      assert(readers[i].received < TOTAL);
+    } else {
+      assert(readers[i].received == TOTAL);
+    }
+  }
+
+  /* both commands whole, in either order */
+  char commands[sizeof(COMMAND)-1 + sizeof(COMMAND2)-1];
+  assert(read(source[1], commands, sizeof(commands)) == sizeof(commands));
+  if (memcmp(commands, COMMAND, sizeof(COMMAND)-1) == 0) {
+    assert(memcmp(&commands[sizeof(COMMAND)-1], COMMAND2,
+                  sizeof(COMMAND2)-1) == 0);
+  } else {
+    assert(memcmp(commands, COMMAND2, sizeof(COMMAND2)-1) == 0);
+    assert(memcmp(&commands[sizeof(COMMAND2)-1], COMMAND,
+                  sizeof(COMMAND)-1) == 0);
+  }
+  close(source[0]);
+  close(source[1]);
+
+  fmlog("device relay OK");
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,85 @@
+/** \file hostware/test-spsc-queue.c
+ * \brief Test single producer single consumer queue
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * A producer thread pushes the numbers 1 to #ITEMS through a small
+ * queue as fast as it can, retrying whenever the queue is full. The
+ * consumer has to pop every number exactly once, in order.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "freemcan-log.h"
+#include "freemcan-spsc.h"
+
+
+#define ITEMS    1000000
+#define CAPACITY 16
+
+
+static unsigned long full_count = 0;
+
+
+static void *producer(void *data)
+{
+  spsc_queue_t *queue = data;
+  for (uintptr_t i=1; i<=ITEMS; i++) {
+    while (!spsc_queue_push(queue, (void *)i)) {
+      full_count++;
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+
+int main()
+{
+  spsc_queue_t *queue = spsc_queue_new(CAPACITY);
+  pthread_t thread;
+  int ret = pthread_create(&thread, NULL, producer, queue);
+  assert(ret == 0);
+
+  for (uintptr_t i=1; i<=ITEMS; i++) {
+    const uintptr_t item = (uintptr_t)spsc_queue_pop(queue);
+    assert(item == i);
+    assert(spsc_queue_depth(queue) <= CAPACITY);
+  }
+
+  ret = pthread_join(thread, NULL);
+  assert(ret == 0);
+  assert(spsc_queue_depth(queue) == 0);
+  spsc_queue_free(queue);
+
+  fmlog("%d items passed through queue of %d, producer found it full %lu times",
+        ITEMS, CAPACITY, full_count);
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
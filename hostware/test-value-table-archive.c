@@ -0,0 +1,328 @@
+/** \file hostware/test-value-table-archive.c
+ * \brief Test the value table archive
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Appends value tables with all kinds of element values (and some
+ * out of order receive times) to an archive, and checks that reading
+ * them back gives the same value tables in receive time order. Then
+ * damages the archive's time index and a record, and checks that
+ * reader and writer cope. Finally appends enough value tables to
+ * fill several time index blocks.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "freemcan-log.h"
+#include "packet-value-table.h"
+#include "personality-info.h"
+#include "value-table-archive.h"
+
+
+#define TABLES 40
+
+/** More than fit into two time index blocks */
+#define MANY_TABLES 600
+
+/** Sizes of the archive's parts, as in value-table-archive.c */
+#define TRAILER_SIZE 24
+#define INDEX_BLOCK_OVERHEAD (16 + 4)
+#define INDEX_ENTRY_SIZE 16
+#define CHECKSUM_SIZE 4
+
+
+static packet_value_table_t *tables[TABLES+1];
+
+
+static packet_value_table_t *make_table(const personality_info_t *pi,
+                                        const unsigned int n)
+{
+  /* receive times 1000, 1010, ..., with a few going back in time */
+  const time_t receive_time = (n % 7 == 6) ? (1000 + 10*n - 25) : (1000 + 10*n);
+  const size_t element_count = (n % 5 == 0) ? 0 : (n * 97);
+  packet_value_table_t *vtab =
+    packet_value_table_new_empty(pi, (n % 2) ? PACKET_VALUE_TABLE_INTERMEDIATE
+                                 : PACKET_VALUE_TABLE_DONE,
+                                 (n % 3) ? VALUE_TABLE_TYPE_HISTOGRAM
+                                 : VALUE_TABLE_TYPE_TIME_SERIES,
+                                 receive_time, 24, element_count, 0, 0, NULL);
+  vtab->duration = n;
+  vtab->total_duration = (n % 4) ? 3*n : (unsigned int)-1;
+  vtab->dead_cycles = (n % 2) ? (3*n) : 0;
+  vtab->cpu_khz = (n % 2) ? 16000 : 0;
+  if (n % 3 == 0) {
+    vtab->token = vtab->token_buf;
+    vtab->token_size = sizeof(time_t);
+    memcpy(vtab->token, &receive_time, sizeof(time_t));
+  }
+  uint32_t x = n;
+  for (size_t i=0; i<element_count; i++) {
+    x = x*1103515245 + 12345;
+    switch (n % 4) {
+    case 0: vtab->elements[i] = i; break;
+    case 1: vtab->elements[i] = x >> (x % 32); break;
+    case 2: vtab->elements[i] = (i % 2) ? UINT32_MAX : 0; break;
+    case 3: vtab->elements[i] = x; break;
+    }
+  }
+  return vtab;
+}
+
+
+static void check_entry(const archive_entry_t *entry,
+                        const packet_value_table_t *vtab)
+{
+  assert(entry->reason == vtab->reason);
+  assert(entry->type == vtab->type);
+  assert(entry->receive_time == vtab->receive_time);
+  assert(entry->element_count == vtab->element_count);
+  assert(entry->orig_bits_per_value == vtab->orig_bits_per_value);
+  assert(entry->duration == vtab->duration);
+  assert(entry->total_duration == vtab->total_duration);
+  assert(entry->skip_samples == vtab->skip_samples);
+  assert(entry->dead_cycles == vtab->dead_cycles);
+  assert(entry->cpu_khz == vtab->cpu_khz);
+  assert(entry->token_size == vtab->token_size);
+  assert(!entry->token == !vtab->token);
+  assert(!vtab->token || !memcmp(entry->token, vtab->token, vtab->token_size));
+  uint32_t *elements = malloc(entry->element_count*sizeof(uint32_t) + 1);
+  assert(elements);
+  const bool ok = archive_decode_elements(entry, elements);
+  assert(ok);
+  assert(!memcmp(elements, vtab->elements,
+                 entry->element_count*sizeof(uint32_t)));
+  free(elements);
+}
+
+
+/** Check archive contains the first count tables */
+static void check_archive(const char *fname, const size_t count)
+{
+  /* expected order: by receive time, then in order of appending */
+  size_t order[TABLES+1];
+  for (size_t i=0; i<count; i++) {
+    size_t k = i;
+    while ((k > 0) &&
+           (tables[order[k-1]]->receive_time > tables[i]->receive_time)) {
+      order[k] = order[k-1];
+      k--;
+    }
+    order[k] = i;
+  }
+
+  archive_t *archive = archive_open(fname);
+  assert(archive);
+  assert(archive_get_count(archive) == count);
+  for (size_t i=0; i<count; i++) {
+    const packet_value_table_t *vtab = tables[order[i]];
+    assert(archive_get_time(archive, i) == vtab->receive_time);
+    const size_t found = archive_find_time(archive, vtab->receive_time);
+    assert(found <= i);
+    assert(archive_get_time(archive, found) == vtab->receive_time);
+    assert((found == 0) ||
+           (archive_get_time(archive, found-1) < vtab->receive_time));
+    archive_entry_t entry;
+    const bool ok = archive_get_entry(archive, i, &entry);
+    assert(ok);
+    check_entry(&entry, vtab);
+  }
+  assert(archive_find_time(archive, 0) == 0);
+  assert(archive_find_time(archive, 1000000) == count);
+  archive_unref(archive);
+}
+
+
+static long file_size(const char *fname)
+{
+  FILE *file = fopen(fname, "r");
+  assert(file);
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+
+/** The archive's checksum (32 bit FNV-1a), for forging a trailer */
+static uint32_t fnv1a(const uint8_t *data, const size_t size)
+{
+  uint32_t hash = 2166136261U;
+  for (size_t i=0; i<size; i++) {
+    hash = (hash ^ data[i]) * 16777619U;
+  }
+  return hash;
+}
+
+
+/** Append many small value tables, which need several index blocks */
+static void check_many(const char *fname, const personality_info_t *pi)
+{
+  unlink(fname);
+  for (unsigned int n=0; n<=MANY_TABLES; n++) {
+    /* every tenth one goes back in time */
+    const time_t receive_time = 5000 + n - ((n % 10 == 9) ? 3 : 0);
+    packet_value_table_t *vtab =
+      packet_value_table_new_empty(pi, PACKET_VALUE_TABLE_DONE,
+                                   VALUE_TABLE_TYPE_HISTOGRAM,
+                                   receive_time, 24, 1, 0, 0, NULL);
+    vtab->elements[0] = n;
+    vtab->duration = n;
+    archive_append(fname, vtab);
+    packet_value_table_unref(vtab);
+    if (n == MANY_TABLES-1) {
+      archive_t *archive = archive_open(fname);
+      assert(archive);
+      assert(archive_get_count(archive) == MANY_TABLES);
+      archive_unref(archive);
+      /* the writer rebuilds the index once, in several blocks */
+      int ret = truncate(fname, file_size(fname) - 1);
+      assert(ret == 0);
+      fmlog("expect message about rebuilding the time index:");
+    }
+  }
+
+  archive_t *archive = archive_open(fname);
+  assert(archive);
+  assert(archive_get_count(archive) == MANY_TABLES+1);
+  time_t last_time = 0;
+  unsigned int last_n = 0;
+  unsigned int seen = 0;
+  for (size_t i=0; i<=MANY_TABLES; i++) {
+    archive_entry_t entry;
+    const bool ok = archive_get_entry(archive, i, &entry);
+    assert(ok);
+    assert(entry.receive_time == archive_get_time(archive, i));
+    /* sorted by receive time, then in order of appending */
+    assert(entry.receive_time >= last_time);
+    assert((entry.receive_time > last_time) || (entry.duration > last_n));
+    last_time = entry.receive_time;
+    last_n = entry.duration;
+    uint32_t element;
+    const bool decoded = archive_decode_elements(&entry, &element);
+    assert(decoded);
+    assert(element == entry.duration);
+    seen++;
+  }
+  assert(seen == MANY_TABLES+1);
+  archive_unref(archive);
+  unlink(fname);
+}
+
+
+int main()
+{
+  char fname[64];
+  snprintf(fname, sizeof(fname), "/tmp/test-value-table-archive.%ld",
+           (long)getpid());
+  unlink(fname);
+
+  personality_info_t *pi =
+    personality_info_new(0xffff, 24, 1, 2, 0, 5, "tests");
+  for (unsigned int n=0; n<=TABLES; n++) {
+    tables[n] = make_table(pi, n);
+  }
+
+  for (size_t i=0; i<TABLES; i++) {
+    archive_append(fname, tables[i]);
+  }
+  check_archive(fname, TABLES);
+
+  /* cut off the trailer: time index is rebuilt by reader and writer */
+  int ret = truncate(fname, file_size(fname) - 1);
+  assert(ret == 0);
+  fmlog("expect message about rebuilding the time index:");
+  check_archive(fname, TABLES);
+  archive_append(fname, tables[TABLES]);
+  check_archive(fname, TABLES+1);
+
+  /* damage the last record, which is followed by the time index and
+   * the trailer: it must not be returned */
+  archive_t *archive = archive_open(fname);
+  assert(archive);
+  const size_t last = archive_find_time(archive, tables[TABLES]->receive_time);
+  archive_entry_t entry;
+  bool ok = archive_get_entry(archive, last, &entry);
+  assert(ok);
+  archive_unref(archive);
+  FILE *file = fopen(fname, "r+");
+  assert(file);
+  const long ofs = file_size(fname) -
+    (TRAILER_SIZE + INDEX_BLOCK_OVERHEAD + (TABLES+1)*INDEX_ENTRY_SIZE +
+     CHECKSUM_SIZE + 1);
+  fseek(file, ofs, SEEK_SET);
+  const int byte = fgetc(file);
+  fseek(file, ofs, SEEK_SET);
+  fputc(byte ^ 0x55, file);
+  fclose(file);
+  archive = archive_open(fname);
+  assert(archive);
+  assert(archive_get_count(archive) == TABLES+1);
+  ok = archive_get_entry(archive, last, &entry);
+  assert(!ok);
+  archive_unref(archive);
+
+  /* an intact trailer with an index offset wrapping around to the
+   * file size must not be followed: the index is rebuilt up to the
+   * damage */
+  const long size = file_size(fname);
+  const uint64_t bad_count = (TABLES+1) + (UINT64_C(1) << 28);
+  const uint64_t bad_ofs = (uint64_t)size - TRAILER_SIZE - 16*bad_count;
+  uint8_t trailer[16];
+  for (unsigned int i=0; i<8; i++) {
+    trailer[i] = (bad_ofs >> (8*i)) & 0xff;
+  }
+  for (unsigned int i=0; i<4; i++) {
+    trailer[8+i] = ((TABLES+1) >> (8*i)) & 0xff;
+  }
+  const uint32_t checksum = fnv1a(trailer, 12);
+  for (unsigned int i=0; i<4; i++) {
+    trailer[12+i] = (checksum >> (8*i)) & 0xff;
+  }
+  file = fopen(fname, "r+");
+  assert(file);
+  fseek(file, size - TRAILER_SIZE, SEEK_SET);
+  assert(fwrite(trailer, sizeof(trailer), 1, file) == 1);
+  fclose(file);
+  fmlog("expect message about rebuilding the time index:");
+  archive = archive_open(fname);
+  assert(archive);
+  assert(archive_get_count(archive) == TABLES);
+  archive_unref(archive);
+
+  for (unsigned int n=0; n<=TABLES; n++) {
+    packet_value_table_unref(tables[n]);
+  }
+  check_many(fname, pi);
+  personality_info_unref(pi);
+  unlink(fname);
+  fmlog("value table archive OK");
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,237 @@
+/** \file hostware/test-value-table-compress.c
+ * \brief Test compressing and decompressing value table data
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Compresses tables of all sizes from 0 to 300 elements with zero
+ * runs and values of all varint lengths, and checks that
+ *
+ *   - decompressing gives the same elements,
+ *   - every truncated or extended version of the data is rejected,
+ *   - values too large for the element size are rejected,
+ *   - packet_value_table_new() decompresses the same way, also
+ *     behind an extended header with the dead time per trigger.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freemcan-log.h"
+#include "packet-defs.h"
+#include "packet-value-table.h"
+#include "personality-info.h"
+#include "value-table-compress.h"
+
+
+#define MAX_COUNT 300
+
+
+static uint32_t x = 1;
+
+
+/** Pseudo random element, zero half of the time */
+static uint32_t random_element(const unsigned int bits)
+{
+  x = x*1103515245 + 12345;
+  if (x & 0x10000) {
+    return 0;
+  }
+  const uint32_t value = (x >> 17) * (x >> 3);
+  return value >> (x % 32) >> (32 - bits);
+}
+
+
+static void check_table(const uint32_t *elements, const size_t count,
+                        const unsigned int bits)
+{
+  const size_t max_size = value_table_compress_max_size(count);
+  uint8_t *data = malloc(max_size + 1);
+  assert(data);
+  const size_t size = value_table_compress(data, elements, count);
+  assert(size <= max_size);
+  assert(size == value_table_compress(NULL, elements, count));
+
+  size_t n;
+  bool ok = value_table_compressed_count(data, size, &n);
+  assert(ok);
+  assert(n == count);
+
+  uint32_t *dest = malloc((count+1)*sizeof(uint32_t));
+  assert(dest);
+  ok = value_table_decompress(dest, count, data, size, bits);
+  assert(ok);
+  assert(!memcmp(dest, elements, count*sizeof(uint32_t)));
+
+  for (size_t s=0; s<size; s++) {
+    ok = value_table_decompress(dest, count, data, s, bits);
+    assert(!ok);
+  }
+  data[size] = 0;
+  ok = value_table_decompress(dest, count, data, size+1, bits);
+  assert(!ok);
+  ok = value_table_decompress(dest, count+1, data, size, bits);
+  assert(!ok);
+
+  free(dest);
+  free(data);
+}
+
+
+static void check_too_large(void)
+{
+  const uint32_t elements[] = { 0, 255, 0, 0 };
+  uint8_t data[32];
+  uint32_t dest[4];
+  const size_t size = value_table_compress(data, elements, 4);
+  bool ok = value_table_decompress(dest, 4, data, size, 8);
+  assert(ok);
+  const uint32_t large[] = { 0, 256, 0, 0 };
+  const size_t large_size = value_table_compress(data, large, 4);
+  ok = value_table_decompress(dest, 4, data, large_size, 8);
+  assert(!ok);
+}
+
+
+static void check_packet_value_table(const personality_info_t *pi)
+{
+  uint32_t elements[MAX_COUNT];
+  for (size_t i=0; i<MAX_COUNT; i++) {
+    elements[i] = random_element(24);
+  }
+  uint8_t data[4 + MAX_COUNT*5 + 16];
+  data[0] = 0x34; /* total_duration */
+  data[1] = 0x12;
+  data[2] = 'X'; /* token */
+  data[3] = 'Y';
+  const size_t size = value_table_compress(&data[4], elements, MAX_COUNT);
+
+  packet_value_table_t *vtab =
+    packet_value_table_new(pi, PACKET_VALUE_TABLE_DONE,
+                           VALUE_TABLE_TYPE_HISTOGRAM, 0,
+                           24 | PACKET_VALUE_TABLE_COMPRESSED, size,
+                           0, 4, data);
+  assert(vtab);
+  assert(vtab->element_count == MAX_COUNT);
+  assert(vtab->orig_bits_per_value == 24);
+  assert(vtab->wire_size == size);
+  assert(vtab->total_duration == 0x1234);
+  assert(!memcmp(vtab->elements, elements, sizeof(elements)));
+  packet_value_table_unref(vtab);
+
+  fmlog("expect messages about dropping compressed value tables:");
+  vtab = packet_value_table_new(pi, PACKET_VALUE_TABLE_DONE,
+                                VALUE_TABLE_TYPE_HISTOGRAM, 0,
+                                24 | PACKET_VALUE_TABLE_COMPRESSED, size-1,
+                                0, 4, data);
+  assert(!vtab);
+  /* more elements than the personality's table can hold */
+  data[4] = 0xff;
+  data[5] = 0x7f;
+  vtab = packet_value_table_new(pi, PACKET_VALUE_TABLE_DONE,
+                                VALUE_TABLE_TYPE_HISTOGRAM, 0,
+                                24 | PACKET_VALUE_TABLE_COMPRESSED, 2,
+                                0, 4, data);
+  assert(!vtab);
+  /* no element size at all */
+  vtab = packet_value_table_new(pi, PACKET_VALUE_TABLE_DONE,
+                                VALUE_TABLE_TYPE_HISTOGRAM, 0,
+                                PACKET_VALUE_TABLE_COMPRESSED, size,
+                                0, 4, data);
+  assert(!vtab);
+}
+
+
+static void check_extended(const personality_info_t *pi)
+{
+  const uint32_t elements[] = { 0, 300, 0, 0, 0, 700, 0, 0 };
+  uint8_t data[4 + sizeof(packet_value_table_ext_header_t) + 32];
+  data[0] = 10; /* total_duration */
+  data[1] = 0;
+  data[2] = 'X'; /* token */
+  data[3] = 'Y';
+  data[4] = 100; /* dead_cycles */
+  data[5] = 0;
+  data[6] = 16000 & 0xff; /* cpu_khz */
+  data[7] = 16000 >> 8;
+  const size_t size = value_table_compress(&data[8], elements, 8);
+
+  packet_value_table_t *vtab =
+    packet_value_table_new(pi, PACKET_VALUE_TABLE_DONE,
+                           VALUE_TABLE_TYPE_HISTOGRAM, 0,
+                           24 | PACKET_VALUE_TABLE_COMPRESSED |
+                           PACKET_VALUE_TABLE_EXTENDED, size,
+                           10, 4, data);
+  assert(vtab);
+  assert(vtab->element_count == 8);
+  assert(vtab->orig_bits_per_value == 24);
+  assert(!memcmp(vtab->elements, elements, sizeof(elements)));
+  assert(packet_value_table_triggers(vtab) == 1000);
+  assert(vtab->dead_cycles == 100);
+  assert(vtab->cpu_khz == 16000);
+  /* 100 cycles at 16MHz per trigger, in seconds */
+  assert(vtab->dead_time_per_trigger > 6.2499e-6);
+  assert(vtab->dead_time_per_trigger < 6.2501e-6);
+  const double live = packet_value_table_live_duration(vtab);
+  assert((live > 9.99374) && (live < 9.99376));
+  /* 100 triggers/s recorded give 100/(1-100*6.25e-6) true triggers/s */
+  const double missed = packet_value_table_missed_triggers(vtab);
+  assert((missed > 0.625) && (missed < 0.626));
+  packet_value_table_unref(vtab);
+}
+
+
+int main()
+{
+  uint32_t elements[MAX_COUNT];
+  const unsigned int bits[] = { 8, 16, 24, 32 };
+  for (size_t b=0; b<sizeof(bits)/sizeof(bits[0]); b++) {
+    for (size_t count=0; count<=MAX_COUNT; count++) {
+      for (size_t i=0; i<count; i++) {
+        elements[i] = random_element(bits[b]);
+      }
+      check_table(elements, count, bits[b]);
+
+      /* long zero runs, with the extreme values in between */
+      for (size_t i=0; i<count; i++) {
+        elements[i] = (i % 97 == 96) ?
+          ((i % 2) ? 1 : (uint32_t)((((uint64_t)1) << bits[b]) - 1)) : 0;
+      }
+      check_table(elements, count, bits[b]);
+    }
+  }
+  check_too_large();
+
+  personality_info_t *pi =
+    personality_info_new(MAX_COUNT*3, 24, 1, 2, 0, 5, "tests");
+  check_packet_value_table(pi);
+  check_extended(pi);
+  personality_info_unref(pi);
+
+  fmlog("value table compression OK");
+  return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
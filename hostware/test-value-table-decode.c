@@ -0,0 +1,179 @@
+/** \file hostware/test-value-table-decode.c
+ * \brief Test the value table widening kernels against the scalar loops
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * Every implementation supported by the CPU running the test has to
+ * reproduce the results of the reference loop below (the loop
+ * packet_value_table_new() used to contain)
+ *
+ *   - for every possible 8, 16 and 24 bit element value,
+ *   - for pseudo random 32 bit element values,
+ *   - for all table sizes from 0 to 100 elements at all source
+ *     alignments, which exercises the scalar tail handling.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freemcan-log.h"
+#include "value-table-decode.h"
+
+
+/** Number of elements to check in one go */
+#define CHUNK (1<<20)
+
+
+static uint32_t reference_value(const uint8_t *e8, const size_t i,
+                                const unsigned int bits_per_value)
+{
+  const size_t bytes = bits_per_value/8;
+  uint32_t v = 0;
+  for (size_t k=0; k<bytes; k++) {
+    v += ((uint32_t)e8[bytes*i+k]) << (8*k);
+  }
+  return v;
+}
+
+
+/** Encode value as little endian element number i */
+static void put_value(uint8_t *e8, const size_t i, const uint32_t value,
+                      const unsigned int bits_per_value)
+{
+  const size_t bytes = bits_per_value/8;
+  for (size_t k=0; k<bytes; k++) {
+    e8[bytes*i+k] = (value >> (8*k)) & 0xff;
+  }
+}
+
+
+static unsigned long failures = 0;
+
+
+static void check(const value_table_decode_impl_t impl,
+                  const uint8_t *src, const size_t count,
+                  const unsigned int bits_per_value, uint32_t *dest)
+{
+  /* poison the destination, including one element past the end */
+  memset(dest, 0xa5, (count+1)*sizeof(dest[0]));
+  const bool ok = value_table_decode_impl(impl, dest, src, count,
+                                          bits_per_value);
+  assert(ok);
+  for (size_t i=0; i<count; i++) {
+    const uint32_t expected = reference_value(src, i, bits_per_value);
+    if (dest[i] != expected) {
+      if (failures < 10) {
+        fmlog("FAIL: %s %u bit: count=%zu element %zu: 0x%08x != 0x%08x",
+              value_table_decode_impl_name(impl), bits_per_value,
+              count, i, dest[i], expected);
+      }
+      failures++;
+    }
+  }
+  if (dest[count] != 0xa5a5a5a5) {
+    fmlog("FAIL: %s %u bit: count=%zu: wrote past the end",
+          value_table_decode_impl_name(impl), bits_per_value, count);
+    failures++;
+  }
+}
+
+
+static void test_exhaustive(const value_table_decode_impl_t impl,
+                            const unsigned int bits_per_value,
+                            uint8_t *src, uint32_t *dest)
+{
+  const uint64_t values = (bits_per_value < 32)
+    ? (((uint64_t)1) << bits_per_value)
+    : (((uint64_t)64) * CHUNK);
+  uint32_t seed = 0x12345678;
+  for (uint64_t base=0; base<values; base+=CHUNK) {
+    const size_t count = (values-base < CHUNK) ? (values-base) : CHUNK;
+    for (size_t i=0; i<count; i++) {
+      uint32_t v;
+      if (bits_per_value < 32) {
+        v = base + i;
+      } else {
+        seed = seed * 1103515245 + 12345;
+        v = seed ^ (seed >> 16) ^ (((uint32_t)i) << 24);
+      }
+      put_value(src, i, v, bits_per_value);
+    }
+    check(impl, src, count, bits_per_value, dest);
+  }
+}
+
+
+static void test_sizes(const value_table_decode_impl_t impl,
+                       const unsigned int bits_per_value,
+                       uint8_t *src, uint32_t *dest)
+{
+  for (size_t i=0; i<4*100+3; i++) {
+    src[i] = (uint8_t)(i*37 + 11);
+  }
+  for (size_t ofs=0; ofs<4; ofs++) {
+    for (size_t count=0; count<=100; count++) {
+      check(impl, &src[ofs], count, bits_per_value, dest);
+    }
+  }
+}
+
+
+int main()
+{
+  uint8_t *src = malloc(4*CHUNK+16);
+  uint32_t *dest = malloc((CHUNK+1)*sizeof(uint32_t));
+  assert(src && dest);
+
+  static const unsigned int bpvs[] = { 8, 16, 24, 32 };
+  for (int impl=0; impl<VALUE_TABLE_DECODE_IMPL_COUNT; impl++) {
+    const char *name = value_table_decode_impl_name(impl);
+    if (!value_table_decode_impl_supported(impl)) {
+      fmlog("%-12s not supported on this CPU, skipping", name);
+      continue;
+    }
+    for (size_t k=0; k<sizeof(bpvs)/sizeof(bpvs[0]); k++) {
+      test_sizes(impl, bpvs[k], src, dest);
+      test_exhaustive(impl, bpvs[k], src, dest);
+    }
+    fmlog("%-12s checked", name);
+  }
+
+  uint8_t bogus[4] = { 0, 0, 0, 0 };
+  assert(!value_table_decode(dest, bogus, 1, 12));
+
+  free(src);
+  free(dest);
+
+  if (failures) {
+    fmlog("%lu failures", failures);
+    return EXIT_FAILURE;
+  }
+  fmlog("All tests passed (best implementation: %s)",
+        value_table_decode_impl_name(value_table_decode_best_impl()));
+  return EXIT_SUCCESS;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
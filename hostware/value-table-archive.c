@@ -0,0 +1,791 @@
+/** \file hostware/value-table-archive.c
+ * \brief Indexed append-only value table archive (implementation)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup value_table_archive Value Table Archive
+ * \ingroup hostware_generic
+ *
+ * Keeps all value tables exported to one directory in a single
+ * binary file, so that scripts do not have to find and parse
+ * thousands of .dat files.
+ *
+ * All numbers in the archive are little endian. The archive consists
+ * of
+ *
+ *   - the file header: "FMCANARC", u32 version (2), u32 reserved (0),
+ *   - one record per value table, in the order they were appended,
+ *     with full time index blocks in between,
+ *   - the last time index block,
+ *   - the trailer: u64 offset of the last time index block, u32
+ *     number of records, u32 checksum of the trailer up to here,
+ *     "FMCANIDX".
+ *
+ * A record consists of
+ *
+ *   - "FMVT", u32 record size in bytes (including this header),
+ *   - u64 receive_time,
+ *   - u8 reason, u8 type, u8 orig_bits_per_value, u8 token size,
+ *   - u32 duration, u32 total_duration, u32 skip_samples,
+ *   - u32 element count,
+ *   - u16 dead_cycles, u16 cpu_khz (0 if unknown, see \ref
+ *     packet_value_table_extended),
+ *   - the token bytes,
+ *   - the elements: the difference to the previous element (0 for
+ *     the first one), zigzag encoded and written as a varint of 7
+ *     bits per byte with the high bit set in all but the last byte,
+ *   - u32 checksum of the record up to here.
+ *
+ * The time index is a chain of blocks, starting at the trailer and
+ * going back to the first block. A time index block consists of
+ *
+ *   - "FMIB", u32 number of entries (1 to #INDEX_BLOCK_ENTRIES),
+ *   - u64 offset of the previous time index block, 0 for the first,
+ *   - one u64 receive_time and u64 record offset per record, in the
+ *     order the records were appended,
+ *   - u32 checksum of the block up to here.
+ *
+ * Appending a value table overwrites the last time index block and
+ * the trailer with the new record, followed by the last block with
+ * the new entry added and the new trailer. Once the last block is
+ * full, it stays where it is, and the new record starts a new last
+ * block after it. So every append writes at most one block, however
+ * large the archive gets. If an append is interrupted, the trailer
+ * or the last block do not check out anymore, and the time index is
+ * rebuilt from the records.
+ *
+ * Readers sort the time index by receive_time when opening the
+ * archive.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "freemcan-log.h"
+#include "value-table-archive.h"
+
+
+/** Magic bytes at the start of the archive */
+#define FILE_MAGIC "FMCANARC"
+
+/** Archive format version */
+#define FILE_VERSION 2
+
+/** Size of the file header in bytes */
+#define FILE_HEADER_SIZE 16
+
+/** Magic bytes at the start of each record */
+#define RECORD_MAGIC "FMVT"
+
+/** Size of the fixed record header in bytes */
+#define RECORD_HEADER_SIZE 40
+
+/** Size of the record and time index block checksums in bytes */
+#define CHECKSUM_SIZE 4
+
+/** Magic bytes at the start of each time index block */
+#define INDEX_BLOCK_MAGIC "FMIB"
+
+/** Size of the time index block header in bytes */
+#define INDEX_BLOCK_HEADER_SIZE 16
+
+/** Maximum number of entries in one time index block */
+#define INDEX_BLOCK_ENTRIES 256
+
+/** Size of one time index entry in bytes */
+#define INDEX_ENTRY_SIZE 16
+
+/** Magic bytes at the end of the trailer */
+#define TRAILER_MAGIC "FMCANIDX"
+
+/** Size of the trailer in bytes */
+#define TRAILER_SIZE 24
+
+/** Maximum size of a varint encoded element in bytes */
+#define VARINT_MAX_SIZE 5
+
+
+static inline void put_le16(uint8_t *p, const uint16_t value)
+{
+  p[0] = value & 0xff;
+  p[1] = value >> 8;
+}
+
+
+static inline void put_le32(uint8_t *p, const uint32_t value)
+{
+  for (unsigned int i=0; i<4; i++) {
+    p[i] = (value >> (8*i)) & 0xff;
+  }
+}
+
+
+static inline void put_le64(uint8_t *p, const uint64_t value)
+{
+  put_le32(&p[0], value & 0xffffffff);
+  put_le32(&p[4], value >> 32);
+}
+
+
+static inline uint16_t get_le16(const uint8_t *p)
+{
+  return ((uint16_t)p[0]) | ((uint16_t)p[1] << 8);
+}
+
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+  return (((uint32_t)p[0]) |
+          ((uint32_t)p[1] << 8) |
+          ((uint32_t)p[2] << 16) |
+          ((uint32_t)p[3] << 24));
+}
+
+
+static inline uint64_t get_le64(const uint8_t *p)
+{
+  return ((uint64_t)get_le32(&p[0])) | ((uint64_t)get_le32(&p[4]) << 32);
+}
+
+
+/** Record, time index block and trailer checksum (32 bit FNV-1a) */
+static uint32_t archive_checksum(const uint8_t *data, const size_t size)
+{
+  uint32_t hash = 2166136261U;
+  for (size_t i=0; i<size; i++) {
+    hash = (hash ^ data[i]) * 16777619U;
+  }
+  return hash;
+}
+
+
+/** Encode elements into dest, return number of bytes written
+ *
+ * dest must have room for count*#VARINT_MAX_SIZE bytes.
+ */
+static size_t encode_elements(uint8_t *dest, const uint32_t *elements,
+                              const size_t count)
+{
+  uint8_t *p = dest;
+  uint32_t prev = 0;
+  for (size_t i=0; i<count; i++) {
+    const uint32_t delta = elements[i] - prev;
+    prev = elements[i];
+    /* zigzag: small negative deltas become small numbers, too */
+    uint32_t z = (delta << 1) ^ (0U - (delta >> 31));
+    while (z >= 0x80) {
+      *p++ = (z & 0x7f) | 0x80;
+      z >>= 7;
+    }
+    *p++ = z;
+  }
+  return p - dest;
+}
+
+
+/* documented in value-table-archive.h */
+bool archive_decode_elements(const archive_entry_t *entry, uint32_t *elements)
+{
+  const uint8_t *p = entry->payload;
+  const uint8_t *end = &entry->payload[entry->payload_size];
+  uint32_t prev = 0;
+  for (size_t i=0; i<entry->element_count; i++) {
+    uint32_t z = 0;
+    for (unsigned int shift=0; true; shift += 7) {
+      if ((p == end) || (shift >= 7*VARINT_MAX_SIZE)) {
+        return false;
+      }
+      const uint8_t byte = *p++;
+      z |= ((uint32_t)(byte & 0x7f)) << shift;
+      if (!(byte & 0x80)) {
+        break;
+      }
+    }
+    prev += (z >> 1) ^ (0U - (z & 1));
+    elements[i] = prev;
+  }
+  return (p == end);
+}
+
+
+/** Check the record at ofs, and parse it into entry if entry is not NULL
+ *
+ * \return Size of the record, or 0 if there is no intact record at ofs.
+ */
+static size_t parse_record(const uint8_t *data, const size_t size,
+                           const size_t ofs, archive_entry_t *entry)
+{
+  if ((ofs > size) ||
+      ((size - ofs) < (RECORD_HEADER_SIZE + CHECKSUM_SIZE))) {
+    return 0;
+  }
+  const uint8_t *r = &data[ofs];
+  if (memcmp(r, RECORD_MAGIC, 4) != 0) {
+    return 0;
+  }
+  const size_t record_size = get_le32(&r[4]);
+  const size_t token_size = r[19];
+  if ((record_size > (size - ofs)) ||
+      (record_size < (RECORD_HEADER_SIZE + token_size + CHECKSUM_SIZE))) {
+    return 0;
+  }
+  const size_t checksum_ofs = record_size - CHECKSUM_SIZE;
+  if (archive_checksum(r, checksum_ofs) != get_le32(&r[checksum_ofs])) {
+    return 0;
+  }
+  if (entry) {
+    entry->receive_time        = (time_t)(int64_t)get_le64(&r[8]);
+    entry->reason              = r[16];
+    entry->type                = r[17];
+    entry->orig_bits_per_value = r[18];
+    entry->token_size          = token_size;
+    entry->duration            = get_le32(&r[20]);
+    entry->total_duration      = get_le32(&r[24]);
+    entry->skip_samples        = get_le32(&r[28]);
+    entry->element_count       = get_le32(&r[32]);
+    entry->dead_cycles         = get_le16(&r[36]);
+    entry->cpu_khz             = get_le16(&r[38]);
+    entry->token = token_size ? (const char *)&r[RECORD_HEADER_SIZE] : NULL;
+    entry->payload = &r[RECORD_HEADER_SIZE + token_size];
+    entry->payload_size = checksum_ofs - RECORD_HEADER_SIZE - token_size;
+  }
+  return record_size;
+}
+
+
+/** Insert time index entry into sorted index of count entries
+ *
+ * The new entry goes after all entries with the same time. The index
+ * must have room for count+1 entries.
+ */
+static void index_insert(uint8_t *index, const size_t count,
+                         const int64_t time, const uint64_t offset)
+{
+  /* value tables are usually appended in order of receive time */
+  size_t i = count;
+  while ((i > 0) && ((int64_t)get_le64(&index[(i-1)*INDEX_ENTRY_SIZE]) > time)) {
+    i--;
+  }
+  memmove(&index[(i+1)*INDEX_ENTRY_SIZE], &index[i*INDEX_ENTRY_SIZE],
+          (count-i)*INDEX_ENTRY_SIZE);
+  put_le64(&index[i*INDEX_ENTRY_SIZE], time);
+  put_le64(&index[i*INDEX_ENTRY_SIZE+8], offset);
+}
+
+
+/** Sort time index entries in order of appending by receive time */
+static void index_sort(uint8_t *index, const size_t count)
+{
+  for (size_t i=1; i<count; i++) {
+    const int64_t time = get_le64(&index[i*INDEX_ENTRY_SIZE]);
+    const uint64_t offset = get_le64(&index[i*INDEX_ENTRY_SIZE+8]);
+    index_insert(index, i, time, offset);
+  }
+}
+
+
+/** Check the time index block at ofs
+ *
+ * \param count Set to the number of entries in the block.
+ * \param prev_ofs Set to the offset of the previous block.
+ * \return Size of the block, or 0 if there is no intact block at ofs.
+ */
+static size_t parse_index_block(const uint8_t *data, const size_t size,
+                                const size_t ofs, size_t *count,
+                                uint64_t *prev_ofs)
+{
+  if ((ofs > size) ||
+      ((size - ofs) < (INDEX_BLOCK_HEADER_SIZE + CHECKSUM_SIZE))) {
+    return 0;
+  }
+  const uint8_t *b = &data[ofs];
+  if (memcmp(b, INDEX_BLOCK_MAGIC, 4) != 0) {
+    return 0;
+  }
+  const size_t n = get_le32(&b[4]);
+  if ((n == 0) || (n > INDEX_BLOCK_ENTRIES)) {
+    return 0;
+  }
+  const size_t checksum_ofs = INDEX_BLOCK_HEADER_SIZE + n*INDEX_ENTRY_SIZE;
+  if (((size - ofs) < (checksum_ofs + CHECKSUM_SIZE)) ||
+      (archive_checksum(b, checksum_ofs) != get_le32(&b[checksum_ofs]))) {
+    return 0;
+  }
+  *count = n;
+  *prev_ofs = get_le64(&b[8]);
+  return checksum_ofs + CHECKSUM_SIZE;
+}
+
+
+/** Check the trailer and the last time index block before it
+ *
+ * \param last_ofs Set to the offset of the last block.
+ * \param last_count Set to the number of entries in the last block.
+ * \param prev_ofs Set to the offset of the block before the last.
+ * \param total Set to the number of records in the archive.
+ * \return Whether trailer and last block are intact.
+ */
+static bool trailer_load(const uint8_t *data, const size_t size,
+                         size_t *last_ofs, size_t *last_count,
+                         uint64_t *prev_ofs, size_t *total)
+{
+  if (size < (FILE_HEADER_SIZE + TRAILER_SIZE)) {
+    return false;
+  }
+  const uint8_t *t = &data[size - TRAILER_SIZE];
+  if ((memcmp(&t[16], TRAILER_MAGIC, 8) != 0) ||
+      (archive_checksum(t, 12) != get_le32(&t[12]))) {
+    return false;
+  }
+  /* bounds checked one by one, as the sum of them may wrap around */
+  const uint64_t ofs = get_le64(&t[0]);
+  if ((ofs < FILE_HEADER_SIZE) || (ofs > (size - TRAILER_SIZE))) {
+    return false;
+  }
+  const size_t block_size =
+    parse_index_block(data, size - TRAILER_SIZE, ofs, last_count, prev_ofs);
+  if (!block_size || ((ofs + block_size) != (size - TRAILER_SIZE))) {
+    return false;
+  }
+  /* every record has an entry somewhere in the file */
+  const size_t record_count = get_le32(&t[8]);
+  if (record_count > (size / INDEX_ENTRY_SIZE)) {
+    return false;
+  }
+  *last_ofs = ofs;
+  *total = record_count;
+  return true;
+}
+
+
+/** Read the whole time index chain, in order of appending
+ *
+ * \return The entries for the caller to free(3), or NULL if the
+ *         chain is missing or damaged.
+ */
+static uint8_t *chain_load(const uint8_t *data, const size_t size,
+                           size_t *count, size_t *data_end)
+{
+  size_t ofs, n, total;
+  uint64_t prev_ofs;
+  if (!trailer_load(data, size, &ofs, &n, &prev_ofs, &total)) {
+    return NULL;
+  }
+  uint8_t *index = malloc(total*INDEX_ENTRY_SIZE + 1);
+  assert(index);
+  *data_end = ofs;
+  /* fill the index from the end, walking back from the last block */
+  size_t remaining = total;
+  while (true) {
+    if (n > remaining) {
+      free(index);
+      return NULL;
+    }
+    remaining -= n;
+    memcpy(&index[remaining*INDEX_ENTRY_SIZE],
+           &data[ofs + INDEX_BLOCK_HEADER_SIZE], n*INDEX_ENTRY_SIZE);
+    if (prev_ofs == 0) {
+      break;
+    }
+    /* blocks go strictly backwards, so this ends */
+    const uint64_t block_ofs = prev_ofs;
+    if ((block_ofs < FILE_HEADER_SIZE) || (block_ofs >= ofs) ||
+        !parse_index_block(data, ofs, block_ofs, &n, &prev_ofs)) {
+      free(index);
+      return NULL;
+    }
+    ofs = block_ofs;
+  }
+  if (remaining) {
+    free(index);
+    return NULL;
+  }
+  *count = total;
+  return index;
+}
+
+
+/** Rebuild the time index from the records, in order of appending
+ *
+ * \param data_end Set to the end of the last record.
+ * \return The entries for the caller to free(3).
+ */
+static uint8_t *index_rebuild(const char *fname,
+                              const uint8_t *data, const size_t size,
+                              size_t *count, size_t *data_end)
+{
+  fmlog("%s: Time index missing or damaged, rebuilding it", fname);
+  uint8_t *buf = NULL;
+  size_t buf_count = 0;
+  size_t n = 0;
+  size_t ofs = FILE_HEADER_SIZE;
+  while (true) {
+    const size_t record_size = parse_record(data, size, ofs, NULL);
+    if (!record_size) {
+      /* skip the full time index blocks between the records */
+      size_t block_count;
+      uint64_t prev_ofs;
+      const size_t block_size =
+        parse_index_block(data, size, ofs, &block_count, &prev_ofs);
+      if (!block_size) {
+        break;
+      }
+      ofs += block_size;
+      continue;
+    }
+    if (n == buf_count) {
+      buf_count = buf_count ? (2*buf_count) : 64;
+      buf = realloc(buf, buf_count*INDEX_ENTRY_SIZE);
+      assert(buf);
+    }
+    put_le64(&buf[n*INDEX_ENTRY_SIZE], get_le64(&data[ofs+8]));
+    put_le64(&buf[n*INDEX_ENTRY_SIZE+8], ofs);
+    n++;
+    ofs += record_size;
+  }
+  if (ofs < size) {
+    fmlog("%s: Ignoring %zu bytes after the last intact value table",
+          fname, size - ofs);
+  }
+  *count = n;
+  *data_end = ofs;
+  return buf;
+}
+
+
+/** Check the file header of the archive in data */
+static bool header_check(const uint8_t *data, const size_t size)
+{
+  return ((size >= FILE_HEADER_SIZE) &&
+          (memcmp(data, FILE_MAGIC, 8) == 0) &&
+          (get_le32(&data[8]) == FILE_VERSION));
+}
+
+
+/** Write size bytes from buf to fd at ofs */
+static void pwrite_all(const int fd, const uint8_t *buf, const size_t size,
+                       const off_t ofs)
+{
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t n = pwrite(fd, &buf[done], size - done, ofs + done);
+    if ((n < 0) && (errno == EINTR)) {
+      continue;
+    }
+    assert(n > 0);
+    done += n;
+  }
+}
+
+
+/* documented in value-table-archive.h */
+void archive_append(const char *fname, const packet_value_table_t *value_table)
+{
+  const int fd = open(fname, O_RDWR|O_CREAT, 0666);
+  if (fd < 0) {
+    fmlog_error("Cannot open archive %s", fname);
+    return;
+  }
+  int ret = flock(fd, LOCK_EX);
+  assert(ret == 0);
+  struct stat st;
+  ret = fstat(fd, &st);
+  assert(ret == 0);
+
+  /* find the time index entries which are not in a full block yet:
+   * only those need to be written again */
+  const size_t old_size = st.st_size;
+  const uint8_t *old = NULL;
+  const uint8_t *pending = NULL;
+  uint8_t *rebuilt = NULL;
+  size_t pending_count = 0;
+  uint64_t prev_ofs = 0;
+  size_t total = 0;
+  size_t write_ofs = 0;
+  if (old_size > 0) {
+    old = mmap(NULL, old_size, PROT_READ, MAP_SHARED, fd, 0);
+    assert(old != MAP_FAILED);
+    if (!header_check(old, old_size)) {
+      fmlog("%s: Not a value table archive, not appending", fname);
+      munmap((void *)old, old_size);
+      close(fd);
+      return;
+    }
+    size_t last_ofs, last_count;
+    if (trailer_load(old, old_size, &last_ofs, &last_count, &prev_ofs,
+                     &total)) {
+      if (last_count < INDEX_BLOCK_ENTRIES) {
+        pending = &old[last_ofs + INDEX_BLOCK_HEADER_SIZE];
+        pending_count = last_count;
+        write_ofs = last_ofs;
+      } else {
+        prev_ofs = last_ofs;
+        write_ofs = old_size - TRAILER_SIZE;
+      }
+    } else {
+      /* write the whole index anew, once */
+      rebuilt = index_rebuild(fname, old, old_size, &pending_count, &write_ofs);
+      pending = rebuilt;
+      prev_ofs = 0;
+      total = pending_count;
+    }
+  }
+
+  const size_t token_size = value_table->token ? value_table->token_size : 0;
+  const size_t entry_count = pending_count + 1;
+  const size_t block_count =
+    (entry_count + INDEX_BLOCK_ENTRIES - 1) / INDEX_BLOCK_ENTRIES;
+  const size_t max_size =
+    FILE_HEADER_SIZE +
+    RECORD_HEADER_SIZE + token_size +
+    value_table->element_count*VARINT_MAX_SIZE + CHECKSUM_SIZE +
+    block_count*(INDEX_BLOCK_HEADER_SIZE + CHECKSUM_SIZE) +
+    entry_count*INDEX_ENTRY_SIZE + TRAILER_SIZE;
+  uint8_t *buf = malloc(max_size);
+  assert(buf);
+  uint8_t *p = buf;
+
+  if (old_size == 0) {
+    memcpy(p, FILE_MAGIC, 8);
+    put_le32(&p[8], FILE_VERSION);
+    put_le32(&p[12], 0);
+    p += FILE_HEADER_SIZE;
+  }
+
+  /* the record */
+  const uint64_t record_ofs = write_ofs + (p - buf);
+  uint8_t *r = p;
+  memcpy(&r[0], RECORD_MAGIC, 4);
+  put_le64(&r[8], (int64_t)value_table->receive_time);
+  r[16] = value_table->reason;
+  r[17] = value_table->type;
+  r[18] = value_table->orig_bits_per_value;
+  r[19] = token_size;
+  put_le32(&r[20], value_table->duration);
+  put_le32(&r[24], value_table->total_duration);
+  put_le32(&r[28], value_table->skip_samples);
+  put_le32(&r[32], value_table->element_count);
+  put_le16(&r[36], value_table->dead_cycles);
+  put_le16(&r[38], value_table->cpu_khz);
+  p += RECORD_HEADER_SIZE;
+  if (token_size) {
+    memcpy(p, value_table->token, token_size);
+    p += token_size;
+  }
+  p += encode_elements(p, value_table->elements, value_table->element_count);
+  const size_t record_size = (p - r) + CHECKSUM_SIZE;
+  put_le32(&r[4], record_size);
+  put_le32(p, archive_checksum(r, p - r));
+  p += CHECKSUM_SIZE;
+
+  /* the pending time index entries and the new one, in blocks */
+  for (size_t i=0; i<entry_count; i+=INDEX_BLOCK_ENTRIES) {
+    const size_t n = ((entry_count - i) < INDEX_BLOCK_ENTRIES) ?
+      (entry_count - i) : INDEX_BLOCK_ENTRIES;
+    const uint64_t block_ofs = write_ofs + (p - buf);
+    uint8_t *b = p;
+    memcpy(&b[0], INDEX_BLOCK_MAGIC, 4);
+    put_le32(&b[4], n);
+    put_le64(&b[8], prev_ofs);
+    p += INDEX_BLOCK_HEADER_SIZE;
+    for (size_t k=i; k<i+n; k++) {
+      if (k < pending_count) {
+        memcpy(p, &pending[k*INDEX_ENTRY_SIZE], INDEX_ENTRY_SIZE);
+      } else {
+        put_le64(&p[0], (int64_t)value_table->receive_time);
+        put_le64(&p[8], record_ofs);
+      }
+      p += INDEX_ENTRY_SIZE;
+    }
+    put_le32(p, archive_checksum(b, p - b));
+    p += CHECKSUM_SIZE;
+    prev_ofs = block_ofs;
+  }
+
+  /* the trailer */
+  put_le64(&p[0], prev_ofs);
+  put_le32(&p[8], total + 1);
+  put_le32(&p[12], archive_checksum(p, 12));
+  memcpy(&p[16], TRAILER_MAGIC, 8);
+  p += TRAILER_SIZE;
+  assert((size_t)(p - buf) <= max_size);
+
+  if (old) {
+    munmap((void *)old, old_size);
+  }
+  free(rebuilt);
+
+  pwrite_all(fd, buf, p - buf, write_ofs);
+  ret = ftruncate(fd, write_ofs + (p - buf));
+  assert(ret == 0);
+  free(buf);
+  ret = close(fd);
+  assert(ret == 0);
+}
+
+
+/** Archive opened for reading */
+struct _archive_t {
+  /** Reference counter */
+  int refs;
+
+  /** The memory mapped archive file */
+  const uint8_t *data;
+
+  /** Size of the memory mapping */
+  size_t map_size;
+
+  /** End of the last record */
+  size_t data_end;
+
+  /** The time index, sorted by receive time */
+  uint8_t *index;
+
+  /** Number of time index entries */
+  size_t count;
+};
+
+
+/* documented in value-table-archive.h */
+archive_t *archive_open(const char *fname)
+{
+  const int fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    fmlog_error("Cannot open archive %s", fname);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    fmlog_error("Cannot stat archive %s", fname);
+    close(fd);
+    return NULL;
+  }
+  const size_t size = st.st_size;
+  if (size < FILE_HEADER_SIZE) {
+    fmlog("%s: Not a value table archive", fname);
+    close(fd);
+    return NULL;
+  }
+  const uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    fmlog_error("Cannot mmap archive %s", fname);
+    return NULL;
+  }
+
+  if (!header_check(data, size)) {
+    fmlog("%s: Not a value table archive", fname);
+    munmap((void *)data, size);
+    return NULL;
+  }
+
+  archive_t *self = calloc(1, sizeof(*self));
+  assert(self);
+  self->index = chain_load(data, size, &self->count, &self->data_end);
+  if (!self->index) {
+    self->index = index_rebuild(fname, data, size, &self->count,
+                                &self->data_end);
+  }
+  index_sort(self->index, self->count);
+  self->refs = 1;
+  self->data = data;
+  self->map_size = size;
+  return self;
+}
+
+
+void archive_ref(archive_t *self)
+{
+  assert(self->refs > 0);
+  self->refs++;
+}
+
+
+void archive_unref(archive_t *self)
+{
+  assert(self->refs > 0);
+  self->refs--;
+  if (self->refs == 0) {
+    free(self->index);
+    munmap((void *)self->data, self->map_size);
+    free(self);
+  }
+}
+
+
+/* documented in value-table-archive.h */
+size_t archive_get_count(const archive_t *self)
+{
+  return self->count;
+}
+
+
+/* documented in value-table-archive.h */
+time_t archive_get_time(const archive_t *self, const size_t index)
+{
+  assert(index < self->count);
+  return (time_t)(int64_t)get_le64(&self->index[index*INDEX_ENTRY_SIZE]);
+}
+
+
+/* documented in value-table-archive.h */
+size_t archive_find_time(const archive_t *self, const time_t time)
+{
+  size_t lo = 0;
+  size_t hi = self->count;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo)/2;
+    if (archive_get_time(self, mid) < time) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+
+/* documented in value-table-archive.h */
+bool archive_get_entry(const archive_t *self, const size_t index,
+                       archive_entry_t *entry)
+{
+  assert(index < self->count);
+  const uint64_t ofs = get_le64(&self->index[index*INDEX_ENTRY_SIZE+8]);
+  return (parse_record(self->data, self->data_end, ofs, entry) != 0);
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
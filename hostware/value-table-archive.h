@@ -0,0 +1,179 @@
+/** \file hostware/value-table-archive.h
+ * \brief Indexed append-only value table archive (interface)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup value_table_archive
+ * @{
+ */
+
+
+#ifndef VALUE_TABLE_ARCHIVE_H
+#define VALUE_TABLE_ARCHIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "packet-defs.h"
+#include "packet-value-table.h"
+
+
+/** Name of the archive file #export_value_table appends to */
+#define ARCHIVE_FILENAME "value-tables.fma"
+
+
+/** Append value table to the archive file fname
+ *
+ * Creates the archive if it does not exist yet. The file is locked
+ * while appending, so several processes may append to the same
+ * archive. Only the last, partly filled time index block is written
+ * again, so appending takes the same time however large the archive
+ * is.
+ */
+void archive_append(const char *fname, const packet_value_table_t *value_table)
+  __attribute__(( nonnull(1,2) ));
+
+
+/** Archive opened for reading (opaque data type) */
+struct _archive_t;
+
+/** Archive opened for reading (opaque data type) */
+typedef struct _archive_t archive_t;
+
+
+/** One value table in an archive, without the elements */
+typedef struct {
+  /** The reason for sending the value table */
+  packet_value_table_reason_t reason;
+
+  /** The type of value table */
+  packet_value_table_type_t type;
+
+  /** Timestamp when the value table was received */
+  time_t receive_time;
+
+  /** Number of elements in value table */
+  size_t element_count;
+
+  /** Size of each element as received from the device in bits */
+  size_t orig_bits_per_value;
+
+  /** As in #packet_value_table_t */
+  unsigned int duration;
+
+  /** As in #packet_value_table_t */
+  unsigned int total_duration;
+
+  /** As in #packet_value_table_t */
+  unsigned int skip_samples;
+
+  /** As in #packet_value_table_t */
+  unsigned int dead_cycles;
+
+  /** As in #packet_value_table_t */
+  unsigned int cpu_khz;
+
+  /** Token bytes, NULL if none (points into the archive) */
+  const char *token;
+
+  /** Number of token bytes */
+  size_t token_size;
+
+  /** Encoded elements (private, for #archive_decode_elements) */
+  const uint8_t *payload;
+
+  /** Size of encoded elements in bytes (private) */
+  size_t payload_size;
+} archive_entry_t;
+
+
+/** Open archive file for reading
+ *
+ * The archive is memory mapped, and its time index is read and
+ * sorted by receive time. If the time index is missing or damaged,
+ * e.g. because the writer was killed while appending, the index is
+ * rebuilt from the value tables.
+ *
+ * \return The archive, or NULL (with a logged error message) if
+ *         fname cannot be opened or is not an archive.
+ */
+archive_t *archive_open(const char *fname)
+  __attribute__(( warn_unused_result ))
+  __attribute__(( nonnull(1) ));
+
+
+void archive_ref(archive_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+void archive_unref(archive_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Number of value tables in archive */
+size_t archive_get_count(const archive_t *self)
+  __attribute__(( nonnull(1) ));
+
+
+/** Receive time of the value table at index (sorted by receive time) */
+time_t archive_get_time(const archive_t *self, const size_t index)
+  __attribute__(( nonnull(1) ));
+
+
+/** Index of the first value table received at or after time
+ *
+ * Binary search in the time index.
+ *
+ * \return The index, or #archive_get_count if there is no such table.
+ */
+size_t archive_find_time(const archive_t *self, const time_t time)
+  __attribute__(( nonnull(1) ));
+
+
+/** Read the value table at index
+ *
+ * \return false if the value table is damaged, true otherwise.
+ */
+bool archive_get_entry(const archive_t *self, const size_t index,
+                       archive_entry_t *entry)
+  __attribute__(( nonnull(1,3) ))
+  __attribute__(( warn_unused_result ));
+
+
+/** Decode the elements of entry into entry->element_count elements
+ *
+ * \return false if the elements are damaged, true otherwise.
+ */
+bool archive_decode_elements(const archive_entry_t *entry, uint32_t *elements)
+  __attribute__(( nonnull(1,2) ))
+  __attribute__(( warn_unused_result ));
+
+
+/** @} */
+
+#endif /* !VALUE_TABLE_ARCHIVE_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,177 @@
+/** \file hostware/value-table-compress.c
+ * \brief Compressed value table data (implementation)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup value_table_compress Compressed Value Table Data
+ * \ingroup hostware_generic
+ *
+ * Zero runs and varints, as described in \ref
+ * packet_value_table_compressed. The decoder is what
+ * packet_value_table_new() uses, the encoder does the same as the
+ * firmware and is there for tests, benchmarks and emulators.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+
+#include "value-table-compress.h"
+
+
+/** Maximum size of a varint token for a uint32_t element (33 bits) */
+#define MAX_TOKEN_SIZE 5
+
+/** Maximum size of the element count varint */
+#define MAX_COUNT_SIZE ((8*sizeof(size_t)+6)/7)
+
+
+/** Write varint to dest (unless NULL), return its size */
+static size_t put_varint(uint8_t *dest, uint64_t value)
+{
+  size_t i = 0;
+  while (value > 0x7f) {
+    if (dest) {
+      dest[i] = (value & 0x7f) | 0x80;
+    }
+    i++;
+    value >>= 7;
+  }
+  if (dest) {
+    dest[i] = value;
+  }
+  return i+1;
+}
+
+
+/** Read varint of at most max_size bytes from src[*ofs] on
+ *
+ * \return false if the varint is longer or not complete
+ */
+static bool get_varint(const uint8_t *src, const size_t size, size_t *ofs,
+                       const size_t max_size, uint64_t *value)
+{
+  uint64_t result = 0;
+  for (size_t i=0; (i<max_size) && (*ofs<size); i++) {
+    const uint8_t byte = src[(*ofs)++];
+    result |= ((uint64_t)(byte & 0x7f)) << (7*i);
+    if (!(byte & 0x80)) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/* documented in value-table-compress.h */
+size_t value_table_compress_max_size(const size_t count)
+{
+  return MAX_COUNT_SIZE + count*MAX_TOKEN_SIZE;
+}
+
+
+/* documented in value-table-compress.h */
+size_t value_table_compress(uint8_t *dest,
+                            const uint32_t *elements, const size_t count)
+{
+  size_t size = put_varint(dest, count);
+  for (size_t i=0; i<count; ) {
+    uint64_t token;
+    if (elements[i] == 0) {
+      size_t run = 1;
+      while ((i+run < count) && (elements[i+run] == 0)) {
+        run++;
+      }
+      token = 2*((uint64_t)run-1) + 1;
+      i += run;
+    } else {
+      token = 2*(uint64_t)elements[i];
+      i++;
+    }
+    size += put_varint(dest ? &dest[size] : NULL, token);
+  }
+  return size;
+}
+
+
+/* documented in value-table-compress.h */
+bool value_table_compressed_count(const void *src, const size_t size,
+                                  size_t *count)
+{
+  size_t ofs = 0;
+  uint64_t value;
+  if (!get_varint(src, size, &ofs, MAX_COUNT_SIZE, &value) ||
+      (value > SIZE_MAX)) {
+    return false;
+  }
+  *count = value;
+  return true;
+}
+
+
+/* documented in value-table-compress.h */
+bool value_table_decompress(uint32_t *dest, const size_t count,
+                            const void *src, const size_t size,
+                            const unsigned int bits_per_value)
+{
+  assert((bits_per_value > 0) && (bits_per_value <= 32));
+  const uint64_t max_value = (((uint64_t)1) << bits_per_value) - 1;
+  const uint8_t *bytes = src;
+  size_t ofs = 0;
+  uint64_t n;
+  if (!get_varint(bytes, size, &ofs, MAX_COUNT_SIZE, &n) || (n != count)) {
+    return false;
+  }
+
+  size_t i = 0;
+  while (i < count) {
+    uint64_t token;
+    if (!get_varint(bytes, size, &ofs, MAX_TOKEN_SIZE, &token)) {
+      return false;
+    }
+    if (token & 1) {
+      const uint64_t run = (token >> 1) + 1;
+      if (run > count - i) {
+        return false;
+      }
+      for (size_t k=0; k<run; k++) {
+        dest[i++] = 0;
+      }
+    } else {
+      const uint64_t value = token >> 1;
+      if (value > max_value) {
+        return false;
+      }
+      dest[i++] = value;
+    }
+  }
+  return (ofs == size);
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,86 @@
+/** \file hostware/value-table-compress.h
+ * \brief Compressed value table data (interface)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup value_table_compress
+ * @{
+ */
+
+
+#ifndef VALUE_TABLE_COMPRESS_H
+#define VALUE_TABLE_COMPRESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/** Compress count elements like the firmware does
+ *
+ * \param dest Destination buffer, or NULL to only determine the size.
+ *             Needs to hold #value_table_compress_max_size bytes.
+ *
+ * \return Size of the compressed data in bytes
+ */
+size_t value_table_compress(uint8_t *dest,
+                            const uint32_t *elements, const size_t count)
+  __attribute__(( nonnull(2) ));
+
+
+/** Maximum size of count compressed elements in bytes */
+size_t value_table_compress_max_size(const size_t count)
+  __attribute__(( warn_unused_result ));
+
+
+/** Read the element count from the start of compressed data
+ *
+ * \return false if src does not start with a valid element count
+ */
+bool value_table_compressed_count(const void *src, const size_t size,
+                                  size_t *count)
+  __attribute__(( nonnull(1,3) ))
+  __attribute__(( warn_unused_result ));
+
+
+/** Decompress size bytes of compressed data into count elements
+ *
+ * \param count Element count as returned by #value_table_compressed_count
+ * \param bits_per_value Element size without the compression flag;
+ *                       larger values are rejected
+ *
+ * \return false if the data are broken, true otherwise
+ */
+bool value_table_decompress(uint32_t *dest, const size_t count,
+                            const void *src, const size_t size,
+                            const unsigned int bits_per_value)
+  __attribute__(( nonnull(1,3) ))
+  __attribute__(( warn_unused_result ));
+
+
+/** @} */
+
+#endif /* !VALUE_TABLE_COMPRESS_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
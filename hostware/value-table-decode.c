@@ -0,0 +1,369 @@
+/** \file hostware/value-table-decode.c
+ * \brief Widen little endian value table elements to uint32_t (implementation)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \defgroup value_table_decode Value Table Element Widening
+ * \ingroup hostware_generic
+ *
+ * The firmware sends value table elements as little endian integers
+ * of 8, 16, 24 or 32 bits. The hostware works with uint32_t
+ * elements. The kernels here do the widening.
+ *
+ * On x86, SSE2/SSSE3 and AVX2 versions are compiled in with GCC's
+ * target attribute and chosen at runtime according to what the CPU
+ * supports. Every SIMD kernel handles the elements at the end of the
+ * table which do not fill a whole vector (or which would make the
+ * vector load read past the end of the source buffer) with the
+ * scalar code.
+ *
+ * @{
+ */
+
+
+#include <assert.h>
+#include <string.h>
+
+#include "value-table-decode.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+# define HAVE_X86_SIMD
+# include <immintrin.h>
+#endif
+
+
+/** Widening kernel: decode count elements from src into dest */
+typedef void (*decode_func_t)(uint32_t *dest, const uint8_t *src,
+                              const size_t count);
+
+
+/************************************************************************
+ * Scalar kernels
+ ************************************************************************/
+
+
+static void decode8_scalar(uint32_t *dest, const uint8_t *e8,
+                           const size_t count)
+{
+  for (size_t i=0; i<count; i++) {
+    const uint32_t v = e8[i];
+    dest[i] = v;
+  }
+}
+
+
+static void decode16_scalar(uint32_t *dest, const uint8_t *e8,
+                            const size_t count)
+{
+  for (size_t i=0; i<count; i++) {
+    const uint32_t v =
+      (((uint32_t)e8[2*i+0]) << 0) +
+      (((uint32_t)e8[2*i+1]) << 8);
+    dest[i] = v;
+  }
+}
+
+
+static void decode24_scalar(uint32_t *dest, const uint8_t *e8,
+                            const size_t count)
+{
+  for (size_t i=0; i<count; i++) {
+    const uint32_t v =
+      (((uint32_t)e8[3*i+0]) << 0) +
+      (((uint32_t)e8[3*i+1]) << 8) +
+      (((uint32_t)e8[3*i+2]) << 16);
+    dest[i] = v;
+  }
+}
+
+
+static void decode32_scalar(uint32_t *dest, const uint8_t *e8,
+                            const size_t count)
+{
+  for (size_t i=0; i<count; i++) {
+    const uint32_t v =
+      (((uint32_t)e8[4*i+0]) << 0) +
+      (((uint32_t)e8[4*i+1]) << 8) +
+      (((uint32_t)e8[4*i+2]) << 16) +
+      (((uint32_t)e8[4*i+3]) << 24);
+    dest[i] = v;
+  }
+}
+
+
+#ifdef HAVE_X86_SIMD
+
+
+/** x86 is little endian, so 32 bit elements just need copying */
+static void decode32_memcpy(uint32_t *dest, const uint8_t *e8,
+                            const size_t count)
+{
+  memcpy(dest, e8, 4*count);
+}
+
+
+/************************************************************************
+ * SSE2 and SSSE3 kernels
+ ************************************************************************/
+
+
+__attribute__(( target("sse2") ))
+static void decode8_sse2(uint32_t *dest, const uint8_t *e8,
+                         const size_t count)
+{
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i+16 <= count; i+=16) {
+    const __m128i v  = _mm_loadu_si128((const __m128i *)&e8[i]);
+    const __m128i lo = _mm_unpacklo_epi8(v, zero);
+    const __m128i hi = _mm_unpackhi_epi8(v, zero);
+    _mm_storeu_si128((__m128i *)&dest[i+ 0], _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128((__m128i *)&dest[i+ 4], _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128((__m128i *)&dest[i+ 8], _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128((__m128i *)&dest[i+12], _mm_unpackhi_epi16(hi, zero));
+  }
+  decode8_scalar(&dest[i], &e8[i], count-i);
+}
+
+
+__attribute__(( target("sse2") ))
+static void decode16_sse2(uint32_t *dest, const uint8_t *e8,
+                          const size_t count)
+{
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i+8 <= count; i+=8) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)&e8[2*i]);
+    _mm_storeu_si128((__m128i *)&dest[i+0], _mm_unpacklo_epi16(v, zero));
+    _mm_storeu_si128((__m128i *)&dest[i+4], _mm_unpackhi_epi16(v, zero));
+  }
+  decode16_scalar(&dest[i], &e8[2*i], count-i);
+}
+
+
+__attribute__(( target("ssse3") ))
+static void decode24_ssse3(uint32_t *dest, const uint8_t *e8,
+                           const size_t count)
+{
+  /* byte i of the result comes from byte shuf[i] of the source, or
+   * is zero for shuffle index -1 */
+  const __m128i shuf = _mm_setr_epi8(0, 1, 2, -1,  3,  4,  5, -1,
+                                     6, 7, 8, -1,  9, 10, 11, -1);
+  size_t i = 0;
+  /* Each step consumes 12 bytes but loads 16, so stop 6 elements
+   * (18 bytes) before the end of the table. */
+  for (; i+6 <= count; i+=4) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)&e8[3*i]);
+    _mm_storeu_si128((__m128i *)&dest[i], _mm_shuffle_epi8(v, shuf));
+  }
+  decode24_scalar(&dest[i], &e8[3*i], count-i);
+}
+
+
+/************************************************************************
+ * AVX2 kernels
+ ************************************************************************/
+
+
+__attribute__(( target("avx2") ))
+static void decode8_avx2(uint32_t *dest, const uint8_t *e8,
+                         const size_t count)
+{
+  size_t i = 0;
+  for (; i+16 <= count; i+=16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)&e8[i]);
+    _mm256_storeu_si256((__m256i *)&dest[i+0], _mm256_cvtepu8_epi32(v));
+    _mm256_storeu_si256((__m256i *)&dest[i+8],
+                        _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+  }
+  decode8_scalar(&dest[i], &e8[i], count-i);
+}
+
+
+__attribute__(( target("avx2") ))
+static void decode16_avx2(uint32_t *dest, const uint8_t *e8,
+                          const size_t count)
+{
+  size_t i = 0;
+  for (; i+16 <= count; i+=16) {
+    const __m128i v0 = _mm_loadu_si128((const __m128i *)&e8[2*i+ 0]);
+    const __m128i v1 = _mm_loadu_si128((const __m128i *)&e8[2*i+16]);
+    _mm256_storeu_si256((__m256i *)&dest[i+0], _mm256_cvtepu16_epi32(v0));
+    _mm256_storeu_si256((__m256i *)&dest[i+8], _mm256_cvtepu16_epi32(v1));
+  }
+  decode16_scalar(&dest[i], &e8[2*i], count-i);
+}
+
+
+__attribute__(( target("avx2") ))
+static void decode24_avx2(uint32_t *dest, const uint8_t *e8,
+                          const size_t count)
+{
+  /* Move source dwords 3..6 into the upper 128bit lane, so that each
+   * lane starts with its 12 bytes of source data: lane 0 gets source
+   * bytes 0..15, lane 1 gets source bytes 12..27. */
+  const __m256i perm = _mm256_setr_epi32(0, 1, 2, 3,  3, 4, 5, 6);
+  /* Then spread each 3 byte element into 4 bytes within each lane */
+  const __m256i shuf = _mm256_setr_epi8(0, 1, 2, -1,  3,  4,  5, -1,
+                                        6, 7, 8, -1,  9, 10, 11, -1,
+                                        0, 1, 2, -1,  3,  4,  5, -1,
+                                        6, 7, 8, -1,  9, 10, 11, -1);
+  size_t i = 0;
+  /* Each step consumes 24 bytes but loads 32, so stop 11 elements
+   * (33 bytes) before the end of the table. */
+  for (; i+11 <= count; i+=8) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)&e8[3*i]);
+    const __m256i p = _mm256_permutevar8x32_epi32(v, perm);
+    _mm256_storeu_si256((__m256i *)&dest[i], _mm256_shuffle_epi8(p, shuf));
+  }
+  decode24_ssse3(&dest[i], &e8[3*i], count-i);
+}
+
+
+#endif /* HAVE_X86_SIMD */
+
+
+/************************************************************************
+ * Dispatch
+ ************************************************************************/
+
+
+/** Kernels of one implementation, indexed by bytes per value minus 1 */
+typedef struct {
+  const char *name;
+  decode_func_t decode[4];
+} decode_impl_t;
+
+
+static const decode_impl_t impls[VALUE_TABLE_DECODE_IMPL_COUNT] = {
+  [VALUE_TABLE_DECODE_SCALAR] =
+  { "scalar", { decode8_scalar, decode16_scalar,
+                decode24_scalar, decode32_scalar } },
+#ifdef HAVE_X86_SIMD
+  [VALUE_TABLE_DECODE_SSE] =
+  { "sse2/ssse3", { decode8_sse2, decode16_sse2,
+                    decode24_ssse3, decode32_memcpy } },
+  [VALUE_TABLE_DECODE_AVX2] =
+  { "avx2", { decode8_avx2, decode16_avx2,
+              decode24_avx2, decode32_memcpy } },
+#else
+  [VALUE_TABLE_DECODE_SSE]  = { "sse2/ssse3", { NULL, NULL, NULL, NULL } },
+  [VALUE_TABLE_DECODE_AVX2] = { "avx2",       { NULL, NULL, NULL, NULL } },
+#endif
+};
+
+
+/* documented in value-table-decode.h */
+bool value_table_decode_impl_supported(const value_table_decode_impl_t impl)
+{
+  switch (impl) {
+  case VALUE_TABLE_DECODE_SCALAR:
+    return true;
+#ifdef HAVE_X86_SIMD
+  case VALUE_TABLE_DECODE_SSE:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2") && __builtin_cpu_supports("ssse3");
+  case VALUE_TABLE_DECODE_AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+  case VALUE_TABLE_DECODE_SSE:
+  case VALUE_TABLE_DECODE_AVX2:
+    return false;
+#endif
+  case VALUE_TABLE_DECODE_IMPL_COUNT:
+    break;
+  }
+  return false;
+}
+
+
+/* documented in value-table-decode.h */
+const char *value_table_decode_impl_name(const value_table_decode_impl_t impl)
+{
+  assert(impl < VALUE_TABLE_DECODE_IMPL_COUNT);
+  return impls[impl].name;
+}
+
+
+/** Best supported implementation, determined at startup */
+static value_table_decode_impl_t best_impl = VALUE_TABLE_DECODE_SCALAR;
+
+
+static void value_table_decode_init(void)
+  __attribute__(( constructor ));
+
+static void value_table_decode_init(void)
+{
+  for (int i=VALUE_TABLE_DECODE_IMPL_COUNT-1; i>=0; i--) {
+    const value_table_decode_impl_t impl = i;
+    if (value_table_decode_impl_supported(impl)) {
+      best_impl = impl;
+      return;
+    }
+  }
+}
+
+
+/* documented in value-table-decode.h */
+value_table_decode_impl_t value_table_decode_best_impl(void)
+{
+  return best_impl;
+}
+
+
+/* documented in value-table-decode.h */
+bool value_table_decode_impl(const value_table_decode_impl_t impl,
+                             uint32_t *dest, const void *src,
+                             const size_t count,
+                             const unsigned int bits_per_value)
+{
+  assert(impl < VALUE_TABLE_DECODE_IMPL_COUNT);
+  switch (bits_per_value) {
+  case 8:
+  case 16:
+  case 24:
+  case 32:
+    break;
+  default:
+    return false;
+  }
+  const decode_func_t decode = impls[impl].decode[bits_per_value/8-1];
+  assert(decode);
+  decode(dest, (const uint8_t *)src, count);
+  return true;
+}
+
+
+/* documented in value-table-decode.h */
+bool value_table_decode(uint32_t *dest, const void *src,
+                        const size_t count, const unsigned int bits_per_value)
+{
+  return value_table_decode_impl(best_impl, dest, src, count, bits_per_value);
+}
+
+
+/** @} */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
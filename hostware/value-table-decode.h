@@ -0,0 +1,99 @@
+/** \file hostware/value-table-decode.h
+ * \brief Widen little endian value table elements to uint32_t (interface)
+ *
+ * \author Copyright (C) 2010 Hans Ulrich Niedermann <hun@n-dimensional.de>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ *
+ * \addtogroup value_table_decode
+ * @{
+ */
+
+
+#ifndef VALUE_TABLE_DECODE_H
+#define VALUE_TABLE_DECODE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/** Implementations of the widening kernels, in order of preference */
+typedef enum {
+  /** Plain C, works everywhere */
+  VALUE_TABLE_DECODE_SCALAR,
+  /** SSE2 for 8 and 16 bit, SSSE3 byte shuffle for 24 bit */
+  VALUE_TABLE_DECODE_SSE,
+  /** AVX2 for 8, 16 and 24 bit */
+  VALUE_TABLE_DECODE_AVX2,
+  /** Number of implementations (not an implementation) */
+  VALUE_TABLE_DECODE_IMPL_COUNT
+} value_table_decode_impl_t;
+
+
+/** Whether impl can run on this CPU */
+bool value_table_decode_impl_supported(const value_table_decode_impl_t impl)
+  __attribute__(( warn_unused_result ));
+
+
+/** Human readable name of impl */
+const char *value_table_decode_impl_name(const value_table_decode_impl_t impl)
+  __attribute__(( warn_unused_result ));
+
+
+/** The implementation #value_table_decode uses on this CPU */
+value_table_decode_impl_t value_table_decode_best_impl(void)
+  __attribute__(( warn_unused_result ));
+
+
+/** Widen count little endian elements of bits_per_value bits each
+ *
+ * \param dest Destination array of count elements
+ * \param src Source data, count*bits_per_value/8 bytes, no alignment
+ *            requirements
+ * \param bits_per_value One of 8, 16, 24, 32
+ *
+ * \return false if bits_per_value is not supported, true otherwise
+ */
+bool value_table_decode(uint32_t *dest, const void *src,
+                        const size_t count, const unsigned int bits_per_value)
+  __attribute__(( nonnull(1,2) ))
+  __attribute__(( warn_unused_result ));
+
+
+/** Like #value_table_decode, but with a specific implementation
+ *
+ * impl must be supported on this CPU. Used by tests and benchmarks.
+ */
+bool value_table_decode_impl(const value_table_decode_impl_t impl,
+                             uint32_t *dest, const void *src,
+                             const size_t count,
+                             const unsigned int bits_per_value)
+  __attribute__(( nonnull(2,3) ))
+  __attribute__(( warn_unused_result ));
+
+
+/** @} */
+
+#endif /* !VALUE_TABLE_DECODE_H */
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
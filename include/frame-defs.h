@@ -178,6 +178,9 @@ typedef enum {
   /** value table data */
   FRAME_TYPE_VALUE_TABLE = 'V',
 
+  /** changed blocks of intermediate value table data */
+  FRAME_TYPE_VALUE_TABLE_DELTA = 'U',
+
   /** Device state message */
   FRAME_TYPE_STATE = 'S'
 
@@ -205,6 +208,14 @@ typedef enum {
   /** Transmit intermediate results, then resume measurement */
   FRAME_CMD_INTERMEDIATE = 'i',
 
+  /** Transmit changes to intermediate results, then resume measurement
+   *
+   * Takes a single parameter byte: The sequence number of the most
+   * recent delta value table the host has received, or 0. See \ref
+   * packet_value_table_delta.
+   */
+  FRAME_CMD_INTERMEDIATE_DELTA = 'u',
+
   /** Abort running measurement and transmit current results */
   FRAME_CMD_ABORT = 'a',
 
@@ -39,9 +39,99 @@
  *  <tr><th>size in bytes</th> <th>name</th> <th>C type define</th> <th>description</th></tr>
  *  <tr><td>sizeof(packet_value_table_header_t)</td> <td>header</td> <td>packet_value_table_header_t</td> <td>value table packet header</td></tr>
  *  <tr><td><em>header.param_buf_length</em></td> <td>param_buf</td> <td>uint8_t []</td> <td>firmware sends back the same parameter buffer that started the measurement</td></tr>
+ *  <tr><td>sizeof(packet_value_table_ext_header_t) <em>or 0</em></td> <td>ext_header</td> <td>packet_value_table_ext_header_t</td> <td>only if #PACKET_VALUE_TABLE_EXTENDED is set, see \ref packet_value_table_extended</td></tr>
  *  <tr><td><em>see text</em></td> <td>data_table</td> <td>uintX_t []</td> <td>value table data</td></tr>
  * </table>
  *
+ * \section packet_value_table_compressed From firmware to hostware: Compressed value table packet
+ *
+ * If #PACKET_VALUE_TABLE_COMPRESSED is set in header.bits_per_value,
+ * the value table data is not a uintX_t array but a sequence of
+ * unsigned LEB128 varints (7 bits per byte, least significant group
+ * first, bit 7 set on all bytes but the last):
+ *
+ *   - the number of elements in the value table,
+ *   - then one token per element or per run of zero elements.
+ *
+ * The lowest bit of a token tells what it stands for:
+ *
+ * <table class="table header-top">
+ *  <tr><th>token</th> <th>meaning</th></tr>
+ *  <tr><td>2*v</td> <td>one element with the value v</td></tr>
+ *  <tr><td>2*n+1</td> <td>n+1 elements with the value 0</td></tr>
+ * </table>
+ *
+ * The tokens must describe exactly the given number of elements, and
+ * the varints must fill the value table data exactly. The remaining
+ * bits of header.bits_per_value still give the element size, which
+ * is the limit for the element values.
+ *
+ * This takes a single byte for runs of up to 64 zeros and for values
+ * up to 63, which is what most of a histogram or geiger counter time
+ * series consists of.
+ *
+ * \section packet_value_table_extended From firmware to hostware: Extended value table header
+ *
+ * If #PACKET_VALUE_TABLE_EXTENDED is set in header.bits_per_value, a
+ * #packet_value_table_ext_header_t follows the parameter buffer, in
+ * value table packets as well as in delta value table packets. It
+ * tells the host how long the device is blind after each trigger it
+ * records (ADC conversion plus ISR), so the host can work out the
+ * live time
+ *
+ *   live time = duration - recorded triggers * dead_cycles / (1000 * cpu_khz)
+ *
+ * and estimate the number of triggers the device has missed.
+ *
+ * Both are estimates: dead_cycles assumes the average delay until
+ * the ADC conversion starts. They are no measurements, and the
+ * firmware counts neither missed triggers nor ISR busy time.
+ *
+ * Only the adc-int-mca personality (external trigger) built with the
+ * assembly language ISR(ADC_vect) sends the extended header. Its
+ * dead_cycles are hand counted from ISR-ADC_vect.S. Firmware built
+ * with the C version of the ADC ISR does not know the ISR's cycles,
+ * and the timed trigger personalities have no external triggers to
+ * miss. Neither sends the extended header, and the host reports no
+ * live time for their value tables.
+ *
+ * Triggers arriving during the dead time cannot be counted by the
+ * firmware: The trigger's INT0 flag itself starts the ADC conversion
+ * and stays set until the ISR clears it, so further edges leave no
+ * trace.
+ *
+ * \section packet_value_table_delta From firmware to hostware: Delta value table packet
+ *
+ * On #FRAME_CMD_INTERMEDIATE_DELTA, the firmware sends only the
+ * blocks of #PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE elements which have
+ * changed since the value table the host has acknowledged, in a
+ * #FRAME_TYPE_VALUE_TABLE_DELTA frame:
+ *
+ * <table class="table header-top">
+ *  <tr><th>size in bytes</th> <th>name</th> <th>C type define</th> <th>description</th></tr>
+ *  <tr><td>sizeof(packet_value_table_header_t)</td> <td>header</td> <td>packet_value_table_header_t</td> <td>value table packet header</td></tr>
+ *  <tr><td><em>header.param_buf_length</em></td> <td>param_buf</td> <td>uint8_t []</td> <td>as in the value table packet</td></tr>
+ *  <tr><td>sizeof(packet_value_table_ext_header_t) <em>or 0</em></td> <td>ext_header</td> <td>packet_value_table_ext_header_t</td> <td>as in the value table packet</td></tr>
+ *  <tr><td>sizeof(packet_value_table_delta_header_t)</td> <td>delta_header</td> <td>packet_value_table_delta_header_t</td> <td>sequence numbers and table size</td></tr>
+ *  <tr><td><em>see text</em></td> <td>runs</td> <td>uint8_t []</td> <td>runs of changed blocks</td></tr>
+ * </table>
+ *
+ * Each run of changed blocks consists of the index of the first
+ * block (uint8_t), the number of blocks (uint8_t), and the elements
+ * of those blocks as in the value table packet. The last block of
+ * the table may have fewer than #PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE
+ * elements.
+ *
+ * The host reconstructs the value table by applying the runs to its
+ * copy of the value table with the sequence number base_seq, or to a
+ * table of zeros if base_seq is 0. The host acknowledges the result
+ * by sending seq with the next #FRAME_CMD_INTERMEDIATE_DELTA. If the
+ * host sends anything else than seq or base_seq, the firmware sends
+ * all blocks with a base_seq of 0.
+ *
+ * Firmware personalities which do not keep track of changed blocks
+ * answer #FRAME_CMD_INTERMEDIATE_DELTA with a value table packet.
+ *
  * \section packet_emb_to_host From firmware to hostware: Personality Information packet
  *
  * The personality information packet just contains a single instance
@@ -117,7 +207,8 @@ typedef enum {
  *   * native gcc-4.5.1 on i386
  */
 typedef struct {
-  /** value table element size in bits (8,16,24,32) */
+  /** value table element size in bits (8,16,24,32), possibly with
+   *  #PACKET_VALUE_TABLE_COMPRESSED and #PACKET_VALUE_TABLE_EXTENDED set */
   uint8_t  bits_per_value;
   /** Reason for sending value table (#packet_value_table_reason_t cast to uint8_t) */
   uint8_t  reason;
@@ -130,6 +221,40 @@ typedef struct {
 } PACKED packet_value_table_header_t;
 
 
+/** Flag in packet_value_table_header_t.bits_per_value for compressed
+ *  value table data, see \ref packet_value_table_compressed */
+#define PACKET_VALUE_TABLE_COMPRESSED 0x80
+
+
+/** Flag in packet_value_table_header_t.bits_per_value for an
+ *  extended header, see \ref packet_value_table_extended */
+#define PACKET_VALUE_TABLE_EXTENDED 0x40
+
+
+/** Extended value table header (after the parameter buffer) */
+typedef struct {
+  /** Dead time per recorded trigger in CPU cycles */
+  uint16_t dead_cycles;
+  /** CPU clock frequency in kHz */
+  uint16_t cpu_khz;
+} PACKED packet_value_table_ext_header_t;
+
+
+/** Number of elements per block in delta value table packets */
+#define PACKET_VALUE_TABLE_DELTA_BLOCK_SIZE 16
+
+
+/** Delta value table packet header (after the parameter buffer) */
+typedef struct {
+  /** Sequence number of the value table the changes apply to, 0 for none */
+  uint8_t  base_seq;
+  /** Sequence number of this value table (1..255) */
+  uint8_t  seq;
+  /** Number of elements in the complete value table */
+  uint16_t element_count;
+} PACKED packet_value_table_delta_header_t;
+
+
 /** Personality Information packet content */
 typedef struct {
   /** Maximum size of the complete table in byte */